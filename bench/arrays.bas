@@ -0,0 +1,55 @@
+rem ==================================================
+rem  arrays - integer array indexing (sieve and sort)
+rem ==================================================
+
+option stacksize=64
+
+include "print.bas"
+
+def SIZE = 8000
+def SORTSIZE = 400
+
+dim flags(SIZE) as byte
+dim values(SORTSIZE)
+
+def sieve(size)
+    dim i, k, count = 0
+    for i = 0 to size - 1
+        flags(i) = 1
+    next i
+    for i = 2 to size - 1
+        if flags(i) then
+            count = count + 1
+            k = i + i
+            do while k < size
+                flags(k) = 0
+                k = k + i
+            loop
+        end if
+    next i
+    return count
+end def
+
+def sort(seed)
+    dim i, j, t
+    for i = 0 to SORTSIZE - 1
+        seed = (seed * 1103515245 + 12345) & 0x7fffffff
+        values(i) = seed >> 16
+    next i
+    for i = 0 to SORTSIZE - 2
+        for j = 0 to SORTSIZE - 2 - i
+            if values(j) > values(j + 1) then
+                t = values(j)
+                values(j) = values(j + 1)
+                values(j + 1) = t
+            end if
+        next j
+    next i
+    return values(0) + values(SORTSIZE / 2) + values(SORTSIZE - 1)
+end def
+
+dim pass
+for pass = 1 to 5
+    print "primes = "; sieve(SIZE)
+next pass
+print "sort = "; sort(12345)
@@ -0,0 +1,197 @@
+#!/bin/sh
+#
+# bench.sh - compile and run the benchmark kernels and compare the results
+#            against a baseline
+#
+# usage: bench.sh [ -u ] <bindir> <workdir> <results> [ <baseline> [ <host-baseline> ] ]
+#
+# Each kernel is compiled with xbcom and run with xbint.  The samples in
+# SAMPLES are run too (as samples/<name>).  The results file
+# has one tab separated line per kernel with these columns:
+#
+#   kernel          kernel name
+#   compile_ms      xbcom wall time
+#   compile_kb      xbcom peak resident memory
+#   code_bytes      size of the image file
+#   run_ms          xbint wall time (best of BENCH_RUNS runs)
+#   run_kb          xbint peak resident memory
+#   instructions    bytecode instructions executed
+#   cycles          estimated Propeller clocks (xbint -c)
+#
+# The code size, instruction count and cycle count are the same on every
+# host, so they are kept in the committed baseline and a kernel is flagged
+# as a regression if any of them goes up at all.  The times and memory
+# depend on the host, so they are compared against a host baseline that is
+# kept with the build output (it is made by the first run).  They are
+# flagged only if they go up by more than BENCH_TOLERANCE percent (and by
+# more than 10 ms for times).
+#
+# With -u the results replace both baselines instead of being compared.
+#
+
+UPDATE=
+if [ "$1" = "-u" ]; then
+    UPDATE=1
+    shift
+fi
+
+BINDIR=$1
+WORKDIR=$2
+RESULTS=$3
+BASELINE=$4
+HOSTBASELINE=$5
+
+BENCHDIR=`dirname $0`
+SAMPLEDIR=$BENCHDIR/../samples
+SAMPLES="array fibo loop loop1k select testprint"
+RUNS=${BENCH_RUNS:-5}
+TOLERANCE=${BENCH_TOLERANCE:-25}
+
+if [ -z "$RESULTS" ]; then
+    echo "usage: bench.sh [ -u ] <bindir> <workdir> <results> [ <baseline> [ <host-baseline> ] ]" >&2
+    exit 1
+fi
+
+# the compiler needs to find xbasic.cfg and the include files
+XB_INC=${XB_INC:-$BENCHDIR/../include}
+export XB_INC
+
+mkdir -p $WORKDIR || exit 1
+STAT=$WORKDIR/runstat.out
+
+printf "kernel\tcompile_ms\tcompile_kb\tcode_bytes\trun_ms\trun_kb\tinstructions\tcycles\n" > $RESULTS
+
+# bench - compile and run a kernel (the xbint options are also used for the timed runs)
+bench() {
+    name=$1
+    file=$2
+    flags=$3
+
+    # compile the kernel
+    if ! $BINDIR/runstat $STAT $BINDIR/xbcom -b hub $WORKDIR/$file.bas > $WORKDIR/$file.log 2>&1; then
+        cat $WORKDIR/$file.log >&2
+        echo "error: $name failed to compile" >&2
+        exit 1
+    fi
+    read compile_ms compile_kb < $STAT
+    code_bytes=`wc -c < $WORKDIR/$file.bai | tr -d ' '`
+
+    # run it, keeping the fastest run
+    run_ms=
+    run=0
+    while [ $run -lt $RUNS ]; do
+        if ! $BINDIR/runstat $STAT $BINDIR/xbint -b hub $flags $WORKDIR/$file.bai > $WORKDIR/$file.out 2>&1; then
+            cat $WORKDIR/$file.out >&2
+            echo "error: $name failed to run" >&2
+            exit 1
+        fi
+        read ms kb < $STAT
+        if [ -z "$run_ms" ] || awk "BEGIN { exit !($ms < $run_ms) }"; then
+            run_ms=$ms
+            run_kb=$kb
+        fi
+        run=`expr $run + 1`
+    done
+
+    # count the instructions and clocks
+    set -- `$BINDIR/xbint -b hub -c $WORKDIR/$file.bai 2>&1 >/dev/null | grep " instructions, "`
+    instructions=$1
+    cycles=$3
+
+    printf "%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n" $name $compile_ms $compile_kb $code_bytes \
+        $run_ms $run_kb $instructions $cycles >> $RESULTS
+}
+
+for src in $BENCHDIR/*.bas; do
+    name=`basename $src .bas`
+    cp $src $WORKDIR/$name.bas
+    bench $name $name
+done
+
+# the samples that run on the host (they read CNT so they need the simulated
+# clock and the endless loop at the end of the main code is left out)
+for name in $SAMPLES; do
+    sed -e '/^do[ 	]*$/d' -e '/^loop[ 	]*$/d' $SAMPLEDIR/$name.bas > $WORKDIR/sample_$name.bas
+    bench samples/$name sample_$name -c
+done
+
+cat $RESULTS
+
+# columns that are the same on every host
+FIXED="kernel|code_bytes|instructions|cycles"
+
+# replace the baselines with the results
+if [ -n "$UPDATE" ]; then
+    awk -F '\t' -v OFS='\t' -v columns="^($FIXED)\$" '
+        FNR == 1 { for (i = 1; i <= NF; ++i) keep[i] = ($i ~ columns) }
+        {
+            line = ""
+            for (i = 1; i <= NF; ++i)
+                if (keep[i])
+                    line = line (line == "" ? "" : OFS) $i
+            print line
+        }' $RESULTS > $BASELINE || exit 1
+    [ -n "$HOSTBASELINE" ] && cp $RESULTS $HOSTBASELINE
+    exit 0
+fi
+
+# compare - compare the columns of the results that match a pattern against a baseline
+compare() {
+    awk -F '\t' -v tolerance=$TOLERANCE -v columns="$2" '
+        function check(kernel, column, old, new, slack) {
+            if (new > old * (1 + tolerance / 100.0) + slack) {
+                printf("REGRESSION: %s %s %s -> %s\n", kernel, column, old, new)
+                ++regressions
+            }
+        }
+        NR == FNR && FNR == 1 { for (i = 1; i <= NF; ++i) baseNames[i] = $i; next }
+        NR == FNR { for (i = 2; i <= NF; ++i) base[$1, baseNames[i]] = $i; next }
+        FNR == 1 { for (i = 1; i <= NF; ++i) names[i] = $i; next }
+        {
+            found = 0
+            for (i = 2; i <= NF; ++i) {
+                if (names[i] !~ columns || !(($1, names[i]) in base))
+                    continue
+                found = 1
+                old = base[$1, names[i]]
+                if (names[i] ~ /_ms$/)
+                    check($1, names[i], old, $i, 10)
+                else if (names[i] ~ /_kb$/)
+                    check($1, names[i], old, $i, 0)
+                else if ($i > old) {
+                    printf("REGRESSION: %s %s %s -> %s\n", $1, names[i], old, $i)
+                    ++regressions
+                }
+            }
+            if (!found)
+                printf("new kernel: %s\n", $1)
+        }
+        END { exit regressions }' $1 $RESULTS
+}
+
+# compare against the baselines
+if [ -z "$BASELINE" ]; then
+    exit 0
+elif [ ! -f "$BASELINE" ]; then
+    echo "no baseline (make bench-baseline to create $BASELINE)"
+    exit 0
+fi
+compare $BASELINE "^($FIXED)\$"
+regressions=$?
+
+# the first run on a host makes the host baseline
+if [ -n "$HOSTBASELINE" ]; then
+    if [ -f "$HOSTBASELINE" ]; then
+        compare $HOSTBASELINE "_(ms|kb)\$"
+        regressions=`expr $regressions + $?`
+    else
+        cp $RESULTS $HOSTBASELINE
+        echo "times and memory saved in $HOSTBASELINE for the next run"
+    fi
+fi
+
+if [ $regressions -gt 0 ]; then
+    echo "$regressions regression(s) against the baseline"
+    exit 1
+fi
+echo "no regressions against the baseline"
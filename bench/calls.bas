@@ -0,0 +1,27 @@
+rem ==================================================
+rem  calls - recursive and nested function calls
+rem ==================================================
+
+include "print.bas"
+
+def fibo(n)
+    if n < 2 then
+        return n
+    end if
+    return fibo(n - 1) + fibo(n - 2)
+end def
+
+def add3(a, b, c)
+    return a + b + c
+end def
+
+def chain(n)
+    dim i, sum = 0
+    for i = 1 to n
+        sum = add3(sum, i, 1)
+    next i
+    return sum
+end def
+
+print "fibo(22) = "; fibo(22)
+print "chain(50000) = "; chain(50000)
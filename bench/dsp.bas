@@ -0,0 +1,68 @@
+rem ==================================================
+rem  dsp - fixed point FIR filter and integer DFT
+rem ==================================================
+
+option stacksize=64
+
+include "print.bas"
+
+def N = 256
+def TAPS = 16
+def BINS = 16
+
+dim signal(N)
+dim output(N)
+dim coeff(TAPS) = { 1, 3, 8, 16, 28, 42, 55, 63, 63, 55, 42, 28, 16, 8, 3, 1 }
+
+rem 256 * cos(2 * pi * k / 16)
+dim cosine(16) = { 256, 237, 181, 98, 0, -98, -181, -237, -256, -237, -181, -98, 0, 98, 181, 237 }
+
+def generate(seed)
+    dim i
+    for i = 0 to N - 1
+        seed = (seed * 1103515245 + 12345) & 0x7fffffff
+        signal(i) = ((cosine((i * 3) & 15) * 100) >> 8) + ((seed >> 20) & 63) - 32
+    next i
+end def
+
+def fir(shift)
+    dim i, k, acc, sum = 0
+    for i = TAPS - 1 to N - 1
+        acc = 0
+        for k = 0 to TAPS - 1
+            acc = acc + coeff(k) * signal(i - k)
+        next k
+        output(i) = acc >> shift
+        sum = sum + output(i)
+    next i
+    return sum
+end def
+
+def dft(bins)
+    dim k, i, re, im, power, peak = 0, peakBin = 0
+    for k = 0 to bins - 1
+        re = 0
+        im = 0
+        for i = 0 to N - 1
+            re = re + signal(i) * cosine((k * i) & 15)
+            im = im + signal(i) * cosine((k * i + 12) & 15)
+        next i
+        re = re >> 8
+        im = im >> 8
+        power = (re * re + im * im) >> 8
+        if power > peak then
+            peak = power
+            peakBin = k
+        end if
+    next k
+    return peakBin
+end def
+
+dim pass, sum = 0, bin = 0
+generate(1)
+for pass = 1 to 20
+    sum = sum + fir(9)
+    bin = dft(BINS)
+next pass
+print "fir = "; sum
+print "peak bin = "; bin
@@ -0,0 +1,52 @@
+rem ==================================================
+rem  loops - FOR, DO WHILE and DO UNTIL loops
+rem ==================================================
+
+include "print.bas"
+
+def nested(n)
+    dim i, j, sum = 0
+    for i = 1 to n
+        for j = 1 to n
+            sum = sum + (i ^ j)
+        next j
+    next i
+    return sum
+end def
+
+def countdown(n)
+    dim steps = 0
+    do while n
+        n = n - 1
+        steps = steps + 1
+    loop
+    return steps
+end def
+
+def collatz(n)
+    dim steps = 0
+    do until n = 1
+        if n & 1 then
+            n = n * 3 + 1
+        else
+            n = n >> 1
+        end if
+        steps = steps + 1
+    loop
+    return steps
+end def
+
+def collatzMax(n)
+    dim i, steps, best = 0
+    for i = 1 to n
+        steps = collatz(i)
+        if steps > best then
+            best = steps
+        end if
+    next i
+    return best
+end def
+
+print "nested(300) = "; nested(300)
+print "countdown(200000) = "; countdown(200000)
+print "collatzMax(3000) = "; collatzMax(3000)
@@ -0,0 +1,10 @@
+rem ==================================================
+rem  printing - formatted output of strings and integers
+rem ==================================================
+
+include "print.bas"
+
+dim i
+for i = 0 to 3000
+    print "line "; i, i * i, -i; " end"
+next i
@@ -0,0 +1,78 @@
+#!/bin/sh
+#
+# scale.sh - time the compiler on generated programs of increasing size
+#
+# usage: scale.sh <bindir> <workdir> <results> [ <lines>... ]
+#
+# A program of each size (1k to 200k lines by default) is generated with
+# xbgen and compiled with xbcom -M.  The results file has one tab separated
+# line per size with these columns:
+#
+#   lines           lines in the generated program (including include files)
+#   compile_ms      xbcom wall time
+#   compile_kb      xbcom peak resident memory
+#   us_per_line     compile time per source line (flat if the compiler scales linearly)
+#   <phase>_ms      time spent in each compiler phase (see xbcom -T)
+#   peak_heap       most compiler heap space in use at once
+#
+# Extra xbgen options (for example "-i 8 -c 32") can be given in SCALE_OPTS.
+#
+
+BINDIR=$1
+WORKDIR=$2
+RESULTS=$3
+
+BENCHDIR=`dirname $0`
+OPTS=${SCALE_OPTS:--i 4}
+
+if [ -z "$RESULTS" ]; then
+    echo "usage: scale.sh <bindir> <workdir> <results> [ <lines>... ]" >&2
+    exit 1
+fi
+shift 3
+SIZES=${*:-1000 2000 5000 10000 20000 50000 100000 200000}
+
+# the compiler needs to find xbasic.cfg and the include files
+XB_INC=${XB_INC:-$BENCHDIR/../include}
+export XB_INC
+
+mkdir -p $WORKDIR || exit 1
+STAT=$WORKDIR/runstat.out
+PHASES="pass1 pass2 dependencies generate store references image"
+
+printf "lines\tcompile_ms\tcompile_kb\tus_per_line" > $RESULTS
+for phase in $PHASES; do
+    printf "\t%s_ms" $phase >> $RESULTS
+done
+printf "\tpeak_heap\n" >> $RESULTS
+
+for size in $SIZES; do
+    rm -f $WORKDIR/scale*.bas
+    if ! $BINDIR/xbgen -l $size $OPTS $WORKDIR/scale.bas; then
+        echo "error: can't generate a $size line program" >&2
+        exit 1
+    fi
+    lines=`cat $WORKDIR/scale*.bas | wc -l | tr -d ' '`
+
+    # compile it
+    if ! $BINDIR/runstat $STAT $BINDIR/xbcom -b hub -M -I $WORKDIR $WORKDIR/scale.bas > $WORKDIR/scale.log 2>&1; then
+        cat $WORKDIR/scale.log >&2
+        echo "error: the $size line program failed to compile" >&2
+        exit 1
+    fi
+    read compile_ms compile_kb < $STAT
+
+    # pick the phase times and the peak heap out of the statistics
+    awk -F '\t' -v lines=$lines -v ms=$compile_ms -v kb=$compile_kb -v phases="$PHASES" '
+        $1 == "phase" { time[$2] = $4 }
+        $1 == "heap" && $2 == "peak" { peak = $5 }
+        END {
+            printf("%d\t%s\t%s\t%.2f", lines, ms, kb, ms * 1000.0 / lines)
+            n = split(phases, names, " ")
+            for (i = 1; i <= n; ++i)
+                printf("\t%s", time[names[i]])
+            printf("\t%s\n", peak)
+        }' $WORKDIR/scale.log >> $RESULTS
+done
+
+cat $RESULTS
@@ -0,0 +1,26 @@
+rem ==================================================
+rem  select - SELECT with single values, lists and ranges
+rem ==================================================
+
+include "print.bas"
+
+def classify(n)
+    select n & 31
+        case 0
+            return 1
+        case 1, 3, 5, 7
+            return 2
+        case 8 to 15
+            return 3
+        case 16, 20 to 23, 30
+            return 4
+        case else
+            return 5
+    end select
+end def
+
+dim i, sum = 0
+for i = 0 to 100000
+    sum = sum + classify(i)
+next i
+print "sum = "; sum
@@ -0,0 +1,61 @@
+rem ==================================================
+rem  strings - byte string copying, scanning and hashing
+rem ==================================================
+
+option stacksize=64
+
+include "print.bas"
+include "string.bas"
+
+dim buf(64) as byte
+dim words(64) as byte
+
+def hash(str() as byte)
+    dim i = 0, h = 5381, ch
+    ch = str(i)
+    do while ch
+        h = ((h << 5) + h) ^ ch
+        i = i + 1
+        ch = str(i)
+    loop
+    return h & 0x7fffffff
+end def
+
+def countWords(str() as byte)
+    dim i = 0, count = 0, inWord = 0, ch
+    ch = str(i)
+    do while ch
+        if isspace(ch) then
+            inWord = 0
+        else if not inWord then
+            inWord = 1
+            count = count + 1
+        end if
+        i = i + 1
+        ch = str(i)
+    loop
+    return count
+end def
+
+def reverse(str() as byte)
+    dim i = 0, j, t
+    j = strlen(str) - 1
+    do while i < j
+        t = str(i)
+        str(i) = str(j)
+        str(j) = t
+        i = i + 1
+        j = j - 1
+    loop
+end def
+
+dim pass, h = 0, n = 0
+strcpy(words, "a quick brown fox jumps")
+for pass = 1 to 2000
+    strcpy(buf, words)
+    reverse(buf)
+    h = (h + hash(buf)) & 0x7fffffff
+    n = n + countWords(buf) + strlen(buf)
+next pass
+print "hash = "; h
+print "count = "; n
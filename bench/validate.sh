@@ -0,0 +1,83 @@
+#!/bin/sh
+#
+# validate.sh - run the benchmark kernels and the samples under every
+#               execution engine and compare the output
+#
+# usage: validate.sh <bindir> <workdir>
+#
+# Each program is compiled with xbcom and run with xbint, xbint -p and
+# xbint -j.  The output (including any abort message) of the pre-decoded
+# and native code runs must be the same as the output of the plain
+# interpreter.  All of the runs read the same input so the samples that
+# use INPUT behave the same way every time.
+#
+# Only the samples in the top level of samples/ are run; the ones in its
+# subdirectories drive Propeller hardware.  The samples that read CNT are
+# timed with it, so CNT is replaced with zero (the JIT compiler doesn't
+# simulate it) and the endless loop at the end of the main code is left out.
+#
+
+BINDIR=$1
+WORKDIR=$2
+
+BENCHDIR=`dirname $0`
+SAMPLEDIR=$BENCHDIR/../samples
+ENGINES="-p -j"
+
+if [ -z "$WORKDIR" ]; then
+    echo "usage: validate.sh <bindir> <workdir>" >&2
+    exit 1
+fi
+
+# the compiler needs to find xbasic.cfg and the include files
+XB_INC=${XB_INC:-$BENCHDIR/../include}
+export XB_INC
+
+mkdir -p $WORKDIR || exit 1
+INPUT=$WORKDIR/input.txt
+printf '1, 2, 3, 4\nsomething\nmore\n' > $INPUT
+
+failures=0
+
+# validate - compile a program and compare its output under each engine
+validate() {
+    name=$1
+    file=$2
+
+    if ! $BINDIR/xbcom -b hub $WORKDIR/$file.bas > $WORKDIR/$file.log 2>&1; then
+        cat $WORKDIR/$file.log >&2
+        echo "FAILED: $name doesn't compile"
+        failures=`expr $failures + 1`
+        return
+    fi
+    $BINDIR/xbint -b hub $WORKDIR/$file.bai < $INPUT > $WORKDIR/$file.out 2>&1
+    for engine in $ENGINES; do
+        $BINDIR/xbint -b hub $engine $WORKDIR/$file.bai < $INPUT > $WORKDIR/$file$engine.out 2>&1
+        if cmp -s $WORKDIR/$file.out $WORKDIR/$file$engine.out; then
+            echo "ok: $name $engine"
+        else
+            diff $WORKDIR/$file.out $WORKDIR/$file$engine.out | head -10
+            echo "FAILED: $name $engine"
+            failures=`expr $failures + 1`
+        fi
+    done
+}
+
+for src in $BENCHDIR/*.bas; do
+    name=`basename $src .bas`
+    cp $src $WORKDIR/$name.bas
+    validate $name $name
+done
+
+for src in $SAMPLEDIR/*.bas; do
+    name=`basename $src .bas`
+    sed -e '/^do[ 	]*$/d' -e '/^loop[ 	]*$/d' -e 's/\<[Cc][Nn][Tt]\>/0/g' \
+        $src > $WORKDIR/sample_$name.bas
+    validate samples/$name sample_$name
+done
+
+if [ $failures -gt 0 ]; then
+    echo "$failures program(s) don't behave the same under every engine"
+    exit 1
+fi
+echo "every program behaves the same under every engine"
@@ -1,73 +1,2 @@
-dim TV_array() = {
- 0xa0fe2a5c, 0xa0fe360a, 0x5cbe2d15, 0xe4fe3602
- 0xa0fe2a5c, 0x617e6a01, 0xa08df6fc, 0x627e6a02
- 0xa0be372c, 0x5cfca44a, 0xfc3e5d03, 0x5cbe2d15
- 0xe4fe3609, 0x083df5f0, 0xa0be3720, 0x5cfc9245
- 0xa0be4936, 0xa0be3939, 0xa0be453b, 0x6ce9f001
- 0xec69f02b, 0x5cfca44a, 0xa0bfff1e, 0x6cbe4b80
- 0xfc7e4a00, 0xa0be3738, 0xa0bfff21, 0x04be4b24
- 0x68be4afd, 0x24fe4a06, 0x08be4d25, 0x28fe4a10
- 0x50bc4725, 0x80fe4802, 0xa0be4afb, 0x6cbe4b80
- 0xfc3e4b26, 0xe4fe361b, 0x84be4923, 0xa0bfff1d
- 0xa0be4afb, 0x6cbe4b80, 0xfc7e4a00, 0xe4fe4413
- 0x20bdfaff, 0x81bdfb27, 0x24bdfaff, 0x5c4c0012
- 0x80be4923, 0xe4fe3812, 0x6ee9f001, 0x617e6a01
- 0xa0be371f, 0x80d23601, 0x5cfc9245, 0x0815f3f0
- 0x5ce4a44a, 0xa0a7ff29, 0xfc265d03, 0x6ca5f6fc
- 0x5cfcb653, 0x50fcaf04, 0x50fcb305, 0x5cfcb655
- 0x5cfcb653, 0xa097ff2a, 0xfc165d03, 0x5c680008
- 0x5c7c0004, 0x5cfca44a, 0x6cbe4b80, 0xfc7e4a00
- 0xe4fe3645, 0x5c7c0000, 0x617e6a01, 0x6cb1f6fc
- 0xa0bfff30, 0xa0be4afb, 0x6cbe4b2e, 0xfc3e4b32
- 0xa0bfff28, 0xa0be4afb, 0x5c7c0000, 0x50fcaf02
- 0x50fcb303, 0xa0be372d, 0xa0bfff30, 0xfc3e5d02
- 0xa0bfff31, 0xfc3e5d03, 0xe4fe3656, 0x5c7c0000
- 0xa0be2ff0, 0x54fcc133, 0xa0fe300d, 0x80fe2e04
- 0x08bc0117, 0x80bcc0f5, 0xe4fe305f, 0xa0be2f34
- 0x617e2e08, 0xa08e3100, 0xa0b23101, 0x617e2e40
- 0x28fe2e01, 0x2cfe2e03, 0x28be3117, 0x50bffd18
- 0x28fe2e06, 0x54bffd17, 0x2cfe2e03, 0x60fe30ff
- 0x2cbe3117, 0xa08fed18, 0xa0cfee00, 0xa0f3ec00
- 0xa0b3ef18, 0xec7e66e9, 0x5cbe2b16, 0x50fcf706
- 0x54fcff28, 0xa0fe2e07, 0x617e6a01, 0xa0be3000
- 0x80fcf601, 0x2cce3010, 0x28fe3010, 0xa0bc0118
- 0x80bcfef5, 0xe4fe2e7b, 0x50cd0d0d, 0x50f10d0e
- 0x54fd0d2f, 0xa0fe2e04, 0xa0bc0000, 0x80bd0cf7
- 0xe4fe2e86, 0x08fe2e00, 0x28fe2e01, 0x853e2ef3
- 0xa0f27c00, 0x28fe2e01, 0x853e2f2f, 0x5c7000e9
- 0x5cbe2b16, 0xa0be2f2f, 0x5cfdc4dc, 0x617e6a01
- 0x58f3f00f, 0x58cff00e, 0x2cce3001, 0xa0bff518
- 0x5cbe2b16, 0xa0be2f3e, 0xa0fe3000, 0xec7e2ea3
- 0x48be2ef3, 0x4cbe2ef4, 0xa0fe300c, 0x28fe2e01
- 0x853de717, 0x80f23001, 0x5c70009f, 0x58bff318
- 0x5cfdc4dc, 0xa0bff718, 0x5cbe2b16, 0xa0fe2ea0
- 0x617e6801, 0x68f22e40, 0x617e6a08, 0x68ce2e10
- 0x617e6a04, 0x68ce2e08, 0x60fe7e07, 0x68be2f3f
- 0x58bffd17, 0xa0be433a, 0x2cfe4208, 0x68be433a
- 0x2cfe4204, 0xa0be4738, 0x2cfe4601, 0xa0be2f38
- 0xa0be313a, 0x5cfdd0e3, 0xa0be3b28, 0x84be3b17
- 0x29fe3a01, 0xa0be3d3c, 0xc8be3d1d, 0x84be3b3c
- 0xa0be2f39, 0xa0be313b, 0x5cfdd0e3, 0x617e6a10
- 0x70fdfe01, 0xa0be4efe, 0x28f24e01, 0x2cf22e01
- 0x617e6a02, 0x28f22e01, 0xa0be3f2b, 0x84be3f17
- 0x29fe3e01, 0xa4be413d, 0xc8be411f, 0x80be3f3d
- 0x6cfe6a02, 0x5cbe2b16, 0xa0fe2e0d, 0xa0be30d7
- 0x28fe3007, 0x60fe30fc, 0x80be3137, 0x08bf0118
- 0x80bdaef5, 0x64bdaef6, 0xe4fe2ed3, 0x5c7c00d1
- 0x08fe3200, 0xa0fe3421, 0xe1be2f19, 0x34fe3001
- 0x2cfe2e01, 0xe4fe34de, 0x5c7c0000, 0x2cfe300b
- 0xa0fe3208, 0x29fe2e01, 0x80b22f18, 0xe4fe32e5
- 0x5c7c0000, 0xa0fff000, 0xa0fff200, 0xa0fffc00
- 0x083fe9f0, 0x08fe2e00, 0x28fe2e08, 0x48fe2e03
- 0x80be2ff1, 0xf8fe2e00, 0x5c7c0000, 0x007a1200
- 0x07a12000, 0x00000200, 0x00008000, 0x00000202
- 0x00000000, 0x00000001, 0x00000002, 0x00000000
- 0xf0f0f0f0, 0x00060000, 0x10000000, 0x00000000
- 0xf0700f07, 0xfff77f77, 0x555556a5, 0x55555555
- 0xaaaaaaa5, 0x6aaaaaaa, 0x0e6c0bc8, 0x058e04ac
- 0x08de071c, 0x011e00f3, 0x0012000a, 0x00050006
- 0x02aa028a, 0x00369e99, 0x0043a6d2, 0x00027270
- 0x00035350, 0x000434ac, 0x0004f58e, 0x5006aaa5
- 0x5401aaa5
-}
+dim TV_array() = include "TV.bin"
 def TV_size = 277
@@ -4,6 +4,7 @@ REM This module is the TvText driver.
 REM It includes the TvText PASM and access methods.
 REM ==================================================
 
+include "propeller.bas"
 include "TV.bas"
 
 REM ==================================================
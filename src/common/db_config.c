@@ -3,6 +3,7 @@
 #include <stdarg.h>
 #include <string.h>
 #include <ctype.h>
+#include <setjmp.h>
 
 #include "db_config.h"
 #include "db_image.h"
@@ -11,9 +12,12 @@
 #define MAXLINE 128
 
 typedef struct {
+    System *sys;            /* system interface for reporting errors */
+    const char *path;       /* configuration file */
     char lineBuf[MAXLINE];  /* line buffer */
     char *linePtr;          /* pointer to the current character */
     int lineNumber;         /* current line number */
+    jmp_buf errorTarget;    /* where to go after an error */
 } LineBuf;
 
 typedef struct {
@@ -38,9 +42,7 @@ static ConfigSymbol configSymbols[] = {
 {   NULL,           0           }
 };
 
-/* board configurations */
-static BoardConfig *boardConfigs = NULL;
-
+static void ParseConfigurations(LineBuf *buf, FILE *fp, BoardConfig **pConfigs);
 static int SkipSpaces(LineBuf *buf);
 static char *NextToken(LineBuf *buf, const char *termSet, int *pTerm);
 static int ParseNumericExpr(LineBuf *buf, char *token, int *pValue);
@@ -58,10 +60,11 @@ static BoardConfig *NewBoardConfig(const char *name)
     return config;
 }
 
-BoardConfig *GetBoardConfig(const char *name)
+/* GetBoardConfig - find a board configuration in a list returned by ParseConfigurationFile */
+BoardConfig *GetBoardConfig(BoardConfig *configs, const char *name)
 {
     BoardConfig *config;
-    for (config = boardConfigs; config != NULL; config = config->next)
+    for (config = configs; config != NULL; config = config->next)
         if (strcasecmp(name, config->name) == 0)
             return config;
     return NULL;
@@ -86,47 +89,69 @@ Section *GetSection(BoardConfig *config, const char *name)
     return NULL;
 }
 
-/* ParseConfigurationFile - parse a configuration file */
-void ParseConfigurationFile(System *sys, const char *path)
+/* ParseConfigurationFile - parse a configuration file and return its list of board configurations
+
+   An error in the file is reported through the system interface (so a
+   compile server can pass it on to its client) and NULL is returned.
+*/
+BoardConfig *ParseConfigurationFile(System *sys, const char *path)
 {
-    char text[MAXLINE], data[MAXLINE], *tag, *value;
-    BoardConfig **pNextConfig = &boardConfigs;
-    BoardConfig *config = NULL;
-    Section **pNextSection;
-    Section *section;
+    BoardConfig *configs = NULL;
     LineBuf buf;
-    int iValue;
     FILE *fp;
-    int ch;
 
     if (!(fp = xbOpenFileInPath(sys, path, "r")))
-        return;
+        return NULL;
+    buf.sys = sys;
+    buf.path = path;
+    buf.lineNumber = 0;
 
-    strcpy(text, "hub");
-    strcpy(data, "hub");
+    if (setjmp(buf.errorTarget)) {
+        fclose(fp);
+        FreeBoardConfigs(configs);
+        return NULL;
+    }
+
+    ParseConfigurations(&buf, fp, &configs);
+
+    fclose(fp);
+    
+    return configs;
+}
 
-    while (fgets(buf.lineBuf, sizeof(buf.lineBuf), fp)) {
-        buf.linePtr = buf.lineBuf;
-        ++buf.lineNumber;
-        switch (SkipSpaces(&buf)) {
+/* ParseConfigurations - parse the board configurations in a configuration file */
+static void ParseConfigurations(LineBuf *buf, FILE *fp, BoardConfig **pConfigs)
+{
+    char *tag, *value;
+    BoardConfig **pNextConfig = pConfigs;
+    BoardConfig *config = NULL;
+    Section **pNextSection = NULL;
+    Section *section;
+    int iValue;
+    int ch;
+
+    while (fgets(buf->lineBuf, sizeof(buf->lineBuf), fp)) {
+        buf->linePtr = buf->lineBuf;
+        ++buf->lineNumber;
+        switch (SkipSpaces(buf)) {
         case '\n':  /* blank line */
         case '#':   /* comment */
             // ignore blank lines and comments
             break;
         case '[':   /* board tag */
-            ++buf.linePtr;
-            if (!(tag = NextToken(&buf, "]", &ch)))
-                Error(&buf, "missing board tag");
+            ++buf->linePtr;
+            if (!(tag = NextToken(buf, "]", &ch)))
+                Error(buf, "missing board tag");
             if (ch != ']') {
-                if (SkipSpaces(&buf) != ']')
-                    Error(&buf, "missing close bracket after section tag");
-                ++buf.linePtr;
+                if (SkipSpaces(buf) != ']')
+                    Error(buf, "missing close bracket after section tag");
+                ++buf->linePtr;
             }
-            if (SkipSpaces(&buf) != '\n')
-                Error(&buf, "missing end of line");
+            if (SkipSpaces(buf) != '\n')
+                Error(buf, "missing end of line");
             if (config) {
                 if (!(section = NewSection("hub")))
-                    Error(&buf, "insufficient memory");
+                    Error(buf, "insufficient memory");
                 section->base = HUB_BASE;
                 section->size = HUB_SIZE;
                 *pNextSection = section;
@@ -134,96 +159,96 @@ void ParseConfigurationFile(System *sys, const char *path)
                 config = NULL;
             }
             if (!(config = NewBoardConfig(tag)))
-                Error(&buf, "insufficient memory");
+                Error(buf, "insufficient memory");
             *pNextConfig = config;
             pNextConfig = &config->next;
             pNextSection = &config->sections;
             break;
         default:    /* tag:value pair */
             if (!config)
-                Error(&buf, "not in a board definition");
-            if (!(tag = NextToken(&buf, ":", &ch)))
-                Error(&buf, "missing tag");
+                Error(buf, "not in a board definition");
+            if (!(tag = NextToken(buf, ":", &ch)))
+                Error(buf, "missing tag");
             if (ch != ':') {
-                if (SkipSpaces(&buf) != ':')
-                    Error(&buf, "missing colon");
-                ++buf.linePtr;
+                if (SkipSpaces(buf) != ':')
+                    Error(buf, "missing colon");
+                ++buf->linePtr;
             }
-            if (!(value = NextToken(&buf, "", &ch)))
-                Error(&buf, "missing value");
+            if (!(value = NextToken(buf, "", &ch)))
+                Error(buf, "missing value");
             if (ch != '\n') {
-                if (SkipSpaces(&buf) != '\n')
-                    Error(&buf, "missing end of line");
-                ++buf.linePtr;
+                if (SkipSpaces(buf) != '\n')
+                    Error(buf, "missing end of line");
+                ++buf->linePtr;
             }
             if (strcasecmp(tag, "clkfreq") == 0) {
-                if (!ParseNumericExpr(&buf, value, &iValue))
-                    Error(&buf, "invalid numeric value");
+                if (!ParseNumericExpr(buf, value, &iValue))
+                    Error(buf, "invalid numeric value");
                 config->clkfreq = iValue;
             }
             else if (strcasecmp(tag, "clkmode") == 0) {
-                if (!ParseNumericExpr(&buf, value, &iValue))
-                    Error(&buf, "invalid numeric value");
+                if (!ParseNumericExpr(buf, value, &iValue))
+                    Error(buf, "invalid numeric value");
                 config->clkmode = iValue;
             }
             else if (strcasecmp(tag, "baudrate") == 0) {
-                if (!ParseNumericExpr(&buf, value, &iValue))
-                    Error(&buf, "invalid numeric value");
+                if (!ParseNumericExpr(buf, value, &iValue))
+                    Error(buf, "invalid numeric value");
                 config->baudrate = iValue;
             }
             else if (strcasecmp(tag, "rxpin") == 0) {
-                if (!ParseNumericExpr(&buf, value, &iValue))
-                    Error(&buf, "invalid numeric value");
+                if (!ParseNumericExpr(buf, value, &iValue))
+                    Error(buf, "invalid numeric value");
                 config->rxpin = iValue;
             }
             else if (strcasecmp(tag, "txpin") == 0) {
-                if (!ParseNumericExpr(&buf, value, &iValue))
-                    Error(&buf, "invalid numeric value");
+                if (!ParseNumericExpr(buf, value, &iValue))
+                    Error(buf, "invalid numeric value");
                 config->txpin = iValue;
             }
             else if (strcasecmp(tag, "tvpin") == 0) {
-                if (!ParseNumericExpr(&buf, value, &iValue))
-                    Error(&buf, "invalid numeric value");
+                if (!ParseNumericExpr(buf, value, &iValue))
+                    Error(buf, "invalid numeric value");
                 config->tvpin = iValue;
             }
             else if (strcasecmp(tag, "cache-driver") == 0) {
                 if (config->cacheDriver)
                     free(config->cacheDriver);
-                if (!(config->cacheDriver = CopyString(&buf, value)))
-                    Error(&buf, "insufficient memory");
+                if (!(config->cacheDriver = CopyString(buf, value)))
+                    Error(buf, "insufficient memory");
             }
             else if (strcasecmp(tag, "cache-size") == 0) {
-                if (!ParseNumericExpr(&buf, value, &iValue))
-                    Error(&buf, "invalid numeric value");
+                if (!ParseNumericExpr(buf, value, &iValue))
+                    Error(buf, "invalid numeric value");
                 config->cacheSize = iValue;
             }
             else if (strcasecmp(tag, "cache-param1") == 0) {
-                if (!ParseNumericExpr(&buf, value, &iValue))
-                    Error(&buf, "invalid numeric value");
+                if (!ParseNumericExpr(buf, value, &iValue))
+                    Error(buf, "invalid numeric value");
                 config->cacheParam1 = iValue;
             }
             else if (strcasecmp(tag, "cache-param2") == 0) {
-                if (!ParseNumericExpr(&buf, value, &iValue))
-                    Error(&buf, "invalid numeric value");
+                if (!ParseNumericExpr(buf, value, &iValue))
+                    Error(buf, "invalid numeric value");
                 config->cacheParam2 = iValue;
             }
             else if (strcasecmp(tag, "text") == 0) {
                 if (config->defaultTextSection)
                     free(config->defaultTextSection);
-                if (!(config->defaultTextSection = CopyString(&buf, value)))
-                    Error(&buf, "insufficient memory");
+                if (!(config->defaultTextSection = CopyString(buf, value)))
+                    Error(buf, "insufficient memory");
             }
             else if (strcasecmp(tag, "data") == 0) {
                 if (config->defaultDataSection)
                     free(config->defaultDataSection);
-                if (!(config->defaultDataSection = CopyString(&buf, value)))
-                    Error(&buf, "insufficient memory");
+                if (!(config->defaultDataSection = CopyString(buf, value)))
+                    Error(buf, "insufficient memory");
             }
             else if (strcasecmp(tag, "flash-size") == 0) {
-                if (!ParseNumericExpr(&buf, value, &iValue))
-                    Error(&buf, "invalid numeric value");
+                if (!ParseNumericExpr(buf, value, &iValue))
+                    Error(buf, "invalid numeric value");
                 if (!(section = NewSection("flash")))
-                    Error(&buf, "insufficient memory");
+                    Error(buf, "insufficient memory");
                 section->base = FLASH_BASE;
                 section->size = iValue;
                 *pNextSection = section;
@@ -231,10 +256,10 @@ void ParseConfigurationFile(System *sys, const char *path)
                 ++config->sectionCount;
             }
             else if (strcasecmp(tag, "ram-size") == 0) {
-                if (!ParseNumericExpr(&buf, value, &iValue))
-                    Error(&buf, "invalid numeric value");
+                if (!ParseNumericExpr(buf, value, &iValue))
+                    Error(buf, "invalid numeric value");
                 if (!(section = NewSection("ram")))
-                    Error(&buf, "insufficient memory");
+                    Error(buf, "insufficient memory");
                 section->base = RAM_BASE;
                 section->size = iValue;
                 *pNextSection = section;
@@ -242,21 +267,37 @@ void ParseConfigurationFile(System *sys, const char *path)
                 ++config->sectionCount;
             }
             else
-                Error(&buf, "unknown tag: %s", tag);
+                Error(buf, "unknown tag: %s", tag);
             break;
         }
     }
 
     if (config) {
         if (!(section = NewSection("hub")))
-            Error(&buf, "insufficient memory");
+            Error(buf, "insufficient memory");
         section->base = HUB_BASE;
         section->size = HUB_SIZE;
         *pNextSection = section;
         ++config->sectionCount;
     }
+}
 
-    fclose(fp);
+/* FreeBoardConfigs - free a list of board configurations */
+void FreeBoardConfigs(BoardConfig *configs)
+{
+    BoardConfig *config, *nextConfig;
+    Section *section, *nextSection;
+    for (config = configs; config != NULL; config = nextConfig) {
+        nextConfig = config->next;
+        for (section = config->sections; section != NULL; section = nextSection) {
+            nextSection = section->next;
+            free(section);
+        }
+        free(config->cacheDriver);
+        free(config->defaultTextSection);
+        free(config->defaultDataSection);
+        free(config);
+    }
 }
 
 static int SkipSpaces(LineBuf *buf)
@@ -346,8 +387,8 @@ static int ParseNumericExpr(LineBuf *buf, char *token, int *pValue)
                     op = -1;
                     break;
                 }
-            if (!sym)
-                Error(buf, "undefined symbol: %s\n", id);
+            if (!sym->name)
+                Error(buf, "undefined symbol: %s", id);
         }
         else {
             switch (*p) {
@@ -413,15 +454,23 @@ static char *CopyString(LineBuf *buf, const char *str)
 	return copy;
 }
 
+/* Error - report an error in the configuration file and stop parsing it */
 static void Error(LineBuf *buf, const char *fmt, ...)
 {
+    char message[MAXLINE];
     va_list ap;
     va_start(ap, fmt);
-    fprintf(stderr, "error: ");
-    vfprintf(stderr, fmt, ap);
-    putc('\n', stderr);
-    fprintf(stderr, "  on line number %d\n", buf->lineNumber);
+    vsnprintf(message, sizeof(message), fmt, ap);
     va_end(ap);
-    exit(1);
+    xbError(buf->sys, "error: %s\n  on line number %d of %s\n", message, buf->lineNumber, buf->path);
+    if (buf->sys->ops->diagnostic) {
+        Diagnostic diagnostic;
+        diagnostic.file = buf->path;
+        diagnostic.lineNumber = buf->lineNumber;
+        diagnostic.column = 0;
+        diagnostic.message = message;
+        (*buf->sys->ops->diagnostic)(buf->sys, &diagnostic);
+    }
+    longjmp(buf->errorTarget, 1);
 }
 
@@ -13,6 +13,9 @@
 /* configuration variables
 
 MAXCODE		the size of the bytecode staging buffer used by the compiler
+VM_THREADED	use computed goto dispatch in the bytecode interpreter
+VM_JIT		include the x86-64 JIT compiler in the runtime
+VM_STATS	include opcode statistics in the runtime (make STATS=1)
 
 */
 
@@ -31,6 +34,16 @@ MAXCODE		the size of the bytecode staging buffer used by the compiler
 #define FLASH_SPACE		const
 #define MAXCODE         (32 * 1024)
 
+/* gcc and clang support labels as values */
+#if defined(__GNUC__)
+#define VM_THREADED
+#endif
+
+/* the JIT compiler generates code for the x86-64 System V calling convention */
+#if defined(__GNUC__) && defined(__x86_64__) && defined(LINUX)
+#define VM_JIT
+#endif
+
 #endif
 
 /* for all propeller platforms */
@@ -40,6 +53,10 @@ MAXCODE		the size of the bytecode staging buffer used by the compiler
 #define RAM_BASE        0x20000000
 #define FLASH_BASE      0x30000000
 
+/* the address space is divided into windows of 0x10000000 bytes (see the *_BASE definitions) */
+#define WINDOW_SHIFT    28
+#define WINDOW_COUNT    (1 << (32 - WINDOW_SHIFT))
+
 #ifdef NO_STDINT
 typedef long int32_t;
 typedef unsigned long uint32_t;
@@ -54,11 +71,13 @@ typedef unsigned char uint8_t;
 #ifdef WORD_SIZE_16
 typedef int16_t VMVALUE;
 typedef uint16_t VMUVALUE;
+#define VMVALUE_MIN (-32767 - 1)
 #endif
 
 #ifdef WORD_SIZE_32
 typedef int32_t VMVALUE;
 typedef uint32_t VMUVALUE;
+#define VMVALUE_MIN (-2147483647L - 1)
 #endif
 
 #define RCFAST      0x00
@@ -89,7 +108,9 @@ struct Section {
     VMUVALUE base;      // base address
     VMUVALUE size;      // maximum size
     VMUVALUE offset;    // next available offset
-    FILE *fp;           // image or scratch file pointer
+    VMUVALUE zeroSize;  // size of the zero-filled data after the contents
+    uint8_t *data;      // section contents while compiling
+    VMUVALUE allocated; // size of the data buffer
     Section *next;      // next section
     char name[1];       // section name
 };
@@ -114,8 +135,9 @@ struct BoardConfig {
     char name[1];
 };
 
-void ParseConfigurationFile(System *sys, const char *path);
-BoardConfig *GetBoardConfig(const char *name);
+BoardConfig *ParseConfigurationFile(System *sys, const char *path);
+BoardConfig *GetBoardConfig(BoardConfig *configs, const char *name);
+void FreeBoardConfigs(BoardConfig *configs);
 Section *GetSection(BoardConfig *config, const char *name);
 
 #endif
@@ -10,26 +10,55 @@
 #include "db_config.h"
 
 #define IMAGE_TAG       "XLOD"
-#define IMAGE_VERSION   0x0100
+#define IMAGE_VERSION   0x0101
 
-/* image file section */
+/* image file section (the zero-filled data that follows the contents isn't in the file) */
 typedef struct {
     VMUVALUE base;
     VMUVALUE offset;
     VMUVALUE size;
+    VMUVALUE zeroSize;
 } ImageFileSection;
 
 /* image file header */
 typedef struct {
     uint8_t tag[4];     /* should be 'XLOD' */
     uint16_t version;   /* version number */
-    uint16_t unused;    /* (unused at present) */
+    uint16_t flags;     /* image flags */
     VMUVALUE mainCode;
     VMUVALUE stackSize;
     VMUVALUE sectionCount;
     ImageFileSection sections[1];
 } ImageFileHdr;
 
+/* image flags */
+#define IMAGE_FLAG_DEBUG    0x0001  /* a debug section follows the section data */
+
+#define IMAGE_DEBUG_TAG     "XDBG"
+
+/* debug section header (followed by the file, function and line tables and the strings) */
+typedef struct {
+    uint8_t tag[4];         /* should be 'XDBG' */
+    VMUVALUE fileCount;     /* number of source file name offsets */
+    VMUVALUE functionCount; /* number of function entries */
+    VMUVALUE lineCount;     /* number of line table entries */
+    VMUVALUE stringSize;    /* size of the string table */
+} ImageDebugHdr;
+
+/* debug section function entry */
+typedef struct {
+    VMUVALUE name;          /* offset of the function name in the string table */
+    VMUVALUE base;          /* address of the function code */
+    VMUVALUE size;          /* size of the function code */
+} ImageDebugFunction;
+
+/* debug section line table entry (sorted by address) */
+typedef struct {
+    VMUVALUE addr;          /* address of the first instruction generated for the line */
+    VMUVALUE file;          /* index of the source file name */
+    VMUVALUE line;          /* source line number */
+} ImageDebugLine;
+
 /* stack frame offsets */
 #define F_FP    -1
 #define F_SIZE  1
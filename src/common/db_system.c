@@ -2,23 +2,23 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <sys/stat.h>
 #include "db_system.h"
 
 #if defined(WIN32)
 #include <windows.h>
 #include <psapi.h>
+#else
+#include <sys/time.h>
 #endif
 
-typedef struct PathEntry PathEntry;
 struct PathEntry {
     PathEntry *next;
     char path[1];
 };
 
-static PathEntry *path = NULL;
-static PathEntry **pNextPathEntry = &path;
-
-static const char *MakePath(PathEntry *entry, const char *name);
+static int AddToPath(System *sys, const char *p, size_t length);
+static const char *MakePath(PathEntry *entry, const char *name, char *fullpath);
 
 void xbInfo(System *sys, const char *fmt, ...)
 {
@@ -38,51 +38,82 @@ void xbError(System *sys, const char *fmt, ...)
 
 void *xbOpenFileInPath(System *sys, const char *name, const char *mode)
 {
+    char fullpath[PATH_MAX];
     PathEntry *entry;
     void *file;
     
 #if 0
     xbInfo("path:");
-    for (entry = path; entry != NULL; entry = entry->next)
+    for (entry = sys->path; entry != NULL; entry = entry->next)
         xbInfo(" '%s'", entry->path);
     xbInfo("\n");
 #endif
     
     if (!(file = xbOpenFile(sys, name, mode))) {
-        for (entry = path; entry != NULL; entry = entry->next)
-            if ((file = xbOpenFile(sys, MakePath(entry, name), mode)) != NULL)
+        for (entry = sys->path; entry != NULL; entry = entry->next)
+            if ((file = xbOpenFile(sys, MakePath(entry, name, fullpath), mode)) != NULL)
                 break;
     }
     return file;
 }
 
-int xbAddToPath(const char *p)
+/* xbFindFileInPath - find the file xbOpenFileInPath would open (fullpath is used if the path is searched) */
+const char *xbFindFileInPath(System *sys, const char *name, char *fullpath)
 {
-    PathEntry *entry = malloc(sizeof(PathEntry) + strlen(p));
+    PathEntry *entry;
+    
+    if (xbFileInfo(name, NULL, NULL, NULL))
+        return name;
+    for (entry = sys->path; entry != NULL; entry = entry->next)
+        if (xbFileInfo(MakePath(entry, name, fullpath), NULL, NULL, NULL))
+            return fullpath;
+    return NULL;
+}
+
+int xbAddToPath(System *sys, const char *p)
+{
+    return AddToPath(sys, p, strlen(p));
+}
+
+static int AddToPath(System *sys, const char *p, size_t length)
+{
+    PathEntry *entry = malloc(sizeof(PathEntry) + length);
+    PathEntry **pNext;
     if (!(entry))
         return FALSE;
-    strcpy(entry->path, p);
-    *pNextPathEntry = entry;
-    pNextPathEntry = &entry->next;
+    memcpy(entry->path, p, length);
+    entry->path[length] = '\0';
+    for (pNext = &sys->path; *pNext != NULL; pNext = &(*pNext)->next)
+        ;
+    *pNext = entry;
     entry->next = NULL;
     return TRUE;
 }
 
+void xbFreePath(System *sys)
+{
+    PathEntry *entry, *next;
+    for (entry = sys->path; entry != NULL; entry = next) {
+        next = entry->next;
+        free(entry);
+    }
+    sys->path = NULL;
+}
+
 #if defined(WIN32)
 
 /* GetProgramPath - get the path relative the application directory */
-static char *GetProgramPath(void)
+static char *GetProgramPath(char *fullpath, size_t size)
 {
-    static char fullpath[1024];
     char *p;
 
 #if defined(Q_OS_WIN32)
     /* get the full path to the executable */
-    if (!GetModuleFileNameA(NULL, fullpath, sizeof(fullpath)))
+    if (!GetModuleFileNameA(NULL, fullpath, (DWORD)size))
         return NULL;
 #else
     /* get the full path to the executable */
-    if (!GetModuleFileNameEx(GetCurrentProcess(), NULL, fullpath, sizeof(fullpath)))
+    if (!GetModuleFileNameEx(GetCurrentProcess(), NULL, fullpath, (DWORD)size))
         return NULL;
 #endif
 
@@ -108,35 +139,35 @@ static char *GetProgramPath(void)
 
 #endif
 
-int xbAddEnvironmentPath(void)
+int xbAddEnvironmentPath(System *sys)
 {
-    char *p, *end;
+    const char *p, *end;
     
-    /* add path entries from the environment */
+    /* add path entries from the environment (leaving the environment string alone) */
     if ((p = getenv("XB_INC")) != NULL) {
         while ((end = strchr(p, PATH_SEP)) != NULL) {
-            *end = '\0';
-            if (!xbAddToPath(p))
+            if (!AddToPath(sys, p, end - p))
                 return FALSE;
             p = end + 1;
         }
-        if (!xbAddToPath(p))
+        if (!xbAddToPath(sys, p))
             return FALSE;
     }
     
     /* add the path relative to the location of the executable */
 #if defined(WIN32)
-    if (!(p = GetProgramPath()))
-        if (!xbAddToPath(p))
+    {
+        char fullpath[1024];
+        if ((p = GetProgramPath(fullpath, sizeof(fullpath))) != NULL && !xbAddToPath(sys, p))
             return FALSE;
+    }
 #endif
 
     return TRUE;
 }
 
-static const char *MakePath(PathEntry *entry, const char *name)
+static const char *MakePath(PathEntry *entry, const char *name, char *fullpath)
 {
-    static char fullpath[PATH_MAX];
     sprintf(fullpath, "%s%c%s", entry->path, DIR_SEP, name);
 	return fullpath;
 }
@@ -183,6 +214,59 @@ int xbSeekFile(void *file, long offset, int whence)
     return fseek((FILE *)file, offset, whence);
 }
 
+long xbFileSize(void *file)
+{
+    long size;
+    if (fseek((FILE *)file, 0, SEEK_END) != 0)
+        return -1;
+    size = ftell((FILE *)file);
+    if (fseek((FILE *)file, 0, SEEK_SET) != 0)
+        return -1;
+    return size;
+}
+
+/* xbFileInfo - get the modification time and size of a file (FALSE if there is no such file)
+
+   The nanoseconds part of the modification time tells apart two edits in the
+   same second that leave the size alone.  It is zero where the file system
+   or the C library doesn't keep it.
+*/
+int xbFileInfo(const char *name, time_t *pTime, long *pNanoseconds, long *pSize)
+{
+    struct stat info;
+    if (stat(name, &info) != 0 || !(info.st_mode & S_IFREG))
+        return FALSE;
+    if (pTime)
+        *pTime = info.st_mtime;
+    if (pNanoseconds) {
+#if defined(WIN32)
+        *pNanoseconds = 0;
+#elif defined(MACOSX)
+        *pNanoseconds = info.st_mtimespec.tv_nsec;
+#else
+        *pNanoseconds = info.st_mtim.tv_nsec;
+#endif
+    }
+    if (pSize)
+        *pSize = (long)info.st_size;
+    return TRUE;
+}
+
+/* xbWallTime - get the wall clock time in seconds (for measuring intervals) */
+double xbWallTime(void)
+{
+#if defined(WIN32)
+    LARGE_INTEGER frequency, count;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart / frequency.QuadPart;
+#else
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec + now.tv_usec / 1000000.0;
+#endif
+}
+
 #if defined(NEED_STRCASECMP)
 
 int strcasecmp(const char *s1, const char *s2)
@@ -2,6 +2,7 @@
 #define __DB_SYSTEM_H__
 
 #include <stdarg.h>
+#include <time.h>
 
 #ifndef TRUE
 #define TRUE    1
@@ -18,16 +19,38 @@
 
 /* forward typedefs */
 typedef struct System System;
+typedef struct PathEntry PathEntry;
 
-/* system operations table */
+/* heap statistics */
+typedef struct {
+    size_t globalHeapUsed;          /* amount of global heap space currently allocated */
+    size_t localHeapUsed;           /* amount of local heap space currently allocated */
+    size_t maxHeapUsed;             /* maximum amount of heap space allocated so far */
+    size_t maxGlobalHeapUsed;       /* maximum amount of global heap space allocated so far */
+    size_t maxLocalHeapUsed;        /* maximum amount of local heap space allocated so far */
+    size_t totalAllocated;          /* total of all allocations (including freed local space) */
+} HeapStats;
+
+/* compiler error with its location (for tools that want more than the error text) */
+typedef struct {
+    const char *file;               /* source file (NULL if the error isn't in the source) */
+    int lineNumber;                 /* line number in the source file */
+    int column;                     /* column of the token in error (the first column is 1) */
+    const char *message;            /* error message */
+} Diagnostic;
+
+/* system operations table (diagnostic is optional and is called in addition to error) */
 typedef struct {
     void (*info)(System *sys, const char *fmt, va_list ap);
     void (*error)(System *sys, const char *fmt, va_list ap);
+    void (*diagnostic)(System *sys, const Diagnostic *diagnostic);
 } SystemOps;
 
-/* system interface */
+/* system interface (each compile in a process can have its own) */
 struct System {
     SystemOps   *ops;
+    void        *opsData;   /* data for the system operations (NULL if they don't need any) */
+    PathEntry   *path;      /* include file search path */
 };
 
 #define xbInfoV(sys, fmt, args)     ((*(sys)->ops->info)((sys), (fmt), (args)))
@@ -35,19 +58,27 @@ struct System {
 
 void xbInfo(System *sys, const char *fmt, ...);
 void xbError(System *sys, const char *fmt, ...);
-int xbAddToPath(const char *p);
-int xbAddEnvironmentPath(void);
+int xbAddToPath(System *sys, const char *p);
+int xbAddEnvironmentPath(System *sys);
+void xbFreePath(System *sys);
 void *xbOpenFileInPath(System *sys, const char *name, const char *mode);
+const char *xbFindFileInPath(System *sys, const char *name, char *fullpath);
 void *xbOpenFile(System *sys, const char *name, const char *mode);
 int xbCloseFile(void *file);
 char *xbGetLine(void *file, char *buf, size_t size);
 size_t xbReadFile(void *file, void *buf, size_t size);
 size_t xbWriteFile(void *file, const void *buf, size_t size);
 int xbSeekFile(void *file, long offset, int whence);
+long xbFileSize(void *file);
+int xbFileInfo(const char *name, time_t *pTime, long *pNanoseconds, long *pSize);
+double xbWallTime(void);
 void *xbCreateTmpFile(System *sys, const char *name, const char *mode);
 int xbRemoveTmpFile(System *sys, const char *name);
 void *xbGlobalAlloc(System *sys, size_t size);
 void *xbLocalAlloc(System *sys, size_t size);
+void *xbLocalMark(System *sys);
+void xbLocalRelease(System *sys, void *mark);
 void xbLocalFreeAll(System *sys);
+void xbHeapStats(System *sys, HeapStats *stats);
 
 #endif
@@ -8,6 +8,9 @@ typedef struct {
     uint8_t *heapTop;               /* top of the heap */
     size_t heapSize;                /* size of heap space in bytes */
     size_t maxHeapUsed;             /* maximum amount of heap space allocated so far */
+    size_t maxGlobalHeapUsed;       /* maximum amount of global heap space allocated so far */
+    size_t maxLocalHeapUsed;        /* maximum amount of local heap space allocated so far */
+    size_t totalAllocated;          /* total of all allocations */
 } MySystem;
 
 /* MemInit - initialize the memory allocator */
@@ -25,10 +28,15 @@ System *MemInit(uint8_t *space, size_t size)
     size -= sizeof(MySystem);
         
     /* use the rest of the free space for the compiler heap */
+    sys->sys.opsData = NULL;
+    sys->sys.path = NULL;
     sys->nextGlobal = space;
     sys->heapSize = size;
     sys->heapTop = sys->nextLocal = sys->nextGlobal + size;
     sys->maxHeapUsed = 0;
+    sys->maxGlobalHeapUsed = 0;
+    sys->maxLocalHeapUsed = 0;
+    sys->totalAllocated = 0;
     
     /* return the system interface structure */
     return (System *)sys;
@@ -44,6 +52,9 @@ void *xbGlobalAlloc(System *sysbase, size_t size)
         return NULL;
     p = sys->nextGlobal;
     sys->nextGlobal += size;
+    sys->totalAllocated += size;
+    if ((size_t)(sys->nextGlobal - (sys->heapTop - sys->heapSize)) > sys->maxGlobalHeapUsed)
+        sys->maxGlobalHeapUsed = sys->nextGlobal - (sys->heapTop - sys->heapSize);
     if (sys->heapSize - (sys->nextLocal - sys->nextGlobal) > sys->maxHeapUsed)
         sys->maxHeapUsed = sys->heapSize - (sys->nextLocal - sys->nextGlobal);
     return p;
@@ -57,14 +68,43 @@ void *xbLocalAlloc(System *sysbase, size_t size)
     if (sys->nextLocal - size < sys->nextGlobal)
         return NULL;
     sys->nextLocal -= size;
+    sys->totalAllocated += size;
     if (sys->heapSize - (sys->nextLocal - sys->nextGlobal) > sys->maxHeapUsed)
         sys->maxHeapUsed = sys->heapSize - (sys->nextLocal - sys->nextGlobal);
+    if ((size_t)(sys->heapTop - sys->nextLocal) > sys->maxLocalHeapUsed)
+        sys->maxLocalHeapUsed = sys->heapTop - sys->nextLocal;
     return sys->nextLocal;
 }
 
+/* xbLocalMark - remember the top of the local heap */
+void *xbLocalMark(System *sysbase)
+{
+    MySystem *sys = (MySystem *)sysbase;
+    return sys->nextLocal;
+}
+
+/* xbLocalRelease - free all local memory allocated since a mark */
+void xbLocalRelease(System *sysbase, void *mark)
+{
+    MySystem *sys = (MySystem *)sysbase;
+    sys->nextLocal = (uint8_t *)mark;
+}
+
 /* xbLocalFreeAll - free all local memory */
 void xbLocalFreeAll(System *sysbase)
 {
     MySystem *sys = (MySystem *)sysbase;
     sys->nextLocal = sys->heapTop;
 }
+
+/* xbHeapStats - get the heap statistics */
+void xbHeapStats(System *sysbase, HeapStats *stats)
+{
+    MySystem *sys = (MySystem *)sysbase;
+    stats->globalHeapUsed = sys->nextGlobal - (sys->heapTop - sys->heapSize);
+    stats->localHeapUsed = sys->heapTop - sys->nextLocal;
+    stats->maxHeapUsed = sys->maxHeapUsed;
+    stats->maxGlobalHeapUsed = sys->maxGlobalHeapUsed;
+    stats->maxLocalHeapUsed = sys->maxLocalHeapUsed;
+    stats->totalAllocated = sys->totalAllocated;
+}
@@ -2,36 +2,54 @@
 #include "db_config.h"
 #include "mem_malloc.h"
 
-typedef struct BlockHdr BlockHdr;
-struct BlockHdr {
-    BlockHdr *next;
+/* size of a normal chunk (bigger allocations get a chunk of their own) */
+#define CHUNK_SIZE      (64 * 1024)
+
+/* round allocations up so that pointers in them are aligned on the host */
+#define ALIGN_SIZE(x)   (((x) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+/* chunk of heap space */
+typedef struct Chunk Chunk;
+struct Chunk {
+    Chunk *next;                    /* next older chunk */
+    uint8_t *top;                   /* next free byte when a newer chunk was added */
+    uint8_t *end;                   /* end of the chunk */
 };
 
+/* first free byte in a chunk */
+#define ChunkData(chunk)    ((uint8_t *)(chunk) + ALIGN_SIZE(sizeof(Chunk)))
+
+/* chunked arena (allocations are carved from the newest chunk) */
+typedef struct {
+    Chunk *chunks;                  /* chunks newest first */
+    Chunk *oldest;                  /* oldest chunk */
+    uint8_t *next;                  /* next free byte in the newest chunk */
+    size_t used;                    /* amount of space currently allocated */
+} Arena;
+
 typedef struct {
     System sys;
-    BlockHdr *globalBlocks;         /* next global heap space location */
-    BlockHdr *localBlocks;          /* next local heap space location */
-    size_t localHeapUsed;           /* amount of local heap space currently allocated */
-    size_t totalHeapUsed;           /* total amount of heap space currently allocated */
+    Arena global;                   /* global heap */
+    Arena local;                    /* local heap */
+    Chunk *freeChunks;              /* chunks that can be reused */
     size_t maxHeapUsed;             /* maximum amount of heap space allocated so far */
+    size_t maxGlobalHeapUsed;       /* maximum amount of global heap space allocated so far */
+    size_t maxLocalHeapUsed;        /* maximum amount of local heap space allocated so far */
+    size_t totalAllocated;          /* total of all allocations */
 } MySystem;
 
+static void *ArenaAlloc(MySystem *sys, Arena *arena, size_t size);
+static void FreeChunks(Chunk *chunk);
+
 /* MemInit - initialize the memory allocator */
 System *MemInit(void)
 {
     MySystem *sys;
-    
+
     /* allocate the system interface structure */
-    if (!(sys = (MySystem *)malloc(sizeof(MySystem))))
+    if (!(sys = (MySystem *)calloc(1, sizeof(MySystem))))
         return NULL;
-        
-    /* initialize */
-    sys->globalBlocks = NULL;
-    sys->localBlocks = NULL;
-    sys->localHeapUsed = 0;
-    sys->totalHeapUsed = 0;
-    sys->maxHeapUsed = 0;
-    
+
     /* return the system interface structure */
     return (System *)sys;
 }
@@ -40,12 +58,10 @@ System *MemInit(void)
 void MemFree(System *sysbase)
 {
     MySystem *sys = (MySystem *)sysbase;
-    BlockHdr *hdr, *next;
-    for (hdr = sys->globalBlocks; hdr != NULL; hdr = next) {
-        next = hdr->next;
-        free(hdr);
-    }
-    xbLocalFreeAll(sysbase);
+    xbFreePath(sysbase);
+    FreeChunks(sys->global.chunks);
+    FreeChunks(sys->local.chunks);
+    FreeChunks(sys->freeChunks);
     free(sys);
 }
 
@@ -53,43 +69,130 @@ void MemFree(System *sysbase)
 void *xbGlobalAlloc(System *sysbase, size_t size)
 {
     MySystem *sys = (MySystem *)sysbase;
-    BlockHdr *hdr;
-    size = ROUND_TO_WORDS(size + sizeof(BlockHdr));
-    if (!(hdr = (BlockHdr *)malloc(size)))
-        return NULL;
-    hdr->next = sys->globalBlocks;
-    sys->globalBlocks = hdr;
-    if ((sys->totalHeapUsed += size) > sys->maxHeapUsed)
-        sys->maxHeapUsed = sys->totalHeapUsed;
-    return (void *)++hdr;
+    void *p;
+    if ((p = ArenaAlloc(sys, &sys->global, size)) != NULL && sys->global.used > sys->maxGlobalHeapUsed)
+        sys->maxGlobalHeapUsed = sys->global.used;
+    return p;
 }
 
 /* xbLocalAlloc - allocate memory from the local heap */
 void *xbLocalAlloc(System *sysbase, size_t size)
 {
     MySystem *sys = (MySystem *)sysbase;
-    BlockHdr *hdr;
-    size = ROUND_TO_WORDS(size + sizeof(BlockHdr));
-    if (!(hdr = (BlockHdr *)malloc(size)))
-        return NULL;
-    hdr->next = sys->localBlocks;
-    sys->localBlocks = hdr;
-    sys->localHeapUsed += size;
-    if ((sys->totalHeapUsed += size) > sys->maxHeapUsed)
-        sys->maxHeapUsed = sys->totalHeapUsed;
-    return (void *)++hdr;
+    void *p;
+    if ((p = ArenaAlloc(sys, &sys->local, size)) != NULL && sys->local.used > sys->maxLocalHeapUsed)
+        sys->maxLocalHeapUsed = sys->local.used;
+    return p;
+}
+
+/* xbLocalMark - remember the top of the local heap */
+void *xbLocalMark(System *sysbase)
+{
+    MySystem *sys = (MySystem *)sysbase;
+    return sys->local.next;
+}
+
+/* xbLocalRelease - free all local memory allocated since a mark */
+void xbLocalRelease(System *sysbase, void *mark)
+{
+    MySystem *sys = (MySystem *)sysbase;
+    Arena *arena = &sys->local;
+    Chunk *chunk;
+
+    /* a mark taken before anything was allocated releases everything */
+    if (!mark) {
+        xbLocalFreeAll(sysbase);
+        return;
+    }
+
+    /* move the chunks allocated after the mark to the free list */
+    while ((chunk = arena->chunks) != NULL && !((uint8_t *)mark >= ChunkData(chunk) && (uint8_t *)mark <= chunk->end)) {
+        arena->used -= arena->next - ChunkData(chunk);
+        arena->chunks = chunk->next;
+        arena->next = chunk->next ? chunk->next->top : NULL;
+        chunk->next = sys->freeChunks;
+        sys->freeChunks = chunk;
+    }
+
+    /* release the space allocated in the chunk containing the mark */
+    arena->used -= arena->next - (uint8_t *)mark;
+    arena->next = (uint8_t *)mark;
 }
 
 /* xbLocalFreeAll - free all local memory */
 void xbLocalFreeAll(System *sysbase)
 {
     MySystem *sys = (MySystem *)sysbase;
-    BlockHdr *hdr, *next;
-    for (hdr = sys->localBlocks; hdr != NULL; hdr = next) {
-        next = hdr->next;
-        free(hdr);
+    Arena *arena = &sys->local;
+    if (arena->chunks) {
+        arena->oldest->next = sys->freeChunks;
+        sys->freeChunks = arena->chunks;
+        arena->chunks = arena->oldest = NULL;
+        arena->next = NULL;
+        arena->used = 0;
+    }
+}
+
+/* xbHeapStats - get the heap statistics */
+void xbHeapStats(System *sysbase, HeapStats *stats)
+{
+    MySystem *sys = (MySystem *)sysbase;
+    stats->globalHeapUsed = sys->global.used;
+    stats->localHeapUsed = sys->local.used;
+    stats->maxHeapUsed = sys->maxHeapUsed;
+    stats->maxGlobalHeapUsed = sys->maxGlobalHeapUsed;
+    stats->maxLocalHeapUsed = sys->maxLocalHeapUsed;
+    stats->totalAllocated = sys->totalAllocated;
+}
+
+/* ArenaAlloc - allocate space from an arena, adding a chunk if the newest one is full */
+static void *ArenaAlloc(MySystem *sys, Arena *arena, size_t size)
+{
+    uint8_t *p;
+
+    size = ALIGN_SIZE(size);
+
+    /* add a chunk if there isn't room in the newest one */
+    if (!arena->chunks || size > (size_t)(arena->chunks->end - arena->next)) {
+        size_t chunkSize = ALIGN_SIZE(sizeof(Chunk)) + size;
+        Chunk *chunk;
+        if (chunkSize < CHUNK_SIZE)
+            chunkSize = CHUNK_SIZE;
+
+        /* reuse a free chunk if the first one is big enough */
+        if ((chunk = sys->freeChunks) != NULL && (size_t)(chunk->end - (uint8_t *)chunk) >= chunkSize)
+            sys->freeChunks = chunk->next;
+        else if ((chunk = (Chunk *)malloc(chunkSize)) != NULL)
+            chunk->end = (uint8_t *)chunk + chunkSize;
+        else
+            return NULL;
+
+        /* the space left at the end of the old chunk is wasted */
+        if (arena->chunks)
+            arena->chunks->top = arena->next;
+        else
+            arena->oldest = chunk;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->next = ChunkData(chunk);
+    }
+
+    /* allocate the space */
+    p = arena->next;
+    arena->next += size;
+    arena->used += size;
+    sys->totalAllocated += size;
+    if (sys->global.used + sys->local.used > sys->maxHeapUsed)
+        sys->maxHeapUsed = sys->global.used + sys->local.used;
+    return p;
+}
+
+/* FreeChunks - free a list of chunks */
+static void FreeChunks(Chunk *chunk)
+{
+    Chunk *next;
+    for (; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        free(chunk);
     }
-    sys->localBlocks = NULL;
-    sys->totalHeapUsed -= sys->localHeapUsed;
-    sys->localHeapUsed = 0;
 }
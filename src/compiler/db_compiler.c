@@ -14,13 +14,36 @@
 #include "db_compiler.h"
 #include "db_vmdebug.h"
 
+/* number of string constant hash buckets to start with (a power of two) */
+#define MIN_STRING_BUCKETS  64
+
+/* phase names (the same in both forms of the statistics output) */
+static const char *phaseNames[PHASE_COUNT] = {
+    "pass1",
+    "pass2",
+    "dependencies",
+    "generate",
+    "store",
+    "references",
+    "image"
+};
+
 /* local function prototypes */
+static void ShowPhaseStatistics(ParseContext *c, double time, size_t allocated);
 static void GenerateDependencies(ParseContext *c);
+static void AddReachable(ParseContext *c, Dependency ***ppNext, Symbol *sym);
+static unsigned int HashString(const char *value);
+static void GenerateFunctions(ParseContext *c);
 static void ApplyLocalFixups(ParseContext *c, VMUVALUE base);
 static void DumpLocalFixups(ParseContext *c);
 static void UpdateReferences(ParseContext *c);
+static void SelectBoard(ParseContext *c, BoardConfig *config);
+static void PlaceGlobalData(ParseContext *c);
+static void PlaceZeroData(ParseContext *c);
+static void ClearAddresses(ParseContext *c);
+static BoardConfig *CopyBoardConfig(System *sys, BoardConfig *config);
 
-/* InitCompiler - initialize the compiler */
+/* InitCompiler - initialize the compiler (each compiler needs its own system interface) */
 ParseContext *InitCompiler(System *sys, BoardConfig *config, size_t codeBufSize)
 {
     ParseContext *c;
@@ -28,7 +51,7 @@ ParseContext *InitCompiler(System *sys, BoardConfig *config, size_t codeBufSize)
     /* allocate a parse context */
     if (!(c = (ParseContext *)xbGlobalAlloc(sys, sizeof(ParseContext) + codeBufSize)))
         return NULL;
-        
+    
     /* initialize the new parse context */
     memset(c, 0, sizeof(ParseContext));
     c->stringType.id = TYPE_STRING;
@@ -45,34 +68,85 @@ ParseContext *InitCompiler(System *sys, BoardConfig *config, size_t codeBufSize)
     c->codeBuf = (uint8_t *)c + sizeof(ParseContext);
     c->ctop = c->codeBuf + codeBufSize;
     c->sys = sys;
-    c->config = config;
 
-    /* setup the target sections */
-    if (!(c->textTarget = GetSection(c->config, c->config->defaultTextSection))) {
-        xbError(c->sys, "Unknown section: %s\n", c->config->defaultTextSection);
-        return NULL;
-    }
-    if (!(c->dataTarget = GetSection(c->config, c->config->defaultDataSection))) {
-        xbError(c->sys, "Unknown section: %s\n", c->config->defaultDataSection);
+    /* add the first target board */
+    if (!AddBoard(c, config))
         return NULL;
-    }
+    SelectBoard(c, c->boards);
     
     /* return the new parse context */
     return c;
 }
 
-/* Compile - compile a program */
-int Compile(ParseContext *c, const char *name)
+/* AddBoard - add a board to build an image for (the program is only parsed once) */
+int AddBoard(ParseContext *c, BoardConfig *config)
+{
+    BoardConfig **pNext;
+    
+    /* the sections keep the state of the image being built so each compiler has its own copy */
+    if (!(config = CopyBoardConfig(c->sys, config)))
+        return FALSE;
+        
+    /* make sure the default sections exist */
+    if (!GetSection(config, config->defaultTextSection)) {
+        xbError(c->sys, "Unknown section: %s\n", config->defaultTextSection);
+        return FALSE;
+    }
+    if (!GetSection(config, config->defaultDataSection)) {
+        xbError(c->sys, "Unknown section: %s\n", config->defaultDataSection);
+        return FALSE;
+    }
+    
+    /* add the board to the end of the list */
+    for (pNext = &c->boards; *pNext != NULL; pNext = &(*pNext)->next)
+        ;
+    *pNext = config;
+    
+    return TRUE;
+}
+
+/* SelectBoard - select the board to build an image for */
+static void SelectBoard(ParseContext *c, BoardConfig *config)
+{
+    c->config = config;
+    c->textTarget = GetSection(config, config->defaultTextSection);
+    c->dataTarget = GetSection(config, config->defaultDataSection);
+}
+
+/* Compile - compile a program into an image in memory for the selected board */
+int Compile(ParseContext *c)
+{
+    int result;
+    if (!ParseProgram(c))
+        return FALSE;
+    result = GenerateImage(c, c->config);
+    EndCompile(c);
+    return result;
+}
+
+/* ParseProgram - parse a program and find the functions reachable from the main code */
+int ParseProgram(ParseContext *c)
 {
     /* setup an error target */
     if (setjmp(c->errorTarget) != 0) {
         CloseParseContext(c);
+        FreeSourceTexts(c);
+        xbLocalFreeAll(c->sys);
         return FALSE;
     }
         
-    /* start the image and initialize the interpreter stack size */
-    if (!StartImage(c, name))
-        return FALSE;
+    /* start timing the phases */
+    if (c->flags & COMPILER_STATS) {
+        HeapStats stats;
+        memset(c->phaseStats, 0, sizeof(c->phaseStats));
+        if (c->flags & COMPILER_STATS_TSV)
+            xbInfo(c->sys, "kind\tname\tcount\tms\tallocated\n");
+        xbHeapStats(c->sys, &stats);
+        c->compileAllocated = stats.totalAllocated;
+        c->compileStart = xbWallTime();
+    }
+    
+    /* initialize the interpreter stack size */
     c->stackSize = DEFAULT_STACK_SIZE;
 
     /* initialize block nesting stack */
@@ -82,8 +156,28 @@ int Compile(ParseContext *c, const char *name)
     /* initialize the code staging buffer */
     c->cptr = c->codeBuf;
     
-    /* initialize the string and label tables */
+    /* initialize the string table */
     c->strings = NULL;
+    c->stringBuckets = NULL;
+    c->stringBucketCount = 0;
+    c->stringCount = 0;
+
+    /* initialize the list of globals to place */
+    c->globalData = NULL;
+    c->pNextGlobalData = &c->globalData;
+
+    /* include files with up to date library modules are taken from the modules */
+    c->modules = NULL;
+    c->moduleOut = NULL;
+    if (c->flags & COMPILER_MODULE)
+        StartModule(c);
+
+    /* initialize the list of parse trees */
+    c->functions = NULL;
+    c->pNextFunction = &c->functions;
+
+    /* initialize the debug section tables */
+    InitDebugInfo(c);
 
     /* initialize the global symbol table */
     InitSymbolTable(&c->globals);
@@ -113,20 +207,29 @@ int Compile(ParseContext *c, const char *name)
     /* initialize scanner */
     c->inComment = FALSE;
     
-    /* do three passes over the source program */
-    for (c->pass = 1; c->pass <= 3; ++c->pass) {
+    /* do two passes over the source program */
+    for (c->pass = 1; c->pass <= 2; ++c->pass) {
         
         /* no main function yet */
         c->mainState = MAIN_NOT_DEFINED;
+        StartPhase(c, c->pass == 1 ? PHASE_PASS1 : PHASE_PASS2);
 
         /* rewind to the start of the source program */
-        RewindInput(c);
+        if (!RewindInput(c))
+            ParseError(c, "can't open '%s'", c->mainFile.name);
     
         /* get the next line */
         while (GetLine(c)) {
-            int tkn;
+            int first = c->lineCount - 1, tkn;
+            c->statementDone = FALSE;
             if ((tkn = GetToken(c)) != T_EOL)
                 ParseStatement(c, tkn);
+            else
+                c->statementDone = TRUE;
+
+            /* the second pass doesn't see the lines of statements the first pass handled */
+            if (c->pass == 1 && c->statementDone)
+                c->lineCount = first;
         }
         
         /* end the main function if it's in progress */
@@ -134,29 +237,80 @@ int Compile(ParseContext *c, const char *name)
             switch (c->mainState) {
             case MAIN_IN_PROGRESS:
                 EndFunction(c);
+                if (c->moduleOut)
+                    ParseError(c, "a library module can't have main code");
                 break;
             case MAIN_NOT_DEFINED:
-                ParseError(c, "no main code");
+                if (!c->moduleOut)
+                    ParseError(c, "no main code");
                 break;
             case MAIN_DEFINED:
                 // nothing to do
                 break;
             }
+        }
+        EndPhase(c, NULL);
     
-            /* make a list of dependencies at the end of the second pass */
-            if (c->pass == 2)
-                GenerateDependencies(c);
+        /* make a list of dependencies at the end of the second pass */
+        if (c->pass > 1) {
+            StartPhase(c, PHASE_DEPENDENCIES);
+            GenerateDependencies(c);
+            EndPhase(c, NULL);
         }
         
+        /* the first pass only leaves behind symbols so empty the local heap */
+        else
+            xbLocalFreeAll(c->sys);
+
         /* clear the list of included files for the next pass */
         ClearIncludedFiles(c);
     }
     
+    /* show how fast the source files were scanned */
+    if (c->flags & COMPILER_INFO)
+        ShowScanStatistics(c);
+
     /* close the input file */
     CloseParseContext(c);
+    FreeSourceTexts(c);
+    c->currentFile = NULL;
+
+    return TRUE;
+}
+
+/* GenerateImage - generate code from the parse trees and build an image for a board */
+int GenerateImage(ParseContext *c, BoardConfig *config)
+{
+    void *mark = xbLocalMark(c->sys);
+    int result;
+    
+    /* setup an error target (the parse trees are kept for the other boards) */
+    if (setjmp(c->errorTarget) != 0) {
+        FreeImage(c);
+        xbLocalRelease(c->sys, mark);
+        return FALSE;
+    }
+    
+    /* start the image for the board */
+    SelectBoard(c, config);
+    if (!StartImage(c))
+        return FALSE;
+    if ((c->flags & COMPILER_DEBUG) && c->boards->next)
+        xbInfo(c->sys, "\nboard %s:\n", config->name);
+        
+    /* place the globals in the board's sections */
+    ClearAddresses(c);
+    PlaceGlobalData(c);
+    
+    /* generate code from the parse trees */
+    c->cptr = c->codeBuf;
+    GenerateFunctions(c);
+    PlaceZeroData(c);
 
     /* update all global variable references */
+    StartPhase(c, PHASE_REFERENCES);
     UpdateReferences(c);
+    EndPhase(c, NULL);
 
     /* show the symbol and string tables */
     if (c->flags & COMPILER_DEBUG) {
@@ -177,49 +331,189 @@ int Compile(ParseContext *c, const char *name)
         }
     }
 
+    /* show the most heap space used (the parse trees are in the local heap until code is generated) */
+    if (c->flags & COMPILER_INFO) {
+        HeapStats stats;
+        xbHeapStats(c->sys, &stats);
+        xbInfo(c->sys, "%lu bytes of heap used at most (%lu local)\n", (unsigned long)stats.maxHeapUsed, (unsigned long)stats.maxLocalHeapUsed);
+    }
+
     /* build an image in memory */
-    return BuildImage(c, name);
+    StartPhase(c, PHASE_IMAGE);
+    result = BuildImage(c);
+    EndPhase(c, NULL);
+    
+    return result;
+}
+
+/* GenerateModule - generate code for the functions of a library module and write the module (or cache it if there is no file) */
+int GenerateModule(ParseContext *c, const char *outfile)
+{
+    void *mark = xbLocalMark(c->sys);
+    int result;
+    
+    /* setup an error target */
+    if (setjmp(c->errorTarget) != 0) {
+        FreeImage(c);
+        xbLocalRelease(c->sys, mark);
+        return FALSE;
+    }
+    
+    /* the code is generated in an image for the first board but only the relocatable code is kept */
+    SelectBoard(c, c->boards);
+    if (!StartImage(c))
+        return FALSE;
+    ClearAddresses(c);
+    PlaceGlobalData(c);
+    c->cptr = c->codeBuf;
+    GenerateFunctions(c);
+    
+    /* write the module */
+    result = outfile ? WriteModule(c, outfile) : CacheModule(c);
+    FreeImage(c);
+    
+    return result;
+}
+
+/* EndCompile - free the parse trees once the images for all of the boards are built */
+void EndCompile(ParseContext *c)
+{
+    xbLocalFreeAll(c->sys);
+    
+    /* show the time and heap space used by each phase */
+    if (c->flags & COMPILER_STATS) {
+        HeapStats stats;
+        xbHeapStats(c->sys, &stats);
+        ShowPhaseStatistics(c, xbWallTime() - c->compileStart, stats.totalAllocated - c->compileAllocated);
+    }
+}
+
+/* StartPhase - start timing a compiler phase */
+void StartPhase(ParseContext *c, Phase phase)
+{
+    if (c->flags & COMPILER_STATS) {
+        HeapStats stats;
+        xbHeapStats(c->sys, &stats);
+        c->phase = phase;
+        c->phaseAllocated = stats.totalAllocated;
+        c->phaseStart = xbWallTime();
+    }
+}
+
+/* EndPhase - charge the time and heap space used since StartPhase to the phase */
+void EndPhase(ParseContext *c, const char *name)
+{
+    if (c->flags & COMPILER_STATS) {
+        PhaseStats *phaseStats = &c->phaseStats[c->phase];
+        double time = xbWallTime() - c->phaseStart;
+        HeapStats stats;
+        size_t allocated;
+        
+        /* add to the phase totals */
+        xbHeapStats(c->sys, &stats);
+        allocated = stats.totalAllocated - c->phaseAllocated;
+        phaseStats->time += time;
+        phaseStats->allocated += allocated;
+        ++phaseStats->count;
+        
+        /* the machine readable output also has a line for each function */
+        if (name && (c->flags & COMPILER_STATS_TSV))
+            xbInfo(c->sys, "%s\t%s\t1\t%.3f\t%lu\n", phaseNames[c->phase], name, time * 1000.0, (unsigned long)allocated);
+    }
+}
+
+/* ShowPhaseStatistics - show the time and heap space used by each phase */
+static void ShowPhaseStatistics(ParseContext *c, double time, size_t allocated)
+{
+    HeapStats stats;
+    int i;
+    
+    xbHeapStats(c->sys, &stats);
+    
+    /* tab separated values for scripts */
+    if (c->flags & COMPILER_STATS_TSV) {
+        for (i = 0; i < PHASE_COUNT; ++i) {
+            PhaseStats *phaseStats = &c->phaseStats[i];
+            xbInfo(c->sys, "phase\t%s\t%d\t%.3f\t%lu\n", phaseNames[i], phaseStats->count, phaseStats->time * 1000.0, (unsigned long)phaseStats->allocated);
+        }
+        xbInfo(c->sys, "phase\ttotal\t1\t%.3f\t%lu\n", time * 1000.0, (unsigned long)allocated);
+        xbInfo(c->sys, "heap\tpeak\t0\t0\t%lu\n", (unsigned long)stats.maxHeapUsed);
+        xbInfo(c->sys, "heap\tpeak_global\t0\t0\t%lu\n", (unsigned long)stats.maxGlobalHeapUsed);
+        xbInfo(c->sys, "heap\tpeak_local\t0\t0\t%lu\n", (unsigned long)stats.maxLocalHeapUsed);
+    }
+    
+    /* a table for people */
+    else {
+        xbInfo(c->sys, "phase           count          ms   allocated\n");
+        for (i = 0; i < PHASE_COUNT; ++i) {
+            PhaseStats *phaseStats = &c->phaseStats[i];
+            xbInfo(c->sys, "%-12s %8d %11.3f %11lu\n", phaseNames[i], phaseStats->count, phaseStats->time * 1000.0, (unsigned long)phaseStats->allocated);
+        }
+        xbInfo(c->sys, "%-12s %8s %11.3f %11lu\n", "total", "", time * 1000.0, (unsigned long)allocated);
+        xbInfo(c->sys, "%lu bytes of heap used at most (%lu global, %lu local)\n",
+               (unsigned long)stats.maxHeapUsed, (unsigned long)stats.maxGlobalHeapUsed, (unsigned long)stats.maxLocalHeapUsed);
+    }
+}
+
+/* CopyBoardConfig - make a private copy of a board configuration and its sections */
+static BoardConfig *CopyBoardConfig(System *sys, BoardConfig *config)
+{
+    size_t size = sizeof(BoardConfig) + strlen(config->name);
+    Section *section, **pNext;
+    BoardConfig *copy;
+    
+    /* copy the board configuration (the strings are shared) */
+    if (!(copy = (BoardConfig *)xbGlobalAlloc(sys, size)))
+        return NULL;
+    memcpy(copy, config, size);
+    copy->next = NULL;
+    
+    /* copy the sections */
+    pNext = &copy->sections;
+    for (section = config->sections; section != NULL; section = section->next) {
+        size = sizeof(Section) + strlen(section->name);
+        if (!(*pNext = (Section *)xbGlobalAlloc(sys, size)))
+            return NULL;
+        memcpy(*pNext, section, size);
+        (*pNext)->offset = 0;
+        (*pNext)->data = NULL;
+        (*pNext)->allocated = 0;
+        pNext = &(*pNext)->next;
+    }
+    *pNext = NULL;
+    
+    return copy;
 }
 
 /* GenerateDependencies - generate a list of dependencies of the main function */
 static void GenerateDependencies(ParseContext *c)
 {
-    Dependency *dependencies, **pNext, *d, *d2, *d3, *next;
+    Dependency *dependencies, **pNext, *d, *d2;
     
     /* initialize the main dependency list */
     dependencies = NULL;
     pNext = &dependencies;
     
     /* add all of the main dependencies */
-    for (d = c->mainDependencies; d != NULL; d = next) {
-        next = d->next;
-        *pNext = d;
-        pNext = &d->next;
-        d->next = NULL;
-    }
+    for (d = c->mainDependencies; d != NULL; d = d->next)
+        AddReachable(c, &pNext, d->symbol);
     
-    /* add all of the recursive dependencies */
+    /* add all of the recursive dependencies (the list is the work queue) */
     for (d = dependencies; d != NULL; d = d->next) {
         Symbol *sym = d->symbol;
         if (sym->type->id == TYPE_FUNCTION) {
-            for (d2 = sym->type->u.functionInfo.dependencies; d2 != NULL; d2 = next) {
-                sym = d2->symbol;
-                next = d2->next;
-                for (d3 = dependencies; d3 != NULL; d3 = d3->next)
-                    if (sym == d3->symbol)
-                        break;
-                if (!d3) {
-                    *pNext = d2;
-                    pNext = &d2->next;
-                    d2->next = NULL;
-                }
-            }
+            for (d2 = sym->type->u.functionInfo.dependencies; d2 != NULL; d2 = d2->next)
+                AddReachable(c, &pNext, d2->symbol);
         }
     }
     
     /* save the dependencies of the main function */
     c->mainDependencies = dependencies;
 
+    /* a library module has code for all of its functions */
+    if (c->moduleOut)
+        MarkModuleFunctions(c);
+
     if (c->flags & COMPILER_DEBUG) {
         if ((d = c->mainDependencies) != NULL) {
             xbInfo(c->sys, "main dependencies:\n");
@@ -229,20 +523,85 @@ static void GenerateDependencies(ParseContext *c)
     }
 }
 
+/* AddReachable - add a symbol to the main dependency list if it isn't already there */
+static void AddReachable(ParseContext *c, Dependency ***ppNext, Symbol *sym)
+{
+    if (!sym->reachable) {
+        Dependency *d = (Dependency *)GlobalAlloc(c, sizeof(Dependency));
+        sym->reachable = TRUE;
+        d->symbol = sym;
+        d->next = NULL;
+        **ppNext = d;
+        *ppNext = &d->next;
+    }
+}
+
+/* GenerateFunctions - generate code for the main code and the functions it depends on */
+static void GenerateFunctions(ParseContext *c)
+{
+    NodeListEntry *entry;
+    
+    /* generate the code in source order */
+    for (entry = c->functions; entry != NULL; entry = entry->next) {
+        ParseTreeNode *node = entry->node;
+        Symbol *sym = node->u.functionDefinition.symbol;
+        
+        /* skip functions that are never called */
+        if (sym && !sym->reachable)
+            continue;
+        
+        /* generate and store the code */
+        c->function = node;
+        c->functionType = node->type;
+        StoreCode(c);
+    }
+    c->function = NULL;
+    c->functionType = NULL;
+}
+
 /* StoreCode - store the function or method under construction */
 void StoreCode(ParseContext *c)
 {
+    DebugLine **pLines = c->pNextDebugLine;
+    Symbol *symbol = c->function->u.functionDefinition.symbol;
+    const char *name = symbol ? symbol->name : "[main]";
+    void *mark = xbLocalMark(c->sys);
+    Label *label;
     int codeSize;
 
     /* initialize */
     c->symbolFixups = NULL;
+    c->lastDebugLine = NULL;
+    c->relocations = NULL;
+    c->pNextRelocation = NULL;
+    
+    /* forget where the labels were placed in the code for the last board */
+    for (label = c->function->u.functionDefinition.labels; label != NULL; label = label->next) {
+        if (label->state == LS_PLACED)
+            label->state = LS_DEFINED;
+        label->fixups = 0;
+    }
 
-    /* generate code for the function */
-    Generate(c, c->function);
+    /* generate code for the function unless it comes from a library module */
+    StartPhase(c, PHASE_GENERATE);
+    if (c->function->u.functionDefinition.moduleCode)
+        LoadModuleCode(c, c->function->u.functionDefinition.moduleCode);
+    else if (c->moduleOut) {
+        c->pNextRelocation = &c->relocations;
+        Generate(c, c->function);
+        AddModuleCode(c, symbol);
+    }
+    else
+        Generate(c, c->function);
+    c->pNextRelocation = NULL;
+    EndPhase(c, name);
+    StartPhase(c, PHASE_STORE);
     
     /* store the function or main offset */
-    if (c->functionType)
-        c->function->u.functionDefinition.symbol->v.variable.offset = c->textTarget->offset;
+    if (c->functionType) {
+        symbol->section = c->textTarget;
+        symbol->v.variable.offset = c->textTarget->offset;
+    }
     else
         c->mainCode = c->textTarget->base + c->textTarget->offset;
 
@@ -252,10 +611,13 @@ void StoreCode(ParseContext *c)
     /* determine the code size */
     codeSize = c->cptr - c->codeBuf;
 
+    /* add the function and its line table entries to the debug section */
+    if (c->flags & COMPILER_SYMBOLS)
+        AddDebugFunction(c, name, c->textTarget->base + c->textTarget->offset, codeSize, pLines);
+
     /* show the function disassembly */
     if (c->flags & COMPILER_DEBUG) {
-        Symbol *symbol = c->function->u.functionDefinition.symbol;
-        xbInfo(c->sys, "\n%s:\n", symbol ? symbol->name : "[main]");
+        xbInfo(c->sys, "\n%s:\n", name);
         DecodeFunction(c->sys, c->textTarget->base + c->textTarget->offset, c->codeBuf, codeSize);
         if (c->functionType)
             DumpSymbols(c, &c->function->type->u.functionInfo.arguments, "arguments");
@@ -267,31 +629,70 @@ void StoreCode(ParseContext *c)
     /* store the code */
     c->textTarget->offset += WriteSection(c, c->textTarget, c->codeBuf, codeSize);
 
-    /* reset to compile the next code */
+    /* reset to compile the next code (the fixups go but the parse trees stay) */
     c->cptr = c->codeBuf;
+    c->symbolFixups = NULL;
+    xbLocalRelease(c->sys, mark);
+    EndPhase(c, name);
 }
 
 /* AddString - add a string to the string table */
 String *AddString(ParseContext *c, char *value)
 {
+    unsigned int hash = HashString(value);
+    String **pBucket;
+    size_t size;
     String *str;
     
     /* check to see if the string is already in the table */
-    for (str = c->strings; str != NULL; str = str->next)
-        if (strcmp(value, (char *)str->value) == 0)
-            return str;
+    if (c->stringBuckets) {
+        for (str = c->stringBuckets[hash & (c->stringBucketCount - 1)]; str != NULL; str = str->hashNext)
+            if (strcmp(value, (char *)str->value) == 0)
+                return str;
+    }
 
-    /* allocate the string structure */
-    str = (String *)GlobalAlloc(c, sizeof(String) + strlen(value));
-    memset(str, 0, sizeof(String));
+    /* allocate the string structure (zero padded to a whole number of words for AddStringRef) */
+    size = sizeof(String) + ROUND_TO_WORDS(strlen(value) + 1);
+    str = (String *)GlobalAlloc(c, size);
+    memset(str, 0, size);
     strcpy((char *)str->value, value);
     str->next = c->strings;
     c->strings = str;
 
+    /* rebuild the hash buckets when the table outgrows them (the old buckets stay in the heap) */
+    if (++c->stringCount > c->stringBucketCount) {
+        String *str2;
+        c->stringBucketCount = c->stringBucketCount ? c->stringBucketCount * 2 : MIN_STRING_BUCKETS;
+        size = c->stringBucketCount * sizeof(String *);
+        c->stringBuckets = (String **)GlobalAlloc(c, size);
+        memset(c->stringBuckets, 0, size);
+        for (str2 = c->strings; str2 != NULL; str2 = str2->next) {
+            pBucket = &c->stringBuckets[HashString((char *)str2->value) & (c->stringBucketCount - 1)];
+            str2->hashNext = *pBucket;
+            *pBucket = str2;
+        }
+    }
+    
+    /* otherwise just add the new string to its bucket */
+    else {
+        pBucket = &c->stringBuckets[hash & (c->stringBucketCount - 1)];
+        str->hashNext = *pBucket;
+        *pBucket = str;
+    }
+
     /* return the string table entry */
     return str;
 }
 
+/* HashString - compute the hash of a string constant */
+static unsigned int HashString(const char *value)
+{
+    unsigned int hash = 2166136261u;
+    while (*value)
+        hash = (hash ^ (uint8_t)*value++) * 16777619u;
+    return hash;
+}
+
 /* AddStringRef - add a reference to a string in the string table */
 VMUVALUE AddStringRef(ParseContext *c, String *str)
 {
@@ -303,6 +704,119 @@ VMUVALUE AddStringRef(ParseContext *c, String *str)
     return c->textTarget->base + str->offset;
 }
 
+/* AddGlobalData - add a global to be placed when an image is built */
+void AddGlobalData(ParseContext *c, Symbol *symbol, const char *sectionName, const uint8_t *data, VMUVALUE size)
+{
+    GlobalData *global = (GlobalData *)GlobalAlloc(c, sizeof(GlobalData) + size + strlen(sectionName));
+    VMUVALUE i;
+    global->next = NULL;
+    global->symbol = symbol;
+    global->size = size;
+    memcpy(global->data, data, size);
+    for (i = 0; i < size && data[i] == 0; ++i)
+        ;
+    global->zero = (i == size);
+    global->sectionName = strcpy((char *)global->data + size, sectionName);
+    *c->pNextGlobalData = global;
+    c->pNextGlobalData = &global->next;
+}
+
+/* CheckSectionName - make sure all of the target boards have a section */
+void CheckSectionName(ParseContext *c, const char *name)
+{
+    BoardConfig *config;
+    for (config = c->boards; config != NULL; config = config->next) {
+        if (!GetSection(config, name)) {
+            if (c->boards->next)
+                ParseError(c, "no section '%s' on board '%s'", name, config->name);
+            else
+                ParseError(c, "no section '%s'", name);
+        }
+    }
+}
+
+/* PlaceGlobalData - place the globals the program uses in the sections of the selected board */
+static void PlaceGlobalData(ParseContext *c)
+{
+    VMUVALUE unusedSize = 0;
+    int unusedCount = 0;
+    GlobalData *global;
+    for (global = c->globalData; global != NULL; global = global->next) {
+        Symbol *sym = global->symbol;
+        Section *section;
+        
+        /* leave out the globals that the main code doesn't reach (a library module keeps all of them) */
+        if (!sym->reachable && !c->moduleOut) {
+            sym->section = NULL;
+            sym->v.variable.offset = UNDEF_VALUE;
+            sym->v.variable.fixups = 0;
+            unusedSize += ROUND_TO_WORDS(global->size);
+            ++unusedCount;
+            continue;
+        }
+        
+        if (strcasecmp(global->sectionName, "text") == 0)
+            section = c->textTarget;
+        else if (strcasecmp(global->sectionName, "data") == 0)
+            section = c->dataTarget;
+        else
+            section = GetSection(c->config, global->sectionName);
+        sym->section = section;
+        sym->v.variable.fixups = 0;
+        
+        /* globals that start out zero are placed after the code (flash can't be cleared when the program is loaded) */
+        if (global->zero && (section->base >> WINDOW_SHIFT) != (FLASH_BASE >> WINDOW_SHIFT))
+            sym->v.variable.offset = UNDEF_VALUE;
+        else {
+            sym->v.variable.offset = section->offset;
+            section->offset += WriteSection(c, section, global->data, global->size);
+        }
+    }
+    
+    if ((c->flags & COMPILER_INFO) && unusedCount > 0)
+        xbInfo(c->sys, "%d unused globals left out (%u bytes)\n", unusedCount, unusedSize);
+}
+
+/* PlaceZeroData - place the globals that start out zero in the zero-filled data after the section contents */
+static void PlaceZeroData(ParseContext *c)
+{
+    GlobalData *global;
+    for (global = c->globalData; global != NULL; global = global->next) {
+        Symbol *sym = global->symbol;
+        if (sym->section && sym->v.variable.offset == UNDEF_VALUE) {
+            Section *section = sym->section;
+            sym->v.variable.offset = section->offset + section->zeroSize;
+            section->zeroSize += ROUND_TO_WORDS(global->size);
+        }
+    }
+}
+
+/* ClearAddresses - forget the function and string addresses of the last image built */
+static void ClearAddresses(ParseContext *c)
+{
+    Symbol *sym;
+    String *str;
+    
+    /* the functions are placed as their code is stored */
+    for (sym = c->globals.head; sym != NULL; sym = sym->next) {
+        if (sym->storageClass == SC_CONSTANT && sym->type->id == TYPE_FUNCTION) {
+            sym->section = NULL;
+            sym->v.variable.offset = UNDEF_VALUE;
+            sym->v.variable.fixups = 0;
+        }
+    }
+    
+    /* the strings are placed the first time they are referenced */
+    for (str = c->strings; str != NULL; str = str->next) {
+        str->placed = FALSE;
+        str->offset = 0;
+    }
+    
+    /* the line table is built as the code is generated */
+    c->mainCode = 0;
+    ClearDebugLines(c);
+}
+
 /* AddLocalSymbolFixup - add a symbol entry to the local fixup list */
 VMUVALUE AddLocalSymbolFixup(ParseContext *c, Symbol *symbol, VMUVALUE offset)
 {
@@ -364,7 +878,7 @@ static void UpdateReferences(ParseContext *c)
     for (sym = c->globals.head; sym != NULL; sym = sym->next) {
         VMUVALUE offset, next;
         if (sym->type->id != TYPE_STRING && (offset = sym->v.variable.fixups) != 0) {
-            VMUVALUE addr;
+            VMUVALUE addr = 0;
             switch (sym->storageClass) {
             case SC_CONSTANT: // function text offset
             case SC_GLOBAL:
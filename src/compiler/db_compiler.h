@@ -9,6 +9,7 @@
 
 #include <stdio.h>
 #include <setjmp.h>
+#include <time.h>
 #include "db_config.h"
 #include "db_image.h"
 #include "db_system.h"
@@ -19,7 +20,6 @@
 #endif
 
 /* program limits */
-#define MAXLINE             128
 #define MAXTOKEN            32
 #define DEFAULT_STACK_SIZE  (64 * sizeof(VMVALUE))
 
@@ -28,11 +28,18 @@ typedef struct Type Type;
 typedef struct SymbolTable SymbolTable;
 typedef struct Symbol Symbol;
 typedef struct IncludedFile IncludedFile;
+typedef struct SourceText SourceText;
+typedef struct CachedModule CachedModule;
 typedef struct Dependency Dependency;
 typedef struct String String;
 typedef struct ParseTreeNode ParseTreeNode;
 typedef struct NodeListEntry NodeListEntry;
 typedef struct CaseListEntry CaseListEntry;
+typedef struct DebugFile DebugFile;
+typedef struct DebugFunction DebugFunction;
+typedef struct DebugLine DebugLine;
+typedef struct GlobalData GlobalData;
+typedef struct Module Module;
 
 /* lexical tokens */
 enum {
@@ -124,6 +131,7 @@ typedef struct {
 
 struct String {
     String *next;
+    String *hashNext;
     int placed;
     VMUVALUE offset;
     uint8_t value[1];
@@ -139,6 +147,7 @@ typedef enum {
 typedef struct Label Label;
 struct Label {
     Label *next;
+    Label *hashNext;
     LabelState state;
     VMUVALUE offset;
     VMUVALUE fixups;
@@ -156,17 +165,25 @@ typedef enum {
 
 #define UNDEF_VALUE 0xffffffff
 
-/* symbol table */
+/* symbol table (the list keeps the symbols in the order they were defined) */
 struct SymbolTable {
     Symbol *head;
     Symbol **pTail;
     int count;
+    Symbol **buckets;       /* hash buckets (NULL until the table gets big enough to need them) */
+    int bucketCount;        /* number of hash buckets (a power of two) */
 };
 
+/* number of label hash buckets (a power of two) */
+#define LABEL_BUCKETS   64
+
 /* symbol structure */
 struct Symbol {
     Symbol *prev;
     Symbol *next;
+    Symbol *hashNext;
+    int dependencyMark;     /* number of the last function that added a dependency on this symbol */
+    int reachable;          /* symbol is reachable from the main code */
     StorageClass storageClass;
     Section *section;
     Type *type;
@@ -217,6 +234,23 @@ struct LocalFixup {
     VMUVALUE chain;
 };
 
+/* address of a function, global or string in the code of the current function (for library modules) */
+typedef struct Relocation Relocation;
+struct Relocation {
+    Relocation *next;           /* next relocation in the order the code was generated */
+    VMUVALUE offset;            /* offset of the address in the code */
+    Symbol *symbol;             /* function or global (or NULL) */
+    String *string;             /* string constant (or NULL) */
+};
+
+/* code of a library module function with the addresses stored as relocations (see db_module.c) */
+typedef struct {
+    VMUVALUE codeSize;          /* size of the code */
+    VMUVALUE relocCount;        /* number of relocations */
+    VMUVALUE dataSize;          /* size of the code and relocations */
+    const uint8_t *data;        /* code followed by the relocations */
+} ModuleCode;
+
 /* main code state */
 typedef enum {
     MAIN_NOT_DEFINED,
@@ -224,57 +258,144 @@ typedef enum {
     MAIN_DEFINED
 } MainState;
 
-typedef void RewindFcn(void *cookie);
-typedef int GetLineFcn(void *cookie, char *buf, int len);
-#define GET_NULL ((GetLineFcn *)0)
-
-/* main file */
-typedef struct {
-    RewindFcn *rewind;          /* function to rewind to the start of the source program */
-    GetLineFcn *getLine;        /* function to get a line from the source program */
-    void *getLineCookie;        /* cookie for the rewind and getLine functions */
-} MainFile;
-
-/* current include file */
-typedef struct {
-    IncludedFile *file;
-    void *fp;
-} CurrentIncludeFile;
-
 /* parse file */
 typedef struct ParseFile ParseFile;
 struct ParseFile {
     ParseFile *next;            /* next file in stack */
-    union {
-        CurrentIncludeFile file;
-        MainFile main;
-    } u;
+    const char *name;           /* file name */
+    SourceText *source;         /* text of the file */
+    char *ptr;                  /* start of the next line */
     int lineNumber;             /* current line number */
 };
 
+/* line left by the first pass for the second pass */
+typedef struct {
+    SourceText *source;         /* text of the file containing the line */
+    char *text;                 /* start of the line (in the source text) */
+    int lineNumber;             /* line number */
+    int inComment;              /* the line starts inside of a slash/star comment */
+} SourceLine;
+
 /* included file */
 struct IncludedFile {
     IncludedFile *next;         /* next included file */
     char name[1];               /* file name */
 };
 
+/* text of a source file (read once and shared by both passes) */
+struct SourceText {
+    SourceText *next;           /* next file */
+    char *text;                 /* file contents (always ending with a newline) */
+    size_t size;                /* size of the file contents */
+    int lineCount;              /* number of lines */
+    clock_t scanTime;           /* time spent with this file as the current input (COMPILER_INFO only) */
+    int shared;                 /* the text belongs to a source cache */
+    time_t modTime;             /* modification time of the file (source cache entries only) */
+    long modTimeNsec;           /* nanoseconds part of the modification time (source cache entries only) */
+    long fileSize;              /* size of the file (source cache entries only) */
+    char name[1];               /* file name as given on the command line or in the INCLUDE statement */
+};
+
+/* library module built for an include file kept in a source cache (see db_module.c) */
+struct CachedModule {
+    CachedModule *next;         /* next module */
+    uint8_t *data;              /* module contents (NULL if the file can't be compiled by itself) */
+    size_t size;                /* size of the module contents */
+    int pending;                /* the module is to be built after the compile in progress */
+    int misses;                 /* source cache misses when the module couldn't be built */
+    char path[1];               /* path where the include file was found */
+};
+
+/* include files kept between compiles (keyed by path, modification time and size) */
+struct SourceCache {
+    SourceText *texts;          /* cached files (the names are the paths where they were found) */
+    CachedModule *modules;      /* library modules built for the included files */
+    int hits;                   /* number of times a cached file was used */
+    int misses;                 /* number of times a file had to be read */
+    int moduleHits;             /* number of times a cached module was used */
+};
+
 /* dependency */
 struct Dependency {
     Symbol *symbol;
     Dependency *next;
 };
 
-/* parse context */
+/* global variable or array waiting to be placed (where it goes depends on the board) */
+struct GlobalData {
+    GlobalData *next;           /* next global in the order they were defined */
+    Symbol *symbol;             /* symbol that gets the address */
+    const char *sectionName;    /* "text", "data" or the name of a board section */
+    VMUVALUE size;              /* size of the initial value */
+    int zero;                   /* initial value is all zeros (it isn't stored in the image) */
+    uint8_t data[1];            /* initial value */
+};
+
+/* source file in the debug section */
+struct DebugFile {
+    DebugFile *next;            /* next source file */
+    int index;                  /* index in the debug section file table */
+    char name[1];               /* file name */
+};
+
+/* function in the debug section */
+struct DebugFunction {
+    DebugFunction *next;        /* next function */
+    VMUVALUE base;              /* address of the function code */
+    VMUVALUE size;              /* size of the function code */
+    char name[1];               /* function name */
+};
+
+/* line table entry in the debug section */
+struct DebugLine {
+    DebugLine *next;            /* next line table entry */
+    VMUVALUE addr;              /* code offset while generating, address once the code is stored */
+    DebugFile *file;            /* source file */
+    int lineNumber;             /* source line number */
+};
+
+/* compiler phases (timed with COMPILER_STATS) */
+typedef enum {
+    PHASE_PASS1,                /* scan and parse the first pass */
+    PHASE_PASS2,                /* scan and parse the second pass */
+    PHASE_DEPENDENCIES,         /* find the functions reachable from the main code */
+    PHASE_GENERATE,             /* generate code from a parse tree */
+    PHASE_STORE,                /* apply fixups and store the code of a function */
+    PHASE_REFERENCES,           /* update global symbol references */
+    PHASE_IMAGE,                /* build the image */
+    PHASE_COUNT
+} Phase;
+
+/* phase statistics */
 typedef struct {
+    int count;                  /* number of times the phase was run */
+    double time;                /* total wall time in seconds */
+    size_t allocated;           /* total heap space allocated */
+} PhaseStats;
+
+/* parse context (the ParseContext typedef is in xb_api.h) */
+struct ParseContext {
     jmp_buf errorTarget;            /* error target */
     System *sys;                    /* system interface */
-    BoardConfig *config;            /* board configuration */
+    BoardConfig *boards;            /* private copies of the target board configurations */
+    BoardConfig *config;            /* board configuration of the image being built */
     int flags;                      /* compiler flags */
     ParseFile mainFile;             /* scan - main input file */
     ParseFile *currentFile;         /* scan - current input file */
     IncludedFile *includedFiles;    /* scan - list of files that have already been included */
-    IncludedFile *currentInclude;   /* scan - file currently being included */
-    char lineBuf[MAXLINE];          /* scan - line buffer */
+    SourceText *sourceTexts;        /* scan - include files that have been read */
+    SourceLine *lines;              /* scan - lines of the statements left for the second pass */
+    int lineCount;                  /* scan - number of lines left for the second pass */
+    int lineMax;                    /* scan - number of lines there is room for */
+    int nextLine;                   /* scan - next line for the second pass */
+    ParseFile replayFile;           /* scan - include file of the line the second pass is on */
+    int statementDone;              /* scan - the first pass has handled the current statement */
+    SourceCache *sourceCache;       /* scan - include files kept between compiles (or NULL) */
+    Module *modules;                /* scan - library modules used in place of include files */
+    Module *moduleOut;              /* scan - library module being compiled (or NULL) */
+    char *lineBuf;                  /* scan - start of the current line (in the source text) */
+    char *lineEnd;                  /* scan - end of the current line (after the newline) */
+    clock_t scanStart;              /* scan - time the current file became the current input */
     char *linePtr;                  /* scan - pointer to the current character */
     int savedToken;                 /* scan - lookahead token */
     int tokenOffset;                /* scan - offset to the start of the current token */
@@ -290,6 +411,13 @@ typedef struct {
     Type bytePointerType;           /* parse - byte pointer type */
     SymbolTable globals;            /* parse - global variables and constants */
     String *strings;                /* parse - string constants */
+    String **stringBuckets;         /* parse - string constant hash buckets */
+    int stringBucketCount;          /* parse - number of string constant hash buckets */
+    int stringCount;                /* parse - number of string constants */
+    GlobalData *globalData;         /* parse - global variables and arrays in the order they were defined */
+    GlobalData **pNextGlobalData;   /* parse - place to store the next global */
+    Label *labelBuckets[LABEL_BUCKETS]; /* parse - label hash buckets for the current function */
+    int functionNumber;             /* parse - number of the function currently being compiled */
     Type *functionType;             /* parse - in a function definition */
     ParseTreeNode *function;        /* parse - function currently being compiled */
     Dependency *dependencies;       /* parse - dependencies for the function currently being compiled */
@@ -297,6 +425,8 @@ typedef struct {
     MainState mainState;            /* parse - state of main code processing */
     VMUVALUE mainCode;              /* parse - main code offset into text space */
     Dependency *mainDependencies;   /* parse - main code dependencies */
+    NodeListEntry *functions;       /* parse - parse trees of the main code and functions in source order */
+    NodeListEntry **pNextFunction;  /* parse - place to store the next parse tree */
     LocalFixup *symbolFixups;       /* parse - list of symbol fixups for the current code or data structure */
     Block blockBuf[10];             /* parse - stack of nested blocks */
     Block *bptr;                    /* parse - current block */
@@ -311,7 +441,28 @@ typedef struct {
     uint8_t *cptr;                  /* generate - next available code staging buffer position */
     uint8_t *ctop;                  /* generate - top of code staging buffer */
     uint8_t *codeBuf;               /* generate - code staging buffer */
-} ParseContext;
+    Relocation *relocations;        /* generate - addresses in the code of the current function */
+    Relocation **pNextRelocation;   /* generate - place to store the next relocation (NULL unless compiling a library module) */
+    uint8_t *imageBuffer;           /* image - caller supplied buffer for the image (or NULL) */
+    size_t imageBufferSize;         /* image - size of the caller supplied buffer */
+    uint8_t *image;                 /* image - the finished image */
+    size_t imageSize;               /* image - size of the finished image */
+    DebugFile *debugFiles;          /* debug - source files */
+    int debugFileCount;             /* debug - number of source files */
+    DebugFunction *debugFunctions;  /* debug - functions in address order */
+    DebugFunction **pNextDebugFunction; /* debug - place to store the next function */
+    int debugFunctionCount;         /* debug - number of functions */
+    DebugLine *debugLines;          /* debug - line table in address order */
+    DebugLine **pNextDebugLine;     /* debug - place to store the next line table entry */
+    DebugLine *lastDebugLine;       /* debug - last line table entry */
+    int debugLineCount;             /* debug - number of line table entries */
+    PhaseStats phaseStats[PHASE_COUNT]; /* stats - time and heap space used by each phase */
+    Phase phase;                    /* stats - phase in progress */
+    double phaseStart;              /* stats - time the phase in progress started */
+    size_t phaseAllocated;          /* stats - total heap allocation when the phase started */
+    double compileStart;            /* stats - time the compile started */
+    size_t compileAllocated;        /* stats - total heap allocation when the compile started */
+};
 
 /* partial value */
 typedef struct PVAL PVAL;
@@ -375,6 +526,8 @@ typedef enum {
 struct ParseTreeNode {
     NodeType nodeType;
     Type *type;
+    DebugFile *file;
+    int lineNumber;
     union {
         struct {
             Symbol *symbol;
@@ -382,6 +535,7 @@ struct ParseTreeNode {
             Label *labels;
             int localOffset;
             NodeListEntry *bodyStatements;
+            ModuleCode *moduleCode;     /* code from a library module (there is no body) */
         } functionDefinition;
         struct {
             ParseTreeNode *lvalue;
@@ -493,12 +647,21 @@ uint8_t *HeapAlloc(size_t size);
 
 /* db_compiler.c */
 ParseContext *InitCompiler(System *sys, BoardConfig *config, size_t codeBufSize);
-int Compile(ParseContext *c, const char *name);
+int AddBoard(ParseContext *c, BoardConfig *config);
+int Compile(ParseContext *c);
+int ParseProgram(ParseContext *c);
+int GenerateImage(ParseContext *c, BoardConfig *config);
+int GenerateModule(ParseContext *c, const char *outfile);
+void EndCompile(ParseContext *c);
 void StoreCode(ParseContext *c);
+void StartPhase(ParseContext *c, Phase phase);
+void EndPhase(ParseContext *c, const char *name);
 void AddIntrinsic(ParseContext *c, char *name, char *argTypes, char *retType, int index);
 void AddRegister(ParseContext *c, char *name, VMUVALUE addr);
 String *AddString(ParseContext *c, char *value);
 VMUVALUE AddStringRef(ParseContext *c, String *str);
+void AddGlobalData(ParseContext *c, Symbol *symbol, const char *sectionName, const uint8_t *data, VMUVALUE size);
+void CheckSectionName(ParseContext *c, const char *name);
 VMUVALUE AddLocalSymbolFixup(ParseContext *c, Symbol *symbol, VMUVALUE offset);
 void Fatal(ParseContext *c, const char *fmt, ...);
 
@@ -519,9 +682,13 @@ int IsIntegerLit(ParseTreeNode *node);
 int IsStringLit(ParseTreeNode *node);
 
 /* db_scan.c */
-void RewindInput(ParseContext *c);
+int RewindInput(ParseContext *c);
 int PushFile(ParseContext *c, const char *name);
 void ClearIncludedFiles(ParseContext *c);
+void FreeSourceTexts(ParseContext *c);
+SourceCache *NewSourceCache(void);
+void FreeSourceCache(SourceCache *cache);
+void ShowScanStatistics(ParseContext *c);
 void CloseParseContext(ParseContext *c);
 int GetLine(ParseContext *c);
 void FRequire(ParseContext *c, int requiredToken);
@@ -552,6 +719,7 @@ Symbol *AddGlobalConstantString(ParseContext *c, const char *name, String *strin
 Symbol *AddFormalArgument(ParseContext *c, SymbolTable *table, const char *name, Type *type, VMUVALUE offset);
 Symbol *AddLocal(ParseContext *c, const char *name, Type *type, VMUVALUE value);
 Symbol *FindSymbol(SymbolTable *table, const char *name);
+unsigned int HashName(const char *name);
 int IsConstant(Symbol *symbol);
 void DumpSymbols(ParseContext *c, SymbolTable *table, char *tag);
 
@@ -567,6 +735,7 @@ void Generate(ParseContext *c, ParseTreeNode *expr);
 void code_expr(ParseContext *c, ParseTreeNode *expr, PVAL *pv);
 void code_global(ParseContext *c, PValOp fcn, PVAL *pv);
 void code_local(ParseContext *c, PValOp fcn, PVAL *pv);
+VMUVALUE code_globaladdr(ParseContext *c, Symbol *sym, VMUVALUE off);
 VMUVALUE codeaddr(ParseContext *c);
 VMUVALUE putcbyte(ParseContext *c, int b);
 VMUVALUE putcword(ParseContext *c, VMVALUE w);
@@ -576,9 +745,37 @@ int merge(ParseContext *c, VMUVALUE chn, VMUVALUE chn2);
 void fixup(ParseContext *c, VMUVALUE chn, VMUVALUE val);
 void fixupbranch(ParseContext *c, VMUVALUE chn, VMUVALUE val);
 
+/* db_module.c */
+void StartModule(ParseContext *c);
+void AddModuleSymbol(ParseContext *c, Symbol *symbol);
+void AddModuleInclude(ParseContext *c, const char *name);
+void MarkModuleFunctions(ParseContext *c);
+void AddRelocation(ParseContext *c, Symbol *symbol, String *string, VMUVALUE offset);
+void AddModuleCode(ParseContext *c, Symbol *symbol);
+int WriteModule(ParseContext *c, const char *path);
+int CacheModule(ParseContext *c);
+CachedModule *NextPendingModule(SourceCache *cache);
+void DropCachedModule(SourceCache *cache, CachedModule *entry);
+void FreeCachedModules(SourceCache *cache);
+int IncludeModule(ParseContext *c, const char *name);
+void AddModuleFile(ParseContext *c, const char *name);
+void LoadModuleCode(ParseContext *c, ModuleCode *code);
+
+/* db_debug.c */
+void InitDebugInfo(ParseContext *c);
+void ClearDebugLines(ParseContext *c);
+DebugFile *CurrentDebugFile(ParseContext *c);
+void AddDebugLine(ParseContext *c, ParseTreeNode *node, VMUVALUE offset);
+void AddDebugFunction(ParseContext *c, const char *name, VMUVALUE base, VMUVALUE size, DebugLine **pLines);
+VMUVALUE DebugSectionSize(ParseContext *c);
+void WriteDebugSection(ParseContext *c, uint8_t *p);
+
 /* db_wrimage.c */
-int StartImage(ParseContext *c, const char *name);
-int BuildImage(ParseContext *c, const char *name);
+int StartImage(ParseContext *c);
+int BuildImage(ParseContext *c);
+int WriteImage(ParseContext *c, const char *name);
+void FreeImage(ParseContext *c);
+void FreeSectionBuffers(ParseContext *c);
 VMUVALUE WriteSection(ParseContext *c, Section *section, const uint8_t *buf, VMUVALUE size);
 VMUVALUE ReadSectionOffset(ParseContext *c, Section *section, VMUVALUE offset);
 void WriteSectionOffset(ParseContext *c, Section *section, VMUVALUE offset, VMUVALUE value);
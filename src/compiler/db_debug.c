@@ -0,0 +1,198 @@
+/* db_debug.c - debug section functions
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <string.h>
+#include "db_compiler.h"
+
+/* InitDebugInfo - initialize the debug section tables */
+void InitDebugInfo(ParseContext *c)
+{
+    c->debugFiles = NULL;
+    c->debugFileCount = 0;
+    ClearDebugLines(c);
+}
+
+/* ClearDebugLines - clear the function and line tables before generating code for a board */
+void ClearDebugLines(ParseContext *c)
+{
+    c->debugFunctions = NULL;
+    c->pNextDebugFunction = &c->debugFunctions;
+    c->debugFunctionCount = 0;
+    c->debugLines = NULL;
+    c->pNextDebugLine = &c->debugLines;
+    c->lastDebugLine = NULL;
+    c->debugLineCount = 0;
+}
+
+/* CurrentDebugFile - get the debug section entry for the file currently being parsed */
+DebugFile *CurrentDebugFile(ParseContext *c)
+{
+    DebugFile *file, **pNext;
+    const char *name;
+
+    /* get the name of the current file */
+    if (!c->currentFile)
+        return NULL;
+    name = c->currentFile->name ? c->currentFile->name : "";
+
+    /* check to see if the file is already in the table */
+    for (pNext = &c->debugFiles; (file = *pNext) != NULL; pNext = &file->next)
+        if (strcmp(name, file->name) == 0)
+            return file;
+
+    /* add a new file at the end of the table */
+    file = (DebugFile *)GlobalAlloc(c, sizeof(DebugFile) + strlen(name));
+    strcpy(file->name, name);
+    file->index = c->debugFileCount++;
+    file->next = NULL;
+    *pNext = file;
+
+    /* return the new file */
+    return file;
+}
+
+/* AddDebugLine - add a line table entry for a statement starting at a code offset */
+void AddDebugLine(ParseContext *c, ParseTreeNode *node, VMUVALUE offset)
+{
+    DebugLine *line;
+
+    /* nothing to do if the statement has no line information */
+    if (!node->file)
+        return;
+
+    /* combine the entry with the previous one if possible */
+    if ((line = c->lastDebugLine) != NULL) {
+        if (line->file == node->file && line->lineNumber == node->lineNumber)
+            return;
+        if (line->addr == offset) {
+            line->file = node->file;
+            line->lineNumber = node->lineNumber;
+            return;
+        }
+    }
+
+    /* add a new entry */
+    line = (DebugLine *)GlobalAlloc(c, sizeof(DebugLine));
+    line->addr = offset;
+    line->file = node->file;
+    line->lineNumber = node->lineNumber;
+    line->next = NULL;
+    *c->pNextDebugLine = line;
+    c->pNextDebugLine = &line->next;
+    c->lastDebugLine = line;
+    ++c->debugLineCount;
+}
+
+/* AddDebugFunction - add a function and relocate the line table entries generated for it */
+void AddDebugFunction(ParseContext *c, const char *name, VMUVALUE base, VMUVALUE size, DebugLine **pLines)
+{
+    DebugFunction *function;
+    DebugLine *line;
+
+    /* relocate the line table entries and drop a trailing entry that generated no code */
+    for (; (line = *pLines) != NULL; pLines = &line->next) {
+        if (line->addr >= size) {
+            *pLines = NULL;
+            c->pNextDebugLine = pLines;
+            --c->debugLineCount;
+            break;
+        }
+        line->addr += base;
+    }
+    c->lastDebugLine = NULL;
+
+    /* add the function */
+    function = (DebugFunction *)GlobalAlloc(c, sizeof(DebugFunction) + strlen(name));
+    strcpy(function->name, name);
+    function->base = base;
+    function->size = size;
+    function->next = NULL;
+    *c->pNextDebugFunction = function;
+    c->pNextDebugFunction = &function->next;
+    ++c->debugFunctionCount;
+}
+
+/* DebugSectionSize - get the size of the debug section */
+VMUVALUE DebugSectionSize(ParseContext *c)
+{
+    DebugFunction *function;
+    DebugFile *file;
+    VMUVALUE size;
+
+    size = sizeof(ImageDebugHdr)
+         + c->debugFileCount * sizeof(VMUVALUE)
+         + c->debugFunctionCount * sizeof(ImageDebugFunction)
+         + c->debugLineCount * sizeof(ImageDebugLine);
+    for (file = c->debugFiles; file != NULL; file = file->next)
+        size += strlen(file->name) + 1;
+    for (function = c->debugFunctions; function != NULL; function = function->next)
+        size += strlen(function->name) + 1;
+    return size;
+}
+
+/* WriteDebugSection - write the debug section (DebugSectionSize bytes) */
+void WriteDebugSection(ParseContext *c, uint8_t *p)
+{
+    ImageDebugHdr hdr;
+    DebugFunction *function;
+    DebugFile *file;
+    DebugLine *line;
+    VMUVALUE offset;
+
+    /* write the header */
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.tag, IMAGE_DEBUG_TAG, sizeof(hdr.tag));
+    hdr.fileCount = c->debugFileCount;
+    hdr.functionCount = c->debugFunctionCount;
+    hdr.lineCount = c->debugLineCount;
+    for (file = c->debugFiles; file != NULL; file = file->next)
+        hdr.stringSize += strlen(file->name) + 1;
+    for (function = c->debugFunctions; function != NULL; function = function->next)
+        hdr.stringSize += strlen(function->name) + 1;
+    memcpy(p, &hdr, sizeof(hdr));
+    p += sizeof(hdr);
+
+    /* write the file table */
+    offset = 0;
+    for (file = c->debugFiles; file != NULL; file = file->next) {
+        memcpy(p, &offset, sizeof(offset));
+        p += sizeof(offset);
+        offset += strlen(file->name) + 1;
+    }
+
+    /* write the function table */
+    for (function = c->debugFunctions; function != NULL; function = function->next) {
+        ImageDebugFunction entry;
+        entry.name = offset;
+        entry.base = function->base;
+        entry.size = function->size;
+        memcpy(p, &entry, sizeof(entry));
+        p += sizeof(entry);
+        offset += strlen(function->name) + 1;
+    }
+
+    /* write the line table */
+    for (line = c->debugLines; line != NULL; line = line->next) {
+        ImageDebugLine entry;
+        entry.addr = line->addr;
+        entry.file = line->file->index;
+        entry.line = line->lineNumber;
+        memcpy(p, &entry, sizeof(entry));
+        p += sizeof(entry);
+    }
+
+    /* write the string table */
+    for (file = c->debugFiles; file != NULL; file = file->next) {
+        int size = strlen(file->name) + 1;
+        memcpy(p, file->name, size);
+        p += size;
+    }
+    for (function = c->debugFunctions; function != NULL; function = function->next) {
+        int size = strlen(function->name) + 1;
+        memcpy(p, function->name, size);
+        p += size;
+    }
+}
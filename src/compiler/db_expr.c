@@ -472,11 +472,12 @@ ParseTreeNode *GetSymbolRef(ParseContext *c, char *name)
             node->type = &c->integerType;
         else {
             VMVALUE value = 0;
-            symbol = AddGlobalSymbol(c, name, SC_GLOBAL, &c->integerType, c->dataTarget);
+            symbol = AddGlobalSymbol(c, name, SC_GLOBAL, &c->integerType, NULL);
             node->type = symbol->type;
             node->u.globalRef.symbol = symbol;
             AddDependency(c, symbol);
-            c->dataTarget->offset += WriteSection(c, c->dataTarget, (uint8_t *)&value, sizeof(VMVALUE));
+            AddGlobalData(c, symbol, "data", (uint8_t *)&value, sizeof(VMVALUE));
+            AddModuleSymbol(c, symbol);
         }
     }
 
@@ -599,6 +600,10 @@ ParseTreeNode *NewParseTreeNode(ParseContext *c, int type)
     ParseTreeNode *node = (ParseTreeNode *)xbLocalAlloc(c->sys, sizeof(ParseTreeNode));
     memset(node, 0, sizeof(ParseTreeNode));
     node->nodeType = type;
+    if ((c->flags & COMPILER_SYMBOLS) && c->pass == 2) {
+        node->file = CurrentDebugFile(c);
+        node->lineNumber = c->currentFile->lineNumber;
+    }
     return node;
 }
 
@@ -25,6 +25,7 @@ static void code_label_definition(ParseContext *c, ParseTreeNode *node);
 static void code_goto_statement(ParseContext *c, ParseTreeNode *node);
 static void code_asm_statement(ParseContext *c, ParseTreeNode *node);
 static void code_statement_list(ParseContext *c, NodeListEntry *entry);
+static void code_line(ParseContext *c, ParseTreeNode *node);
 static void code_shortcircuit(ParseContext *c, int op, ParseTreeNode *expr);
 static void code_addressof(ParseContext *c, ParseTreeNode *expr);
 static void code_call(ParseContext *c, ParseTreeNode *expr);
@@ -147,6 +148,8 @@ void code_expr(ParseContext *c, ParseTreeNode *expr, PVAL *pv)
         break;
     case NodeTypeStringLit:
         putcbyte(c, OP_LIT);
+        if (c->pNextRelocation)
+            AddRelocation(c, NULL, expr->u.stringLit.string, codeaddr(c));
         putcword(c, AddStringRef(c, expr->u.stringLit.string));
         pv->type = &c->bytePointerType;
         pv->fcn = GEN_NULL;
@@ -199,6 +202,7 @@ void code_expr(ParseContext *c, ParseTreeNode *expr, PVAL *pv)
 /* code_function_definition - generate code for a function definition */
 static void code_function_definition(ParseContext *c, ParseTreeNode *node)
 {
+    code_line(c, node);
     if (node->type) {
         putcbyte(c, OP_FRAME);
         putcbyte(c, F_SIZE + node->u.functionDefinition.localOffset);
@@ -348,6 +352,7 @@ static void code_for_statement(ParseContext *c, ParseTreeNode *node)
     upd = putcword(c, 0);
     nxt = codeaddr(c);
     code_statement_list(c, node->u.forStatement.bodyStatements);
+    code_line(c, node);
     (*pv.fcn)(c, PV_LOAD, &pv);
     if (node->u.forStatement.stepExpr)
         code_rvalue(c, node->u.forStatement.stepExpr);
@@ -374,6 +379,7 @@ static void code_do_while_statement(ParseContext *c, ParseTreeNode *node)
     nxt = codeaddr(c);
     code_statement_list(c, node->u.loopStatement.bodyStatements);
     fixupbranch(c, test, codeaddr(c));
+    code_line(c, node->u.loopStatement.test);
     code_rvalue(c, node->u.loopStatement.test);
     inst = putcbyte(c, OP_BRT);
     putcword(c, nxt - inst - 1 - sizeof(VMVALUE));
@@ -388,6 +394,7 @@ static void code_do_until_statement(ParseContext *c, ParseTreeNode *node)
     nxt = codeaddr(c);
     code_statement_list(c, node->u.loopStatement.bodyStatements);
     fixupbranch(c, test, codeaddr(c));
+    code_line(c, node->u.loopStatement.test);
     code_rvalue(c, node->u.loopStatement.test);
     inst = putcbyte(c, OP_BRF);
     putcword(c, nxt - inst - 1 - sizeof(VMVALUE));
@@ -409,6 +416,7 @@ static void code_loop_while_statement(ParseContext *c, ParseTreeNode *node)
     VMUVALUE nxt, inst;
     nxt = codeaddr(c);
     code_statement_list(c, node->u.loopStatement.bodyStatements);
+    code_line(c, node->u.loopStatement.test);
     code_rvalue(c, node->u.loopStatement.test);
     inst = putcbyte(c, OP_BRT);
     putcword(c, nxt - inst - 1 - sizeof(VMVALUE));
@@ -420,6 +428,7 @@ static void code_loop_until_statement(ParseContext *c, ParseTreeNode *node)
     VMUVALUE nxt, inst;
     nxt = codeaddr(c);
     code_statement_list(c, node->u.loopStatement.bodyStatements);
+    code_line(c, node->u.loopStatement.test);
     code_rvalue(c, node->u.loopStatement.test);
     inst = putcbyte(c, OP_BRF);
     putcword(c, nxt - inst - 1 - sizeof(VMVALUE));
@@ -477,11 +486,19 @@ static void code_statement_list(ParseContext *c, NodeListEntry *entry)
 {
     while (entry) {
         PVAL pv;
+        code_line(c, entry->node);
         code_expr(c, entry->node, &pv);
         entry = entry->next;
     }
 }
 
+/* code_line - add a line table entry for the code generated for a node */
+static void code_line(ParseContext *c, ParseTreeNode *node)
+{
+    if (c->flags & COMPILER_SYMBOLS)
+        AddDebugLine(c, node, codeaddr(c));
+}
+
 /* code_shortcircuit - generate code for a conjunction or disjunction of boolean expressions */
 static void code_shortcircuit(ParseContext *c, int op, ParseTreeNode *expr)
 {
@@ -535,25 +552,35 @@ static void code_addressof(ParseContext *c, ParseTreeNode *expr)
 /* code_globalref - code a global reference */
 static void code_globalref(ParseContext *c, Symbol *sym)
 {
-    VMUVALUE offset = sym->v.variable.offset;
     putcbyte(c, OP_LIT);
+    if (c->pNextRelocation && (sym->storageClass == SC_CONSTANT || sym->storageClass == SC_GLOBAL))
+        AddRelocation(c, sym, NULL, codeaddr(c));
+    putcword(c, code_globaladdr(c, sym, codeaddr(c)));
+}
+
+/* code_globaladdr - get the address of a global for the code word at an offset (or link it into the fixup chain) */
+VMUVALUE code_globaladdr(ParseContext *c, Symbol *sym, VMUVALUE off)
+{
+    VMUVALUE offset = sym->v.variable.offset;
+    VMUVALUE addr = 0;
     if (offset == UNDEF_VALUE)
-        putcword(c, AddLocalSymbolFixup(c, sym, codeaddr(c)));
+        addr = AddLocalSymbolFixup(c, sym, off);
     else {
         switch (sym->storageClass) {
         case SC_CONSTANT: // function text offset
         case SC_GLOBAL:
-            putcword(c, sym->section ? sym->section->base + offset : offset);
+            addr = sym->section ? sym->section->base + offset : offset;
             break;
         case SC_COG:
         case SC_HUB:
-            putcword(c, offset);
+            addr = offset;
             break;
         default:
             ParseError(c, "unexpected storage class");
             break;
         }
     }
+    return addr;
 }
 
 /* code_arrayref - code an array reference */
@@ -0,0 +1,32 @@
+/* db_keywords.h - keyword hash table for db_scan.c
+ *
+ * Generated by kwhash from the keyword table in db_scan.c.  Don't edit it,
+ * it is rebuilt by the makefile whenever the keywords change.
+ *
+ */
+
+#ifndef __DB_KEYWORDS_H__
+#define __DB_KEYWORDS_H__
+
+/* keyword hash table size (a power of two) */
+#define KEYWORD_SLOTS   128
+
+/* KeywordHash - add a character to a keyword hash (case insensitive for letters) */
+#define KeywordHash(hash, ch)   ((hash) * 5 + ((ch) | 0x20))
+
+/* KeywordSlot - map a keyword hash onto a slot in keywordSlots */
+#define KeywordSlot(hash)       (((hash) >> 2) & (KEYWORD_SLOTS - 1))
+
+/* ktab index plus one of the keyword in each slot (zero for an empty slot) */
+static const uint8_t keywordSlots[KEYWORD_SLOTS] = {
+    25,  0,  0,  0, 20, 29,  0,  0,  4, 33,  0, 22,  0,  0,  0,  5,
+     0,  0,  0,  0,  0, 27,  6, 18, 19, 14,  0,  0,  9, 13,  7,  0,
+    11,  0,  0,  0, 15,  0,  0, 26,  0,  0,  0,  0, 16,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 30,  0,  0,  0,  8,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 21,  0, 10, 24,  0,  0,
+     0,  0,  0,  0,  0,  0,  0, 28, 12,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  1,  0,  0,  0,  0,  0,  0,  0,  0,  2,  0,  0,  0, 31,
+     0,  0,  0,  0,  0, 23,  0,  0,  0, 17,  3,  0,  0, 32,  0,  0
+};
+
+#endif
@@ -0,0 +1,1019 @@
+/* db_module.c - separately compiled library modules
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ * A library module (.bao) is an include file compiled by itself with
+ * "xbcom -c".  It holds the definitions of the include file in source order
+ * along with the code of each of its functions.  The addresses of
+ * functions, globals and string constants in the code are stored as
+ * relocations by name so the code can be placed anywhere in an image.
+ *
+ * When an INCLUDE statement names a file that has an up to date module
+ * next to it the definitions are taken from the module instead of parsing
+ * the source.  The module's functions take part in finding the functions
+ * reachable from the main code like any other function and only the ones
+ * that are reachable are linked into the image.  A module is up to date if
+ * the source file and every file it includes have the same size and
+ * modification time (to the nanosecond where the file system keeps it) as
+ * when the module was compiled.  Modules aren't used
+ * with -D or -g since their code has no parse trees or line numbers.
+ *
+ * A compile server keeps modules in its source cache instead of next to
+ * the source.  An include file that has to be parsed by a compile is noted
+ * and the server builds a module for it after the compile so later compiles
+ * get its definitions already checked.  Files that can't be compiled by
+ * themselves or that use globals they don't declare (which might be
+ * defined by the file that includes them) are parsed every time.
+ *
+ * Words are little endian and names and strings are zero terminated:
+ *
+ *   "XBO2"         tag
+ *   file count     word
+ *   files          size word, modification time (two words), nanoseconds word, name
+ *   item count     word
+ *   items          kind byte followed by the item
+ *
+ * The first file is the module source and the others are the files it
+ * includes (found using the include path).  The items are:
+ *
+ *   'C'  name, value word                                  integer constant
+ *   'T'  name, value                                       string constant
+ *   'G'  name, type byte, section name, size word, data    global variable or array
+ *   'F'  name, argument count word, arguments (type byte, name),
+ *        dependency count word, dependencies (names),
+ *        code size word, relocation count word, data size word,
+ *        code and relocations                              function
+ *   'I'  name                                              include statement
+ *   'U'  name                                              undeclared global
+ *
+ * The addresses in a function's code are zero.  Each relocation is the
+ * offset of an address in the code (word), 'F' for a function or global or
+ * 'S' for a string constant (byte) and the name or string.  The addresses
+ * are filled in when the code is linked in the order they were generated.
+ *
+ * Undeclared globals are made on the second pass when they are first used
+ * so they are after the other items and are defined at the start of the
+ * second pass over the module (before the functions that use them).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "db_compiler.h"
+
+/* library module file tag (change it when the generated code or the format changes) */
+#define MODULE_TAG          "XBO2"
+
+/* module item kinds */
+#define ITEM_CONSTANT       'C'
+#define ITEM_STRING         'T'
+#define ITEM_GLOBAL         'G'
+#define ITEM_FUNCTION       'F'
+#define ITEM_INCLUDE        'I'
+#define ITEM_UNDECLARED     'U'
+
+/* relocation kinds */
+#define RELOC_SYMBOL        'F'
+#define RELOC_STRING        'S'
+
+/* file the module was compiled from */
+typedef struct ModuleFile ModuleFile;
+struct ModuleFile {
+    ModuleFile *next;           /* next file */
+    time_t modTime;             /* modification time */
+    long modTimeNsec;           /* nanoseconds part of the modification time */
+    long fileSize;              /* size */
+    char name[1];               /* name as given in the INCLUDE statement */
+};
+
+/* definition in a library module */
+typedef struct ModuleItem ModuleItem;
+struct ModuleItem {
+    ModuleItem *next;           /* next item in source order */
+    int kind;                   /* item kind */
+    const char *name;           /* name of the symbol or include file */
+    Symbol *symbol;             /* symbol defined by the item */
+    union {
+        VMVALUE value;          /* integer constant */
+        const char *string;     /* string constant */
+        struct {
+            int type;           /* type byte */
+            const char *section;/* section name */
+            VMUVALUE size;      /* size of the initial value */
+            const uint8_t *data;/* initial value */
+        } global;
+        struct {
+            VMUVALUE argc;      /* number of arguments */
+            const uint8_t *args;/* arguments */
+            VMUVALUE depCount;  /* number of dependencies */
+            const uint8_t *deps;/* names of the dependencies */
+            ModuleCode code;    /* code and relocations */
+        } function;
+    } u;
+};
+
+/* library module */
+struct Module {
+    Module *next;               /* next module used by the compile */
+    ModuleFile *files;          /* files the module was compiled from */
+    ModuleFile **pNextFile;     /* place to store the next file */
+    ModuleItem *items;          /* definitions in source order */
+    ModuleItem **pNextItem;     /* place to store the next item */
+    char name[1];               /* name as given in the INCLUDE statement (or the source file) */
+};
+
+/* module file being read */
+typedef struct {
+    const uint8_t *p;           /* next byte */
+    const uint8_t *end;         /* end of the file */
+    int ok;                     /* FALSE once a read runs past the end */
+} Reader;
+
+static Module *NewModule(ParseContext *c, const char *name);
+static Module *ReadModule(ParseContext *c, const char *name);
+static Module *LoadModule(ParseContext *c, const char *name, const char *path, const uint8_t *buf, long size);
+static void NoteCachedModule(ParseContext *c, const char *name);
+static uint8_t *PackCode(ParseContext *c, VMUVALUE *pRelocCount, VMUVALUE *pDataSize);
+static int LinkCode(ParseContext *c, const uint8_t *data, VMUVALUE codeSize, VMUVALUE relocCount, VMUVALUE dataSize);
+static CachedModule *FindCachedModule(SourceCache *cache, const char *path);
+static int WriteModuleFile(ParseContext *c, FILE *fp);
+static int ReadItems(ParseContext *c, Module *module, Reader *r);
+static void DefineItem(ParseContext *c, Module *module, ModuleItem *item);
+static void DefineFunction(ParseContext *c, Module *module, ModuleItem *item);
+static ModuleItem *AddItem(ParseContext *c, Module *module, int kind, const char *name, Symbol *symbol);
+static void AddFile(ParseContext *c, Module *module, const char *name, const char *path);
+static int CheckFile(ParseContext *c, const char *path, ModuleFile *file);
+static int TypeCode(ParseContext *c, Type *type);
+static Type *CodeType(ParseContext *c, int code);
+static int ReadByte(Reader *r);
+static VMUVALUE ReadWord(Reader *r);
+static const char *ReadName(Reader *r);
+static const uint8_t *ReadBytes(Reader *r, VMUVALUE size);
+static void WriteWord(FILE *fp, VMUVALUE value);
+static void WriteName(FILE *fp, const char *name);
+static void PutWord(uint8_t *p, VMUVALUE value);
+static VMUVALUE GetWord(const uint8_t *p);
+
+/* StartModule - start compiling a library module */
+void StartModule(ParseContext *c)
+{
+    /* the module source is the first file the module depends on */
+    c->moduleOut = NewModule(c, c->mainFile.name);
+    AddFile(c, c->moduleOut, c->mainFile.name, c->mainFile.name);
+}
+
+/* AddModuleSymbol - add a constant, global or function defined in the source of a library module */
+void AddModuleSymbol(ParseContext *c, Symbol *symbol)
+{
+    int kind;
+
+    /* only the definitions in the module source go in the module (the included files have their own) */
+    if (!c->moduleOut || c->currentFile != &c->mainFile)
+        return;
+
+    /* determine the kind of definition (only undeclared globals are made on the second pass) */
+    if (c->pass > 1)
+        kind = ITEM_UNDECLARED;
+    else if (symbol->type->id == TYPE_FUNCTION)
+        kind = ITEM_FUNCTION;
+    else if (symbol->type->id == TYPE_STRING)
+        kind = ITEM_STRING;
+    else if (symbol->storageClass == SC_GLOBAL || symbol->type->id == TYPE_ARRAY)
+        kind = ITEM_GLOBAL;
+    else
+        kind = ITEM_CONSTANT;
+
+    AddItem(c, c->moduleOut, kind, symbol->name, symbol);
+}
+
+/* AddModuleInclude - add an include statement in the source of a library module */
+void AddModuleInclude(ParseContext *c, const char *name)
+{
+    if (c->moduleOut && c->pass == 1 && c->currentFile == &c->mainFile) {
+        char *copy = (char *)GlobalAlloc(c, strlen(name) + 1);
+        AddItem(c, c->moduleOut, ITEM_INCLUDE, strcpy(copy, name), NULL);
+    }
+}
+
+/* MarkModuleFunctions - mark the functions defined in a library module so code is generated for them */
+void MarkModuleFunctions(ParseContext *c)
+{
+    ModuleItem *item;
+    for (item = c->moduleOut->items; item != NULL; item = item->next)
+        if (item->kind == ITEM_FUNCTION)
+            item->symbol->reachable = TRUE;
+}
+
+/* AddRelocation - add the address of a symbol or string at an offset in the code of a library module function */
+void AddRelocation(ParseContext *c, Symbol *symbol, String *string, VMUVALUE offset)
+{
+    Relocation *reloc = (Relocation *)LocalAlloc(c, sizeof(Relocation));
+    reloc->next = NULL;
+    reloc->offset = offset;
+    reloc->symbol = symbol;
+    reloc->string = string;
+    *c->pNextRelocation = reloc;
+    c->pNextRelocation = &reloc->next;
+}
+
+/* AddModuleCode - keep the code just generated for a function of a library module */
+void AddModuleCode(ParseContext *c, Symbol *symbol)
+{
+    ModuleItem *item;
+    for (item = c->moduleOut->items; item != NULL; item = item->next) {
+        if (item->symbol == symbol) {
+            ModuleCode *code = &item->u.function.code;
+            code->codeSize = c->cptr - c->codeBuf;
+            code->data = PackCode(c, &code->relocCount, &code->dataSize);
+            break;
+        }
+    }
+}
+
+/* WriteModule - write the library module that was compiled */
+int WriteModule(ParseContext *c, const char *path)
+{
+    char temp[PATH_MAX + 8];
+    int ok;
+    FILE *fp;
+
+    /* write a new file and replace the old one with it */
+    sprintf(temp, "%s.tmp", path);
+    if (!(fp = fopen(temp, "wb"))) {
+        xbError(c->sys, "error: can't create '%s'\n", path);
+        return FALSE;
+    }
+    ok = WriteModuleFile(c, fp);
+    if (fclose(fp) != 0)
+        ok = FALSE;
+    if (ok && rename(temp, path) != 0) {
+        remove(path);
+        ok = rename(temp, path) == 0;
+    }
+    if (!ok) {
+        remove(temp);
+        xbError(c->sys, "error: can't write '%s'\n", path);
+    }
+    return ok;
+}
+
+/* CacheModule - keep the library module that was compiled in the source cache */
+int CacheModule(ParseContext *c)
+{
+    CachedModule *entry;
+    ModuleItem *item;
+    uint8_t *data;
+    long size;
+    FILE *fp;
+
+    /* the module replaces the one for the path where the server found the include file */
+    if (!c->sourceCache || !(entry = FindCachedModule(c->sourceCache, c->mainFile.name)))
+        return FALSE;
+
+    /* an undeclared global might be one the including file defines */
+    for (item = c->moduleOut->items; item != NULL; item = item->next)
+        if (item->kind == ITEM_UNDECLARED)
+            return FALSE;
+
+    /* write the module to a temporary file and read it back */
+    if (!(fp = tmpfile()))
+        return FALSE;
+    if (!WriteModuleFile(c, fp) || fflush(fp) != 0 || (size = ftell(fp)) < 4 || fseek(fp, 0, SEEK_SET) != 0
+    ||  !(data = (uint8_t *)malloc(size))) {
+        fclose(fp);
+        return FALSE;
+    }
+    if (fread(data, 1, size, fp) != (size_t)size) {
+        fclose(fp);
+        free(data);
+        return FALSE;
+    }
+    fclose(fp);
+
+    /* replace the old module */
+    free(entry->data);
+    entry->data = data;
+    entry->size = size;
+
+    return TRUE;
+}
+
+/* NextPendingModule - get the next include file noted by a compile that needs a module built */
+CachedModule *NextPendingModule(SourceCache *cache)
+{
+    CachedModule *entry;
+    for (entry = cache->modules; entry != NULL; entry = entry->next)
+        if (entry->pending) {
+            entry->pending = FALSE;
+            return entry;
+        }
+    return NULL;
+}
+
+/* DropCachedModule - remember that a module couldn't be built for an include file */
+void DropCachedModule(SourceCache *cache, CachedModule *entry)
+{
+    /* it is tried again once an include file changes */
+    free(entry->data);
+    entry->data = NULL;
+    entry->size = 0;
+    entry->misses = cache->misses;
+}
+
+/* FreeCachedModules - free the modules in a source cache */
+void FreeCachedModules(SourceCache *cache)
+{
+    CachedModule *entry, *next;
+    for (entry = cache->modules; entry != NULL; entry = next) {
+        next = entry->next;
+        free(entry->data);
+        free(entry);
+    }
+    cache->modules = NULL;
+}
+
+/* WriteModuleFile - write the library module that was compiled to an open file */
+static int WriteModuleFile(ParseContext *c, FILE *fp)
+{
+    Module *module = c->moduleOut;
+    GlobalData *global = c->globalData;
+    ModuleFile *file;
+    ModuleItem *item;
+    VMUVALUE count;
+
+    /* write the files the module was compiled from */
+    fwrite(MODULE_TAG, 1, 4, fp);
+    for (file = module->files, count = 0; file != NULL; file = file->next)
+        ++count;
+    WriteWord(fp, count);
+    for (file = module->files; file != NULL; file = file->next) {
+        WriteWord(fp, (VMUVALUE)file->fileSize);
+        WriteWord(fp, (VMUVALUE)file->modTime);
+        WriteWord(fp, (VMUVALUE)((uint64_t)file->modTime >> 32));
+        WriteWord(fp, (VMUVALUE)file->modTimeNsec);
+        WriteName(fp, file->name);
+    }
+
+    /* write the definitions */
+    for (item = module->items, count = 0; item != NULL; item = item->next)
+        ++count;
+    WriteWord(fp, count);
+    for (item = module->items; item != NULL; item = item->next) {
+        Symbol *sym = item->symbol;
+        putc(item->kind, fp);
+        WriteName(fp, item->name);
+        switch (item->kind) {
+        case ITEM_CONSTANT:
+            WriteWord(fp, sym->v.value);
+            break;
+        case ITEM_STRING:
+            WriteName(fp, (char *)sym->v.string->value);
+            break;
+        case ITEM_GLOBAL:
+            /* the globals are in the same order as the items */
+            while (global->symbol != sym)
+                global = global->next;
+            putc(TypeCode(c, sym->type), fp);
+            WriteName(fp, global->sectionName);
+            WriteWord(fp, global->size);
+            fwrite(global->data, 1, global->size, fp);
+            break;
+        case ITEM_FUNCTION:
+        {
+            SymbolTable *args = &sym->type->u.functionInfo.arguments;
+            ModuleCode *code = &item->u.function.code;
+            Dependency *d;
+            Symbol *arg;
+            WriteWord(fp, args->count);
+            for (arg = args->head; arg != NULL; arg = arg->next) {
+                putc(TypeCode(c, arg->type), fp);
+                WriteName(fp, arg->name);
+            }
+            for (d = sym->type->u.functionInfo.dependencies, count = 0; d != NULL; d = d->next)
+                ++count;
+            WriteWord(fp, count);
+            for (d = sym->type->u.functionInfo.dependencies; d != NULL; d = d->next)
+                WriteName(fp, d->symbol->name);
+            WriteWord(fp, code->codeSize);
+            WriteWord(fp, code->relocCount);
+            WriteWord(fp, code->dataSize);
+            fwrite(code->data, 1, code->dataSize, fp);
+            break;
+        }
+        case ITEM_INCLUDE:
+        case ITEM_UNDECLARED:
+            break;
+        }
+    }
+
+    return !ferror(fp);
+}
+
+/* IncludeModule - use the library module for an include file if there is an up to date one */
+int IncludeModule(ParseContext *c, const char *name)
+{
+    Module *module;
+    ModuleItem *item;
+
+    /* a library module being compiled depends on every file it includes */
+    AddModuleFile(c, name);
+
+    /* there are no parse trees or line numbers for the code in a module */
+    if (c->flags & (COMPILER_DEBUG | COMPILER_SYMBOLS))
+        return FALSE;
+
+    /* the first pass reads the module and the second pass uses the same one */
+    if (c->pass == 1) {
+        if (!(module = ReadModule(c, name))) {
+            if (c->sourceCache)
+                NoteCachedModule(c, name);
+            return FALSE;
+        }
+        module->next = c->modules;
+        c->modules = module;
+    }
+    else {
+        for (module = c->modules; module != NULL; module = module->next)
+            if (strcmp(name, module->name) == 0)
+                break;
+        if (!module)
+            return FALSE;
+    }
+
+    /* make the undeclared globals used by the functions on the second pass */
+    if (c->pass > 1) {
+        for (item = module->items; item != NULL; item = item->next) {
+            if (item->kind == ITEM_UNDECLARED) {
+                VMVALUE value = 0;
+                Symbol *sym = AddGlobalSymbol(c, item->name, SC_GLOBAL, &c->integerType, NULL);
+                AddGlobalData(c, sym, "data", (uint8_t *)&value, sizeof(VMVALUE));
+            }
+        }
+    }
+
+    /* make the definitions in source order */
+    for (item = module->items; item != NULL; item = item->next)
+        DefineItem(c, module, item);
+
+    return TRUE;
+}
+
+/* AddModuleFile - add an include or binary file to the files the library module being compiled depends on */
+void AddModuleFile(ParseContext *c, const char *name)
+{
+    if (c->moduleOut && c->pass == 1) {
+        char fullpath[PATH_MAX];
+        const char *path;
+        if ((path = xbFindFileInPath(c->sys, name, fullpath)) != NULL)
+            AddFile(c, c->moduleOut, name, path);
+    }
+}
+
+/* LoadModuleCode - put the code of a library module function in the code buffer and link it */
+void LoadModuleCode(ParseContext *c, ModuleCode *code)
+{
+    if (code->codeSize > (VMUVALUE)(c->ctop - c->codeBuf)
+    ||  !LinkCode(c, code->data, code->codeSize, code->relocCount, code->dataSize))
+        ParseError(c, "can't link '%s' from its library module", c->function->u.functionDefinition.symbol->name);
+}
+
+/* PackCode - copy the code just generated followed by its relocations (the addresses are filled in when it is linked) */
+static uint8_t *PackCode(ParseContext *c, VMUVALUE *pRelocCount, VMUVALUE *pDataSize)
+{
+    VMUVALUE codeSize = c->cptr - c->codeBuf;
+    VMUVALUE dataSize = codeSize;
+    Relocation *reloc;
+    VMUVALUE count;
+    uint8_t *data, *p;
+
+    /* determine the size of the code and relocations */
+    for (reloc = c->relocations, count = 0; reloc != NULL; reloc = reloc->next, ++count) {
+        const char *value = reloc->symbol ? reloc->symbol->name : (const char *)reloc->string->value;
+        dataSize += 5 + strlen(value) + 1;
+    }
+
+    /* copy the code without the addresses and add the relocations */
+    data = p = (uint8_t *)GlobalAlloc(c, dataSize);
+    memcpy(p, c->codeBuf, codeSize);
+    for (reloc = c->relocations; reloc != NULL; reloc = reloc->next)
+        memset(p + reloc->offset, 0, sizeof(VMVALUE));
+    p += codeSize;
+    for (reloc = c->relocations; reloc != NULL; reloc = reloc->next) {
+        const char *value = reloc->symbol ? reloc->symbol->name : (const char *)reloc->string->value;
+        PutWord(p, reloc->offset);
+        p[4] = reloc->symbol ? RELOC_SYMBOL : RELOC_STRING;
+        strcpy((char *)p + 5, value);
+        p += 5 + strlen(value) + 1;
+    }
+
+    *pRelocCount = count;
+    *pDataSize = dataSize;
+    return data;
+}
+
+/* LinkCode - put code with relocations in the code buffer and fill in the addresses (FALSE if it can't be linked) */
+static int LinkCode(ParseContext *c, const uint8_t *data, VMUVALUE codeSize, VMUVALUE relocCount, VMUVALUE dataSize)
+{
+    const uint8_t *p, *end;
+    Relocation *relocs;
+    VMUVALUE i;
+
+    /* find the symbols and strings before changing anything */
+    relocs = (Relocation *)LocalAlloc(c, (relocCount + 1) * sizeof(Relocation));
+    p = data + codeSize;
+    end = data + dataSize;
+    for (i = 0; i < relocCount; ++i) {
+        Relocation *reloc = &relocs[i];
+        const char *value;
+        size_t length;
+        int kind;
+        if (end - p < 6)
+            return FALSE;
+        reloc->offset = GetWord(p);
+        kind = p[4];
+        value = (const char *)p + 5;
+        if (p + 5 + (length = strnlen(value, end - p - 5)) >= end)
+            return FALSE;
+        p += 5 + length + 1;
+        if (reloc->offset + sizeof(VMVALUE) > codeSize)
+            return FALSE;
+        reloc->symbol = NULL;
+        reloc->string = NULL;
+        if (kind == RELOC_SYMBOL) {
+            if (!(reloc->symbol = FindSymbol(&c->globals, value)))
+                return FALSE;
+        }
+        else if (kind == RELOC_STRING)
+            reloc->string = AddString(c, (char *)value);
+        else
+            return FALSE;
+    }
+
+    /* copy the code and fill in the addresses in the order they were generated */
+    memcpy(c->codeBuf, data, codeSize);
+    c->cptr = c->codeBuf + codeSize;
+    for (i = 0; i < relocCount; ++i) {
+        Relocation *reloc = &relocs[i];
+        if (reloc->symbol)
+            wr_cword(c, reloc->offset, code_globaladdr(c, reloc->symbol, reloc->offset));
+        else
+            wr_cword(c, reloc->offset, AddStringRef(c, reloc->string));
+    }
+
+    return TRUE;
+}
+
+/* NewModule - make an empty module */
+static Module *NewModule(ParseContext *c, const char *name)
+{
+    Module *module = (Module *)GlobalAlloc(c, sizeof(Module) + strlen(name));
+    memset(module, 0, sizeof(Module));
+    module->pNextFile = &module->files;
+    module->pNextItem = &module->items;
+    strcpy(module->name, name);
+    return module;
+}
+
+/* ReadModule - read the library module for an include file if it is up to date */
+static Module *ReadModule(ParseContext *c, const char *name)
+{
+    char fullpath[PATH_MAX], modpath[PATH_MAX + 4], *p;
+    CachedModule *entry;
+    const char *path;
+    Module *module;
+    uint8_t *buf;
+    long size;
+    FILE *fp;
+
+    /* find the source file */
+    if (!(path = xbFindFileInPath(c->sys, name, fullpath)))
+        return NULL;
+
+    /* a compile server keeps the modules it built in its source cache */
+    if (c->sourceCache && (entry = FindCachedModule(c->sourceCache, path)) != NULL && entry->data) {
+        if ((module = LoadModule(c, name, path, entry->data, (long)entry->size)) != NULL) {
+            ++c->sourceCache->moduleHits;
+            if (c->flags & COMPILER_INFO)
+                xbInfo(c->sys, "using the cached library module for '%s'\n", path);
+            return module;
+        }
+    }
+
+    /* the module is next to the source file */
+    strcpy(modpath, path);
+    if ((p = strrchr(modpath, '.')) != NULL && !strchr(p, '/') && !strchr(p, '\\'))
+        *p = '\0';
+    strcat(modpath, ".bao");
+
+    /* read the whole file */
+    if (!(fp = fopen(modpath, "rb")))
+        return NULL;
+    if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 4 || fseek(fp, 0, SEEK_SET) != 0) {
+        fclose(fp);
+        return NULL;
+    }
+    buf = (uint8_t *)GlobalAlloc(c, size);
+    if (fread(buf, 1, size, fp) != (size_t)size) {
+        fclose(fp);
+        return NULL;
+    }
+    fclose(fp);
+
+    /* check the module and read its definitions */
+    if (!(module = LoadModule(c, name, path, buf, size)))
+        return NULL;
+
+    if (c->flags & COMPILER_INFO)
+        xbInfo(c->sys, "using library module '%s'\n", modpath);
+
+    return module;
+}
+
+/* LoadModule - read the definitions in a module if the files it was compiled from haven't changed */
+static Module *LoadModule(ParseContext *c, const char *name, const char *path, const uint8_t *buf, long size)
+{
+    char fullpath[PATH_MAX];
+    ModuleFile file;
+    VMUVALUE count, i;
+    Module *module;
+    Reader r;
+
+    /* check the tag */
+    if (size < 4 || memcmp(buf, MODULE_TAG, 4) != 0)
+        return NULL;
+    r.p = buf + 4;
+    r.end = buf + size;
+    r.ok = TRUE;
+
+    /* make sure the source and the files it includes haven't changed */
+    count = ReadWord(&r);
+    for (i = 0; i < count; ++i) {
+        const char *fileName;
+        file.fileSize = (long)ReadWord(&r);
+        file.modTime = (time_t)ReadWord(&r);
+        file.modTime |= (time_t)((uint64_t)ReadWord(&r) << 32);
+        file.modTimeNsec = (long)ReadWord(&r);
+        if (!(fileName = ReadName(&r)))
+            return NULL;
+        if (i > 0 && !(path = xbFindFileInPath(c->sys, fileName, fullpath)))
+            return NULL;
+        if (!CheckFile(c, path, &file))
+            return NULL;
+    }
+    if (!r.ok || count == 0)
+        return NULL;
+
+    /* read the definitions */
+    module = NewModule(c, name);
+    if (!ReadItems(c, module, &r))
+        return NULL;
+
+    return module;
+}
+
+/* NoteCachedModule - note an include file that a compile server should build a module for */
+static void NoteCachedModule(ParseContext *c, const char *name)
+{
+    SourceCache *cache = c->sourceCache;
+    char fullpath[PATH_MAX];
+    CachedModule *entry;
+    const char *path;
+
+    /* find the file the way it would be opened */
+    if (!(path = xbFindFileInPath(c->sys, name, fullpath)))
+        return;
+
+    /* a file that couldn't be compiled by itself is only tried again once an include file has changed */
+    if ((entry = FindCachedModule(cache, path)) != NULL) {
+        if (entry->data || entry->misses != cache->misses)
+            entry->pending = TRUE;
+        return;
+    }
+
+    /* add an entry for the file */
+    if (!(entry = (CachedModule *)malloc(sizeof(CachedModule) + strlen(path))))
+        return;
+    memset(entry, 0, sizeof(CachedModule));
+    strcpy(entry->path, path);
+    entry->pending = TRUE;
+    entry->next = cache->modules;
+    cache->modules = entry;
+}
+
+/* FindCachedModule - find the module for the path of an include file in a source cache */
+static CachedModule *FindCachedModule(SourceCache *cache, const char *path)
+{
+    CachedModule *entry;
+    for (entry = cache->modules; entry != NULL; entry = entry->next)
+        if (strcmp(path, entry->path) == 0)
+            return entry;
+    return NULL;
+}
+
+/* ReadItems - read the definitions in a module (FALSE if the module is damaged) */
+static int ReadItems(ParseContext *c, Module *module, Reader *r)
+{
+    VMUVALUE count, i, j;
+    ModuleItem *item;
+
+    count = ReadWord(r);
+    for (i = 0; r->ok && i < count; ++i) {
+        int kind = ReadByte(r);
+        const char *name = ReadName(r);
+        if (!name)
+            return FALSE;
+        item = AddItem(c, module, kind, name, NULL);
+        switch (kind) {
+        case ITEM_CONSTANT:
+            item->u.value = (VMVALUE)ReadWord(r);
+            break;
+        case ITEM_STRING:
+            item->u.string = ReadName(r);
+            break;
+        case ITEM_GLOBAL:
+            if (!CodeType(c, item->u.global.type = ReadByte(r)))
+                return FALSE;
+            item->u.global.section = ReadName(r);
+            item->u.global.size = ReadWord(r);
+            item->u.global.data = ReadBytes(r, item->u.global.size);
+            break;
+        case ITEM_FUNCTION:
+            item->u.function.argc = ReadWord(r);
+            item->u.function.args = r->p;
+            for (j = 0; r->ok && j < item->u.function.argc; ++j) {
+                if (!CodeType(c, ReadByte(r)))
+                    return FALSE;
+                ReadName(r);
+            }
+            item->u.function.depCount = ReadWord(r);
+            item->u.function.deps = r->p;
+            for (j = 0; r->ok && j < item->u.function.depCount; ++j)
+                ReadName(r);
+            item->u.function.code.codeSize = ReadWord(r);
+            item->u.function.code.relocCount = ReadWord(r);
+            item->u.function.code.dataSize = ReadWord(r);
+            item->u.function.code.data = ReadBytes(r, item->u.function.code.dataSize);
+            if (item->u.function.code.codeSize > item->u.function.code.dataSize)
+                return FALSE;
+            break;
+        case ITEM_INCLUDE:
+        case ITEM_UNDECLARED:
+            break;
+        default:
+            return FALSE;
+        }
+    }
+    return r->ok && i == count;
+}
+
+/* DefineItem - make a definition from a module (the same way the parser would for each pass) */
+static void DefineItem(ParseContext *c, Module *module, ModuleItem *item)
+{
+    switch (item->kind) {
+    case ITEM_CONSTANT:
+        if (c->pass == 1)
+            AddGlobalConstantInteger(c, item->name, item->u.value);
+        break;
+    case ITEM_STRING:
+        if (c->pass == 1)
+            AddGlobalConstantString(c, item->name, AddString(c, (char *)item->u.string));
+        break;
+    case ITEM_GLOBAL:
+        if (c->pass == 1) {
+            Type *type = CodeType(c, item->u.global.type);
+            const char *section = item->u.global.section;
+            Symbol *sym = AddGlobalSymbol(c, item->name, type->id == TYPE_ARRAY ? SC_CONSTANT : SC_GLOBAL, type, NULL);
+            if (strcasecmp(section, "text") != 0 && strcasecmp(section, "data") != 0)
+                CheckSectionName(c, section);
+            AddGlobalData(c, sym, section, item->u.global.data, item->u.global.size);
+        }
+        break;
+    case ITEM_FUNCTION:
+        DefineFunction(c, module, item);
+        break;
+    case ITEM_INCLUDE:
+        if (!PushFile(c, item->name))
+            ParseError(c, "include file not found: %s", item->name);
+        break;
+    case ITEM_UNDECLARED:
+        break;
+    }
+}
+
+/* DefineFunction - define a function from a module */
+static void DefineFunction(ParseContext *c, Module *module, ModuleItem *item)
+{
+    Reader r;
+    VMUVALUE i;
+
+    /* end the main function if it is in progress */
+    if (c->mainState == MAIN_IN_PROGRESS) {
+        EndFunction(c);
+        c->mainState = MAIN_DEFINED;
+    }
+
+    /* don't allow nested functions or subroutines */
+    if (c->functionType)
+        ParseError(c, "nested subroutines and functions are not supported");
+
+    /* enter the function in the global symbol table on pass 1 */
+    if (c->pass == 1) {
+        Type *type = NewGlobalType(c, TYPE_FUNCTION);
+        type->u.functionInfo.returnType = &c->integerType;
+        InitSymbolTable(&type->u.functionInfo.arguments);
+        item->symbol = AddGlobalSymbol(c, item->name, SC_CONSTANT, type, NULL);
+        r.p = item->u.function.args;
+        r.end = item->u.function.deps;
+        r.ok = TRUE;
+        for (i = 0; i < item->u.function.argc; ++i) {
+            Type *argType = CodeType(c, ReadByte(&r));
+            AddFormalArgument(c, &type->u.functionInfo.arguments, ReadName(&r), argType, i);
+        }
+    }
+
+    /* make a function node with the module code and find the dependencies on pass 2 */
+    else {
+        Dependency *dependencies = NULL, **pNext = &dependencies;
+        ParseTreeNode *node;
+        node = NewParseTreeNode(c, NodeTypeFunctionDefinition);
+        node->type = item->symbol->type;
+        node->u.functionDefinition.symbol = item->symbol;
+        InitSymbolTable(&node->u.functionDefinition.locals);
+        node->u.functionDefinition.labels = NULL;
+        node->u.functionDefinition.localOffset = 0;
+        node->u.functionDefinition.moduleCode = &item->u.function.code;
+        ++c->functionNumber;
+        r.p = item->u.function.deps;
+        r.end = item->u.function.code.data;
+        r.ok = TRUE;
+        for (i = 0; i < item->u.function.depCount; ++i) {
+            const char *name = ReadName(&r);
+            Dependency *d = (Dependency *)GlobalAlloc(c, sizeof(Dependency));
+            if (!(d->symbol = FindSymbol(&c->globals, name)))
+                ParseError(c, "'%s' in library module '%s' needs '%s'", item->name, module->name, name);
+            d->next = NULL;
+            *pNext = d;
+            pNext = &d->next;
+        }
+        item->symbol->type->u.functionInfo.dependencies = dependencies;
+        AddNodeToList(c, &c->pNextFunction, node);
+    }
+}
+
+/* AddItem - add a definition to a module */
+static ModuleItem *AddItem(ParseContext *c, Module *module, int kind, const char *name, Symbol *symbol)
+{
+    ModuleItem *item = (ModuleItem *)GlobalAlloc(c, sizeof(ModuleItem));
+    memset(item, 0, sizeof(ModuleItem));
+    item->kind = kind;
+    item->name = name;
+    item->symbol = symbol;
+    *module->pNextItem = item;
+    module->pNextItem = &item->next;
+    return item;
+}
+
+/* AddFile - add an included file to the files a module depends on */
+static void AddFile(ParseContext *c, Module *module, const char *name, const char *path)
+{
+    ModuleFile *file;
+    time_t modTime;
+    long modTimeNsec;
+    long fileSize;
+    if (xbFileInfo(path, &modTime, &modTimeNsec, &fileSize)) {
+        file = (ModuleFile *)GlobalAlloc(c, sizeof(ModuleFile) + strlen(name));
+        file->next = NULL;
+        file->modTime = modTime;
+        file->modTimeNsec = modTimeNsec;
+        file->fileSize = fileSize;
+        strcpy(file->name, name);
+        *module->pNextFile = file;
+        module->pNextFile = &file->next;
+    }
+}
+
+/* CheckFile - check that a file is the same as when a module was compiled */
+static int CheckFile(ParseContext *c, const char *path, ModuleFile *file)
+{
+    time_t modTime;
+    long modTimeNsec;
+    long fileSize;
+    return xbFileInfo(path, &modTime, &modTimeNsec, &fileSize)
+        && modTime == file->modTime
+        && modTimeNsec == file->modTimeNsec
+        && fileSize == file->fileSize;
+}
+
+/* TypeCode - get the type byte for the type of a global or argument */
+static int TypeCode(ParseContext *c, Type *type)
+{
+    if (type == &c->byteType)
+        return 'b';
+    else if (type == &c->integerArrayType)
+        return 'I';
+    else if (type == &c->byteArrayType)
+        return 'B';
+    else if (type == &c->integerPointerType)
+        return 'p';
+    else if (type == &c->bytePointerType)
+        return 'q';
+    return 'i';
+}
+
+/* CodeType - get the type for a type byte (NULL if it isn't valid) */
+static Type *CodeType(ParseContext *c, int code)
+{
+    switch (code) {
+    case 'i':
+        return &c->integerType;
+    case 'b':
+        return &c->byteType;
+    case 'I':
+        return &c->integerArrayType;
+    case 'B':
+        return &c->byteArrayType;
+    case 'p':
+        return &c->integerPointerType;
+    case 'q':
+        return &c->bytePointerType;
+    }
+    return NULL;
+}
+
+/* ReadByte - read a byte from a module */
+static int ReadByte(Reader *r)
+{
+    if (r->p >= r->end) {
+        r->ok = FALSE;
+        return -1;
+    }
+    return *r->p++;
+}
+
+/* ReadWord - read a little endian word from a module */
+static VMUVALUE ReadWord(Reader *r)
+{
+    const uint8_t *p = r->p;
+    if (r->end - p < 4) {
+        r->ok = FALSE;
+        return 0;
+    }
+    r->p += 4;
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((VMUVALUE)p[3] << 24);
+}
+
+/* ReadName - read a zero terminated name or string from a module (NULL if it runs past the end) */
+static const char *ReadName(Reader *r)
+{
+    const char *name = (const char *)r->p;
+    size_t length;
+    if (!r->ok || (length = strnlen(name, r->end - r->p)) >= (size_t)(r->end - r->p)) {
+        r->ok = FALSE;
+        return NULL;
+    }
+    r->p += length + 1;
+    return name;
+}
+
+/* ReadBytes - read data from a module */
+static const uint8_t *ReadBytes(Reader *r, VMUVALUE size)
+{
+    const uint8_t *p = r->p;
+    if ((VMUVALUE)(r->end - p) < size) {
+        r->ok = FALSE;
+        return NULL;
+    }
+    r->p += size;
+    return p;
+}
+
+/* WriteWord - write a little endian word to a module */
+static void WriteWord(FILE *fp, VMUVALUE value)
+{
+    putc(value, fp);
+    putc(value >> 8, fp);
+    putc(value >> 16, fp);
+    putc(value >> 24, fp);
+}
+
+/* WriteName - write a zero terminated name or string to a module */
+static void WriteName(FILE *fp, const char *name)
+{
+    fwrite(name, 1, strlen(name) + 1, fp);
+}
+
+/* PutWord - store a little endian word */
+static void PutWord(uint8_t *p, VMUVALUE value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+/* GetWord - get a little endian word */
+static VMUVALUE GetWord(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((VMUVALUE)p[3] << 24);
+}
@@ -771,10 +771,24 @@ static void Require(ParseContext *c, int token, int requiredToken)
     }
 }
 
+/* quoted names of the single character tokens from ' ' to '~' (four bytes each) */
+static const char charTokenNames[] =
+    "' '\0" "'!'\0" "'\"'\0" "'#'\0" "'$'\0" "'%'\0" "'&'\0" "'\''\0"
+    "'('\0" "')'\0" "'*'\0" "'+'\0" "','\0" "'-'\0" "'.'\0" "'/'\0"
+    "'0'\0" "'1'\0" "'2'\0" "'3'\0" "'4'\0" "'5'\0" "'6'\0" "'7'\0"
+    "'8'\0" "'9'\0" "':'\0" "';'\0" "'<'\0" "'='\0" "'>'\0" "'?'\0"
+    "'@'\0" "'A'\0" "'B'\0" "'C'\0" "'D'\0" "'E'\0" "'F'\0" "'G'\0"
+    "'H'\0" "'I'\0" "'J'\0" "'K'\0" "'L'\0" "'M'\0" "'N'\0" "'O'\0"
+    "'P'\0" "'Q'\0" "'R'\0" "'S'\0" "'T'\0" "'U'\0" "'V'\0" "'W'\0"
+    "'X'\0" "'Y'\0" "'Z'\0" "'['\0" "'\\'\0" "']'\0" "'^'\0" "'_'\0"
+    "'`'\0" "'a'\0" "'b'\0" "'c'\0" "'d'\0" "'e'\0" "'f'\0" "'g'\0"
+    "'h'\0" "'i'\0" "'j'\0" "'k'\0" "'l'\0" "'m'\0" "'n'\0" "'o'\0"
+    "'p'\0" "'q'\0" "'r'\0" "'s'\0" "'t'\0" "'u'\0" "'v'\0" "'w'\0"
+    "'x'\0" "'y'\0" "'z'\0" "'{'\0" "'|'\0" "'}'\0" "'~'\0";
+
 /* TokenName - get the name of a token */
 static char *TokenName(int token)
 {
-    static char nameBuf[4];
     char *name;
 
     switch (token) {
@@ -812,11 +826,10 @@ static char *TokenName(int token)
         name = "<EOF>";
         break;
     default:
-        nameBuf[0] = '\'';
-        nameBuf[1] = token;
-        nameBuf[2] = '\'';
-        nameBuf[3] = '\0';
-        name = nameBuf;
+        if (token >= ' ' && token <= '~')
+            name = (char *)&charTokenNames[(token - ' ') * 4];
+        else
+            name = "<CHAR>";
         break;
     }
 
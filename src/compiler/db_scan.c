@@ -10,7 +10,9 @@
 #include <string.h>
 #include <setjmp.h>
 #include <ctype.h>
+#include <limits.h>
 #include "db_compiler.h"
+#include "db_keywords.h"
 
 /* keyword table */
 static struct {
@@ -18,10 +20,11 @@ static struct {
     int token;
 } ktab[] = {
 
-/* these must be in the same order as the int enum */
+/* these must be in the same order as the int enum
+   (the keyword hash table in db_keywords.h is generated from this table by kwhash) */
 {   "REM",      T_REM       },
-{   "OPTION",   T_OPTION    },
 {   "INCLUDE",  T_INCLUDE   },
+{   "OPTION",   T_OPTION    },
 {   "DEF",      T_DEF       },
 {   "DIM",      T_DIM       },
 {   "AS",       T_AS        },
@@ -55,20 +58,47 @@ static struct {
 {   NULL,       0           }
 };
 
+/* compound keyword table */
+static struct {
+    int token;
+    int next;
+    int compound;
+} ctab[] = {
+{   T_ELSE,     T_IF,       T_ELSE_IF       },
+{   T_END,      T_DEF,      T_END_DEF       },
+{   T_END,      T_IF,       T_END_IF        },
+{   T_END,      T_SELECT,   T_END_SELECT    },
+{   T_END,      T_ASM,      T_END_ASM       },
+{   T_DO,       T_WHILE,    T_DO_WHILE      },
+{   T_DO,       T_UNTIL,    T_DO_UNTIL      },
+{   T_LOOP,     T_WHILE,    T_LOOP_WHILE    },
+{   T_LOOP,     T_UNTIL,    T_LOOP_UNTIL    },
+{   T_NONE,     T_NONE,     T_NONE          }
+};
+
 /* local function prototypes */
 static int NextToken(ParseContext *c);
 static int IdentifierToken(ParseContext *c, int ch);
+static int CompoundToken(ParseContext *c, int tkn);
 static int LiteralChar(ParseContext *c);
 static int SkipComment(ParseContext *c);
 static int XGetC(ParseContext *c);
+static SourceText *ReadSourceText(ParseContext *c, const char *name, int search);
+static SourceText *ReadCachedSourceText(ParseContext *c, const char *name);
+static SourceText *LoadSourceText(ParseContext *c, const char *name, int search);
+static void SaveLine(ParseContext *c, ParseFile *f);
+static int ReplayLine(ParseContext *c);
+static void ChargeScanTime(ParseContext *c);
 
 /* RewindInput - rewind the main input */
-void RewindInput(ParseContext *c)
+int RewindInput(ParseContext *c)
 {
     ParseFile *f = &c->mainFile;
     
-    /* rewind the source input */
-    (*f->u.main.rewind)(f->u.main.getLineCookie);
+    /* get the text of the main file (only the first pass reads it) */
+    if (!(f->source = ReadSourceText(c, f->name, FALSE)))
+        return FALSE;
+    f->ptr = f->source->text;
 
     /* initialize the parse context */
     f->lineNumber = 0;
@@ -76,6 +106,15 @@ void RewindInput(ParseContext *c)
     /* setup the input file stack */
     c->currentFile = f;
     f->next = NULL;
+    c->scanStart = clock();
+
+    /* the first pass saves the lines that the second pass parses */
+    if (c->pass == 1)
+        c->lineCount = 0;
+    c->nextLine = 0;
+    
+    /* return successfully */
+    return TRUE;
 }
 
 /* PushFile - push a file onto the input file stack */
@@ -96,29 +135,226 @@ int PushFile(ParseContext *c, const char *name)
     inc->next = c->includedFiles;
     c->includedFiles = inc;
 
+    /* use the library module for the file instead if there is an up to date one */
+    if (IncludeModule(c, name))
+        return TRUE;
+
+    /* the second pass gets the lines of the file from the first pass */
+    if (c->pass > 1)
+        return TRUE;
+
     /* allocate a parse file structure */
     if (!(f = (ParseFile *)malloc(sizeof(ParseFile))))
         ParseError(c, "insufficient memory");
     
-    /* open the input file */
-    if (!(f->u.file.fp = xbOpenFileInPath(c->sys, name, "r"))) {
+    /* get the text of the file (only the first pass reads it) */
+    if (!(f->source = ReadSourceText(c, name, TRUE))) {
         free(f);
         return FALSE;
     }
-    f->u.file.file = inc;
+    f->ptr = f->source->text;
+    f->name = inc->name;
     
     /* initialize the parse context */
     f->lineNumber = 0;
     
     /* push the file onto the input file stack */
+    ChargeScanTime(c);
     f->next = c->currentFile;
     c->currentFile = f;
-    c->currentInclude = inc;
     
     /* return successfully */
     return TRUE;
 }
 
+/* ReadSourceText - find the text of a source file, reading the file if this is the first time it is used */
+static SourceText *ReadSourceText(ParseContext *c, const char *name, int search)
+{
+    SourceText *source;
+
+    /* check to see if the file has already been read */
+    for (source = c->sourceTexts; source != NULL; source = source->next)
+        if (strcmp(name, source->name) == 0)
+            return source;
+
+    /* include files can come from the source cache (the main file is the one being edited) */
+    if (search && c->sourceCache)
+        source = ReadCachedSourceText(c, name);
+    else
+        source = LoadSourceText(c, name, search);
+    if (!source)
+        return NULL;
+
+    /* add it to the list of files that have been read */
+    source->next = c->sourceTexts;
+    c->sourceTexts = source;
+
+    /* return the source text */
+    return source;
+}
+
+/* ReadCachedSourceText - get the text of an include file from the source cache */
+static SourceText *ReadCachedSourceText(ParseContext *c, const char *name)
+{
+    SourceCache *cache = c->sourceCache;
+    SourceText *entry, **pEntry, *source;
+    char fullpath[PATH_MAX];
+    const char *path;
+    time_t modTime;
+    long modTimeNsec;
+    long fileSize;
+
+    /* find the file the way it would be opened */
+    if (!(path = xbFindFileInPath(c->sys, name, fullpath)) || !xbFileInfo(path, &modTime, &modTimeNsec, &fileSize))
+        return NULL;
+
+    /* look for the file in the cache dropping it if it has changed */
+    for (pEntry = &cache->texts; (entry = *pEntry) != NULL; pEntry = &entry->next) {
+        if (strcmp(path, entry->name) == 0) {
+            if (entry->modTime != modTime || entry->modTimeNsec != modTimeNsec || entry->fileSize != fileSize) {
+                *pEntry = entry->next;
+                free(entry->text);
+                free(entry);
+                entry = NULL;
+            }
+            break;
+        }
+    }
+
+    /* read the file into the cache if necessary */
+    if (entry)
+        ++cache->hits;
+    else {
+        if (!(entry = LoadSourceText(c, path, FALSE)))
+            return NULL;
+        entry->modTime = modTime;
+        entry->modTimeNsec = modTimeNsec;
+        entry->fileSize = fileSize;
+        entry->next = cache->texts;
+        cache->texts = entry;
+        ++cache->misses;
+    }
+
+    /* the compile gets its own entry that shares the cached text */
+    if (!(source = (SourceText *)malloc(sizeof(SourceText) + strlen(name))))
+        ParseError(c, "insufficient memory");
+    *source = *entry;
+    strcpy(source->name, name);
+    source->scanTime = 0;
+    source->shared = TRUE;
+
+    /* return the source text */
+    return source;
+}
+
+/* LoadSourceText - read the whole text of a source file */
+static SourceText *LoadSourceText(ParseContext *c, const char *name, int search)
+{
+    SourceText *source;
+    char *p, *end;
+    long size;
+    void *fp;
+
+    /* open the file (include files are found using the include path) */
+    if (!(fp = search ? xbOpenFileInPath(c->sys, name, "r") : xbOpenFile(c->sys, name, "r")))
+        return NULL;
+    if ((size = xbFileSize(fp)) < 0) {
+        xbCloseFile(fp);
+        return NULL;
+    }
+
+    /* make a source text structure with room for a final newline and a terminator */
+    if (!(source = (SourceText *)malloc(sizeof(SourceText) + strlen(name)))
+    ||  !(source->text = (char *)malloc(size + 2))) {
+        xbCloseFile(fp);
+        free(source);
+        ParseError(c, "insufficient memory");
+    }
+    strcpy(source->name, name);
+    source->lineCount = 0;
+    source->scanTime = 0;
+    source->shared = FALSE;
+    source->modTime = 0;
+    source->modTimeNsec = 0;
+    source->fileSize = 0;
+
+    /* read the whole file (text mode translation can make it shorter than its size) */
+    source->size = xbReadFile(fp, source->text, size);
+    xbCloseFile(fp);
+
+    /* make sure the last line ends with a newline */
+    if (source->size == 0 || source->text[source->size - 1] != '\n')
+        source->text[source->size++] = '\n';
+    source->text[source->size] = '\0';
+
+    /* count the lines */
+    end = source->text + source->size;
+    for (p = source->text; (p = memchr(p, '\n', end - p)) != NULL; ++p)
+        ++source->lineCount;
+
+    /* return the source text */
+    return source;
+}
+
+/* FreeSourceTexts - free the text of the source files and the lines saved for the second pass */
+void FreeSourceTexts(ParseContext *c)
+{
+    SourceText *source, *next;
+    for (source = c->sourceTexts; source != NULL; source = next) {
+        next = source->next;
+        if (!source->shared)
+            free(source->text);
+        free(source);
+    }
+    c->sourceTexts = NULL;
+    free(c->lines);
+    c->lines = NULL;
+    c->lineCount = c->lineMax = c->nextLine = 0;
+}
+
+/* NewSourceCache - make an empty source cache */
+SourceCache *NewSourceCache(void)
+{
+    return (SourceCache *)calloc(1, sizeof(SourceCache));
+}
+
+/* FreeSourceCache - free a source cache, the text of its files and its modules */
+void FreeSourceCache(SourceCache *cache)
+{
+    SourceText *entry, *next;
+    for (entry = cache->texts; entry != NULL; entry = next) {
+        next = entry->next;
+        free(entry->text);
+        free(entry);
+    }
+    FreeCachedModules(cache);
+    free(cache);
+}
+
+/* ShowScanStatistics - show the size of each source file and how fast it was scanned */
+void ShowScanStatistics(ParseContext *c)
+{
+    SourceText *source;
+    for (source = c->sourceTexts; source != NULL; source = source->next) {
+        double seconds = (double)source->scanTime / CLOCKS_PER_SEC;
+        xbInfo(c->sys, "%8d lines %8lu bytes %8.1f ms", source->lineCount, (unsigned long)source->size, seconds * 1000.0);
+        if (seconds > 0.0)
+            xbInfo(c->sys, " %8.0f lines/s %6.1f MB/s", source->lineCount / seconds, source->size / seconds / (1024.0 * 1024.0));
+        xbInfo(c->sys, "  %s\n", source->name);
+    }
+}
+
+/* ChargeScanTime - charge the time since the last input file change to the current input file */
+static void ChargeScanTime(ParseContext *c)
+{
+    if (c->flags & COMPILER_INFO) {
+        clock_t now = clock();
+        if (c->currentFile)
+            c->currentFile->source->scanTime += now - c->scanStart;
+        c->scanStart = now;
+    }
+}
+
 /* ClearIncludedFiles - clear the list of included files for the next pass */
 void ClearIncludedFiles(ParseContext *c)
 {
@@ -128,7 +364,6 @@ void ClearIncludedFiles(ParseContext *c)
         free(f);
     }
     c->includedFiles = NULL;
-    c->currentInclude = NULL;
 }
 
 /* CloseParseContext - close a parse context */
@@ -136,23 +371,25 @@ void CloseParseContext(ParseContext *c)
 {
     ParseFile *f, *next;
     
-    /* close all of the currently open files */
-    for (f = c->currentFile; f != NULL && f != &c->mainFile; f = next) {
+    /* close all of the currently open files (the second pass doesn't open any) */
+    for (f = c->currentFile; f != NULL && f != &c->mainFile && f != &c->replayFile; f = next) {
         next = f->next;
-        fclose(f->u.file.fp);
         free(f);
     }
     
     /* restore the input to the main file */
     c->currentFile = &c->mainFile;
-    c->currentInclude = NULL;
 }
 
 /* GetLine - get the next input line */
 int GetLine(ParseContext *c)
 {
     ParseFile *f;
-    int len;
+    char *end;
+
+    /* the second pass only gets the lines that the first pass saved */
+    if (c->pass > 1)
+        return ReplayLine(c);
 
     /* get the next input line */
     for (;;) {
@@ -161,41 +398,90 @@ int GetLine(ParseContext *c)
         if (!(f = c->currentFile))
             return FALSE;
         
-        /* get a line from the main input */
-        if (f == &c->mainFile) {
-            if ((*f->u.main.getLine)(f->u.main.getLineCookie, c->lineBuf, sizeof(c->lineBuf) - 1))
-                break;
-        }
-        
-        /* get a line from the current include file */
-        else {
-            if (xbGetLine(f->u.file.fp, c->lineBuf, sizeof(c->lineBuf) - 1))
-                break;
-        }
+        /* check for another line in the current file */
+        end = f->source->text + f->source->size;
+        if (f->ptr < end)
+            break;
         
         /* pop the input file stack on end of file */
-        if ((c->currentFile = f->next) != NULL && c->currentFile != &c->mainFile)
-            c->currentInclude = c->currentFile->u.file.file;
-        else
-            c->currentInclude = NULL;
+        ChargeScanTime(c);
+        c->currentFile = f->next;
             
         /* close the file we just finished if it isn't the main file */
-        if (f != &c->mainFile) {
-            fclose(f->u.file.fp);
+        if (f != &c->mainFile)
             free(f);
-        }
     }
     
-    /* make sure the line is correctly terminated */
-    len = strlen(c->lineBuf);
-    if (len == 0 || c->lineBuf[len - 1] != '\n') {
-        c->lineBuf[len++] = '\n';
-        c->lineBuf[len] = '\0';
+    /* the line is scanned in place (every line ends with a newline) */
+    c->lineBuf = c->linePtr = f->ptr;
+    c->lineEnd = f->ptr = (char *)memchr(f->ptr, '\n', end - f->ptr) + 1;
+    ++f->lineNumber;
+
+    /* save the line for the second pass (it is dropped if the first pass handles the statement) */
+    SaveLine(c, f);
+
+    /* clear lookahead token */
+    c->savedToken = T_NONE;
+
+    /* return successfully */
+    return TRUE;
+}
+
+/* SaveLine - save the current line for the second pass */
+static void SaveLine(ParseContext *c, ParseFile *f)
+{
+    SourceLine *line;
+
+    /* make room for another line */
+    if (c->lineCount >= c->lineMax) {
+        int max = c->lineMax > 0 ? c->lineMax * 2 : 1024;
+        if (!(line = (SourceLine *)realloc(c->lines, max * sizeof(SourceLine))))
+            ParseError(c, "insufficient memory");
+        c->lines = line;
+        c->lineMax = max;
     }
 
-    /* initialize the input buffer */
-    c->linePtr = c->lineBuf;
-    ++f->lineNumber;
+    /* the comment state is saved because the lines before it may not be scanned again */
+    line = &c->lines[c->lineCount++];
+    line->source = f->source;
+    line->text = c->lineBuf;
+    line->lineNumber = f->lineNumber;
+    line->inComment = c->inComment;
+}
+
+/* ReplayLine - get the next line saved by the first pass */
+static int ReplayLine(ParseContext *c)
+{
+    SourceLine *line;
+    ParseFile *f;
+
+    /* check for the end of the program */
+    if (c->nextLine >= c->lineCount) {
+        ChargeScanTime(c);
+        c->currentFile = NULL;
+        return FALSE;
+    }
+    line = &c->lines[c->nextLine++];
+
+    /* switch to the file containing the line */
+    if (!c->currentFile || c->currentFile->source != line->source) {
+        ChargeScanTime(c);
+        if (line->source == c->mainFile.source)
+            f = &c->mainFile;
+        else {
+            f = &c->replayFile;
+            f->next = NULL;
+            f->name = line->source->name;
+            f->source = line->source;
+        }
+        c->currentFile = f;
+    }
+    c->currentFile->lineNumber = line->lineNumber;
+
+    /* the line is scanned in place (every line ends with a newline) */
+    c->lineBuf = c->linePtr = line->text;
+    c->lineEnd = (char *)memchr(line->text, '\n', line->source->text + line->source->size - line->text) + 1;
+    c->inComment = line->inComment;
 
     /* clear lookahead token */
     c->savedToken = T_NONE;
@@ -243,10 +529,24 @@ void SaveToken(ParseContext *c, int token)
     c->savedToken = token;
 }
 
+/* quoted names of the single character tokens from ' ' to '~' (four bytes each) */
+static const char charTokenNames[] =
+    "' '\0" "'!'\0" "'\"'\0" "'#'\0" "'$'\0" "'%'\0" "'&'\0" "'\''\0"
+    "'('\0" "')'\0" "'*'\0" "'+'\0" "','\0" "'-'\0" "'.'\0" "'/'\0"
+    "'0'\0" "'1'\0" "'2'\0" "'3'\0" "'4'\0" "'5'\0" "'6'\0" "'7'\0"
+    "'8'\0" "'9'\0" "':'\0" "';'\0" "'<'\0" "'='\0" "'>'\0" "'?'\0"
+    "'@'\0" "'A'\0" "'B'\0" "'C'\0" "'D'\0" "'E'\0" "'F'\0" "'G'\0"
+    "'H'\0" "'I'\0" "'J'\0" "'K'\0" "'L'\0" "'M'\0" "'N'\0" "'O'\0"
+    "'P'\0" "'Q'\0" "'R'\0" "'S'\0" "'T'\0" "'U'\0" "'V'\0" "'W'\0"
+    "'X'\0" "'Y'\0" "'Z'\0" "'['\0" "'\\'\0" "']'\0" "'^'\0" "'_'\0"
+    "'`'\0" "'a'\0" "'b'\0" "'c'\0" "'d'\0" "'e'\0" "'f'\0" "'g'\0"
+    "'h'\0" "'i'\0" "'j'\0" "'k'\0" "'l'\0" "'m'\0" "'n'\0" "'o'\0"
+    "'p'\0" "'q'\0" "'r'\0" "'s'\0" "'t'\0" "'u'\0" "'v'\0" "'w'\0"
+    "'x'\0" "'y'\0" "'z'\0" "'{'\0" "'|'\0" "'}'\0" "'~'\0";
+
 /* TokenName - get the name of a token */
 char *TokenName(int token)
 {
-    static char nameBuf[4];
     char *name;
 
     switch (token) {
@@ -342,11 +642,10 @@ char *TokenName(int token)
         name = "<EOF>";
         break;
     default:
-        nameBuf[0] = '\'';
-        nameBuf[1] = token;
-        nameBuf[2] = '\'';
-        nameBuf[3] = '\0';
-        name = nameBuf;
+        if (token >= ' ' && token <= '~')
+            name = (char *)&charTokenNames[(token - ' ') * 4];
+        else
+            name = "<CHAR>";
         break;
     }
 
@@ -418,82 +717,12 @@ static int NextToken(ParseContext *c)
         if (isdigit(ch))
             tkn = NumberToken(c, ch);
         else if (IdentifierCharP(ch)) {
-            char *savePtr;
-            switch (tkn = IdentifierToken(c,ch)) {
+            switch (tkn = IdentifierToken(c, ch)) {
             case T_ELSE:
-                savePtr = c->linePtr;
-                if ((ch = SkipSpaces(c)) != EOF && IdentifierCharP(ch)) {
-                    switch (IdentifierToken(c, ch)) {
-                    case T_IF:
-                        tkn = T_ELSE_IF;
-                        break;
-                    default:
-                        c->linePtr = savePtr;
-                        break;
-                    }
-                }
-                else
-                    c->linePtr = savePtr;
-                break;
             case T_END:
-                savePtr = c->linePtr;
-                if ((ch = SkipSpaces(c)) != EOF && IdentifierCharP(ch)) {
-                    switch (IdentifierToken(c, ch)) {
-                    case T_DEF:
-                        tkn = T_END_DEF;
-                        break;
-                    case T_IF:
-                        tkn = T_END_IF;
-                        break;
-                    case T_SELECT:
-                        tkn = T_END_SELECT;
-                        break;
-                    case T_ASM:
-                        tkn = T_END_ASM;
-                        break;
-                    default:
-                        c->linePtr = savePtr;
-                        break;
-                    }
-                }
-                else
-                    c->linePtr = savePtr;
-                break;
             case T_DO:
-                savePtr = c->linePtr;
-                if ((ch = SkipSpaces(c)) != EOF && IdentifierCharP(ch)) {
-                    switch (IdentifierToken(c, ch)) {
-                    case T_WHILE:
-                        tkn = T_DO_WHILE;
-                        break;
-                    case T_UNTIL:
-                        tkn = T_DO_UNTIL;
-                        break;
-                    default:
-                        c->linePtr = savePtr;
-                        break;
-                    }
-                }
-                else
-                    c->linePtr = savePtr;
-                break;
             case T_LOOP:
-                savePtr = c->linePtr;
-                if ((ch = SkipSpaces(c)) != EOF && IdentifierCharP(ch)) {
-                    switch (IdentifierToken(c, ch)) {
-                    case T_WHILE:
-                        tkn = T_LOOP_WHILE;
-                        break;
-                    case T_UNTIL:
-                        tkn = T_LOOP_UNTIL;
-                        break;
-                    default:
-                        c->linePtr = savePtr;
-                        break;
-                    }
-                }
-                else
-                    c->linePtr = savePtr;
+                tkn = CompoundToken(c, tkn);
                 break;
             }
         }
@@ -508,28 +737,49 @@ static int NextToken(ParseContext *c)
 /* IdentifierToken - get an identifier */
 static int IdentifierToken(ParseContext *c, int ch)
 {
+    unsigned int hash;
     int len, i;
     char *p;
 
     /* get the identifier */
     p = c->token; *p++ = ch; len = 1;
+    hash = KeywordHash(0, ch);
     while ((ch = GetChar(c)) != EOF && IdentifierCharP(ch)) {
         if (++len > MAXTOKEN)
             ParseError(c, "Identifier too long");
         *p++ = ch;
+        hash = KeywordHash(hash, ch);
     }
     UngetC(c);
     *p = '\0';
 
     /* check to see if it is a keyword */
-    for (i = 0; ktab[i].keyword != NULL; ++i)
-        if (strcasecmp(ktab[i].keyword, c->token) == 0)
-            return ktab[i].token;
+    if ((i = keywordSlots[KeywordSlot(hash)]) != 0 && strcasecmp(ktab[i - 1].keyword, c->token) == 0)
+        return ktab[i - 1].token;
 
     /* otherwise, it is an identifier */
     return T_IDENTIFIER;
 }
 
+/* CompoundToken - combine a keyword with the keyword that follows it (like END IF) */
+static int CompoundToken(ParseContext *c, int tkn)
+{
+    char *savePtr = c->linePtr;
+    int ch, next, i;
+
+    /* check for a keyword that can follow this one */
+    if ((ch = SkipSpaces(c)) != EOF && IdentifierCharP(ch)) {
+        next = IdentifierToken(c, ch);
+        for (i = 0; ctab[i].token != T_NONE; ++i)
+            if (ctab[i].token == tkn && ctab[i].next == next)
+                return ctab[i].compound;
+    }
+
+    /* not a compound keyword so leave the next token to be scanned again */
+    c->linePtr = savePtr;
+    return tkn;
+}
+
 /* IdentifierCharP - is this an identifier character? */
 int IdentifierCharP(int ch)
 {
@@ -740,10 +990,9 @@ static int XGetC(ParseContext *c)
     int ch;
     
     /* get the next character on the current line */
-    if (!(ch = *c->linePtr++)) {
-        --c->linePtr;
+    if (c->linePtr >= c->lineEnd || !(ch = *c->linePtr))
         return EOF;
-    }
+    ++c->linePtr;
     
     /* return the character */
     return ch;
@@ -759,25 +1008,46 @@ void UngetC(ParseContext *c)
 /* ParseError - report a parsing error */
 void ParseError(ParseContext *c, char *fmt, ...)
 {
+    char message[256];
     ParseFile *f;
     va_list ap;
 
     /* print the error message */
     va_start(ap, fmt);
-    xbError(c->sys, "error: ");
-    xbErrorV(c->sys, fmt, ap);
-    xbError(c->sys, "\n");
+    vsnprintf(message, sizeof(message), fmt, ap);
     va_end(ap);
+    xbError(c->sys, "error: %s\n", message);
+    
+    /* pass the error and its location to tools that want them */
+    if (c->sys->ops->diagnostic) {
+        Diagnostic diagnostic;
+        diagnostic.file = NULL;
+        diagnostic.lineNumber = 0;
+        diagnostic.column = 0;
+        diagnostic.message = message;
+        if ((f = c->currentFile) != NULL) {
+            diagnostic.file = f->name;
+            diagnostic.lineNumber = f->lineNumber;
+            diagnostic.column = c->tokenOffset;
+        }
+        (*c->sys->ops->diagnostic)(c->sys, &diagnostic);
+    }
 
     /* show the context */
     if ((f = c->currentFile) != NULL) {
         if (f == &c->mainFile)
             xbError(c->sys, "  line %d\n", c->currentFile->lineNumber);
         else
-            xbError(c->sys, "  file '%s', line %d\n", f->u.file.file->name, f->lineNumber);
-        xbError(c->sys, "    %s\n", c->lineBuf);
+            xbError(c->sys, "  file '%s', line %d\n", f->name, f->lineNumber);
+        xbError(c->sys, "    %.*s\n", (int)(c->lineEnd - c->lineBuf), c->lineBuf);
         xbError(c->sys, "    %*s\n", c->tokenOffset, "^");
     }
+    
+    /* code is generated after all of the source has been parsed so just show the function */
+    else if (c->function) {
+        Symbol *symbol = c->function->u.functionDefinition.symbol;
+        xbError(c->sys, "  in %s\n", symbol ? symbol->name : "the main code");
+    }
 
 	/* exit until we fix the compiler so it can recover from parse errors */
     longjmp(c->errorTarget, 1);
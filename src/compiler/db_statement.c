@@ -18,12 +18,13 @@ static void ParseDef(ParseContext *c);
 static void ParseConstantDef(ParseContext *c, char *name);
 static void ParseFunctionDef(ParseContext *c, char *name);
 static void ParseFunctionDef_pass1(ParseContext *c, char *name);
-static void ParseFunctionDef_pass23(ParseContext *c, char *name);
+static void ParseFunctionDef_pass2(ParseContext *c, char *name);
 static void ParseEndDef(ParseContext *c);
 static void ParseDim(ParseContext *c);
 static Type *ParseVariableDecl(ParseContext *c, char *name, VMUVALUE *pSize);
 static VMVALUE ParseScalarInitializer(ParseContext *c);
 static VMUVALUE ParseArrayInitializers(ParseContext *c, Type *type, VMUVALUE size);
+static VMUVALUE ParseBinaryInitializer(ParseContext *c, Type *type, VMUVALUE size);
 static void ClearArrayInitializers(ParseContext *c, VMVALUE size);
 static void ParseImpliedLetOrFunctionCall(ParseContext *c);
 static void ParseLet(ParseContext *c);
@@ -54,6 +55,8 @@ static void StartFunction(ParseContext *c, Symbol *sym);
 static ParseTreeNode *BuildHandlerCall(ParseContext *c, char *name, ParseTreeNode *devExpr, ParseTreeNode *expr);
 static ParseTreeNode *BuildHandlerFunctionCall(ParseContext *c, char *name, ParseTreeNode *devExpr, ParseTreeNode *expr);
 static void DefineLabel(ParseContext *c, char *name);
+static Label *FindLabel(ParseContext *c, char *name);
+static Label *AddLabel(ParseContext *c, char *name, LabelState state);
 static void PushBlock(ParseContext *c, BlockType type, ParseTreeNode *node);
 static void PopBlock(ParseContext *c);
 static void Assemble(ParseContext *c, char *opname);
@@ -61,8 +64,12 @@ static VMVALUE ParseIntegerConstant(ParseContext *c);
 
 /*
     pass 1: handle definitions
-    pass 2: collect dependencies
-    pass 3: compile code
+    pass 2: build parse trees and collect dependencies
+
+    the second pass only sees the lines of the statements that the first
+    pass didn't handle (see GetLine) so each statement is parsed once
+
+    code is then generated from the parse trees (see GenerateFunctions)
 */
 
 /* ParseStatement - parse a statement */
@@ -73,12 +80,14 @@ again:
     switch (tkn) {
     case T_REM:
         /* just a comment so ignore the rest of the line */
+        c->statementDone = TRUE;
         break;
     case T_INCLUDE:
         ParseInclude(c);
         break;
     case T_OPTION:
         ParseOption(c);
+        c->statementDone = TRUE;
         break;
     case T_DEF:
         ParseDef(c);
@@ -199,6 +208,7 @@ static void ParseInclude(ParseContext *c)
     FRequire(c, T_STRING);
     strcpy(name, c->token);
     FRequire(c, T_EOL);
+    AddModuleInclude(c, name);
     if (!PushFile(c, name))
         ParseError(c, "include file not found: %s", name);
 }
@@ -209,6 +219,10 @@ static void ParseOption(ParseContext *c)
     FRequire(c, T_IDENTIFIER);
     FRequire(c, '=');
 
+    /* a library module only has definitions */
+    if (c->moduleOut && c->currentFile == &c->mainFile)
+        ParseError(c, "options can't be set in a library module");
+
     /* handle the 'target' option */
     if (strcasecmp(c->token, "stacksize") == 0)
         SetIntegerOption(c, &c->stackSize);
@@ -260,13 +274,14 @@ static void ParseConstantDef(ParseContext *c, char *name)
 
         /* make sure it's a constant */
         if (IsIntegerLit(expr))
-            AddGlobalConstantInteger(c, name, expr->u.integerLit.value);
+            AddModuleSymbol(c, AddGlobalConstantInteger(c, name, expr->u.integerLit.value));
         else if (IsStringLit(expr))
-            AddGlobalConstantString(c, name, expr->u.stringLit.string);
+            AddModuleSymbol(c, AddGlobalConstantString(c, name, expr->u.stringLit.string));
         else
             ParseError(c, "expecting a constant expression");
 
         FRequire(c, T_EOL);
+        c->statementDone = TRUE;
     }
 }
 
@@ -286,7 +301,7 @@ static void ParseFunctionDef(ParseContext *c, char *name)
     if (c->pass == 1)
         ParseFunctionDef_pass1(c, name);
     else
-        ParseFunctionDef_pass23(c, name);
+        ParseFunctionDef_pass2(c, name);
 }
 
 /* ParseFunctionDef_pass1 - parse a 'DEF <name>' statement during pass 1 */
@@ -304,6 +319,7 @@ static void ParseFunctionDef_pass1(ParseContext *c, char *name)
 
     /* enter the function name in the global symbol table */
     sym = AddGlobalSymbol(c, name, SC_CONSTANT, type, NULL);
+    AddModuleSymbol(c, sym);
 
     /* get the argument list */
     if ((tkn = GetToken(c)) == '(') {
@@ -328,12 +344,11 @@ static void ParseFunctionDef_pass1(ParseContext *c, char *name)
     FRequire(c, T_EOL);
 }
 
-/* ParseFunctionDef_pass23 - parse a 'DEF <name>' statement during passes 2 and 3 */
-static void ParseFunctionDef_pass23(ParseContext *c, char *name)
+/* ParseFunctionDef_pass2 - parse a 'DEF <name>' statement during pass 2 */
+static void ParseFunctionDef_pass2(ParseContext *c, char *name)
 {
     Symbol *sym;
     sym = FindSymbol(&c->globals, name);
-    sym->section = c->textTarget;
     StartFunction(c, sym);
 }
 
@@ -349,8 +364,10 @@ static void StartFunction(ParseContext *c, Symbol *sym)
     InitSymbolTable(&node->u.functionDefinition.locals);
     node->u.functionDefinition.labels = NULL;
     node->u.functionDefinition.localOffset = 0;
+    memset(c->labelBuckets, 0, sizeof(c->labelBuckets));
     c->dependencies = NULL;
     c->pNextDependency = &c->dependencies;
+    ++c->functionNumber;
     
     /* setup to compile the function body */
     PushBlock(c, BLOCK_FUNCTION, node);
@@ -383,52 +400,30 @@ void EndFunction(ParseContext *c)
     /* make sure all referenced labels were defined */
     CheckLabels(c);
 
-    /* store the dependencies on pass 2 */
-    if (c->pass == 2) {
-    
-        /* store dependencies */
-        if (c->functionType)
-            c->function->u.functionDefinition.symbol->type->u.functionInfo.dependencies = c->dependencies;
-        else
-            c->mainDependencies = c->dependencies;
-            
-        /* show the parse tree if requested */
-        if (c->flags & COMPILER_DEBUG) {
-            xbInfo(c->sys, "\n");
-            PrintNode(c->function, 0);
-            if ((d = c->dependencies) != NULL) {
-                xbInfo(c->sys, "dependencies:\n");
-                for (; d != NULL; d = d->next)
-                    xbInfo(c->sys, "  %s\n", d->symbol->name);
-            }
+    /* store dependencies */
+    if (c->functionType)
+        c->function->u.functionDefinition.symbol->type->u.functionInfo.dependencies = c->dependencies;
+    else
+        c->mainDependencies = c->dependencies;
+        
+    /* show the parse tree if requested */
+    if (c->flags & COMPILER_DEBUG) {
+        xbInfo(c->sys, "\n");
+        PrintNode(c->function, 0);
+        if ((d = c->dependencies) != NULL) {
+            xbInfo(c->sys, "dependencies:\n");
+            for (; d != NULL; d = d->next)
+                xbInfo(c->sys, "  %s\n", d->symbol->name);
         }
     }
     
-    /* generate code on pass 3 */
-    else {
-    
-        /* handle named functions */
-        if (c->functionType) {
-            Symbol *sym = c->function->u.functionDefinition.symbol;
-            for (d = c->mainDependencies; d != NULL; d = d->next)
-                if (sym == d->symbol)
-                    break;
-            if (d)
-                StoreCode(c);
-        }
-        
-        /* always store the main function */
-        else
-            StoreCode(c);
-    }
+    /* keep the parse tree (in the local heap) until code is generated */
+    AddNodeToList(c, &c->pNextFunction, c->function);
     
     /* exit the function block */
     PopBlock(c);
     c->functionType = NULL;
     c->function = NULL;
-    
-    /* empty the local heap */
-    xbLocalFreeAll(c->sys);
 }
 
 /* ParseEndDef - parse the 'END DEF' statement */
@@ -452,6 +447,13 @@ static void ParseDim(ParseContext *c)
     int isArray;
     int tkn;
 
+    /* locals are only declared on the second pass and globals only on the first */
+    if (c->pass == 1) {
+        if (c->functionType)
+            return;
+        c->statementDone = TRUE;
+    }
+
     /* parse variable declarations */
     do {
         Type *type;
@@ -482,41 +484,35 @@ static void ParseDim(ParseContext *c)
                 expr = NULL;
             }
                 
-            if (c->pass > 1) {
+            /* add the local symbol */
+            AddLocal(c, name, type, -F_SIZE - c->function->u.functionDefinition.localOffset - 1);
+            c->function->u.functionDefinition.localOffset += ValueSize(type, 0);
             
-                /* add the local symbol */
-                AddLocal(c, name, type, -F_SIZE - c->function->u.functionDefinition.localOffset - 1);
-                c->function->u.functionDefinition.localOffset += ValueSize(type, 0);
-                
-                /* compile the initialization code */
-                if (expr) {
-                    ParseTreeNode *node = NewParseTreeNode(c, NodeTypeLetStatement);
-                    node->u.letStatement.lvalue = GetSymbolRef(c, name);
-                    node->u.letStatement.rvalue = expr;
-                    AddNodeToList(c, &c->bptr->pNextStatement, node);
-                }
+            /* compile the initialization code */
+            if (expr) {
+                ParseTreeNode *node = NewParseTreeNode(c, NodeTypeLetStatement);
+                node->u.letStatement.lvalue = GetSymbolRef(c, name);
+                node->u.letStatement.rvalue = expr;
+                AddNodeToList(c, &c->bptr->pNextStatement, node);
             }
         }
 
         /* add to the global symbol table if outside a function definition */
         else {
-            Section *target;
+            char sectionName[MAXTOKEN];
         
-            /* check for target section */
+            /* check for target section (the global is placed when an image is built for each board) */
             if ((tkn = GetToken(c)) == T_IN) {
                 FRequire(c, T_STRING);
-                if (strcasecmp(c->token, "text") == 0)
-                    target = c->textTarget;
-                else if (strcasecmp(c->token, "data") == 0)
-                    target = c->dataTarget;
-                else if (!(target = GetSection(c->config, c->token)))
-                    ParseError(c, "no section '%s'", c->token);
+                if (strcasecmp(c->token, "text") != 0 && strcasecmp(c->token, "data") != 0)
+                    CheckSectionName(c, c->token);
+                strcpy(sectionName, c->token);
             }
             
             /* use default data target */
             else {
                 SaveToken(c, tkn);
-                target = c->dataTarget;
+                strcpy(sectionName, "data");
             }
             
             /* check for initializers */
@@ -537,21 +533,19 @@ static void ParseDim(ParseContext *c)
                 }
             }
 
-            /* add the symbol on pass 1 */
-            if (c->pass == 1) {
+            /* handle arrays */
+            if (isArray) {
+                Symbol *sym = AddGlobalSymbol(c, name, SC_CONSTANT, type, NULL);
+                AddGlobalData(c, sym, sectionName, c->cptr, ValueSize(type, size) * sizeof(VMVALUE));
+                AddModuleSymbol(c, sym);
+            }
             
-                /* handle arrays */
-                if (isArray) {
-                    AddGlobalSymbol(c, name, SC_CONSTANT, type, target);
-                    target->offset += WriteSection(c, target, c->cptr, ValueSize(type, size) * sizeof(VMVALUE));
-                }
-                
-                /* handle scalars */
-                else {
-                    AddGlobalSymbol(c, name, SC_GLOBAL, type, target);
-                    target->offset += WriteSection(c, target, (uint8_t *)&value, sizeof(VMVALUE));
-                }
-            }                
+            /* handle scalars */
+            else {
+                Symbol *sym = AddGlobalSymbol(c, name, SC_GLOBAL, type, NULL);
+                AddGlobalData(c, sym, sectionName, (uint8_t *)&value, sizeof(VMVALUE));
+                AddModuleSymbol(c, sym);
+            }
         }
     } while ((tkn = GetToken(c)) == ',');
 
@@ -647,8 +641,7 @@ static VMVALUE ParseScalarInitializer(ParseContext *c)
         value = 0; // never reached
     }
     
-    /* reset the local heap and return the constant value */
-    xbLocalFreeAll(c->sys);
+    /* return the constant value */
     return value;
 }
     
@@ -661,8 +654,12 @@ static VMUVALUE ParseArrayInitializers(ParseContext *c, Type *type, VMUVALUE siz
     VMUVALUE count = 0;
     int tkn;
 
+    /* handle the contents of a binary file */
+    if ((tkn = GetToken(c)) == T_INCLUDE)
+        return ParseBinaryInitializer(c, type, size);
+
     /* handle a bracketed list of initializers */
-    if ((tkn = GetToken(c)) == '{') {
+    if (tkn == '{') {
         VMVALUE initializer;
         int done = FALSE;
         
@@ -792,6 +789,84 @@ static VMUVALUE ParseArrayInitializers(ParseContext *c, Type *type, VMUVALUE siz
     return size > 0 ? size : count;
 }
 
+/* ParseBinaryInitializer - parse an array initialized with the contents of a binary file */
+static VMUVALUE ParseBinaryInitializer(ParseContext *c, Type *type, VMUVALUE size)
+{
+    uint8_t *p = (uint8_t *)c->cptr;
+    VMUVALUE elementSize, count, dataSize, i;
+    long fileSize;
+    void *fp;
+
+    /* get the file name */
+    FRequire(c, T_STRING);
+
+    /* integer arrays are filled with little endian longs */
+    switch (type->id) {
+    case TYPE_INTEGER:
+        elementSize = sizeof(VMVALUE);
+        break;
+    case TYPE_BYTE:
+        elementSize = 1;
+        break;
+    default:
+        ParseError(c, "expecting an integer or byte array");
+        elementSize = 0; // never reached
+        break;
+    }
+
+    /* open the file */
+    if (!(fp = xbOpenFileInPath(c->sys, c->token, "rb")))
+        ParseError(c, "binary file not found: %s", c->token);
+    if ((fileSize = xbFileSize(fp)) < 0) {
+        xbCloseFile(fp);
+        ParseError(c, "can't read %s", c->token);
+    }
+
+    /* check that the file fills a whole number of elements */
+    if (fileSize % elementSize != 0) {
+        xbCloseFile(fp);
+        ParseError(c, "size of %s is not a multiple of %d bytes", c->token, (int)elementSize);
+    }
+    count = fileSize / elementSize;
+
+    /* check the size of the data against the size of the array */
+    if (size > 0 && count > size) {
+        xbCloseFile(fp);
+        ParseError(c, "too many initializers in %s", c->token);
+    }
+    else if (size == 0 && count == 0) {
+        xbCloseFile(fp);
+        ParseError(c, "binary file is empty: %s", c->token);
+    }
+    if (size == 0)
+        size = count;
+
+    /* read the data (the remaining entries are filled with zero) */
+    dataSize = ROUND_TO_WORDS(size * elementSize);
+    if (dataSize > (VMUVALUE)(c->ctop - c->cptr)) {
+        xbCloseFile(fp);
+        ParseError(c, "insufficient data space");
+    }
+    if (xbReadFile(fp, p, fileSize) != (size_t)fileSize) {
+        xbCloseFile(fp);
+        ParseError(c, "can't read %s", c->token);
+    }
+    xbCloseFile(fp);
+    memset(p + fileSize, 0, dataSize - fileSize);
+
+    /* convert the longs to the host byte order */
+    if (elementSize > 1) {
+        for (i = 0; i < count; ++i, p += sizeof(VMVALUE))
+            *(VMVALUE *)p = p[0] | (p[1] << 8) | (p[2] << 16) | ((VMUVALUE)p[3] << 24);
+    }
+
+    /* the module for an include file depends on the binary files it uses */
+    AddModuleFile(c, c->token);
+
+    /* return the number of elements */
+    return size;
+}
+
 /* ClearArrayInitializers - clear the array initializers */
 static void ClearArrayInitializers(ParseContext *c, VMVALUE size)
 {
@@ -1198,17 +1273,20 @@ static void Assemble(ParseContext *c, char *name)
                 putcword(c, ParseIntegerConstant(c));
                 break;
             case FMT_NATIVE:
-                for (p = c->linePtr; *p != '\0' && isspace(*p); ++p)
+                for (p = c->linePtr; p < c->lineEnd && isspace(*p); ++p)
                     ;
-                if (isdigit(*p))
+                if (p < c->lineEnd && isdigit(*p))
                     putcword(c, ParseIntegerConstant(c));
                 else {
-                    if (!PasmAssemble1(c->linePtr, &value))
+                    /* the assembler wants just the rest of this line */
+                    size_t len = c->lineEnd - c->linePtr;
+                    char *line = (char *)LocalAlloc(c, len + 1);
+                    memcpy(line, c->linePtr, len);
+                    line[len] = '\0';
+                    if (!PasmAssemble1(line, &value))
                         ParseError(c, "native assembly failed");
                     putcword(c, (VMVALUE)value);
-                    for (p = c->linePtr; *p != '\0' && *p != '\n'; ++p)
-                        ;
-                    c->linePtr = p;
+                    c->linePtr = c->lineEnd - 1;
                 }
                 break;
             default:
@@ -1239,22 +1317,14 @@ static void DefineLabel(ParseContext *c, char *name)
     Label *label;
     
     /* check to see if the label is already in the table */
-    for (label = c->function->u.functionDefinition.labels; label != NULL; label = label->next)
-        if (strcasecmp(name, label->name) == 0) {
-            if (label->state != LS_UNDEFINED)
-                ParseError(c, "duplicate label: %s", label->name);
-            break;
-        }
+    if ((label = FindLabel(c, name)) != NULL) {
+        if (label->state != LS_UNDEFINED)
+            ParseError(c, "duplicate label: %s", label->name);
+    }
 
     /* allocate the label structure */
-    if (!label) {
-        label = (Label *)xbLocalAlloc(c->sys, sizeof(Label) + strlen(name));
-        memset(label, 0, sizeof(Label));
-        strcpy(label->name, name);
-        label->state = LS_DEFINED;
-        label->next = c->function->u.functionDefinition.labels;
-        c->function->u.functionDefinition.labels = label;
-    }
+    else
+        label = AddLabel(c, name, LS_DEFINED);
     
     /* add a label definition node */
     node = NewParseTreeNode(c, NodeTypeLabelDefinition);
@@ -1270,20 +1340,9 @@ static void ParseGoto(ParseContext *c)
     
     FRequire(c, T_IDENTIFIER);
 
-    /* check to see if the label is already in the table */
-    for (label = c->function->u.functionDefinition.labels; label != NULL; label = label->next)
-        if (strcasecmp(c->token, label->name) == 0)
-            break;
-
-    /* allocate the label structure */
-    if (!label) {
-        label = (Label *)xbLocalAlloc(c->sys, sizeof(Label) + strlen(c->token));
-        memset(label, 0, sizeof(Label));
-        strcpy(label->name, c->token);
-        label->state = LS_UNDEFINED;
-        label->next = c->function->u.functionDefinition.labels;
-        c->function->u.functionDefinition.labels = label;
-    }
+    /* find the label or add a forward reference to it */
+    if (!(label = FindLabel(c, c->token)))
+        label = AddLabel(c, c->token, LS_UNDEFINED);
 
     node = NewParseTreeNode(c, NodeTypeGotoStatement);
     node->u.gotoStatement.label = label;
@@ -1292,6 +1351,31 @@ static void ParseGoto(ParseContext *c)
     FRequire(c, T_EOL);
 }
 
+/* FindLabel - find a label in the current function */
+static Label *FindLabel(ParseContext *c, char *name)
+{
+    Label *label;
+    for (label = c->labelBuckets[HashName(name) & (LABEL_BUCKETS - 1)]; label != NULL; label = label->hashNext)
+        if (strcasecmp(name, label->name) == 0)
+            return label;
+    return NULL;
+}
+
+/* AddLabel - add a label to the current function */
+static Label *AddLabel(ParseContext *c, char *name, LabelState state)
+{
+    Label **pBucket = &c->labelBuckets[HashName(name) & (LABEL_BUCKETS - 1)];
+    Label *label = (Label *)LocalAlloc(c, sizeof(Label) + strlen(name));
+    memset(label, 0, sizeof(Label));
+    strcpy(label->name, name);
+    label->state = state;
+    label->next = c->function->u.functionDefinition.labels;
+    c->function->u.functionDefinition.labels = label;
+    label->hashNext = *pBucket;
+    *pBucket = label;
+    return label;
+}
+
 /* ParseReturn - parse the 'RETURN' statement */
 static void ParseReturn(ParseContext *c)
 {
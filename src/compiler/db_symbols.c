@@ -7,10 +7,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include "db_compiler.h"
 
+/* symbol tables are searched linearly until they have this many symbols */
+#define MIN_HASHED_SYMBOLS  8
+
 /* local functions */
 static Symbol *AddGlobal(ParseContext *c, SymbolTable *table, const char *name, StorageClass storageClass, Type *type, VMUVALUE offset);
+static void AddToTable(ParseContext *c, SymbolTable *table, Symbol *sym, int local);
 
 /* InitSymbolTable - initialize a symbol table */
 void InitSymbolTable(SymbolTable *table)
@@ -18,6 +23,8 @@ void InitSymbolTable(SymbolTable *table)
     table->head = NULL;
     table->pTail = &table->head;
     table->count = 0;
+    table->buckets = NULL;
+    table->bucketCount = 0;
 }
 
 /* AddGlobalSymbol - add a global symbol to the symbol table */
@@ -61,12 +68,9 @@ Symbol *AddFormalArgument(ParseContext *c, SymbolTable *table, const char *name,
 /* AddDependency - add a dependency on a global symbol to the current function */
 void AddDependency(ParseContext *c, Symbol *symbol)
 {
-    if (c->pass == 2) {
-        Dependency *d;
-        for (d = c->dependencies; d != NULL; d = d->next)
-            if (symbol == d->symbol)
-                return;
-        d = (Dependency *)GlobalAlloc(c, sizeof(Dependency));
+    if (c->pass == 2 && symbol->dependencyMark != c->functionNumber) {
+        Dependency *d = (Dependency *)GlobalAlloc(c, sizeof(Dependency));
+        symbol->dependencyMark = c->functionNumber;
         d->symbol = symbol;
         d->next = NULL;
         *c->pNextDependency = d;
@@ -86,18 +90,14 @@ static Symbol *AddGlobal(ParseContext *c, SymbolTable *table, const char *name,
         
     /* allocate the symbol structure */
     sym = (Symbol *)GlobalAlloc(c, size);
+    memset(sym, 0, sizeof(Symbol));
     strcpy(sym->name, name);
     sym->storageClass = storageClass;
-    sym->section = NULL;
     sym->type = type;
     sym->v.variable.offset = offset;
-    sym->v.variable.fixups = 0;
-    sym->next = NULL;
 
     /* add it to the symbol table */
-    *table->pTail = sym;
-    table->pTail = &sym->next;
-    ++table->count;
+    AddToTable(c, table, sym, FALSE);
     
     /* return the symbol */
     return sym;
@@ -115,35 +115,75 @@ Symbol *AddLocal(ParseContext *c, const char *name, Type *type, VMUVALUE offset)
         ParseError(c, "duplicate symbol '%s'", name);
         
     /* allocate the symbol structure */
-    sym = (Symbol *)xbLocalAlloc(c->sys, size);
+    sym = (Symbol *)LocalAlloc(c, size);
+    memset(sym, 0, sizeof(Symbol));
     strcpy(sym->name, name);
     sym->storageClass = SC_LOCAL;
-    sym->section = NULL;
     sym->type = type;
     sym->v.variable.offset = offset;
-    sym->next = NULL;
 
     /* add it to the symbol table */
-    *table->pTail = sym;
-    table->pTail = &sym->next;
-    ++table->count;
+    AddToTable(c, table, sym, TRUE);
     
     /* return the symbol */
     return sym;
 }
 
+/* AddToTable - add a symbol to the end of a symbol table and to its hash buckets */
+static void AddToTable(ParseContext *c, SymbolTable *table, Symbol *sym, int local)
+{
+    *table->pTail = sym;
+    table->pTail = &sym->next;
+    ++table->count;
+
+    /* rebuild the hash buckets when the table outgrows them (the old buckets stay in the heap) */
+    if (table->count >= MIN_HASHED_SYMBOLS && table->count > table->bucketCount) {
+        int count = table->bucketCount ? table->bucketCount * 2 : MIN_HASHED_SYMBOLS * 2;
+        size_t size = count * sizeof(Symbol *);
+        Symbol *sym2;
+        table->buckets = (Symbol **)(local ? LocalAlloc(c, size) : GlobalAlloc(c, size));
+        table->bucketCount = count;
+        memset(table->buckets, 0, size);
+        for (sym2 = table->head; sym2 != NULL; sym2 = sym2->next) {
+            Symbol **pBucket = &table->buckets[HashName(sym2->name) & (count - 1)];
+            sym2->hashNext = *pBucket;
+            *pBucket = sym2;
+        }
+    }
+
+    /* otherwise just add the new symbol to its bucket */
+    else if (table->buckets) {
+        Symbol **pBucket = &table->buckets[HashName(sym->name) & (table->bucketCount - 1)];
+        sym->hashNext = *pBucket;
+        *pBucket = sym;
+    }
+}
+
 /* FindSymbol - find a symbol in a symbol table */
 Symbol *FindSymbol(SymbolTable *table, const char *name)
 {
-    Symbol *sym = table->head;
+    Symbol *sym;
+    if (table->buckets)
+        sym = table->buckets[HashName(name) & (table->bucketCount - 1)];
+    else
+        sym = table->head;
     while (sym) {
         if (strcasecmp(name, sym->name) == 0)
             return sym;
-        sym = sym->next;
+        sym = table->buckets ? sym->hashNext : sym->next;
     }
     return NULL;
 }
 
+/* HashName - compute a case insensitive hash of a symbol or label name */
+unsigned int HashName(const char *name)
+{
+    unsigned int hash = 2166136261u;
+    while (*name)
+        hash = (hash ^ tolower((unsigned char)*name++)) * 16777619u;
+    return hash;
+}
+
 /* IsConstant - check to see if the value of a symbol is a constant */
 int IsConstant(Symbol *symbol)
 {
@@ -4,176 +4,216 @@
  *
  */
 
+#include <stdlib.h>
 #include <string.h>
-#include <limits.h>
 #include "db_compiler.h"
 #include "db_vmdebug.h"
 
+/* initial size of a section buffer */
+#define SECTION_BUFFER_SIZE 4096
+
 /* prototypes */
-static void MakeTmpName(char *outfile, const char *infile, const char *sectionName);
 static void ShowSectionInfo(ParseContext *c, ImageFileSection *section);
 
-/* StartImage - start writing an image */
-int StartImage(ParseContext *c, const char *name)
+/* StartImage - start building an image in memory */
+int StartImage(ParseContext *c)
 {
     VMUVALUE dataOffset = sizeof(ImageFileHdr) + (c->config->sectionCount - 1) * sizeof(ImageFileSection);
     Section *section;
     
-    /* create temporary files for each section */
+    /* make an empty buffer for each section */
     for (section = c->config->sections; section != NULL; section = section->next) {
-        if (section == c->textTarget) {
-            if (!(section->fp = fopen(name, "w+b")))
-                return FALSE;
-            section->offset = dataOffset;
-        }
-        else {
-            char tmpname[PATH_MAX];
-            MakeTmpName(tmpname, name, section->name);
-            if (!(section->fp = xbCreateTmpFile(c->sys, tmpname, "w+b")))
-                return FALSE;
-            section->offset = 0;
+        if (!(section->data = (uint8_t *)malloc(SECTION_BUFFER_SIZE))) {
+            FreeImage(c);
+            return FALSE;
         }
+        section->allocated = SECTION_BUFFER_SIZE;
+        section->offset = 0;
+        section->zeroSize = 0;
     }
     
-    /* skip past the image header */
-    xbSeekFile(c->textTarget->fp, dataOffset, SEEK_SET);
+    /* leave room for the image header at the start of the text section */
+    c->textTarget->offset = dataOffset;
+    memset(c->textTarget->data, 0, dataOffset);
     
     /* return successfully */
     return TRUE;
 }
 
-/* BuildImage - build an image from the symbol table and objects already written to the image file */
-int BuildImage(ParseContext *c, const char *name)
+/* BuildImage - build an image from the symbol table and the section buffers */
+int BuildImage(ParseContext *c)
 {
     VMUVALUE dataOffset = 0;
-    ImageFileHdr fileHdr;
-    VMUVALUE size, cnt;
-    uint8_t buf[512];
+    ImageFileHdr *fileHdr;
+    ImageFileSection *fileSection;
+    VMUVALUE imageSize;
     Section *section;
+    uint8_t *p;
+    
+    /* determine the size of the image */
+    imageSize = 0;
+    for (section = c->config->sections; section != NULL; section = section->next)
+        imageSize += section->offset;
+    if (c->flags & COMPILER_SYMBOLS)
+        imageSize += DebugSectionSize(c);
+    
+    /* use the caller's buffer or allocate one */
+    if (c->imageBuffer) {
+        if (imageSize > c->imageBufferSize)
+            ParseError(c, "image too big for the buffer (%d bytes needed)", imageSize);
+        c->image = c->imageBuffer;
+    }
+    else if (!(c->image = (uint8_t *)malloc(imageSize)))
+        ParseError(c, "insufficient memory");
+    c->imageSize = imageSize;
     
-    /* initialize the image file header */
-    memset(&fileHdr, 0, sizeof(fileHdr));
-    memcpy(fileHdr.tag, IMAGE_TAG, sizeof(fileHdr.tag));
-    fileHdr.version = IMAGE_VERSION;
-    fileHdr.mainCode = c->mainCode;
-    fileHdr.stackSize = c->stackSize * sizeof(VMVALUE);
-    fileHdr.sectionCount = c->config->sectionCount;
+    /* initialize the image file header (it is at the start of the text section) */
+    fileHdr = (ImageFileHdr *)c->textTarget->data;
+    memcpy(fileHdr->tag, IMAGE_TAG, sizeof(fileHdr->tag));
+    fileHdr->version = IMAGE_VERSION;
+    if (c->flags & COMPILER_SYMBOLS)
+        fileHdr->flags |= IMAGE_FLAG_DEBUG;
+    fileHdr->mainCode = c->mainCode;
+    fileHdr->stackSize = c->stackSize * sizeof(VMVALUE);
+    fileHdr->sectionCount = c->config->sectionCount;
     if (c->flags & COMPILER_INFO)
-        xbInfo(c->sys, "%08x entry\n", fileHdr.mainCode);
-    fileHdr.sections[0].base = c->textTarget->base;
-    fileHdr.sections[0].offset = dataOffset;
-    fileHdr.sections[0].size = c->textTarget->offset;
+        xbInfo(c->sys, "%08x entry\n", fileHdr->mainCode);
+    fileHdr->sections[0].base = c->textTarget->base;
+    fileHdr->sections[0].offset = dataOffset;
+    fileHdr->sections[0].size = c->textTarget->offset;
+    fileHdr->sections[0].zeroSize = c->textTarget->zeroSize;
     if (c->flags & COMPILER_INFO)
-        ShowSectionInfo(c, &fileHdr.sections[0]);
-    /* write the image file header */
-    xbSeekFile(c->textTarget->fp, 0, SEEK_SET);
-
-    if (xbWriteFile(c->textTarget->fp, (uint8_t *)&fileHdr, sizeof(fileHdr)) != sizeof(fileHdr))
-        ParseError(c, "error writing image file");
-    dataOffset += fileHdr.sections[0].size;
+        ShowSectionInfo(c, &fileHdr->sections[0]);
+    dataOffset += fileHdr->sections[0].size;
 
+    /* add the headers of the remaining sections */
+    fileSection = &fileHdr->sections[1];
     for (section = c->config->sections; section != NULL; section = section->next) {
         if (section != c->textTarget) {
-            ImageFileSection fileSection;
-            fileSection.base = section->base;
-            fileSection.offset = dataOffset;
-            fileSection.size = section->offset;
+            fileSection->base = section->base;
+            fileSection->offset = dataOffset;
+            fileSection->size = section->offset;
+            fileSection->zeroSize = section->zeroSize;
             if (c->flags & COMPILER_INFO)
-                ShowSectionInfo(c, &fileSection);
-            if (xbWriteFile(c->textTarget->fp, (uint8_t *)&fileSection, sizeof(fileSection)) != sizeof(fileSection))
-                ParseError(c, "error writing image file");
-            dataOffset += fileSection.size;
+                ShowSectionInfo(c, fileSection);
+            dataOffset += fileSection->size;
+            ++fileSection;
         }
     }
 
-    /* write the remaining sections */
-    xbSeekFile(c->textTarget->fp, 0, SEEK_END);
+    /* copy the text section followed by the remaining sections */
+    p = c->image;
+    memcpy(p, c->textTarget->data, c->textTarget->offset);
+    p += c->textTarget->offset;
     for (section = c->config->sections; section != NULL; section = section->next) {
-        if (section != c->textTarget && section->fp) {
-            char tmpname[PATH_MAX];
-            xbSeekFile(section->fp, 0, SEEK_SET);
-            for (size = section->offset; size > 0; size -= cnt) {
-                if ((cnt = size) > sizeof(buf))
-                    cnt = sizeof(buf);
-                if (xbReadFile(section->fp, buf, cnt) != cnt)
-                    ParseError(c, "error reading data file");
-                if (xbWriteFile(c->textTarget->fp, buf, cnt) != cnt)
-                    ParseError(c, "error writing image file");
-            }
-            xbCloseFile(section->fp);
-            MakeTmpName(tmpname, name, section->name);
-            xbRemoveTmpFile(c->sys, tmpname);
+        if (section != c->textTarget) {
+            memcpy(p, section->data, section->offset);
+            p += section->offset;
         }
     }
     
-    /* close the image file */
-    xbCloseFile(c->textTarget->fp);
+    /* add the debug section after the section data */
+    if (c->flags & COMPILER_SYMBOLS)
+        WriteDebugSection(c, p);
+
+    /* the section buffers are no longer needed */
+    FreeSectionBuffers(c);
     
     return TRUE;
 }
 
+/* WriteImage - write the image to a file */
+int WriteImage(ParseContext *c, const char *name)
+{
+    void *fp;
+    int ok;
+    
+    if (!(fp = xbOpenFile(c->sys, name, "wb")))
+        return FALSE;
+    ok = xbWriteFile(fp, c->image, c->imageSize) == c->imageSize;
+    return xbCloseFile(fp) && ok;
+}
+
+/* FreeImage - free the image and the section buffers */
+void FreeImage(ParseContext *c)
+{
+    FreeSectionBuffers(c);
+    if (c->image && c->image != c->imageBuffer)
+        free(c->image);
+    c->image = NULL;
+    c->imageSize = 0;
+}
+
+/* FreeSectionBuffers - free the section buffers */
+void FreeSectionBuffers(ParseContext *c)
+{
+    Section *section;
+    for (section = c->config->sections; section != NULL; section = section->next) {
+        free(section->data);
+        section->data = NULL;
+        section->allocated = 0;
+    }
+}
+
 /* ShowSectionInfo - show information about a section */
 static void ShowSectionInfo(ParseContext *c, ImageFileSection *section)
 {
     xbInfo(c->sys, "%08x base\n", section->base);
     xbInfo(c->sys, "%08x file offset\n", section->offset);
     xbInfo(c->sys, "%08x size\n", section->size);
+    xbInfo(c->sys, "%08x zero fill\n", section->zeroSize);
 }
 
-/* WriteSection - write a block of memory to a section file */
+/* WriteSection - add a block of memory to a section (zero padded to a whole number of words) */
 VMUVALUE WriteSection(ParseContext *c, Section *section, const uint8_t *buf, VMUVALUE size)
 {
     VMUVALUE allocatedSize = ROUND_TO_WORDS(size);
-    if (xbWriteFile(section->fp, (uint8_t *)buf, allocatedSize) != allocatedSize)
-        ParseError(c, "insufficient %s section space", section->name);
+    
+    /* grow the section buffer if necessary */
+    if (section->offset + allocatedSize > section->allocated) {
+        VMUVALUE newSize = section->allocated * 2;
+        uint8_t *data;
+        while (section->offset + allocatedSize > newSize)
+            newSize *= 2;
+        if (!(data = (uint8_t *)realloc(section->data, newSize)))
+            ParseError(c, "insufficient %s section space", section->name);
+        section->data = data;
+        section->allocated = newSize;
+    }
+    
+    /* copy the data */
+    memcpy(section->data + section->offset, buf, size);
+    memset(section->data + section->offset + size, 0, allocatedSize - size);
     return allocatedSize;
 }
 
-/* ReadSectionOffset - read an offset in a section file */
+/* ReadSectionOffset - read an offset in a section */
 VMUVALUE ReadSectionOffset(ParseContext *c, Section *section, VMUVALUE offset)
 {
-    uint8_t buf[sizeof(VMUVALUE)], *p;
+    uint8_t *p = section->data + offset;
     VMUVALUE value = 0;
     int cnt;
 
-    xbSeekFile(section->fp, offset, SEEK_SET);
-    if (xbReadFile(section->fp, buf, sizeof(VMUVALUE)) != sizeof(VMUVALUE))
+    if (offset + sizeof(VMUVALUE) > section->offset)
         ParseError(c, "trouble reading offset in the %s section", section->name);
 
-    for (p = buf, cnt = sizeof(VMVALUE); --cnt >= 0; )
+    for (cnt = sizeof(VMVALUE); --cnt >= 0; )
         value = (value << 8) | *p++;
 
     return value;
 }
 
-/* WriteSectionOffset - overwrite an offset in a section file */
+/* WriteSectionOffset - overwrite an offset in a section */
 void WriteSectionOffset(ParseContext *c, Section *section, VMUVALUE offset, VMUVALUE value)
 {
-    uint8_t buf[sizeof(VMUVALUE)], *p;
+    uint8_t *p;
     int cnt;
     
-    for (p = buf + sizeof(VMVALUE), cnt = sizeof(VMVALUE); --cnt >= 0; ) {
-        *--p = value;
-        value >>= 8;
-    }
-    
-    xbSeekFile(section->fp, offset, SEEK_SET);
-    if (xbWriteFile(section->fp, buf, sizeof(VMUVALUE)) != sizeof(VMUVALUE))
+    if (offset + sizeof(VMUVALUE) > section->offset)
         ParseError(c, "trouble updating offset in the %s section", section->name);
-}
 
-/* MakeTmpName - make the name of a temporary section data file */
-static void MakeTmpName(char *outfile, const char *infile, const char *sectionName)
-{
-    char *end = strrchr(infile, '.');
-    if (end && !strchr(end, '/') && !strchr(end, '\\')) {
-        strncpy(outfile, infile, end - infile);
-        outfile[end - infile] = '\0';
+    for (p = section->data + offset + sizeof(VMVALUE), cnt = sizeof(VMVALUE); --cnt >= 0; ) {
+        *--p = value;
+        value >>= 8;
     }
-    else
-        strcpy(outfile, infile);
-    strcat(outfile,"-");
-    strcat(outfile,sectionName);
-    strcat(outfile,".tmp");
 }
-
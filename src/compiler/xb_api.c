@@ -1,59 +1,166 @@
 #include "db_compiler.h"
 #include "xb_api.h"
 
-/* compiler context */
-static ParseContext *c = NULL;
+static int WriteImageFile(ParseContext *c, void *data, int board, const uint8_t *image, size_t size);
 
-static void SourceRewind(void *cookie);
-static int SourceGetLine(void *cookie, char *buf, int len);
+ParseContext *xbInit(System *sys, BoardConfig *config, size_t maxCode)
+{
+    /* initialize a compiler (it is freed along with the system's heap) */
+    return InitCompiler(sys, config, maxCode);
+}
 
-int xbInit(System *sys, BoardConfig *config, size_t maxCode)
+int xbAddBoard(ParseContext *c, BoardConfig *config)
 {
-    /* initialize the compiler */
-    if (!(c = InitCompiler(sys, config, maxCode)))
-        return FALSE;
-    
-    /* return successfully */
-    return TRUE;
+    /* add another board to build an image for */
+    return AddBoard(c, config);
 }
 
-int xbCompile(const char *infile, const char *outfile, int flags)
+int xbCompile(ParseContext *c, const char *infile, const char *outfile, int flags)
 {
-    FILE *ifp;
-    
-    /* open the input file */
-    if (!(ifp = xbOpenFile(c->sys, infile, "r"))) {
-        fprintf(stderr, "error: can't open '%s'\n", infile);
+    return xbCompileBoards(c, infile, &outfile, flags);
+}
+
+int xbCompileBoards(ParseContext *c, const char *infile, const char **outfiles, int flags)
+{
+    /* write the image for each board to its file */
+    return xbCompileImages(c, infile, flags, WriteImageFile, (void *)outfiles);
+}
+
+static int WriteImageFile(ParseContext *c, void *data, int board, const uint8_t *image, size_t size)
+{
+    const char *outfile = ((const char **)data)[board];
+    if (!WriteImage(c, outfile)) {
+        xbError(c->sys, "error: can't write '%s'\n", outfile);
         return FALSE;
     }
+    return TRUE;
+}
+
+int xbCompileImages(ParseContext *c, const char *infile, int flags, xbImageHandler *handler, void *data)
+{
+    BoardConfig *config;
+    int result = TRUE;
+    int board;
     
     /* store the compiler flags */
     c->flags = flags;
     
-    /* setup source input */
-    c->mainFile.u.main.rewind = SourceRewind;
-    c->mainFile.u.main.getLine = SourceGetLine;
-    c->mainFile.u.main.getLineCookie = ifp;
+    /* setup source input (the whole file is read by the scanner) */
+    c->mainFile.name = infile;
     
-    /* compile the source file */
-    if (!Compile(c, outfile)) {
-        fprintf(stderr, "error: compile failed\n");
+    /* parse the source file */
+    if (!ParseProgram(c)) {
+        xbError(c->sys, "error: compile failed\n");
         return FALSE;
     }
     
-    /* close the files and remove the data section temporary file */
-    fclose(ifp);
+    /* build an image for each board and pass it to the handler */
+    for (config = c->boards, board = 0; config != NULL; config = config->next, ++board) {
+        if (!GenerateImage(c, config)) {
+            if (c->boards->next)
+                xbError(c->sys, "error: compile failed for board '%s'\n", config->name);
+            else
+                xbError(c->sys, "error: compile failed\n");
+            result = FALSE;
+        }
+        else {
+            if (!(*handler)(c, data, board, c->image, c->imageSize))
+                result = FALSE;
+            FreeImage(c);
+        }
+    }
+    EndCompile(c);
 
-    /* return successfully */
-    return TRUE;
+    /* return successfully if the handler took all of the images */
+    return result;
 }
 
-static void SourceRewind(void *cookie)
+SourceCache *xbNewSourceCache(void)
 {
-    xbSeekFile(cookie, 0, SEEK_SET);
+    return NewSourceCache();
 }
 
-static int SourceGetLine(void *cookie, char *buf, int len)
+void xbFreeSourceCache(SourceCache *cache)
 {
-	return xbGetLine(cookie, buf, len) != NULL;
+    FreeSourceCache(cache);
+}
+
+void xbUseSourceCache(ParseContext *c, SourceCache *cache)
+{
+    /* include files are taken from the cache (and added to it) */
+    c->sourceCache = cache;
+}
+
+int xbCompileModule(ParseContext *c, const char *infile, const char *outfile, int flags)
+{
+    int result;
+
+    /* store the compiler flags */
+    c->flags = flags | COMPILER_MODULE;
+
+    /* setup source input (the whole file is read by the scanner) */
+    c->mainFile.name = infile;
+
+    /* parse the source file and write the module (or keep it in the source cache if there is no file) */
+    if (!ParseProgram(c)) {
+        xbError(c->sys, "error: compile failed\n");
+        return FALSE;
+    }
+    result = GenerateModule(c, outfile);
+    EndCompile(c);
+    c->moduleOut = NULL;
+
+    /* return the result */
+    return result;
+}
+
+int xbBuildCachedModules(System *sys, BoardConfig *config, size_t maxCode, SourceCache *cache)
+{
+    CachedModule *entry;
+    ParseContext *c;
+    int count = 0;
+
+    /* build a module for each include file that had to be parsed (building one can note others) */
+    while ((entry = NextPendingModule(cache)) != NULL) {
+        if (!(c = InitCompiler(sys, config, maxCode)))
+            break;
+        c->sourceCache = cache;
+        if (xbCompileModule(c, entry->path, NULL, 0))
+            ++count;
+        else
+            DropCachedModule(cache, entry);
+    }
+
+    /* return the number of modules built */
+    return count;
+}
+
+int xbCompileToBuffer(ParseContext *c, const char *infile, uint8_t *buf, size_t size, size_t *pSize, int flags)
+{
+    int result;
+
+    /* store the compiler flags */
+    c->flags = flags;
+
+    /* setup source input and the image buffer */
+    c->mainFile.name = infile;
+    c->imageBuffer = buf;
+    c->imageBufferSize = size;
+
+    /* compile the source file (the image is built in the caller's buffer) */
+    result = Compile(c);
+    c->imageBuffer = NULL;
+    c->imageBufferSize = 0;
+    if (!result) {
+        fprintf(stderr, "error: compile failed\n");
+        return FALSE;
+    }
+
+    /* return the size of the image */
+    *pSize = c->imageSize;
+    c->image = NULL;
+    c->imageSize = 0;
+
+    /* return successfully */
+    return TRUE;
 }
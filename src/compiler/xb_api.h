@@ -4,8 +4,30 @@
 /* compiler flags */
 #define COMPILER_DEBUG  (1 << 0)
 #define COMPILER_INFO   (1 << 1)
+#define COMPILER_SYMBOLS (1 << 2)
+#define COMPILER_STATS  (1 << 3)    /* show the time and memory used by each phase */
+#define COMPILER_STATS_TSV (1 << 4) /* ... as tab separated values */
+#define COMPILER_MODULE (1 << 5)    /* compile a library module (set by xbCompileModule) */
 
-int xbInit(System *sys, BoardConfig *config, size_t maxCode);
-int xbCompile(const char *infile, const char *outfile, int flags);
+/* compiler context (each thread compiling needs its own along with its own system interface) */
+typedef struct ParseContext ParseContext;
+
+/* include files and the modules built for them kept between compiles (used by one compile at a time) */
+typedef struct SourceCache SourceCache;
+
+ParseContext *xbInit(System *sys, BoardConfig *config, size_t maxCode);
+int xbAddBoard(ParseContext *c, BoardConfig *config);
+int xbCompile(ParseContext *c, const char *infile, const char *outfile, int flags);
+int xbCompileBoards(ParseContext *c, const char *infile, const char **outfiles, int flags);
+
+/* called with the image built for each board in the order they were added (FALSE if it can't be used) */
+typedef int xbImageHandler(ParseContext *c, void *data, int board, const uint8_t *image, size_t size);
+int xbCompileImages(ParseContext *c, const char *infile, int flags, xbImageHandler *handler, void *data);
+SourceCache *xbNewSourceCache(void);
+void xbFreeSourceCache(SourceCache *cache);
+void xbUseSourceCache(ParseContext *c, SourceCache *cache);
+int xbCompileModule(ParseContext *c, const char *infile, const char *outfile, int flags);
+int xbBuildCachedModules(System *sys, BoardConfig *config, size_t maxCode, SourceCache *cache);
+int xbCompileToBuffer(ParseContext *c, const char *infile, uint8_t *buf, size_t size, size_t *pSize, int flags);
 
 #endif
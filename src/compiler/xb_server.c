@@ -0,0 +1,634 @@
+/* xb_server.c - a compile server that keeps board configurations and include files between compiles
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ * The server listens on a unix domain socket and handles one request per
+ * connection, one connection at a time.  A request is a list of lines
+ * ending with a blank line:
+ *
+ *   file <path>        source file to compile (relative to the server's directory)
+ *   board <name>       board to build an image for (a line for each board, hub if none)
+ *   flags <n>          compiler flags (COMPILER_xxx in xb_api.h)
+ *   include <path>     directory to search for include files before the server's path
+ *
+ * The reply is a list of records.  Each one is a line with the record type
+ * and the number of bytes of data that follow the line:
+ *
+ *   output <n>         text the compiler wrote to stdout
+ *   errors <n>         text the compiler wrote to stderr
+ *   diagnostic <n>     an error as <file> TAB <line> TAB <column> TAB <message>
+ *   image <n> <board>  image built for a board
+ *   status <n>         "ok" or "failed" (always the last record)
+ *
+ * The board configuration file and the include files are read again only
+ * when their modification time (to the nanosecond where the file system keeps
+ * it) or size changes.  The main file is always
+ * read since it is the one being edited.  After replying the server builds
+ * a library module (see db_module.c) for each include file the compile had
+ * to parse so later compiles take its definitions and code from the module
+ * instead of parsing and checking the file again.
+ *
+ * Requests are handled one at a time so a client that stops sending or
+ * reading holds up the others until the connection times out after
+ * CLIENT_TIMEOUT seconds.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "db_compiler.h"
+#include "xb_server.h"
+#include "mem_malloc.h"
+
+/* board configuration file */
+#define CONFIG_FILE     "xbasic.cfg"
+
+/* seconds a client has to send its request or take a reply record */
+#define CLIENT_TIMEOUT  10
+
+/* maximum length of a request line */
+#define MAXLINE         (PATH_MAX + 16)
+
+/* board configuration file kept between requests */
+typedef struct ConfigFile ConfigFile;
+struct ConfigFile {
+    ConfigFile *next;           /* next configuration file */
+    BoardConfig *configs;       /* boards in the file */
+    time_t modTime;             /* modification time of the file when it was read */
+    long modTimeNsec;           /* nanoseconds part of the modification time */
+    long fileSize;              /* size of the file when it was read */
+    char path[1];               /* path where the file was found */
+};
+
+/* server state */
+typedef struct {
+    const char **paths;         /* include paths from the command line */
+    int pathCount;              /* number of include paths */
+    ConfigFile *configFiles;    /* board configuration files that have been read */
+    SourceCache *sourceCache;   /* include files that have been read */
+} Server;
+
+/* compile request */
+typedef struct {
+    char file[PATH_MAX];                        /* source file */
+    char boards[SERVER_MAXBOARDS][MAXTOKEN];    /* boards to build images for */
+    int boardCount;                             /* number of boards */
+    int flags;                                  /* compiler flags */
+    char paths[SERVER_MAXPATHS][PATH_MAX];      /* include paths */
+    int pathCount;                              /* number of include paths */
+} Request;
+
+/* buffered connection */
+typedef struct {
+    int fd;                     /* socket */
+    char buf[1024];             /* input buffer */
+    char *ptr;                  /* next character in the input buffer */
+    int count;                  /* number of characters left in the input buffer */
+} Connection;
+
+static volatile sig_atomic_t stopServer = FALSE;
+
+static void StopServer(int sig);
+static void HandleRequest(Server *server, Connection *conn);
+static int ParseRequest(Connection *conn, Request *request);
+static BoardConfig *GetConfigs(Server *server, System *sys);
+static void FreeConfigFiles(ConfigFile *file);
+static int SendImage(ParseContext *c, void *data, int board, const uint8_t *image, size_t size);
+static void ServerInfo(System *sys, const char *fmt, va_list ap);
+static void ServerError(System *sys, const char *fmt, va_list ap);
+static void ServerDiagnostic(System *sys, const Diagnostic *diagnostic);
+static void QuietInfo(System *sys, const char *fmt, va_list ap);
+static void QuietDiagnostic(System *sys, const Diagnostic *diagnostic);
+static void SendText(Connection *conn, const char *type, const char *fmt, va_list ap);
+static int SendRecord(Connection *conn, const char *type, const char *arg, const void *data, size_t size);
+static int MakeAddress(const char *socketPath, struct sockaddr_un *addr);
+static void InitConnection(Connection *conn, int fd);
+static int ReadLine(Connection *conn, char *line, size_t size);
+static int ReadData(Connection *conn, void *buf, size_t size);
+static int WriteData(Connection *conn, const void *buf, size_t size);
+
+static SystemOps serverOps = {
+    ServerInfo,
+    ServerError,
+    ServerDiagnostic
+};
+
+/* the output of the module builds after the reply goes nowhere */
+static SystemOps quietOps = {
+    QuietInfo,
+    QuietInfo,
+    QuietDiagnostic
+};
+
+/* RunCompileServer - handle compile requests until the server is interrupted */
+int RunCompileServer(const char *socketPath, const char **paths, int pathCount)
+{
+    struct sockaddr_un addr;
+    struct sigaction action;
+    struct timeval timeout;
+    Connection conn;
+    Server server;
+    int fd, client;
+
+    /* initialize the server state */
+    memset(&server, 0, sizeof(server));
+    server.paths = paths;
+    server.pathCount = pathCount;
+    if (!(server.sourceCache = xbNewSourceCache())) {
+        fprintf(stderr, "error: insufficient memory\n");
+        return FALSE;
+    }
+
+    /* create the socket (replacing one left behind by an earlier server) */
+    if (!MakeAddress(socketPath, &addr))
+        return FALSE;
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        perror("error: socket");
+        return FALSE;
+    }
+    unlink(socketPath);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+        perror("error: bind");
+        close(fd);
+        return FALSE;
+    }
+
+    /* stop when interrupted (without restarting accept) and keep going if a client goes away */
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = StopServer;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    /* handle requests one at a time (a client that stalls is dropped when a read or write times out) */
+    timeout.tv_sec = CLIENT_TIMEOUT;
+    timeout.tv_usec = 0;
+    while (!stopServer) {
+        if ((client = accept(fd, NULL, NULL)) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("error: accept");
+            break;
+        }
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        InitConnection(&conn, client);
+        HandleRequest(&server, &conn);
+        close(client);
+    }
+
+    /* remove the socket and free the caches */
+    close(fd);
+    unlink(socketPath);
+    FreeConfigFiles(server.configFiles);
+    xbFreeSourceCache(server.sourceCache);
+
+    return TRUE;
+}
+
+/* StopServer - stop the server after the request in progress */
+static void StopServer(int sig)
+{
+    stopServer = TRUE;
+}
+
+/* HandleRequest - handle a compile request */
+static void HandleRequest(Server *server, Connection *conn)
+{
+    BoardConfig *configs, *config;
+    ParseContext *c;
+    Request *request;
+    int result = FALSE;
+    System *sys;
+    int i;
+
+    /* get the request */
+    if (!(request = (Request *)malloc(sizeof(Request))))
+        return;
+    if (!ParseRequest(conn, request)) {
+        SendRecord(conn, "errors", NULL, "error: bad request\n", 19);
+        SendRecord(conn, "status", NULL, "failed", 6);
+        free(request);
+        return;
+    }
+
+    /* make a system interface that sends its output to the client */
+    if (!(sys = MemInit())) {
+        free(request);
+        return;
+    }
+    sys->ops = &serverOps;
+    sys->opsData = conn;
+
+    /* the request's include paths come before the server's */
+    for (i = 0; i < request->pathCount; ++i)
+        xbAddToPath(sys, request->paths[i]);
+    for (i = 0; i < server->pathCount; ++i)
+        xbAddToPath(sys, server->paths[i]);
+    xbAddEnvironmentPath(sys);
+
+    /* get the board configurations */
+    if (!(configs = GetConfigs(server, sys)))
+        xbError(sys, "error: can't read %s\n", CONFIG_FILE);
+
+    /* setup a compiler for the boards */
+    else if (!(config = GetBoardConfig(configs, request->boards[0])))
+        xbError(sys, "error: no board type: %s\n", request->boards[0]);
+    else if (!(c = xbInit(sys, config, MAXCODE)))
+        xbError(sys, "error: compiler initialization failed\n");
+    else {
+        for (i = 1; i < request->boardCount; ++i) {
+            if (!(config = GetBoardConfig(configs, request->boards[i]))) {
+                xbError(sys, "error: no board type: %s\n", request->boards[i]);
+                break;
+            }
+            if (!xbAddBoard(c, config))
+                break;
+        }
+
+        /* compile the file using the cached include files */
+        if (i >= request->boardCount) {
+            xbUseSourceCache(c, server->sourceCache);
+            result = xbCompileImages(c, request->file, request->flags, SendImage, request);
+            if (request->flags & COMPILER_INFO)
+                xbInfo(sys, "%d include files read from the cache, %d read from disk, %d cached modules used\n",
+                       server->sourceCache->hits, server->sourceCache->misses, server->sourceCache->moduleHits);
+        }
+    }
+
+    /* send the result */
+    SendRecord(conn, "status", NULL, result ? "ok" : "failed", result ? 2 : 6);
+
+    /* build modules for the include files that were parsed (for the next compile) */
+    if (result) {
+        sys->ops = &quietOps;
+        xbBuildCachedModules(sys, config, MAXCODE, server->sourceCache);
+    }
+
+    /* free the compiler and all of its memory */
+    MemFree(sys);
+    free(request);
+}
+
+/* ParseRequest - read a request */
+static int ParseRequest(Connection *conn, Request *request)
+{
+    char line[MAXLINE], *value;
+
+    /* initialize the request */
+    request->file[0] = '\0';
+    request->boardCount = 0;
+    request->flags = 0;
+    request->pathCount = 0;
+
+    /* read lines up to a blank line */
+    for (;;) {
+        if (!ReadLine(conn, line, sizeof(line)))
+            return FALSE;
+        if (line[0] == '\0')
+            break;
+        if (!(value = strchr(line, ' ')))
+            return FALSE;
+        *value++ = '\0';
+        if (strcmp(line, "file") == 0) {
+            if (strlen(value) >= sizeof(request->file))
+                return FALSE;
+            strcpy(request->file, value);
+        }
+        else if (strcmp(line, "board") == 0) {
+            if (request->boardCount >= SERVER_MAXBOARDS || strlen(value) >= MAXTOKEN)
+                return FALSE;
+            strcpy(request->boards[request->boardCount++], value);
+        }
+        else if (strcmp(line, "flags") == 0)
+            request->flags = atoi(value);
+        else if (strcmp(line, "include") == 0) {
+            if (request->pathCount >= SERVER_MAXPATHS || strlen(value) >= PATH_MAX)
+                return FALSE;
+            strcpy(request->paths[request->pathCount++], value);
+        }
+        else
+            return FALSE;
+    }
+
+    /* there must be a file and there is always at least one board */
+    if (!request->file[0])
+        return FALSE;
+    if (request->boardCount == 0)
+        strcpy(request->boards[request->boardCount++], "hub");
+
+    return TRUE;
+}
+
+/* GetConfigs - get the boards in the configuration file, reading it if it is new or has changed */
+static BoardConfig *GetConfigs(Server *server, System *sys)
+{
+    ConfigFile *file, **pFile;
+    char fullpath[PATH_MAX];
+    const char *path;
+    time_t modTime;
+    long modTimeNsec;
+    long fileSize;
+
+    /* find the configuration file the way ParseConfigurationFile would */
+    if (!(path = xbFindFileInPath(sys, CONFIG_FILE, fullpath)) || !xbFileInfo(path, &modTime, &modTimeNsec, &fileSize))
+        return NULL;
+
+    /* look for the file dropping it if it has changed */
+    for (pFile = &server->configFiles; (file = *pFile) != NULL; pFile = &file->next) {
+        if (strcmp(path, file->path) == 0) {
+            if (file->modTime == modTime && file->modTimeNsec == modTimeNsec && file->fileSize == fileSize)
+                return file->configs;
+            *pFile = file->next;
+            FreeBoardConfigs(file->configs);
+            free(file);
+            break;
+        }
+    }
+
+    /* read the file */
+    if (!(file = (ConfigFile *)malloc(sizeof(ConfigFile) + strlen(path))))
+        return NULL;
+    if (!(file->configs = ParseConfigurationFile(sys, path))) {
+        free(file);
+        return NULL;
+    }
+    strcpy(file->path, path);
+    file->modTime = modTime;
+    file->modTimeNsec = modTimeNsec;
+    file->fileSize = fileSize;
+    file->next = server->configFiles;
+    server->configFiles = file;
+
+    return file->configs;
+}
+
+/* FreeConfigFiles - free a list of configuration files */
+static void FreeConfigFiles(ConfigFile *file)
+{
+    ConfigFile *next;
+    for (; file != NULL; file = next) {
+        next = file->next;
+        FreeBoardConfigs(file->configs);
+        free(file);
+    }
+}
+
+/* SendImage - send the image for a board to the client */
+static int SendImage(ParseContext *c, void *data, int board, const uint8_t *image, size_t size)
+{
+    Request *request = (Request *)data;
+    return SendRecord((Connection *)c->sys->opsData, "image", request->boards[board], image, size);
+}
+
+/* ServerInfo - send text written to stdout to the client */
+static void ServerInfo(System *sys, const char *fmt, va_list ap)
+{
+    SendText((Connection *)sys->opsData, "output", fmt, ap);
+}
+
+/* ServerError - send text written to stderr to the client */
+static void ServerError(System *sys, const char *fmt, va_list ap)
+{
+    SendText((Connection *)sys->opsData, "errors", fmt, ap);
+}
+
+/* ServerDiagnostic - send an error and its location to the client */
+static void ServerDiagnostic(System *sys, const Diagnostic *diagnostic)
+{
+    char buf[PATH_MAX + 256];
+    int length = snprintf(buf, sizeof(buf), "%s\t%d\t%d\t%s",
+                          diagnostic->file ? diagnostic->file : "",
+                          diagnostic->lineNumber,
+                          diagnostic->column,
+                          diagnostic->message);
+    if (length >= (int)sizeof(buf))
+        length = sizeof(buf) - 1;
+    SendRecord((Connection *)sys->opsData, "diagnostic", NULL, buf, length);
+}
+
+/* QuietInfo - drop text written to stdout or stderr */
+static void QuietInfo(System *sys, const char *fmt, va_list ap)
+{
+}
+
+/* QuietDiagnostic - drop an error */
+static void QuietDiagnostic(System *sys, const Diagnostic *diagnostic)
+{
+}
+
+/* SendText - send formatted text to the client */
+static void SendText(Connection *conn, const char *type, const char *fmt, va_list ap)
+{
+    char buf[1024], *text = buf;
+    va_list ap2;
+    int length;
+
+    /* format the text (long text like a disassembly line gets a bigger buffer) */
+    va_copy(ap2, ap);
+    length = vsnprintf(buf, sizeof(buf), fmt, ap);
+    if (length >= (int)sizeof(buf) && (text = (char *)malloc(length + 1)) != NULL)
+        vsnprintf(text, length + 1, fmt, ap2);
+    va_end(ap2);
+
+    /* send it */
+    if (text) {
+        SendRecord(conn, type, NULL, text, length);
+        if (text != buf)
+            free(text);
+    }
+}
+
+/* SendRecord - send a reply record */
+static int SendRecord(Connection *conn, const char *type, const char *arg, const void *data, size_t size)
+{
+    char header[MAXTOKEN + 64];
+    if (arg)
+        sprintf(header, "%s %lu %.*s\n", type, (unsigned long)size, MAXTOKEN, arg);
+    else
+        sprintf(header, "%s %lu\n", type, (unsigned long)size);
+    return WriteData(conn, header, strlen(header)) && WriteData(conn, data, size);
+}
+
+/* CompileWithServer - compile a file using a compile server */
+int CompileWithServer(const char *socketPath, const char *infile, const char **boards, int boardCount,
+                      const char **paths, int pathCount, int flags, const char **outfiles)
+{
+    char fullpath[PATH_MAX], line[MAXLINE], type[MAXTOKEN], arg[MAXTOKEN];
+    struct sockaddr_un addr;
+    int result = FALSE;
+    Connection conn;
+    unsigned long size;
+    int fd, fd2, i;
+    FILE *fp;
+
+    /* connect to the server */
+    if (!MakeAddress(socketPath, &addr))
+        return FALSE;
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "error: can't connect to the compile server at '%s'\n", socketPath);
+        if (fd >= 0)
+            close(fd);
+        return FALSE;
+    }
+    InitConnection(&conn, fd);
+    signal(SIGPIPE, SIG_IGN);
+
+    /* send the request (the server may be running in another directory) */
+    if ((fd2 = dup(fd)) < 0 || !(fp = fdopen(fd2, "w"))) {
+        perror("error: can't send the request to the compile server");
+        if (fd2 >= 0)
+            close(fd2);
+        close(fd);
+        return FALSE;
+    }
+    fprintf(fp, "file %s\n", realpath(infile, fullpath) ? fullpath : infile);
+    for (i = 0; i < boardCount; ++i)
+        fprintf(fp, "board %s\n", boards[i]);
+    fprintf(fp, "flags %d\n", flags);
+    for (i = 0; i < pathCount; ++i)
+        fprintf(fp, "include %s\n", realpath(paths[i], fullpath) ? fullpath : paths[i]);
+    fprintf(fp, "\n");
+    if (fclose(fp) != 0) {
+        perror("error: can't send the request to the compile server");
+        close(fd);
+        return FALSE;
+    }
+
+    /* handle the reply records */
+    while (ReadLine(&conn, line, sizeof(line))) {
+        uint8_t *data;
+
+        /* get the record header and data */
+        arg[0] = '\0';
+        if (sscanf(line, "%31s %lu %31s", type, &size, arg) < 2 || !(data = (uint8_t *)malloc(size + 1)))
+            break;
+        if (!ReadData(&conn, data, size)) {
+            free(data);
+            break;
+        }
+        data[size] = '\0';
+
+        /* compiler output */
+        if (strcmp(type, "output") == 0)
+            fwrite(data, 1, size, stdout);
+        else if (strcmp(type, "errors") == 0)
+            fwrite(data, 1, size, stderr);
+
+        /* images are written to the file for the board */
+        else if (strcmp(type, "image") == 0) {
+            for (i = 0; i < boardCount; ++i)
+                if (strcmp(arg, boards[i]) == 0)
+                    break;
+            if (i < boardCount) {
+                if (!(fp = fopen(outfiles[i], "wb")) || fwrite(data, 1, size, fp) != size) {
+                    fprintf(stderr, "error: can't write '%s'\n", outfiles[i]);
+                    boardCount = 0; /* ignore any other images */
+                }
+                if (fp)
+                    fclose(fp);
+            }
+        }
+
+        /* the status is the last record */
+        else if (strcmp(type, "status") == 0) {
+            result = strcmp((char *)data, "ok") == 0 && boardCount > 0;
+            free(data);
+            break;
+        }
+
+        /* diagnostics are for tools that show errors in the source */
+        free(data);
+    }
+    close(fd);
+
+    return result;
+}
+
+/* MakeAddress - make the address of a socket */
+static int MakeAddress(const char *socketPath, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "error: socket path too long: %s\n", socketPath);
+        return FALSE;
+    }
+    strcpy(addr->sun_path, socketPath);
+    return TRUE;
+}
+
+/* InitConnection - initialize a buffered connection */
+static void InitConnection(Connection *conn, int fd)
+{
+    conn->fd = fd;
+    conn->ptr = conn->buf;
+    conn->count = 0;
+}
+
+/* ReadLine - read a line without its newline */
+static int ReadLine(Connection *conn, char *line, size_t size)
+{
+    size_t length = 0;
+    char ch;
+    for (;;) {
+        if (!ReadData(conn, &ch, 1))
+            return FALSE;
+        if (ch == '\n')
+            break;
+        if (length >= size - 1)
+            return FALSE;
+        line[length++] = ch;
+    }
+    line[length] = '\0';
+    return TRUE;
+}
+
+/* ReadData - read a block of data */
+static int ReadData(Connection *conn, void *buf, size_t size)
+{
+    char *p = (char *)buf;
+    while (size > 0) {
+        size_t n;
+        if (conn->count == 0) {
+            ssize_t count = read(conn->fd, conn->buf, sizeof(conn->buf));
+            if (count < 0 && errno == EINTR)
+                continue;
+            if (count <= 0)
+                return FALSE;
+            conn->ptr = conn->buf;
+            conn->count = (int)count;
+        }
+        n = size < (size_t)conn->count ? size : (size_t)conn->count;
+        memcpy(p, conn->ptr, n);
+        conn->ptr += n;
+        conn->count -= (int)n;
+        p += n;
+        size -= n;
+    }
+    return TRUE;
+}
+
+/* WriteData - write a block of data */
+static int WriteData(Connection *conn, const void *buf, size_t size)
+{
+    const char *p = (const char *)buf;
+    while (size > 0) {
+        ssize_t count = write(conn->fd, p, size);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return FALSE;
+        p += count;
+        size -= count;
+    }
+    return TRUE;
+}
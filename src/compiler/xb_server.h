@@ -0,0 +1,18 @@
+/* xb_server.h - compile server definitions
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#ifndef __XB_SERVER_H__
+#define __XB_SERVER_H__
+
+/* maximum number of boards and include paths in a request */
+#define SERVER_MAXBOARDS    8
+#define SERVER_MAXPATHS     32
+
+int RunCompileServer(const char *socketPath, const char **paths, int pathCount);
+int CompileWithServer(const char *socketPath, const char *infile, const char **boards, int boardCount,
+                      const char **paths, int pathCount, int flags, const char **outfiles);
+
+#endif
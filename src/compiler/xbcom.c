@@ -8,6 +8,18 @@
 #include "db_packet.h"
 #include "mem_malloc.h"
 
+/* batch compiles (-j) use a thread pool where there are posix threads */
+#if defined(LINUX) || defined(MACOSX) || defined(CYGWIN)
+#define USE_THREADS
+#include <pthread.h>
+#endif
+
+/* compile servers (--server and -S) use unix domain sockets */
+#if defined(LINUX) || defined(MACOSX) || defined(CYGWIN)
+#define USE_SERVER
+#include "xb_server.h"
+#endif
+
 /* defaults */
 #if defined(CYGWIN) || defined(WIN32)
 #define DEF_PORT    "COM1"
@@ -20,6 +32,44 @@
 #endif
 #define DEF_BOARD   "hub"
 
+/* maximum number of include paths on the command line */
+#define MAXPATHS    32
+
+/* maximum number of boards in a -b list */
+#define MAXBOARDS   8
+
+/* file to compile */
+typedef struct {
+    const char *infile;         /* source file */
+    char outfile[PATH_MAX];     /* image file */
+    int result;                 /* TRUE if the compile succeeded */
+} Job;
+
+/* batch of files to compile (each compile has its own system interface and compiler) */
+typedef struct {
+    BoardConfig *configs[MAXBOARDS]; /* target boards (an image is built for each one) */
+    const char *boards[MAXBOARDS]; /* board names as given with -b (used to name the images) */
+    int configCount;            /* number of target boards */
+    const char *paths[MAXPATHS];/* include paths from the command line */
+    int pathCount;              /* number of include paths */
+    int flags;                  /* compiler flags */
+    int modules;                /* compile library modules instead of programs (-c) */
+    const char *server;         /* compile server socket (-S) */
+    Job *jobs;                  /* files to compile */
+    int jobCount;               /* number of files to compile */
+    int nextJob;                /* next file to compile */
+#ifdef USE_THREADS
+    pthread_mutex_t lock;       /* lock for nextJob */
+#endif
+} Batch;
+
+static void CompileBatch(Batch *batch, int threadCount);
+#ifdef USE_THREADS
+static void *CompileThread(void *arg);
+#endif
+static Job *NextJob(Batch *batch);
+static int CompileFile(Batch *batch, Job *job);
+static void ImageNames(Batch *batch, Job *job, char outfiles[][PATH_MAX], const char **names);
 static void Usage(void);
 static char *ConstructOutputName(const char *infile, char *outfile, char *ext);
 
@@ -32,17 +82,27 @@ static SystemOps myOps = {
 
 int main(int argc, char *argv[])
 {
-    char *infile = NULL, outfile[PATH_MAX];
-    char *port, *board, *p;
-    BoardConfig *config;
+    BoardConfig *configs, *config;
+    char *port, *board, *p, *next, *outfile;
     int writeEepromLoader = FALSE;
     int runImage = FALSE;
     int terminalMode = FALSE;
-    int compilerFlags = 0;
     int runFlags = 0;
+    int threadCount = 1;
+#ifdef USE_SERVER
+    char *serverSocket = NULL;
+#endif
+    Batch batch;
     System *sys;
     int i;
     
+    /* initialize the batch */
+    memset(&batch, 0, sizeof(batch));
+    if (!(batch.jobs = (Job *)malloc(argc * sizeof(Job)))) {
+        fprintf(stderr, "error: insufficient memory\n");
+        return 1;
+    }
+    
     /* get the environment settings */
     if (!(port = getenv("PORT")))
         port = DEF_PORT;
@@ -83,6 +143,9 @@ int main(int argc, char *argv[])
 #endif
                 }
                 break;
+            case 'c':   // compile library modules
+                batch.modules = TRUE;
+                break;
             case 'e':
                 writeEepromLoader = TRUE;
                 break;
@@ -99,10 +162,19 @@ int main(int argc, char *argv[])
                 runFlags |= RUN_PAUSE;
                 break;
             case 'D':
-                compilerFlags |= COMPILER_DEBUG;
+                batch.flags |= COMPILER_DEBUG;
                 break;
             case 'v':
-                compilerFlags |= COMPILER_INFO;
+                batch.flags |= COMPILER_INFO;
+                break;
+            case 'T':
+                batch.flags |= COMPILER_STATS;
+                break;
+            case 'M':
+                batch.flags |= COMPILER_STATS | COMPILER_STATS_TSV;
+                break;
+            case 'g':
+                batch.flags |= COMPILER_SYMBOLS;
                 break;
             case 'I':
                 if(argv[i][2])
@@ -111,7 +183,42 @@ int main(int argc, char *argv[])
                     p = argv[i];
                 else
                     Usage();
-                xbAddToPath(p);
+                if (batch.pathCount >= MAXPATHS) {
+                    fprintf(stderr, "error: too many include paths\n");
+                    return 1;
+                }
+                batch.paths[batch.pathCount++] = p;
+                break;
+#ifdef USE_SERVER
+            case 'S':   // compile using a compile server
+                if (argv[i][2])
+                    batch.server = &argv[i][2];
+                else if (++i < argc)
+                    batch.server = argv[i];
+                else
+                    Usage();
+                break;
+#endif
+            case 'j':   // number of files to compile at once
+            case '-':   // --jobs or --server
+#ifdef USE_SERVER
+                if (strcmp(argv[i], "--server") == 0) {
+                    if (++i >= argc)
+                        Usage();
+                    serverSocket = argv[i];
+                    break;
+                }
+#endif
+                if (argv[i][1] == '-' && strcmp(argv[i], "--jobs") != 0)
+                    Usage();
+                if (argv[i][1] == 'j' && argv[i][2])
+                    p = &argv[i][2];
+                else if (++i < argc)
+                    p = argv[i];
+                else
+                    Usage();
+                if ((threadCount = atoi(p)) < 1)
+                    Usage();
                 break;
             default:
                 Usage();
@@ -119,27 +226,51 @@ int main(int argc, char *argv[])
             }
         }
 
-        /* handle the input filename */
+        /* handle the input filenames */
         else {
-            if (infile)
-                Usage();
-            infile = argv[i];
+            Job *job = &batch.jobs[batch.jobCount++];
+            job->infile = argv[i];
+            ConstructOutputName(job->infile, job->outfile, ".bai");
+            job->result = FALSE;
         }
     }
     
+#ifdef USE_SERVER
+    /* run a compile server until it is interrupted */
+    if (serverSocket) {
+        if (batch.jobCount > 0)
+            Usage();
+        return RunCompileServer(serverSocket, batch.paths, batch.pathCount) ? 0 : 1;
+    }
+#endif
+
     /* make sure an input file was specified */
-    if (!infile)
+    if (batch.jobCount == 0)
         Usage();
+    outfile = batch.jobs[0].outfile;
+
+    /* library modules are written next to their source files and can't be run */
+    if (batch.modules) {
+        if (writeEepromLoader || runImage || terminalMode) {
+            fprintf(stderr, "error: library modules can't be used with -r, -e or -t\n");
+            return 1;
+        }
+        for (i = 0; i < batch.jobCount; ++i)
+            ConstructOutputName(batch.jobs[i].infile, batch.jobs[i].outfile, ".bao");
+    }
 
-    /* create the output file name */
-    ConstructOutputName(infile, outfile, ".bai");
-    
     /* make sure -e and -r aren't used together */
     if (writeEepromLoader && runImage) {
         fprintf(stderr, "error: writing the eeprom loader and running the program are mutually exclusive\n");
         return 1;
     }
         
+    /* only a single program can be loaded */
+    if ((runImage || writeEepromLoader || terminalMode) && (batch.jobCount > 1 || strchr(board, ','))) {
+        fprintf(stderr, "error: only one file and board can be compiled with -r, -e or -t\n");
+        return 1;
+    }
+        
     /* initialize the memory allocator */
     if (!(sys = MemInit())) {
         fprintf(stderr, "error: memory initialization failed\n");
@@ -147,30 +278,36 @@ int main(int argc, char *argv[])
     }
     sys->ops = &myOps;
         
-    /* add the XB_INC environment path */
-    xbAddEnvironmentPath();
+    /* add the include paths */
+    for (i = 0; i < batch.pathCount; ++i)
+        xbAddToPath(sys, batch.paths[i]);
+    xbAddEnvironmentPath(sys);
     
     /* load the board configuration file */
-    ParseConfigurationFile(sys, "xbasic.cfg");
+    configs = ParseConfigurationFile(sys, "xbasic.cfg");
 
-    /* setup for the selected board */
-    if (!(config = GetBoardConfig(board))) {
-        fprintf(stderr, "error: no board type: %s\n", board);
-        return 1;
+    /* setup for the selected boards (a comma separated list) */
+    for (p = board; p != NULL; p = next) {
+        if ((next = strchr(p, ',')) != NULL)
+            *next++ = '\0';
+        if (batch.configCount >= MAXBOARDS) {
+            fprintf(stderr, "error: too many boards\n");
+            return 1;
+        }
+        if (!(config = GetBoardConfig(configs, p))) {
+            fprintf(stderr, "error: no board type: %s\n", p);
+            return 1;
+        }
+        batch.boards[batch.configCount] = p;
+        batch.configs[batch.configCount++] = config;
     }
+    config = batch.configs[0];
     
-    /* initialize the compiler */
-    if (!xbInit(sys, config, MAXCODE)) {
-        fprintf(stderr, "error: compiler initialization failed\n");
-        return 1;
-    }
-        
-    /* compile the source file */
-    if (!xbCompile(infile, outfile, compilerFlags))
-        return 1;
-        
-    /* free allocated memory */
-    MemFree(sys);
+    /* compile the source files */
+    CompileBatch(&batch, threadCount);
+    for (i = 0; i < batch.jobCount; ++i)
+        if (!batch.jobs[i].result)
+            return 1;
     
     /* open the port if necessary */
     if (runImage || writeEepromLoader || terminalMode) {
@@ -208,24 +345,174 @@ int main(int argc, char *argv[])
     if (terminalMode)
         TerminalMode();
     
+    /* free allocated memory */
+    FreeBoardConfigs(configs);
+    free(batch.jobs);
+    MemFree(sys);
+    
     return 0;
 }
 
+/* CompileBatch - compile a batch of files using a pool of threads */
+static void CompileBatch(Batch *batch, int threadCount)
+{
+    Job *job;
+#ifdef USE_THREADS
+    pthread_t *threads;
+    int i;
+    
+    /* there is no point in having more threads than files */
+    if (threadCount > batch->jobCount)
+        threadCount = batch->jobCount;
+        
+    /* start the threads (the main thread compiles too) */
+    if (threadCount > 1 && (threads = (pthread_t *)malloc((threadCount - 1) * sizeof(pthread_t))) != NULL) {
+        pthread_mutex_init(&batch->lock, NULL);
+        for (i = 0; i < threadCount - 1; ++i)
+            if (pthread_create(&threads[i], NULL, CompileThread, batch) != 0)
+                break;
+        threadCount = i + 1;
+        CompileThread(batch);
+        for (i = 0; i < threadCount - 1; ++i)
+            pthread_join(threads[i], NULL);
+        pthread_mutex_destroy(&batch->lock);
+        free(threads);
+        return;
+    }
+#endif
+
+    /* compile the files one at a time */
+    while ((job = NextJob(batch)) != NULL)
+        job->result = CompileFile(batch, job);
+}
+
+#ifdef USE_THREADS
+
+/* CompileThread - compile files until there are none left */
+static void *CompileThread(void *arg)
+{
+    Batch *batch = (Batch *)arg;
+    Job *job;
+    while ((job = NextJob(batch)) != NULL)
+        job->result = CompileFile(batch, job);
+    return NULL;
+}
+
+#endif
+
+/* NextJob - get the next file to compile */
+static Job *NextJob(Batch *batch)
+{
+    Job *job = NULL;
+#ifdef USE_THREADS
+    pthread_mutex_lock(&batch->lock);
+#endif
+    if (batch->nextJob < batch->jobCount)
+        job = &batch->jobs[batch->nextJob++];
+#ifdef USE_THREADS
+    pthread_mutex_unlock(&batch->lock);
+#endif
+    return job;
+}
+
+/* CompileFile - compile a file with its own system interface and compiler */
+static int CompileFile(Batch *batch, Job *job)
+{
+    char outfiles[MAXBOARDS][PATH_MAX];
+    const char *names[MAXBOARDS];
+    ParseContext *c;
+    System *sys;
+    int result, i;
+    
+    /* get the names of the images */
+    ImageNames(batch, job, outfiles, names);
+    
+#ifdef USE_SERVER
+    /* let the compile server do the work if there is one (it doesn't compile library modules) */
+    if (batch->server && !batch->modules)
+        return CompileWithServer(batch->server, job->infile, batch->boards, batch->configCount,
+                                 batch->paths, batch->pathCount, batch->flags, names);
+#endif
+
+    /* initialize the memory allocator */
+    if (!(sys = MemInit())) {
+        fprintf(stderr, "error: memory initialization failed\n");
+        return FALSE;
+    }
+    sys->ops = &myOps;
+        
+    /* add the include paths */
+    for (i = 0; i < batch->pathCount; ++i)
+        xbAddToPath(sys, batch->paths[i]);
+    xbAddEnvironmentPath(sys);
+    
+    /* compile the file (it is only parsed once for all of the boards) */
+    if (!(c = xbInit(sys, batch->configs[0], MAXCODE))) {
+        fprintf(stderr, "error: compiler initialization failed\n");
+        result = FALSE;
+    }
+    else {
+        for (i = 1; i < batch->configCount; ++i)
+            if (!xbAddBoard(c, batch->configs[i]))
+                break;
+        if (i < batch->configCount) {
+            fprintf(stderr, "error: compiler initialization failed\n");
+            result = FALSE;
+        }
+        else {
+            if (batch->modules)
+                result = xbCompileModule(c, job->infile, job->outfile, batch->flags);
+            else
+                result = xbCompileBoards(c, job->infile, names, batch->flags);
+        }
+    }
+    
+    /* free the compiler and all of its memory */
+    MemFree(sys);
+    
+    return result;
+}
+
+/* ImageNames - get the names of the images for a file (named after the board if there is more than one) */
+static void ImageNames(Batch *batch, Job *job, char outfiles[][PATH_MAX], const char **names)
+{
+    int i;
+    for (i = 0; i < batch->configCount; ++i) {
+        if (batch->configCount > 1) {
+            char ext[64];
+            sprintf(ext, ".%.50s.bai", batch->boards[i]);
+            names[i] = ConstructOutputName(job->infile, outfiles[i], ext);
+        }
+        else
+            names[i] = job->outfile;
+    }
+}
+
 /* Usage - display a usage message and exit */
 static void Usage(void)
 {
     fprintf(stderr, "\
 usage: xbcom\n\
          [ -b <type> ]   select target board (c3 | ssf | hub | hub96) (default is hub)\n\
+                         a list like hub,c3,ssf builds <name>.<type>.bai for each board\n\
          [ -p <port> ]   serial port (default is %s)\n\
+         [ -c ]          compile include files into library modules (<name>.bao) that\n\
+                         are used in place of the source while it is unchanged\n\
          [ -e ]          write loader to eeprom\n\
          [ -r ]          load and run the compiled program\n\
          [ -t ]          enter terminal mode after running the program\n\
          [ -d ]          add a delay to allow the terminal emulator to start\n\
          [ -D ]          display compiler debug information\n\
          [ -v ]          display verbose compiler statistics\n\
+         [ -T ]          display the time and heap space used by each compiler phase\n\
+         [ -M ]          same as -T but as tab separated values (with a line per function)\n\
+         [ -g ]          write a debug section with function names and line numbers\n\
          [ -I <path> ]   set the path for include files\n\
-         <name>          file to compile\n\
+         [ -j <count> ]  compile up to <count> files at once (also --jobs <count>)\n\
+         [ -S <socket> ] compile using the compile server listening on <socket>\n\
+         [ --server <socket> ] run a compile server that keeps board configurations\n\
+                         and include files between compiles (until interrupted)\n\
+         <name>...       files to compile (only one with -r, -e or -t)\n\
 ", DEF_PORT);
     exit(1);
 }
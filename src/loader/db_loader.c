@@ -88,6 +88,8 @@ extern int xbasic_vm_size;
 
 static int ReadCogImage(System *sys, char *name, uint8_t *buf, int *pSize);
 static FILE *OpenAndProbeFile(char *path, char *buf, int *pSize, int *pCnt, int *pType);
+static uint32_t ImageLoadSize(ImageFileHdr *hdr, uint32_t fileSize);
+static uint32_t ImageZeroSize(ImageFileHdr *hdr);
 static int WriteFileToMemory(char *path);
 static int WriteBuffer(uint8_t *buf, int size);
 static int WriteFile(FILE *fp, uint8_t *buf, int cnt, int size);
@@ -167,8 +169,9 @@ int WriteHubLoaderToEEPROM(System *sys, BoardConfig *config, char *port, char *p
 	SpinHdr *hdr = (SpinHdr *)hub_loader_array;
     SpinObj *obj = (SpinObj *)(hub_loader_array + hdr->objstart);
     HubLoaderDatHdr *dat = (HubLoaderDatHdr *)((uint8_t *)obj + (obj->pubcnt + obj->objcnt) * sizeof(uint32_t));
-    int chksum, i;
-    uint32_t size;
+    uint8_t buf[PKTMAXLEN];
+    int chksum, cnt, i;
+    uint32_t size, zeroSize = 0;
     FILE *fp;
 	
     /* patch serial helper for clock mode and frequency */
@@ -185,13 +188,18 @@ int WriteHubLoaderToEEPROM(System *sys, BoardConfig *config, char *port, char *p
     if ((fp = fopen(path, "rb")) == NULL)
         return Error("can't open image file");
         
-    /* get the file size */
+    /* get the file size without the debug section */
     fseek(fp, 0, SEEK_END);
     size = (uint32_t)ftell(fp);
     fseek(fp, 0, SEEK_SET);
+    if ((cnt = fread(buf, 1, sizeof(buf), fp)) >= sizeof(ImageFileHdr)) {
+        size = ImageLoadSize((ImageFileHdr *)buf, size);
+        zeroSize = ImageZeroSize((ImageFileHdr *)buf);
+    }
+    fseek(fp, 0, SEEK_SET);
     
-    /* make sure the image will fit */
-    if (size > dat->max_image_size)
+    /* make sure the image and its zero-filled data will fit */
+    if (size + zeroSize > dat->max_image_size)
         return Error("image too large");
         
     /* read the image into the binary file */
@@ -265,6 +273,7 @@ int RunLoadedProgram(int flags)
 static int ReadCogImage(System *sys, char *name, uint8_t *buf, int *pSize)
 {
     void *file;
+    *pSize = 0;
     if (!(file = xbOpenFileInPath(sys, name, "rb")))
         return Error("can't open cache driver: %s", name);
     *pSize = xbReadFile(file, buf, COG_IMAGE_MAX);
@@ -298,6 +307,11 @@ static FILE *OpenAndProbeFile(char *path, char *buf, int *pSize, int *pCnt, int
         return NULL;
     }
 
+    /* don't load the debug section */
+    *pSize = ImageLoadSize(hdr, *pSize);
+    if (*pCnt > *pSize)
+        *pCnt = *pSize;
+
     switch (hdr->sections[0].base) {
     case FLASH_BASE:
         *pType = TYPE_FLASH_WRITE;
@@ -340,7 +354,7 @@ static int WriteFile(FILE *fp, uint8_t *buf, int cnt, int size)
         if (!SendPacket(TYPE_DATA, buf, cnt))
             return Error("SendPacket DATA failed\n");
         remaining -= cnt;
-        cnt = fread(buf, 1, PKTMAXLEN, fp);
+        cnt = fread(buf, 1, remaining < PKTMAXLEN ? remaining : PKTMAXLEN, fp);
     }
     printf("%d bytes sent             \n", size);
 
@@ -352,6 +366,31 @@ static int WriteFile(FILE *fp, uint8_t *buf, int cnt, int size)
     return TRUE;
 }
 
+/* ImageLoadSize - get the size of the part of an image file that is loaded into memory */
+static uint32_t ImageLoadSize(ImageFileHdr *hdr, uint32_t fileSize)
+{
+    uint32_t size, end;
+    int i;
+
+    /* the debug section follows the data of the last section */
+    if (!(hdr->flags & IMAGE_FLAG_DEBUG))
+        return fileSize;
+    for (size = 0, i = 0; i < hdr->sectionCount; ++i)
+        if ((end = hdr->sections[i].offset + hdr->sections[i].size) > size)
+            size = end;
+    return size < fileSize ? size : fileSize;
+}
+
+/* ImageZeroSize - get the size of the zero-filled data that isn't in an image file */
+static uint32_t ImageZeroSize(ImageFileHdr *hdr)
+{
+    uint32_t size = 0;
+    int i;
+    for (i = 0; i < hdr->sectionCount; ++i)
+        size += hdr->sections[i].zeroSize;
+    return size;
+}
+
 static int WriteBuffer(uint8_t *buf, int size)
 {
     int remaining, cnt;
@@ -32,7 +32,7 @@ int main(int argc, char *argv[])
     char *infile = NULL, fullName[FILENAME_MAX];
     int runFlags = 0;
     int terminalMode = FALSE;
-    BoardConfig *config;
+    BoardConfig *configs, *config;
     char *port, *board;
     System sys;
     int i;
@@ -101,7 +101,9 @@ int main(int argc, char *argv[])
     }
     
     sys.ops = &myOps;
-    ParseConfigurationFile(&sys, "xbasic.cfg");
+    sys.opsData = NULL;
+    sys.path = NULL;
+    configs = ParseConfigurationFile(&sys, "xbasic.cfg");
 
     /* make sure an input file was specified */
     if (!infile)
@@ -109,7 +111,7 @@ int main(int argc, char *argv[])
     ConstructFileName(infile, fullName, ".bai");
 
     /* setup for the selected board */
-    if (!(config = GetBoardConfig(board)))
+    if (!(config = GetBoardConfig(configs, board)))
         Usage();
 
     /* initialize the serial port */
@@ -15,6 +15,18 @@
 
 /* forward type declarations */
 typedef struct Interpreter Interpreter;
+typedef struct Profile Profile;
+typedef struct Stats Stats;
+typedef struct CycleModel CycleModel;
+typedef struct CacheModel CacheModel;
+
+/* memory window */
+typedef struct {
+    VMUVALUE base;          /* base address of the section mapped into the window */
+    VMUVALUE size;          /* size of the section (zero if nothing is mapped) */
+    VMUVALUE longSize;      /* number of offsets at which a long can be accessed */
+    uint8_t *data;          /* section data */
+} MemoryWindow;
 
 /* intrinsic function handler type */
 typedef void IntrinsicFcn(Interpreter *i);
@@ -23,13 +35,23 @@ typedef void IntrinsicFcn(Interpreter *i);
 struct Interpreter {
     System *sys;
     ImageHdr *image;
+    MemoryWindow windows[WINDOW_COUNT];
     jmp_buf errorTarget;
     VMVALUE *stack;
     VMVALUE *stackTop;
+    uint8_t *code;
+    VMUVALUE codeBase;
     uint8_t *pc;
     VMVALUE *fp;
+    VMVALUE tos;        /* keeps gcc from packing fp and sp into a vector register */
     VMVALUE *sp;
-    VMVALUE tos;
+    DecodedWord *dpc;
+    Profile *profile;   /* profiler state or NULL */
+    CycleModel *cycles; /* cycle-cost model or NULL */
+    CacheModel *cache;  /* cache simulator or NULL */
+#ifdef VM_STATS
+    Stats *stats;       /* opcode statistics or NULL */
+#endif
     int argc;
     int linePos;
 };
@@ -59,13 +81,30 @@ struct Interpreter {
 void Fatal(System *sys, const char *fmt, ...);
 
 /* prototypes from db_vmimage.c */
-ImageHdr *LoadImage(System *sys, const char *name);
+ImageHdr *LoadImage(System *sys, const char *name, int flags);
+
+/* operand size returned by OperandSize for undefined opcodes */
+#define UNDEFINED_OPERAND   -1
+
+/* prototypes from db_vmdecode.c */
+int DecodeImage(System *sys, ImageHdr *image);
+DecodedWord *DecodeCode(System *sys, DecodedText *text, VMUVALUE addr);
+VMUVALUE DecodedAddress(DecodedText *text, DecodedWord *p);
+int OperandSize(int op);
+VMUVALUE GetCodeWord(const uint8_t *p);
+int IsTerminal(int op);
+int IsBranch(int op);
+
+/* prototypes from db_vmjit.c */
+int JitImage(System *sys, ImageHdr *image);
+int ExecuteJit(Interpreter *i, VMUVALUE addr);
 
 /* prototypes from db_vmint.c */
 Interpreter *InitInterpreter(System *sys, ImageHdr *image);
 int Execute(Interpreter *i, ImageHdr *image);
 void Abort(Interpreter *i, const char *fmt, ...);
 void StackOverflow(Interpreter *i);
+void DoTrap(Interpreter *i, int op);
 void ShowStack(Interpreter *i);
 
 /* prototypes and variables from db_vmfcn.c */
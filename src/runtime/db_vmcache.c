@@ -0,0 +1,484 @@
+/* db_vmcache.c - JCACHE simulator
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ * Simulates the path external memory accesses take on boards that run
+ * code from flash.  The VM in spin/xbasic_vm.spin remembers the last
+ * cache line it was given and only sends a request to the cache driver
+ * for a read outside of that line or for a write.  The drivers in
+ * spin/c3_cache.spin and spin/ssf_cache.spin are direct mapped with tags
+ * that hold the line address along with an empty bit and a dirty bit.
+ * The C3 driver keeps flash and SRAM lines in separate halves of the
+ * cache and writes dirty SRAM lines back when they are replaced.  The
+ * SSF driver has a single set of lines and never writes back.
+ *
+ * When the cycle-cost model is running, the time the VM spends on each
+ * access beyond what a hub memory access would take is added to CNT.
+ *
+ * Every access is also recorded in a trace so that the run can be
+ * replayed against other cache sizes, line sizes and associativities.
+ * Consecutive reads of the same block are recorded once since they hit
+ * the VM's line buffer whatever the line size.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "db_vmcache.h"
+#include "db_vmdebug.h"
+
+/* cache line tag flags */
+#define EMPTY_BIT       0x40000000
+#define DIRTY_BIT       0x80000000
+#define TAG_MASK        (DIRTY_BIT - 1)
+
+/* the C3 driver uses this address bit to select flash or SRAM */
+#define FLASH_MASK      0x10000000
+
+/* driver default geometries */
+#define C3_INDEX_WIDTH  5
+#define C3_OFFSET_WIDTH 7
+#define SSF_INDEX_WIDTH 6
+#define SSF_OFFSET_WIDTH 7
+
+/* estimated clocks beyond a hub access for a read from the VM's line
+   buffer, for a driver request and for transferring a line (from
+   cache_read in xbasic_vm.spin and the SPI loops in c3_cache.spin) */
+#define BUFFER_CYCLES   32
+#define REQUEST_CYCLES  200
+#define LINE_CYCLES     900
+#define BYTE_CYCLES     200
+
+/* geometries tried by the sweep */
+static int sweepSizes[] = { 2048, 4096, 8192, 16384, 0 };
+static int sweepLines[] = { 32, 64, 128, 256, 0 };
+static int sweepWays[] = { 1, 2, 4, 0 };
+
+/* access results */
+#define ACCESS_BUFFERED     0   /* hit in the VM's line buffer */
+#define ACCESS_HIT          1   /* hit in the cache */
+#define ACCESS_MISS         2   /* missed in the cache */
+#define ACCESS_WRITE_BACK   3   /* missed and replaced a dirty line */
+
+/* geometry sweep result */
+typedef struct {
+    int size;
+    int lineSize;
+    int ways;
+    uint64_t requests;
+    uint64_t misses;
+    uint64_t writeBacks;
+    uint64_t cycles;
+} SweepResult;
+
+/* prototypes for local functions */
+static int InitSim(CacheSim *s, int indexWidth, int offsetWidth, int ways, int halves, int writeBack);
+static void FreeSim(CacheSim *s);
+static int SimAccess(CacheSim *s, VMUVALUE addr, int write);
+static void Access(CacheModel *m, VMUVALUE addr, int write);
+static CacheFunction *FindFunction(CacheModel *m, VMUVALUE addr);
+static uint64_t StallCycles(CacheSim *s, uint64_t accesses);
+static int Log2(int value);
+static int IsDriver(const char *driver, const char *name);
+static double Percent(uint64_t count, uint64_t total);
+
+/* InitCacheModel - initialize the cache simulator for a board */
+CacheModel *InitCacheModel(System *sys, ImageHdr *image, BoardConfig *config, CycleModel *cycles)
+{
+    int indexWidth, offsetWidth, halves, writeBack;
+    FLASH_SPACE OTDEF *op;
+    CacheModel *m;
+    int j;
+
+    /* allocate the simulator state */
+    if (!(m = (CacheModel *)xbGlobalAlloc(sys, sizeof(CacheModel))))
+        return NULL;
+    memset(m, 0, sizeof(CacheModel));
+    m->sys = sys;
+    m->cycles = cycles;
+    m->driver = config->cacheDriver;
+    m->cacheSize = config->cacheSize;
+
+    /* get the geometry of the board's cache driver */
+    if (IsDriver(config->cacheDriver, "ssf")) {
+        indexWidth = SSF_INDEX_WIDTH;
+        offsetWidth = SSF_OFFSET_WIDTH;
+        halves = 1;
+        writeBack = FALSE;
+    }
+    else {
+        indexWidth = C3_INDEX_WIDTH;
+        offsetWidth = C3_OFFSET_WIDTH;
+        halves = 2;
+        writeBack = TRUE;
+    }
+    if (config->cacheParam1)
+        indexWidth = config->cacheParam1;
+    if (config->cacheParam2)
+        offsetWidth = config->cacheParam2;
+    if (offsetWidth < CACHE_BLOCK_SHIFT || !InitSim(&m->sim, indexWidth, offsetWidth, 1, halves, writeBack))
+        return NULL;
+
+    /* get the length of each instruction */
+    for (j = 0; j < 256; ++j)
+        m->lengths[j] = 1;
+    for (op = OpcodeTable; op->name; ++op) {
+        switch (op->fmt) {
+        case FMT_BYTE:
+        case FMT_SBYTE:
+            m->lengths[op->code] = 2;
+            break;
+        case FMT_WORD:
+        case FMT_NATIVE:
+        case FMT_BR:
+            m->lengths[op->code] = 1 + sizeof(VMUVALUE);
+            break;
+        }
+    }
+
+    /* get the functions from the debug section */
+    if (image->debug && image->debug->functionCount > 0) {
+        ImageDebug *debug = image->debug;
+        m->functionCount = debug->functionCount;
+        if (!(m->functions = (CacheFunction *)xbGlobalAlloc(sys, m->functionCount * sizeof(CacheFunction))))
+            return NULL;
+        memset(m->functions, 0, m->functionCount * sizeof(CacheFunction));
+        for (j = 0; j < m->functionCount; ++j) {
+            m->functions[j].name = debug->functionNames[j];
+            m->functions[j].base = debug->functions[j].base;
+            m->functions[j].size = debug->functions[j].size;
+        }
+    }
+    m->other.name = m->functionCount > 0 ? "[other]" : "[all]";
+
+    /* allocate the trace buffer */
+    m->traceMax = 1024 * 1024;
+    if (!(m->trace = (uint32_t *)malloc(m->traceMax * sizeof(uint32_t))))
+        return NULL;
+    m->lastBlock = ~0;
+
+    /* return the simulator state */
+    return m;
+}
+
+/* CacheOpcode - simulate the external memory accesses made by an instruction */
+int CacheOpcode(CacheModel *m, VMUVALUE addr, int op, VMVALUE tos)
+{
+    int len = m->lengths[op];
+
+    /* the VM fetches the opcode and its operands a byte at a time */
+    m->pc = addr;
+    if (addr >= RAM_BASE) {
+        while (--len >= 0)
+            Access(m, addr++, FALSE);
+    }
+
+    /* and then reads or writes the data */
+    if ((VMUVALUE)tos >= RAM_BASE) {
+        switch (op) {
+        case OP_LOAD:
+        case OP_LOADB:
+            Access(m, (VMUVALUE)tos, FALSE);
+            break;
+        case OP_STORE:
+        case OP_STOREB:
+            Access(m, (VMUVALUE)tos, TRUE);
+            break;
+        }
+    }
+
+    return op;
+}
+
+/* WriteCacheReport - write the cache statistics and the geometry sweep */
+void WriteCacheReport(CacheModel *m, FILE *fp)
+{
+    SweepResult *results, *best = NULL, *bestFit = NULL, *bestDirect = NULL;
+    int resultCount, s, l, w, j;
+    CacheSim *sim = &m->sim;
+    CacheFunction *f;
+
+    /* write the statistics for the board's cache */
+    fprintf(fp, "cache driver: %s (%d bytes, %d-byte lines, %s)\n",
+            m->driver,
+            (sim->halves << (sim->indexWidth + sim->offsetWidth)),
+            1 << sim->offsetWidth,
+            sim->halves > 1 ? "separate flash and SRAM halves" : "shared by flash and SRAM");
+    fprintf(fp, "external reads:       %12llu\n", (unsigned long long)m->reads);
+    fprintf(fp, "external writes:      %12llu\n", (unsigned long long)m->writes);
+    fprintf(fp, "line buffer hits:     %12llu\n", (unsigned long long)(m->reads + m->writes - sim->requests));
+    fprintf(fp, "driver requests:      %12llu\n", (unsigned long long)sim->requests);
+    fprintf(fp, "cache hits:           %12llu  %6.2f%%\n", (unsigned long long)sim->hits, Percent(sim->hits, sim->requests));
+    fprintf(fp, "cache misses:         %12llu  %6.2f%%\n", (unsigned long long)sim->misses, Percent(sim->misses, sim->requests));
+    fprintf(fp, "write-backs:          %12llu\n", (unsigned long long)sim->writeBacks);
+    fprintf(fp, "estimated stall:      %12llu cycles\n\n", (unsigned long long)StallCycles(sim, m->reads + m->writes));
+
+    /* write the statistics for each function */
+    fprintf(fp, "%-24s %12s %12s %8s %12s\n", "function", "requests", "misses", "miss%", "write-backs");
+    for (j = 0; j <= m->functionCount; ++j) {
+        f = (j < m->functionCount ? &m->functions[j] : &m->other);
+        if (f->requests > 0)
+            fprintf(fp, "%-24s %12llu %12llu %7.2f%% %12llu\n",
+                    f->name,
+                    (unsigned long long)f->requests,
+                    (unsigned long long)f->misses,
+                    Percent(f->misses, f->requests),
+                    (unsigned long long)f->writeBacks);
+    }
+
+    /* replay the trace against each geometry */
+    resultCount = 0;
+    if (!(results = (SweepResult *)malloc(64 * sizeof(SweepResult))))
+        Fatal(m->sys, "insufficient memory");
+    for (s = 0; sweepSizes[s]; ++s)
+        for (l = 0; sweepLines[l]; ++l)
+            for (w = 0; sweepWays[w]; ++w) {
+                int lines = sweepSizes[s] / (sim->halves * sweepLines[l] * sweepWays[w]);
+                SweepResult *result = &results[resultCount];
+                CacheSim trial;
+                if (lines < 1 || !InitSim(&trial, Log2(lines), Log2(sweepLines[l]), sweepWays[w], sim->halves, sim->writeBack))
+                    continue;
+                for (j = 0; j < m->traceCount; ++j)
+                    SimAccess(&trial, (m->trace[j] >> 1) << CACHE_BLOCK_SHIFT, m->trace[j] & 1);
+                result->size = sweepSizes[s];
+                result->lineSize = sweepLines[l];
+                result->ways = sweepWays[w];
+                result->requests = trial.requests;
+                result->misses = trial.misses;
+                result->writeBacks = trial.writeBacks;
+                result->cycles = StallCycles(&trial, m->reads + m->writes);
+                FreeSim(&trial);
+
+                /* keep track of the best geometries */
+                if (!best || result->cycles < best->cycles)
+                    best = result;
+                if (result->size <= m->cacheSize && (!bestFit || result->cycles < bestFit->cycles))
+                    bestFit = result;
+                if (result->size <= m->cacheSize && result->ways == 1 && (!bestDirect || result->cycles < bestDirect->cycles))
+                    bestDirect = result;
+                ++resultCount;
+            }
+
+    /* write the sweep results */
+    fprintf(fp, "\ngeometry sweep%s:\n", m->traceFull ? " (over the start of the run)" : "");
+    fprintf(fp, "%8s %6s %5s %12s %12s %12s %14s\n", "size", "line", "ways", "requests", "misses", "write-backs", "stall cycles");
+    for (j = 0; j < resultCount; ++j) {
+        SweepResult *result = &results[j];
+        fprintf(fp, "%8d %6d %5d %12llu %12llu %12llu %14llu%s\n",
+                result->size,
+                result->lineSize,
+                result->ways,
+                (unsigned long long)result->requests,
+                (unsigned long long)result->misses,
+                (unsigned long long)result->writeBacks,
+                (unsigned long long)result->cycles,
+                result == best ? "  <- best" : result == bestFit ? "  <- best within cache-size" : "");
+    }
+
+    /* recommend a geometry the drivers support for the configured cache size */
+    if (bestDirect) {
+        int lines = bestDirect->size / (sim->halves * bestDirect->lineSize);
+        fprintf(fp, "\nrecommended for the %s driver: cache-size: %dK, cache-param1: %d, cache-param2: %d\n",
+                m->driver, bestDirect->size / 1024, Log2(lines), Log2(bestDirect->lineSize));
+    }
+    if (bestFit && bestDirect && bestFit->ways > 1)
+        fprintf(fp, "a %d-way cache of the same size would stall %.1f%% less\n",
+                bestFit->ways, 100.0 - Percent(bestFit->cycles, bestDirect->cycles));
+
+    free(results);
+}
+
+/* InitSim - initialize a simulated cache */
+static int InitSim(CacheSim *s, int indexWidth, int offsetWidth, int ways, int halves, int writeBack)
+{
+    int count = (halves << indexWidth) * ways, j;
+    memset(s, 0, sizeof(CacheSim));
+    s->indexWidth = indexWidth;
+    s->offsetWidth = offsetWidth;
+    s->ways = ways;
+    s->halves = halves;
+    s->writeBack = writeBack;
+    if (!(s->tags = (uint32_t *)malloc(count * sizeof(uint32_t)))
+    ||  !(s->stamps = (uint32_t *)malloc(count * sizeof(uint32_t))))
+        return FALSE;
+    for (j = 0; j < count; ++j) {
+        s->tags[j] = EMPTY_BIT;
+        s->stamps[j] = 0;
+    }
+    return TRUE;
+}
+
+/* FreeSim - free a simulated cache */
+static void FreeSim(CacheSim *s)
+{
+    free(s->tags);
+    free(s->stamps);
+}
+
+/* SimAccess - simulate an external memory access */
+static int SimAccess(CacheSim *s, VMUVALUE addr, int write)
+{
+    uint32_t page = addr >> s->offsetWidth, *tags, *stamps, victimAddr;
+    int set, way, victim, result;
+
+    /* reads from the line the VM already has don't go to the driver */
+    if (!write && s->memoValid && s->memo == page)
+        return ACCESS_BUFFERED;
+    s->memo = page;
+    s->memoValid = TRUE;
+    ++s->requests;
+
+    /* find the set */
+    set = page & ((1 << s->indexWidth) - 1);
+    if (s->halves > 1 && (addr & FLASH_MASK))
+        set += 1 << s->indexWidth;
+    tags = &s->tags[set * s->ways];
+    stamps = &s->stamps[set * s->ways];
+
+    /* check for a hit */
+    for (way = 0; way < s->ways; ++way)
+        if ((tags[way] & TAG_MASK) == page) {
+            if (write)
+                tags[way] |= DIRTY_BIT;
+            stamps[way] = ++s->clock;
+            ++s->hits;
+            return ACCESS_HIT;
+        }
+
+    /* replace an empty line or the least recently used one */
+    for (victim = 0, way = 0; way < s->ways; ++way) {
+        if (tags[way] & EMPTY_BIT) {
+            victim = way;
+            break;
+        }
+        if (stamps[way] < stamps[victim])
+            victim = way;
+    }
+
+    /* write back a dirty SRAM line (the C3 driver ignores dirty flash lines) */
+    result = ACCESS_MISS;
+    victimAddr = (tags[victim] & TAG_MASK) << s->offsetWidth;
+    if (s->writeBack && (tags[victim] & DIRTY_BIT) && !(victimAddr & FLASH_MASK)) {
+        ++s->writeBacks;
+        result = ACCESS_WRITE_BACK;
+    }
+
+    /* load the new line */
+    tags[victim] = page | (write ? DIRTY_BIT : 0);
+    stamps[victim] = ++s->clock;
+    ++s->misses;
+    return result;
+}
+
+/* Access - simulate an external memory access by the current instruction */
+static void Access(CacheModel *m, VMUVALUE addr, int write)
+{
+    uint32_t block = addr >> CACHE_BLOCK_SHIFT;
+    CacheFunction *f;
+    int result;
+
+    /* count the access */
+    if (write)
+        ++m->writes;
+    else
+        ++m->reads;
+
+    /* add it to the trace */
+    if ((write || block != m->lastBlock) && !m->traceFull) {
+        if (m->traceCount >= m->traceMax) {
+            uint32_t *trace;
+            if (m->traceMax >= CACHE_TRACE_MAX || !(trace = (uint32_t *)realloc(m->trace, 2 * m->traceMax * sizeof(uint32_t))))
+                m->traceFull = TRUE;
+            else {
+                m->trace = trace;
+                m->traceMax *= 2;
+            }
+        }
+        if (!m->traceFull)
+            m->trace[m->traceCount++] = (block << 1) | (write ? 1 : 0);
+    }
+    m->lastBlock = block;
+
+    /* simulate it with the board's cache */
+    if ((result = SimAccess(&m->sim, addr, write)) != ACCESS_BUFFERED) {
+        f = FindFunction(m, m->pc);
+        ++f->requests;
+        if (result >= ACCESS_MISS)
+            ++f->misses;
+        if (result == ACCESS_WRITE_BACK)
+            ++f->writeBacks;
+    }
+
+    /* charge the time it took */
+    if (m->cycles) {
+        uint64_t lineCycles = LINE_CYCLES + BYTE_CYCLES * ((uint64_t)1 << m->sim.offsetWidth);
+        switch (result) {
+        case ACCESS_BUFFERED:
+            m->cycles->count += BUFFER_CYCLES;
+            break;
+        case ACCESS_HIT:
+            m->cycles->count += REQUEST_CYCLES;
+            break;
+        case ACCESS_MISS:
+            m->cycles->count += REQUEST_CYCLES + lineCycles;
+            break;
+        case ACCESS_WRITE_BACK:
+            m->cycles->count += REQUEST_CYCLES + 2 * lineCycles;
+            break;
+        }
+    }
+}
+
+/* FindFunction - find the function containing an address */
+static CacheFunction *FindFunction(CacheModel *m, VMUVALUE addr)
+{
+    int lo = 0, hi = m->functionCount - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        CacheFunction *f = &m->functions[mid];
+        if (addr < f->base)
+            hi = mid - 1;
+        else if (addr >= f->base + f->size)
+            lo = mid + 1;
+        else
+            return f;
+    }
+    return &m->other;
+}
+
+/* StallCycles - estimate the clocks spent on external memory accesses beyond those for hub accesses */
+static uint64_t StallCycles(CacheSim *s, uint64_t accesses)
+{
+    uint64_t lineCycles = LINE_CYCLES + BYTE_CYCLES * ((uint64_t)1 << s->offsetWidth);
+    return (accesses - s->requests) * BUFFER_CYCLES + s->requests * REQUEST_CYCLES + (s->misses + s->writeBacks) * lineCycles;
+}
+
+/* Log2 - get the base 2 logarithm of a power of two */
+static int Log2(int value)
+{
+    int n;
+    for (n = 0; value > 1; value >>= 1)
+        ++n;
+    return n;
+}
+
+/* IsDriver - check whether a cache driver file name starts with a driver name */
+static int IsDriver(const char *driver, const char *name)
+{
+    const char *p;
+    if (!driver)
+        return FALSE;
+    if ((p = strrchr(driver, '/')) != NULL || (p = strrchr(driver, '\\')) != NULL)
+        driver = p + 1;
+    while (*name)
+        if (tolower(*driver++) != *name++)
+            return FALSE;
+    return TRUE;
+}
+
+/* Percent - compute a percentage */
+static double Percent(uint64_t count, uint64_t total)
+{
+    return total ? count * 100.0 / total : 0.0;
+}
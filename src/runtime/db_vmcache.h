@@ -0,0 +1,72 @@
+/* db_vmcache.h - definitions for the JCACHE simulator
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#ifndef __DB_VMCACHE_H__
+#define __DB_VMCACHE_H__
+
+#include <stdio.h>
+#include "db_vm.h"
+#include "db_vmcycles.h"
+
+/* the trace is kept in blocks of the smallest line size in the geometry sweep */
+#define CACHE_BLOCK_SHIFT   5
+#define CACHE_TRACE_MAX     (32 * 1024 * 1024)
+
+/* simulated cache (the VM's line buffer in front of a cache driver) */
+typedef struct {
+    int indexWidth;         /* number of bits in the set index */
+    int offsetWidth;        /* number of bits in the line offset */
+    int ways;               /* number of lines in each set */
+    int halves;             /* 2 if flash and SRAM have separate halves of the cache */
+    int writeBack;          /* dirty SRAM lines are written back when they are replaced */
+    uint32_t *tags;         /* line tags with the empty and dirty bits */
+    uint32_t *stamps;       /* last use of each line for LRU replacement */
+    uint32_t clock;         /* use counter */
+    VMUVALUE memo;          /* line in the VM's line buffer */
+    int memoValid;          /* the VM's line buffer has been loaded */
+    uint64_t requests;      /* requests sent to the cache driver */
+    uint64_t hits;          /* requests that hit in the cache */
+    uint64_t misses;        /* requests that missed in the cache */
+    uint64_t writeBacks;    /* dirty lines written back */
+} CacheSim;
+
+/* cache statistics for a function */
+typedef struct {
+    const char *name;       /* function name */
+    VMUVALUE base;          /* address of the function code */
+    VMUVALUE size;          /* size of the function code */
+    uint64_t requests;      /* requests sent to the cache driver */
+    uint64_t misses;        /* requests that missed in the cache */
+    uint64_t writeBacks;    /* dirty lines written back */
+} CacheFunction;
+
+/* JCACHE simulator state */
+struct CacheModel {
+    System *sys;                /* system interface */
+    CycleModel *cycles;         /* cycle-cost model charged for the accesses or NULL */
+    const char *driver;         /* name of the cache driver */
+    VMUVALUE cacheSize;         /* cache-size from the board configuration */
+    CacheSim sim;               /* cache with the board's geometry */
+    uint8_t lengths[256];       /* instruction length for each opcode */
+    VMUVALUE pc;                /* address of the current instruction */
+    uint64_t reads;             /* reads from external memory */
+    uint64_t writes;            /* writes to external memory */
+    CacheFunction *functions;   /* functions in address order */
+    int functionCount;          /* number of functions */
+    CacheFunction other;        /* accesses outside of any known function */
+    uint32_t *trace;            /* external memory accesses (block << 1 | write) */
+    int traceCount;             /* number of trace entries */
+    int traceMax;               /* size of the trace buffer */
+    uint32_t lastBlock;         /* block of the last trace entry */
+    int traceFull;              /* the trace buffer limit was reached */
+};
+
+/* prototypes from db_vmcache.c */
+CacheModel *InitCacheModel(System *sys, ImageHdr *image, BoardConfig *config, CycleModel *cycles);
+int CacheOpcode(CacheModel *m, VMUVALUE addr, int op, VMVALUE tos);
+void WriteCacheReport(CacheModel *m, FILE *fp);
+
+#endif
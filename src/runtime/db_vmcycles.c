@@ -0,0 +1,223 @@
+/* db_vmcycles.c - Propeller cycle-cost model
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ * Estimates the number of system clocks the PASM virtual machine in
+ * spin/xbasic_vm.spin takes to execute each bytecode instruction so that
+ * programs that time themselves by reading CNT give the results they
+ * would give on a HUB-mode board.  The cost of each handler is written
+ * as a string with one character for each PASM instruction it executes:
+ *
+ *  c   ordinary instruction (4 clocks)
+ *  j   tjz/tjnz/djnz that doesn't jump (8 clocks)
+ *  h   hub access (8 clocks once the hub window for the cog comes around)
+ *
+ * Hub windows come around every 16 clocks so the time spent waiting
+ * depends on what was executed before.  Data-dependent loops in the
+ * multiply and divide handlers are costed from their operands.  External
+ * memory is costed as if it were hub memory and the time spent by the
+ * Spin code that handles traps isn't included.
+ *
+ */
+
+#include <string.h>
+#include "db_vmcycles.h"
+
+/* common instruction sequences */
+#define NEXT            "cc"                /* jmp #_next, tjz stepping,#_start */
+#define CODE_BYTE       "cccccchcc"         /* call #get_code_byte from hub memory */
+#define DISPATCH        CODE_BYTE "ccccc"   /* fetch and dispatch an opcode */
+#define IMM32           "c" CODE_BYTE "cc" CODE_BYTE "cc" CODE_BYTE "cc" CODE_BYTE "cc"
+#define PUSH_TOS        "cccchc"
+#define POP_TOS         "chcc"
+#define POP_T1          "chcc"
+#define LREF            "c" CODE_BYTE "cccc"
+#define HUB_LONG        "cccccchcc"         /* call #_read_long or #_write_long for a hub address */
+#define COG_LONG        "ccccccccccc"       /* call #_read_long or #_write_long for a cog address */
+#define HUB_BYTE        "cccchcc"           /* call #_read_byte or #_write_byte */
+#define STORE_STATE     "cchchchchchc"
+#define CONTINUE        "chchchchchchchcc"  /* _VM_Continue after a trap has been handled */
+
+/* handler costs (the second entry is for a branch taken or a cog address) */
+static const char *costs[][2] = {
+/* OP_HALT      */  {   DISPATCH,                                       NULL                                    },
+/* OP_BRT       */  {   DISPATCH "j" POP_TOS "c" NEXT,                  DISPATCH "c" POP_TOS IMM32 "c" NEXT     },
+/* OP_BRTSC     */  {   DISPATCH "j" POP_TOS "c" NEXT,                  DISPATCH "c" IMM32 "c" NEXT             },
+/* OP_BRF       */  {   DISPATCH "j" POP_TOS "c" NEXT,                  DISPATCH "c" POP_TOS IMM32 "c" NEXT     },
+/* OP_BRFSC     */  {   DISPATCH "j" POP_TOS "c" NEXT,                  DISPATCH "c" IMM32 "c" NEXT             },
+/* OP_BR        */  {   DISPATCH IMM32 "c" NEXT,                        NULL                                    },
+/* OP_NOT       */  {   DISPATCH "ccc" NEXT,                            NULL                                    },
+/* OP_NEG       */  {   DISPATCH "c" NEXT,                              NULL                                    },
+/* OP_ADD       */  {   DISPATCH POP_T1 "c" NEXT,                       NULL                                    },
+/* OP_SUB       */  {   DISPATCH POP_T1 "cc" NEXT,                      NULL                                    },
+/* OP_MUL       */  {   DISPATCH POP_T1 "ccccccccc" NEXT,               NULL                                    },
+/* OP_DIV       */  {   DISPATCH "cc" POP_T1 "cccccccccccccc" NEXT,     NULL                                    },
+/* OP_REM       */  {   DISPATCH "cc" POP_T1 "cccccccccccccc" NEXT,     NULL                                    },
+/* OP_BNOT      */  {   DISPATCH "c" NEXT,                              NULL                                    },
+/* OP_BAND      */  {   DISPATCH POP_T1 "c" NEXT,                       NULL                                    },
+/* OP_BOR       */  {   DISPATCH POP_T1 "c" NEXT,                       NULL                                    },
+/* OP_BXOR      */  {   DISPATCH POP_T1 "c" NEXT,                       NULL                                    },
+/* OP_SHL       */  {   DISPATCH POP_T1 "cc" NEXT,                      NULL                                    },
+/* OP_SHR       */  {   DISPATCH POP_T1 "cc" NEXT,                      NULL                                    },
+/* OP_LT        */  {   DISPATCH POP_T1 "ccc" NEXT,                     NULL                                    },
+/* OP_LE        */  {   DISPATCH POP_T1 "ccc" NEXT,                     NULL                                    },
+/* OP_EQ        */  {   DISPATCH POP_T1 "ccc" NEXT,                     NULL                                    },
+/* OP_NE        */  {   DISPATCH POP_T1 "ccc" NEXT,                     NULL                                    },
+/* OP_GE        */  {   DISPATCH POP_T1 "ccc" NEXT,                     NULL                                    },
+/* OP_GT        */  {   DISPATCH POP_T1 "ccc" NEXT,                     NULL                                    },
+/* OP_LIT       */  {   DISPATCH PUSH_TOS IMM32 "c" NEXT,               NULL                                    },
+/* OP_SLIT      */  {   DISPATCH PUSH_TOS CODE_BYTE "ccc" NEXT,         NULL                                    },
+/* OP_LOAD      */  {   DISPATCH "c" HUB_LONG "c" NEXT,                 DISPATCH "c" COG_LONG "c" NEXT          },
+/* OP_LOADB     */  {   DISPATCH "c" HUB_BYTE "c" NEXT,                 NULL                                    },
+/* OP_STORE     */  {   DISPATCH POP_T1 "cc" HUB_LONG POP_TOS NEXT,     DISPATCH POP_T1 "cc" COG_LONG POP_TOS NEXT },
+/* OP_STOREB    */  {   DISPATCH POP_T1 "cc" HUB_BYTE POP_TOS NEXT,     NULL                                    },
+/* OP_LREF      */  {   DISPATCH PUSH_TOS LREF "h" NEXT,                NULL                                    },
+/* OP_LSET      */  {   DISPATCH LREF "h" POP_TOS NEXT,                 NULL                                    },
+/* OP_INDEX     */  {   DISPATCH POP_T1 "cc" NEXT,                      NULL                                    },
+/* OP_PUSHJ     */  {   DISPATCH "ccc" NEXT,                            NULL                                    },
+/* OP_POPJ      */  {   DISPATCH "c" POP_TOS NEXT,                      NULL                                    },
+/* OP_CLEAN     */  {   DISPATCH CODE_BYTE "cc" NEXT,                   NULL                                    },
+/* OP_FRAME     */  {   DISPATCH "cc" CODE_BYTE "cccccch" NEXT,         NULL                                    },
+/* OP_RETURN    */  {   DISPATCH "hcch" NEXT,                           NULL                                    },
+/* OP_RETURNZ   */  {   DISPATCH PUSH_TOS "chcch" NEXT,                 NULL                                    },
+/* OP_DROP      */  {   DISPATCH "hc" NEXT,                             NULL                                    },
+/* OP_DUP       */  {   DISPATCH PUSH_TOS NEXT,                         NULL                                    },
+/* OP_NATIVE    */  {   DISPATCH IMM32 "ccccc" NEXT,                    NULL                                    },
+/* OP_TRAP      */  {   DISPATCH CODE_BYTE "h" STORE_STATE "cchh" CONTINUE, NULL                                },
+};
+
+/* cog addresses of the registers used by native instructions */
+#define REG_TOS         0x005
+
+/* native instruction fields */
+#define INST_OPCODE(i)  ((i) >> 26)
+#define INST_IMM(i)     (((i) >> 22) & 1)
+#define INST_DST(i)     (((i) >> 9) & 0x1ff)
+#define INST_SRC(i)     ((i) & 0x1ff)
+
+#define INST_RDLONG     0x02
+#define INST_WAITCNT    0x3e
+
+/* prototypes for local functions */
+static void Run(CycleModel *m, const char *p);
+static int BitLength(VMUVALUE value);
+
+/* InitCycleModel - initialize the cycle-cost model */
+CycleModel *InitCycleModel(System *sys, uint32_t clkfreq)
+{
+    CycleModel *m;
+    if (!(m = (CycleModel *)xbGlobalAlloc(sys, sizeof(CycleModel))))
+        return NULL;
+    memset(m, 0, sizeof(CycleModel));
+    m->clkfreq = clkfreq;
+    return m;
+}
+
+/* CycleOpcode - add the cost of an instruction given the stack before it executes */
+int CycleOpcode(CycleModel *m, int op, VMVALUE tos, VMVALUE *sp)
+{
+    VMUVALUE a, b;
+    int n;
+
+    ++m->instructions;
+
+    switch (op) {
+    case OP_BRT:
+    case OP_BRTSC:
+        Run(m, costs[op][tos != 0]);
+        break;
+    case OP_BRF:
+    case OP_BRFSC:
+        Run(m, costs[op][tos == 0]);
+        break;
+    case OP_LOAD:
+        Run(m, costs[op][(VMUVALUE)tos >= COG_BASE && (VMUVALUE)tos < RAM_BASE]);
+        break;
+    case OP_STORE:
+        Run(m, costs[op][(VMUVALUE)tos >= COG_BASE && (VMUVALUE)tos < RAM_BASE]);
+        break;
+    case OP_MUL:
+        /* fast_mul loops once for each bit of the smaller operand */
+        Run(m, costs[op][0]);
+        a = (VMUVALUE)(tos < 0 ? -tos : tos);
+        b = (VMUVALUE)(*sp < 0 ? -*sp : *sp);
+        n = BitLength(a < b ? a : b);
+        m->count += 16 * (n > 0 ? n : 1);
+        break;
+    case OP_DIV:
+    case OP_REM:
+        /* fast_div aligns the divisor with bit 31 and then loops once for each shift */
+        Run(m, costs[op][0]);
+        if (tos != 0) {
+            n = 33 - BitLength((VMUVALUE)(tos < 0 ? -tos : tos));
+            m->count += 8 * n + 16 * n + 4;
+        }
+        break;
+    default:
+        if (op < sizeof(costs) / sizeof(costs[0]))
+            Run(m, costs[op][0]);
+        break;
+    }
+
+    return op;
+}
+
+/* CycleNative - add the cost of a native instruction and simulate its effect on tos */
+VMVALUE CycleNative(CycleModel *m, VMUVALUE inst, VMVALUE tos)
+{
+    switch (INST_OPCODE(inst)) {
+    case INST_RDLONG:
+        Run(m, "h");
+        /* the loader stores clkfreq in the first long of hub memory */
+        if (INST_DST(inst) == REG_TOS && INST_IMM(inst) && INST_SRC(inst) == 0)
+            tos = (VMVALUE)m->clkfreq;
+        break;
+    case 0x00:  /* rdbyte/wrbyte */
+    case 0x01:  /* rdword/wrword */
+        Run(m, "h");
+        break;
+    case INST_WAITCNT:
+        /* wait for the counter to reach the value in the destination register */
+        if (INST_DST(inst) == REG_TOS)
+            m->count += (uint32_t)((uint32_t)tos - (uint32_t)m->count);
+        m->count += 6;
+        break;
+    default:
+        Run(m, "c");
+        break;
+    }
+    return tos;
+}
+
+/* CycleRegister - get the value of a cog register */
+VMVALUE CycleRegister(CycleModel *m, VMUVALUE addr)
+{
+    return addr == CYCLE_CNT_ADDR ? (VMVALUE)(uint32_t)m->count : 0;
+}
+
+/* Run - add the cost of a sequence of PASM instructions */
+static void Run(CycleModel *m, const char *p)
+{
+    for (; *p; ++p) {
+        switch (*p) {
+        case 'c':
+            m->count += 4;
+            break;
+        case 'j':
+            m->count += 8;
+            break;
+        case 'h':
+            m->count += (-m->count & 15) + 8;
+            break;
+        }
+    }
+}
+
+/* BitLength - get the number of bits needed to represent a value */
+static int BitLength(VMUVALUE value)
+{
+    int n;
+    for (n = 0; value != 0; value >>= 1)
+        ++n;
+    return n;
+}
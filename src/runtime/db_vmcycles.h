@@ -0,0 +1,28 @@
+/* db_vmcycles.h - definitions for the Propeller cycle-cost model
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#ifndef __DB_VMCYCLES_H__
+#define __DB_VMCYCLES_H__
+
+#include "db_vm.h"
+
+/* address of the CNT register in the cog window */
+#define CYCLE_CNT_ADDR  (COG_BASE + 0x1f1 * 4)
+
+/* cycle-cost model state */
+struct CycleModel {
+    uint64_t count;         /* simulated system counter */
+    uint64_t instructions;  /* instructions executed */
+    uint32_t clkfreq;       /* clock frequency of the simulated board */
+};
+
+/* prototypes from db_vmcycles.c */
+CycleModel *InitCycleModel(System *sys, uint32_t clkfreq);
+int CycleOpcode(CycleModel *m, int op, VMVALUE tos, VMVALUE *sp);
+VMVALUE CycleNative(CycleModel *m, VMUVALUE inst, VMVALUE tos);
+VMVALUE CycleRegister(CycleModel *m, VMUVALUE addr);
+
+#endif
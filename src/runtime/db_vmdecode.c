@@ -0,0 +1,371 @@
+/* db_vmdecode.c - translate bytecode into a pre-decoded host format
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <string.h>
+#include "db_vm.h"
+#include "db_vmdebug.h"
+
+/* decoder instruction flags */
+#define DF_INSN     0x01    /* start of an instruction */
+#define DF_TARGET   0x02    /* target of a branch */
+
+/* local variables */
+static int8_t operandSizes[256];
+static int operandSizesValid = FALSE;
+
+/* branch target used for targets outside of the text section */
+static DecodedWord badAddress[] = { { XOP_BADADDR } };
+
+/* prototypes for local functions */
+static int IsCall(DecodedText *text, VMUVALUE offset, VMUVALUE *pTarget);
+static int WordCount(DecodedText *text, VMUVALUE offset, int *pLength);
+static int NeedsBranch(DecodedText *text, VMUVALUE offset, int len);
+static DecodedWord *BranchTarget(DecodedText *text, VMUVALUE offset);
+
+/* DecodeImage - translate the text section of an image into pre-decoded form */
+int DecodeImage(System *sys, ImageHdr *image)
+{
+    DecodedText *text;
+    ImageSection *section = NULL;
+    int j;
+
+    /* find the section containing the main code */
+    for (j = 0; j < image->sectionCount; ++j) {
+        ImageFileSection *fileSection = image->sections[j].fileSection;
+        if (image->mainCode >= fileSection->base
+        &&  image->mainCode < fileSection->base + fileSection->size) {
+            section = &image->sections[j];
+            break;
+        }
+    }
+    if (!section)
+        return FALSE;
+
+    /* allocate and initialize the decoded text section */
+    if (!(text = (DecodedText *)xbGlobalAlloc(sys, sizeof(DecodedText))))
+        return FALSE;
+    text->base = section->fileSection->base;
+    text->size = section->fileSection->size;
+    text->data = section->data;
+    text->blocks = NULL;
+    if (!(text->map = (DecodedWord **)xbGlobalAlloc(sys, text->size * sizeof(DecodedWord *)))
+    ||  !(text->flags = (uint8_t *)xbGlobalAlloc(sys, text->size))
+    ||  !(text->work = (VMUVALUE *)xbGlobalAlloc(sys, text->size * sizeof(VMUVALUE))))
+        return FALSE;
+    memset(text->map, 0, text->size * sizeof(DecodedWord *));
+
+    /* decode the code reachable from the main entry point */
+    if (!DecodeCode(sys, text, image->mainCode))
+        return FALSE;
+
+    /* use the decoded text section */
+    image->decoded = text;
+    return TRUE;
+}
+
+/* DecodeCode - get the decoded instruction at an image address decoding any code reachable from it */
+DecodedWord *DecodeCode(System *sys, DecodedText *text, VMUVALUE addr)
+{
+    VMUVALUE offset, target, first, last, end;
+    DecodedBlock *block;
+    int op, len, size, cnt, wcnt, k;
+    DecodedWord *code;
+
+    /* check for an address outside of the text section */
+    offset = addr - text->base;
+    if (offset >= text->size)
+        return NULL;
+
+    /* check for code that has already been decoded */
+    if (text->map[offset])
+        return text->map[offset];
+
+    /* find all of the instructions reachable from the starting address */
+    memset(text->flags, 0, text->size);
+    first = last = offset;
+    text->work[0] = offset;
+    cnt = 1;
+    while (cnt > 0) {
+        offset = text->work[--cnt];
+        while (offset < text->size && !(text->flags[offset] & DF_INSN) && !text->map[offset]) {
+            text->flags[offset] |= DF_INSN;
+            if (offset < first)
+                first = offset;
+            if (offset > last)
+                last = offset;
+            op = VMCODEBYTE(text->data + offset);
+            if ((size = OperandSize(op)) == UNDEFINED_OPERAND || offset + 1 + size > text->size)
+                break;
+            end = offset + 1 + size;
+            if (IsBranch(op)) {
+                target = end + GetCodeWord(text->data + offset + 1);
+                if (target < text->size) {
+                    text->flags[target] |= DF_TARGET;
+                    text->work[cnt++] = target;
+                }
+            }
+            else if (op == OP_LIT && end < text->size && VMCODEBYTE(text->data + end) == OP_PUSHJ) {
+                target = GetCodeWord(text->data + offset + 1) - text->base;
+                if (target < text->size)
+                    text->work[cnt++] = target;
+            }
+            if (IsTerminal(op))
+                break;
+            offset = end;
+        }
+    }
+
+    /* count the words needed for the decoded code */
+    for (wcnt = 0, offset = first; offset <= last; ++offset)
+        if (text->flags[offset] & DF_INSN)
+            wcnt += WordCount(text, offset, &len);
+
+    /* allocate the decoded code block */
+    size = sizeof(DecodedBlock) + (wcnt - 1) * sizeof(DecodedWord);
+    if (!(block = (DecodedBlock *)xbGlobalAlloc(sys, size))
+    ||  !(block->addrs = (VMUVALUE *)xbGlobalAlloc(sys, wcnt * sizeof(VMUVALUE))))
+        return NULL;
+    block->count = wcnt;
+
+    /* assign decoded addresses to each instruction */
+    for (k = 0, offset = first; offset <= last; ++offset)
+        if (text->flags[offset] & DF_INSN && (wcnt = WordCount(text, offset, &len)) > 0) {
+            text->map[offset] = &block->code[k];
+            k += wcnt;
+        }
+
+    /* fill in the decoded instructions */
+    for (code = block->code, offset = first; offset <= last; ++offset) {
+        DecodedWord *start = code;
+
+        /* skip bytes that aren't the start of an instruction */
+        if (!(text->flags[offset] & DF_INSN) || WordCount(text, offset, &len) == 0)
+            continue;
+
+        /* decode the instruction */
+        op = VMCODEBYTE(text->data + offset);
+        size = OperandSize(op);
+        if (size == UNDEFINED_OPERAND)
+            (code++)->op = XOP_UNDEFINED;
+        else if (offset + 1 + size > text->size)
+            (code++)->op = XOP_BADADDR;
+        else if (IsCall(text, offset, &target)) {
+            (code++)->op = XOP_CALL;
+            (code++)->target = BranchTarget(text, target);
+            (code++)->value = text->base + offset + len;
+        }
+        else {
+            (code++)->op = op;
+            switch (op) {
+            case OP_BRT:
+            case OP_BRTSC:
+            case OP_BRF:
+            case OP_BRFSC:
+            case OP_BR:
+                (code++)->target = BranchTarget(text, offset + len + GetCodeWord(text->data + offset + 1));
+                break;
+            case OP_LIT:
+            case OP_NATIVE:
+                (code++)->value = (VMVALUE)GetCodeWord(text->data + offset + 1);
+                break;
+            case OP_SLIT:
+            case OP_LREF:
+            case OP_LSET:
+                (code++)->value = (int8_t)VMCODEBYTE(text->data + offset + 1);
+                break;
+            case OP_CLEAN:
+            case OP_FRAME:
+            case OP_TRAP:
+                (code++)->value = VMCODEBYTE(text->data + offset + 1);
+                break;
+            case OP_PUSHJ:
+                (code++)->value = text->base + offset + len;
+                break;
+            }
+        }
+
+        /* branch to the next instruction if it doesn't immediately follow this one */
+        if (NeedsBranch(text, offset, len)) {
+            (code++)->op = OP_BR;
+            (code++)->target = BranchTarget(text, offset + len);
+        }
+
+        /* remember the image address of each word */
+        while (start < code)
+            block->addrs[start++ - block->code] = text->base + offset;
+    }
+
+    /* add the block to the list of decoded blocks */
+    block->next = text->blocks;
+    text->blocks = block;
+
+    /* return the decoded starting instruction */
+    return text->map[addr - text->base];
+}
+
+/* DecodedAddress - get the image address of a decoded instruction */
+VMUVALUE DecodedAddress(DecodedText *text, DecodedWord *p)
+{
+    DecodedBlock *block;
+    for (block = text->blocks; block != NULL; block = block->next)
+        if (p >= block->code && p < block->code + block->count)
+            return block->addrs[p - block->code];
+        else if (p == block->code + block->count)
+            return block->addrs[block->count - 1];
+    return 0;
+}
+
+/* OperandSize - get the size of the operand of an opcode */
+int OperandSize(int op)
+{
+    if (!operandSizesValid) {
+        FLASH_SPACE OTDEF *entry;
+        memset(operandSizes, UNDEFINED_OPERAND, sizeof(operandSizes));
+        for (entry = OpcodeTable; entry->name; ++entry) {
+            switch (entry->fmt) {
+            case FMT_NONE:
+                operandSizes[entry->code] = 0;
+                break;
+            case FMT_BYTE:
+            case FMT_SBYTE:
+                operandSizes[entry->code] = 1;
+                break;
+            case FMT_WORD:
+            case FMT_NATIVE:
+            case FMT_BR:
+                operandSizes[entry->code] = sizeof(VMVALUE);
+                break;
+            }
+        }
+        operandSizesValid = TRUE;
+    }
+    return operandSizes[op];
+}
+
+/* GetCodeWord - get a big-endian word operand */
+VMUVALUE GetCodeWord(const uint8_t *p)
+{
+    VMUVALUE value;
+    int cnt;
+    for (value = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
+        value = (value << 8) | VMCODEBYTE(p++);
+    return value;
+}
+
+/* IsTerminal - check for an instruction that doesn't continue with the next instruction */
+int IsTerminal(int op)
+{
+    switch (op) {
+    case OP_HALT:
+    case OP_BR:
+    case OP_POPJ:
+    case OP_RETURN:
+    case OP_RETURNZ:
+        return TRUE;
+    }
+    return OperandSize(op) == UNDEFINED_OPERAND;
+}
+
+/* IsBranch - check for a branch instruction */
+int IsBranch(int op)
+{
+    switch (op) {
+    case OP_BRT:
+    case OP_BRTSC:
+    case OP_BRF:
+    case OP_BRFSC:
+    case OP_BR:
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/* IsCall - check for a literal function address followed by a call that can be combined into XOP_CALL */
+static int IsCall(DecodedText *text, VMUVALUE offset, VMUVALUE *pTarget)
+{
+    VMUVALUE next = offset + 1 + sizeof(VMVALUE), target;
+    if (offset >= text->size
+    ||  !(text->flags[offset] & DF_INSN)
+    ||  VMCODEBYTE(text->data + offset) != OP_LIT
+    ||  next >= text->size
+    ||  VMCODEBYTE(text->data + next) != OP_PUSHJ
+    ||  (text->flags[next] & (DF_INSN | DF_TARGET)) != DF_INSN)
+        return FALSE;
+    target = GetCodeWord(text->data + offset + 1) - text->base;
+    if (target >= text->size || (!text->map[target] && !(text->flags[target] & DF_INSN)))
+        return FALSE;
+    if (pTarget)
+        *pTarget = target;
+    return TRUE;
+}
+
+/* WordCount - get the number of decoded words and the bytecode length of an instruction */
+static int WordCount(DecodedText *text, VMUVALUE offset, int *pLength)
+{
+    int op = VMCODEBYTE(text->data + offset);
+    int size = OperandSize(op);
+    int cnt;
+
+    /* undefined opcodes and truncated instructions abort when executed */
+    if (size == UNDEFINED_OPERAND || offset + 1 + size > text->size) {
+        *pLength = 1;
+        return 1;
+    }
+
+    /* the call in a combined call sequence is not decoded separately */
+    if (offset >= sizeof(VMVALUE) + 1 && IsCall(text, offset - sizeof(VMVALUE) - 1, NULL)) {
+        *pLength = 1;
+        return 0;
+    }
+
+    /* combined call sequences include the call instruction */
+    if (IsCall(text, offset, NULL)) {
+        *pLength = 2 + size;
+        cnt = 3;
+    }
+
+    /* all other instructions are an opcode word and at most one operand word */
+    else {
+        *pLength = 1 + size;
+        cnt = (size > 0 || op == OP_PUSHJ ? 2 : 1);
+    }
+
+    /* add a branch if the next instruction doesn't immediately follow this one */
+    if (NeedsBranch(text, offset, *pLength))
+        cnt += 2;
+
+    return cnt;
+}
+
+/* NeedsBranch - check for an instruction that needs a branch to the instruction that follows it */
+static int NeedsBranch(DecodedText *text, VMUVALUE offset, int len)
+{
+    int op = VMCODEBYTE(text->data + offset);
+    VMUVALUE next = offset + len, p;
+
+    /* undefined, truncated and terminal instructions don't continue */
+    if (IsTerminal(op) || next > text->size)
+        return FALSE;
+
+    /* the next instruction must be decoded in this block */
+    if (next == text->size || !(text->flags[next] & DF_INSN))
+        return TRUE;
+
+    /* and nothing else can be decoded between the two */
+    for (p = offset + 1; p < next; ++p)
+        if (text->flags[p] & DF_INSN)
+            return TRUE;
+
+    return FALSE;
+}
+
+/* BranchTarget - get the decoded address of a branch target */
+static DecodedWord *BranchTarget(DecodedText *text, VMUVALUE offset)
+{
+    if (offset >= text->size || !text->map[offset])
+        return badAddress;
+    return text->map[offset];
+}
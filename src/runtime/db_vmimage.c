@@ -10,8 +10,11 @@
 #include "db_vmdebug.h"
 #include "db_vm.h"
 
+/* prototypes for local functions */
+static ImageDebug *LoadDebugSection(System *sys, FILE *fp);
+
 /* LoadImage - load an image from a file */
-ImageHdr *LoadImage(System *sys, const char *name)
+ImageHdr *LoadImage(System *sys, const char *name, int flags)
 {
     ImageFileHdr fileHdr;
     ImageFileSection *src;
@@ -27,6 +30,12 @@ ImageHdr *LoadImage(System *sys, const char *name)
     /* read the image file header */
     if (fread((uint8_t *)&fileHdr, 1, sizeof(ImageFileHdr), fp) != sizeof(ImageFileHdr))
         Fatal(sys, "error reading image header");
+
+    /* make sure it is an image this VM can run */
+    if (memcmp(fileHdr.tag, IMAGE_TAG, sizeof(fileHdr.tag)) != 0)
+        Fatal(sys, "invalid image file '%s'", name);
+    else if (fileHdr.version != IMAGE_VERSION)
+        Fatal(sys, "wrong image file version: expected %04x, found %04x", IMAGE_VERSION, fileHdr.version);
         
     /* get the section count */
     count = fileHdr.sectionCount;
@@ -39,7 +48,10 @@ ImageHdr *LoadImage(System *sys, const char *name)
     image->mainCode = fileHdr.mainCode;
     image->stackSize = fileHdr.stackSize;
     image->sectionCount = count;
-    if (!(image->sections[0].data = (uint8_t *)xbGlobalAlloc(sys, fileHdr.sections[0].size)))
+    image->decoded = NULL;
+    image->jit = NULL;
+    image->debug = NULL;
+    if (!(image->sections[0].data = (uint8_t *)xbGlobalAlloc(sys, fileHdr.sections[0].size + fileHdr.sections[0].zeroSize)))
         Fatal(sys, "insufficient space for %08x section", fileHdr.sections[0].base);
     memcpy(image->sections[0].data, &fileHdr, sizeof(ImageFileHdr));
     
@@ -52,20 +64,90 @@ ImageHdr *LoadImage(System *sys, const char *name)
     src = ((ImageFileHdr *)image->sections[0].data)->sections;
     dst = image->sections;
     dst->fileSection = src;
+    dst->size = src->size + src->zeroSize;
+    memset(dst->data + src->size, 0, src->zeroSize);
     ++src; ++dst;
     
-    /* initialize the headers and read the data for the remaining sections */
+    /* initialize the headers and read the data for the remaining sections (the zero-filled data isn't in the file) */
     for (; --count >= 1; ++src, ++dst) {
         dst->fileSection = src;
-        if (!(dst->data = (uint8_t *)xbGlobalAlloc(sys, src->size)))
+        dst->size = src->size + src->zeroSize;
+        if (!(dst->data = (uint8_t *)xbGlobalAlloc(sys, dst->size)))
             Fatal(sys, "insufficient space for %08x section", src->base);
         if (fread(dst->data, 1, src->size, fp) != src->size)
             Fatal(sys, "error reading %08x section", src->base);
+        memset(dst->data + src->size, 0, src->zeroSize);
     }
     
+    /* load the debug section that follows the section data if requested */
+    if ((flags & IMAGE_DEBUG) && (fileHdr.flags & IMAGE_FLAG_DEBUG))
+        image->debug = LoadDebugSection(sys, fp);
+
     fclose(fp);
     
+    /* translate the text section into pre-decoded form if requested */
+    if ((flags & IMAGE_PREDECODE) && !DecodeImage(sys, image))
+        Fatal(sys, "error pre-decoding image");
+
+    /* prepare the text section for the JIT compiler if requested */
+    if ((flags & IMAGE_JIT) && !JitImage(sys, image))
+        Fatal(sys, "JIT compiler not available for this image");
+
     /* return the image */
     return image;
 }
 
+
+/* LoadDebugSection - load the debug section */
+static ImageDebug *LoadDebugSection(System *sys, FILE *fp)
+{
+    ImageDebugHdr hdr;
+    ImageDebug *debug;
+    VMUVALUE *offsets = NULL;
+    char *strings;
+    size_t size;
+    int j;
+
+    /* read the debug section header */
+    if (fread((uint8_t *)&hdr, 1, sizeof(ImageDebugHdr), fp) != sizeof(ImageDebugHdr)
+    ||  memcmp(hdr.tag, IMAGE_DEBUG_TAG, sizeof(hdr.tag)) != 0)
+        Fatal(sys, "error reading debug section header");
+
+    /* allocate space for the tables */
+    if (!(debug = (ImageDebug *)xbGlobalAlloc(sys, sizeof(ImageDebug)))
+    ||  !(debug->files = (char **)xbGlobalAlloc(sys, (hdr.fileCount + 1) * sizeof(char *)))
+    ||  !(offsets = (VMUVALUE *)xbGlobalAlloc(sys, (hdr.fileCount + 1) * sizeof(VMUVALUE)))
+    ||  !(debug->functionNames = (char **)xbGlobalAlloc(sys, (hdr.functionCount + 1) * sizeof(char *)))
+    ||  !(debug->functions = (ImageDebugFunction *)xbGlobalAlloc(sys, (hdr.functionCount + 1) * sizeof(ImageDebugFunction)))
+    ||  !(debug->lines = (ImageDebugLine *)xbGlobalAlloc(sys, (hdr.lineCount + 1) * sizeof(ImageDebugLine)))
+    ||  !(strings = (char *)xbGlobalAlloc(sys, hdr.stringSize + 1)))
+        Fatal(sys, "insufficient space for debug section");
+    debug->fileCount = hdr.fileCount;
+    debug->functionCount = hdr.functionCount;
+    debug->lineCount = hdr.lineCount;
+
+    /* read the tables */
+    size = hdr.fileCount * sizeof(VMUVALUE);
+    if (fread(offsets, 1, size, fp) != size)
+        Fatal(sys, "error reading debug file table");
+    size = hdr.functionCount * sizeof(ImageDebugFunction);
+    if (fread(debug->functions, 1, size, fp) != size)
+        Fatal(sys, "error reading debug function table");
+    size = hdr.lineCount * sizeof(ImageDebugLine);
+    if (fread(debug->lines, 1, size, fp) != size)
+        Fatal(sys, "error reading debug line table");
+    if (fread(strings, 1, hdr.stringSize, fp) != hdr.stringSize)
+        Fatal(sys, "error reading debug string table");
+    strings[hdr.stringSize] = '\0';
+
+    /* resolve the names */
+    for (j = 0; j < hdr.fileCount; ++j)
+        debug->files[j] = strings + (offsets[j] < hdr.stringSize ? offsets[j] : hdr.stringSize);
+    for (j = 0; j < hdr.functionCount; ++j) {
+        VMUVALUE offset = debug->functions[j].name;
+        debug->functionNames[j] = strings + (offset < hdr.stringSize ? offset : hdr.stringSize);
+    }
+
+    /* return the debug section */
+    return debug;
+}
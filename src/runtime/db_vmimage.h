@@ -13,14 +13,71 @@
 /* image file section */
 typedef struct {
     ImageFileSection *fileSection;
+    VMUVALUE size;          /* size in memory (the contents and the zero-filled data) */
     uint8_t *data;
 } ImageSection;
 
+/* LoadImage flags */
+#define IMAGE_PREDECODE 0x0001  /* translate the text section into pre-decoded form */
+#define IMAGE_JIT       0x0002  /* translate functions into native code on their first call */
+#define IMAGE_DEBUG     0x0004  /* load the debug section if the image has one */
+
+/* internal opcodes used only in pre-decoded code */
+#define XOP_CALL        0x100   /* call a function whose address was known at load time */
+#define XOP_BADADDR     0x101   /* branch to an address outside of the text section */
+#define XOP_UNDEFINED   0x102   /* undefined opcode */
+#define XOP_LAST        0x102
+
+/* pre-decoded instruction word */
+typedef union DecodedWord DecodedWord;
+union DecodedWord {
+    intptr_t op;            /* opcode */
+    VMVALUE value;          /* native-endian operand */
+    DecodedWord *target;    /* resolved branch or call target */
+};
+
+/* block of pre-decoded code */
+typedef struct DecodedBlock DecodedBlock;
+struct DecodedBlock {
+    DecodedBlock *next;     /* next block */
+    VMUVALUE *addrs;        /* image address of the instruction containing each word */
+    int count;              /* number of words in the block */
+    DecodedWord code[1];    /* pre-decoded code */
+};
+
+/* pre-decoded text section */
+typedef struct {
+    VMUVALUE base;          /* image address of the text section */
+    VMUVALUE size;          /* size of the text section */
+    uint8_t *data;          /* original bytecode */
+    DecodedWord **map;      /* maps text offsets to decoded instructions */
+    uint8_t *flags;         /* scratch instruction flags used while decoding */
+    VMUVALUE *work;         /* scratch work list used while decoding */
+    DecodedBlock *blocks;   /* blocks of decoded code */
+} DecodedText;
+
+/* native code generated by the JIT compiler (defined in db_vmjit.c) */
+typedef struct JitText JitText;
+
+/* debug section */
+typedef struct {
+    VMUVALUE fileCount;             /* number of source files */
+    VMUVALUE functionCount;         /* number of functions */
+    VMUVALUE lineCount;             /* number of line table entries */
+    char **files;                   /* source file names */
+    char **functionNames;           /* function names */
+    ImageDebugFunction *functions;  /* functions in address order */
+    ImageDebugLine *lines;          /* line table in address order */
+} ImageDebug;
+
 /* in-memory image header */
 typedef struct {
     VMUVALUE        mainCode;
     VMUVALUE        stackSize;
     VMUVALUE        sectionCount;
+    DecodedText     *decoded;   /* pre-decoded text section or NULL */
+    JitText         *jit;       /* JIT compiled text section or NULL */
+    ImageDebug      *debug;     /* debug section or NULL */
     ImageSection    sections[1];
 } ImageHdr;
 
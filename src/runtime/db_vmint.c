@@ -11,14 +11,30 @@
 #include <ctype.h>
 #include "db_vm.h"
 #include "db_vmdebug.h"
+#include "db_vmprof.h"
+#include "db_vmstats.h"
+#include "db_vmcycles.h"
+#include "db_vmcache.h"
 
 /* prototypes for local functions */
+static int ExecuteBytecode(Interpreter *i);
+static int ExecuteDecoded(Interpreter *i);
+static int ExecuteProfiled(Interpreter *i);
+static int ExecuteCycles(Interpreter *i);
+static int ExecuteCached(Interpreter *i);
+#ifdef VM_STATS
+static int ExecuteStats(Interpreter *i);
+#endif
+static void MapSections(Interpreter *i);
 static uint8_t *MapAddress(Interpreter *i, VMUVALUE addr);
+static DecodedWord *MapCode(Interpreter *i, VMUVALUE addr);
+static VMUVALUE CodeAddress(Interpreter *i);
 static VMVALUE LoadValue(Interpreter *i, VMUVALUE addr);
+static VMVALUE LoadRegister(Interpreter *i, VMUVALUE addr);
 static VMVALUE LoadByteValue(Interpreter *i, VMUVALUE addr);
 static void StoreValue(Interpreter *i, VMUVALUE addr, VMVALUE value);
+static void StoreRegister(Interpreter *i, VMUVALUE addr, VMVALUE value);
 static void StoreByteValue(Interpreter *i, VMUVALUE addr, VMVALUE value);
-static void DoTrap(Interpreter *i, int op);
 static void PrintC(Interpreter *i, int ch);
 
 /* InitInterpreter - initialize the interpreter */
@@ -32,8 +48,15 @@ Interpreter *InitInterpreter(System *sys, ImageHdr *image)
     if (!(i->stack = (VMVALUE *)xbGlobalAlloc(sys, image->stackSize * sizeof(VMVALUE))))
         return NULL;
         
+    i->sys = sys;
     i->image = image;
     i->stackTop = i->stack + image->stackSize;
+    i->profile = NULL;
+    i->cycles = NULL;
+    i->cache = NULL;
+#ifdef VM_STATS
+    i->stats = NULL;
+#endif
     
     return i;
 }
@@ -41,247 +64,215 @@ Interpreter *InitInterpreter(System *sys, ImageHdr *image)
 /* Execute - execute the main code */
 int Execute(Interpreter *i, ImageHdr *image)
 {
-    VMVALUE tmp;
-    int8_t tmpb;
-    int cnt;
+    MemoryWindow *window;
 
 	/* setup the new image */
 	i->image = image;
 
     /* initialize */    
-    i->pc = (uint8_t *)MapAddress(i, i->image->mainCode);
     i->sp = i->fp = i->stackTop;
+    i->tos = 0;
     i->linePos = 0;
 
     if (setjmp(i->errorTarget))
         return FALSE;
 
-    for (;;) {
-#if 0
-        ShowStack(i);
-        DecodeInstruction(UnmapAddress(i, i->pc), i->pc);
+    /* map the image sections into the address space */
+    MapSections(i);
+
+    /* find the text section */
+    window = &i->windows[image->mainCode >> WINDOW_SHIFT];
+    if (image->mainCode - window->base >= window->size)
+        Abort(i, "address error");
+    i->code = window->data;
+    i->codeBase = window->base;
+
+    /* execute the bytecode with instruction counting if the profiler is enabled */
+    if (i->profile) {
+        i->pc = i->code + (image->mainCode - i->codeBase);
+        return ExecuteProfiled(i);
+    }
+
+    /* execute the bytecode with the cache simulator (which also uses the cycle-cost model) if it is enabled */
+    if (i->cache) {
+        i->pc = i->code + (image->mainCode - i->codeBase);
+        return ExecuteCached(i);
+    }
+
+    /* execute the bytecode with the cycle-cost model if CNT is being simulated */
+    if (i->cycles) {
+        i->pc = i->code + (image->mainCode - i->codeBase);
+        return ExecuteCycles(i);
+    }
+
+#ifdef VM_STATS
+    /* execute the bytecode with opcode counting if statistics are enabled */
+    if (i->stats) {
+        i->pc = i->code + (image->mainCode - i->codeBase);
+        return ExecuteStats(i);
+    }
 #endif
-        switch (VMCODEBYTE(i->pc++)) {
-        case OP_HALT:
-            return TRUE;
-        case OP_BRT:
-            for (tmp = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
-                tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
-            if (i->tos)
-                i->pc += tmp;
-            i->tos = Pop(i);
-            break;
-        case OP_BRTSC:
-            for (tmp = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
-                tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
-            if (i->tos)
-                i->pc += tmp;
-            else
-                i->tos = Pop(i);
-            break;
-        case OP_BRF:
-            for (tmp = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
-                tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
-            if (!i->tos)
-                i->pc += tmp;
-            i->tos = Pop(i);
-            break;
-        case OP_BRFSC:
-            for (tmp = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
-                tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
-            if (!i->tos)
-                i->pc += tmp;
-            else
-                i->tos = Pop(i);
-            break;
-        case OP_BR:
-            for (tmp = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
-                tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
-            i->pc += tmp;
-            break;
-        case OP_NOT:
-            i->tos = (i->tos ? FALSE : TRUE);
-            break;
-        case OP_NEG:
-            i->tos = -i->tos;
-            break;
-        case OP_ADD:
-            tmp = Pop(i);
-            i->tos = tmp + i->tos;
-            break;
-        case OP_SUB:
-            tmp = Pop(i);
-            i->tos = tmp - i->tos;
-            break;
-        case OP_MUL:
-            tmp = Pop(i);
-            i->tos = tmp * i->tos;
-            break;
-        case OP_DIV:
-            tmp = Pop(i);
-            i->tos = (i->tos == 0 ? 0 : tmp / i->tos);
-            break;
-        case OP_REM:
-            tmp = Pop(i);
-            i->tos = (i->tos == 0 ? 0 : tmp % i->tos);
-            break;
-        case OP_BNOT:
-            i->tos = ~i->tos;
-            break;
-        case OP_BAND:
-            tmp = Pop(i);
-            i->tos = tmp & i->tos;
-            break;
-        case OP_BOR:
-            tmp = Pop(i);
-            i->tos = tmp | i->tos;
-            break;
-        case OP_BXOR:
-            tmp = Pop(i);
-            i->tos = tmp ^ i->tos;
-            break;
-        case OP_SHL:
-            tmp = Pop(i);
-            i->tos = tmp << i->tos;
-            break;
-        case OP_SHR:
-            tmp = Pop(i);
-            i->tos = tmp >> i->tos;
-            break;
-        case OP_LT:
-            tmp = Pop(i);
-            i->tos = (tmp < i->tos ? TRUE : FALSE);
-            break;
-        case OP_LE:
-            tmp = Pop(i);
-            i->tos = (tmp <= i->tos ? TRUE : FALSE);
-            break;
-        case OP_EQ:
-            tmp = Pop(i);
-            i->tos = (tmp == i->tos ? TRUE : FALSE);
-            break;
-        case OP_NE:
-            tmp = Pop(i);
-            i->tos = (tmp != i->tos ? TRUE : FALSE);
-            break;
-        case OP_GE:
-            tmp = Pop(i);
-            i->tos = (tmp >= i->tos ? TRUE : FALSE);
-            break;
-        case OP_GT:
-            tmp = Pop(i);
-            i->tos = (tmp > i->tos ? TRUE : FALSE);
-            break;
-        case OP_LIT:
-            for (tmp = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
-                tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
-            CPush(i, i->tos);
-            i->tos = tmp;
-            break;
-        case OP_SLIT:
-            tmpb = (int8_t)VMCODEBYTE(i->pc++);
-            CPush(i, i->tos);
-            i->tos = tmpb;
-            break;
-        case OP_LOAD:
-            i->tos = LoadValue(i, (VMUVALUE)i->tos);
-            break;
-        case OP_LOADB:
-            i->tos = LoadByteValue(i, (VMUVALUE)i->tos);
-            break;
-        case OP_STORE:
-            tmp = Pop(i);
-            StoreValue(i, (VMUVALUE)i->tos, tmp);
-            i->tos = Pop(i);
-            break;
-        case OP_STOREB:
-            tmp = Pop(i);
-            StoreByteValue(i, (VMUVALUE)i->tos, tmp);
-            i->tos = Pop(i);
-            break;
-        case OP_LREF:
-            tmpb = (int8_t)VMCODEBYTE(i->pc++);
-            CPush(i, i->tos);
-            i->tos = i->fp[(int)tmpb];
-            break;
-        case OP_LSET:
-            tmpb = (int8_t)VMCODEBYTE(i->pc++);
-            i->fp[(int)tmpb] = i->tos;
-            i->tos = Pop(i);
-            break;
-        case OP_INDEX:
-            tmp = Pop(i);
-            i->tos = tmp + i->tos * sizeof (VMVALUE);
-            break;
-        case OP_PUSHJ:
-            tmp = (VMVALUE)(i->pc - (uint8_t *)i->image);
-            i->pc = (uint8_t *)MapAddress(i, i->tos);
-            i->tos = tmp;
-            break;
-        case OP_POPJ:
-            i->pc = (uint8_t *)i->image + i->tos;
-            i->tos = Pop(i);
-            break;
-        case OP_CLEAN:
-            cnt = VMCODEBYTE(i->pc++);
-            Drop(i, cnt);
-            break;
-        case OP_FRAME:
-            cnt = VMCODEBYTE(i->pc++);
-            tmp = (VMVALUE)(i->fp - i->stack);
-            i->fp = i->sp;
-            Reserve(i, cnt);
-            i->fp[F_FP] = tmp;
-            break;
-        case OP_RETURNZ:
-            CPush(i, i->tos);
-            i->tos = 0;
-            // fall through
-        case OP_RETURN:
-            i->pc = (uint8_t *)i->image + Top(i);
-            i->sp = i->fp;
-            i->fp = (VMVALUE *)(i->stack + i->fp[F_FP]);
-            break;
-        case OP_DROP:
-            i->tos = Pop(i);
-            break;
-        case OP_DUP:
-            CPush(i, i->tos);
-            break;
-        case OP_NATIVE:
-            for (tmp = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
-                tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
-            break;
-        case OP_TRAP:
-            DoTrap(i, VMCODEBYTE(i->pc++));
-            break;
-        default:
-            Abort(i, "undefined opcode 0x%02x", VMCODEBYTE(i->pc - 1));
-            break;
-        }
+
+    /* execute native code if the JIT compiler is enabled */
+    if (image->jit)
+        return ExecuteJit(i, image->mainCode);
+
+    /* execute pre-decoded code if it is available */
+    if (image->decoded) {
+        i->dpc = MapCode(i, image->mainCode);
+        return ExecuteDecoded(i);
     }
+
+    /* otherwise, execute the bytecode directly */
+    i->pc = i->code + (image->mainCode - i->codeBase);
+    return ExecuteBytecode(i);
 }
 
-static uint8_t *MapAddress(Interpreter *i, VMUVALUE addr)
+/* the interpreter state is kept in locals while executing and is only
+   written back to the Interpreter structure around calls that use it */
+#define SaveState()     (i->PC_FIELD = pc, i->sp = sp, i->fp = fp, i->tos = tos)
+#define RestoreState()  (pc = i->PC_FIELD, sp = i->sp, fp = i->fp, tos = i->tos)
+
+/* local versions of the stack manipulation macros */
+#define LReserve(n)     do {                                    \
+                            if (sp - (n) < stack) {             \
+                                SaveState();                    \
+                                StackOverflow(i);               \
+                            }                                   \
+                            else  {                             \
+                                int _cnt = (n);                 \
+                                while (--_cnt >= 0)             \
+                                    LPush(0);                   \
+                            }                                   \
+                        } while (0)
+#define LCPush(v)       do {                                    \
+                            if (sp - 1 < stack) {               \
+                                SaveState();                    \
+                                StackOverflow(i);               \
+                            }                                   \
+                            else                                \
+                                LPush(v);                       \
+                        } while (0)
+#define LPush(v)        (*--sp = (v))
+#define LPop()          (*sp++)
+#define LTop()          (*sp)
+#define LDrop(n)        (sp += (n))
+
+/* instruction dispatch */
+#ifdef VM_THREADED
+#define OPCODE(op)      L_##op:
+#define UNDEFINED       L_undefined:
+#define NEXT            goto *dispatch[FetchOpcode()]
+#else
+#define OPCODE(op)      case op:
+#define UNDEFINED       default:
+#define NEXT            break
+#endif
+
+/* interpreter for bytecode */
+#define EXECUTE             ExecuteBytecode
+#include "db_vmloop.h"
+
+/* interpreter for pre-decoded code */
+#define EXECUTE             ExecuteDecoded
+#define DECODED
+#include "db_vmloop.h"
+
+/* interpreter for bytecode that counts instructions, calls and returns for the profiler */
+#define EXECUTE             ExecuteProfiled
+#define FetchOpcode()       (ProfileInstruction(i->profile, pc - i->code), VMCODEBYTE(pc++))
+#define CallHook(addr)      ProfileCall(i->profile, addr)
+#define ReturnHook()        ProfileReturn(i->profile)
+#include "db_vmloop.h"
+
+/* interpreter for bytecode that advances the simulated CNT by the cost of each instruction */
+#define EXECUTE             ExecuteCycles
+#define FetchOpcode()       CycleOpcode(i->cycles, VMCODEBYTE(pc++), tos, sp)
+#define NativeInstruction(inst) (tos = CycleNative(i->cycles, (VMUVALUE)(inst), tos))
+#include "db_vmloop.h"
+
+/* interpreter for bytecode that also passes its external memory accesses through the cache simulator */
+#define EXECUTE             ExecuteCached
+#define FetchOpcode()       (++pc, CacheOpcode(i->cache, i->codeBase + (VMUVALUE)(pc - 1 - i->code), \
+                                               CycleOpcode(i->cycles, VMCODEBYTE(pc - 1), tos, sp), tos))
+#define NativeInstruction(inst) (tos = CycleNative(i->cycles, (VMUVALUE)(inst), tos))
+#include "db_vmloop.h"
+
+#ifdef VM_STATS
+
+/* interpreter for bytecode that counts opcodes, opcode sequences and branch outcomes */
+#define EXECUTE             ExecuteStats
+#define FetchOpcode()       StatsOpcode(i->stats, VMCODEBYTE(pc++))
+#define BranchHook(taken)   StatsBranch(i->stats, taken)
+#include "db_vmloop.h"
+
+#endif
+
+/* MapSections - map each image section into the window containing its base address */
+static void MapSections(Interpreter *i)
 {
     int j;
+    memset(i->windows, 0, sizeof(i->windows));
     for (j = 0; j < i->image->sectionCount; ++j) {
         ImageSection *section = &i->image->sections[j];
         VMUVALUE base = section->fileSection->base;
-        if (addr >= base && addr < base + 0x10000000) {
-            if (addr > base + section->fileSection->size)
-                Abort(i, "address error");
-            return (uint8_t *)(section->data + (addr - base));
-        }
+        VMUVALUE size = section->size;
+        MemoryWindow *window = &i->windows[base >> WINDOW_SHIFT];
+        if (window->size > 0 || size > (~base & ((1 << WINDOW_SHIFT) - 1)) + 1)
+            Abort(i, "overlapping sections");
+        window->base = base;
+        window->size = size;
+        window->longSize = (size >= sizeof(VMVALUE) ? size - sizeof(VMVALUE) + 1 : 0);
+        window->data = section->data;
     }
-    Abort(i, "address error");
-    return NULL; // not reached
+}
+
+/* MapAddress - map the address of a byte to a host pointer */
+static uint8_t *MapAddress(Interpreter *i, VMUVALUE addr)
+{
+    MemoryWindow *window = &i->windows[addr >> WINDOW_SHIFT];
+    VMUVALUE offset = addr - window->base;
+    if (offset >= window->size)
+        Abort(i, "address error");
+    return window->data + offset;
+}
+
+/* MapCode - map an image address to pre-decoded code */
+static DecodedWord *MapCode(Interpreter *i, VMUVALUE addr)
+{
+    DecodedText *text = i->image->decoded;
+    VMUVALUE offset = addr - text->base;
+    DecodedWord *code;
+    if (offset < text->size && (code = text->map[offset]) != NULL)
+        return code;
+    if (!(code = DecodeCode(i->sys, text, addr)))
+        Abort(i, "address error");
+    return code;
+}
+
+/* CodeAddress - get the image address corresponding to the saved pc */
+static VMUVALUE CodeAddress(Interpreter *i)
+{
+    if (i->image->decoded)
+        return DecodedAddress(i->image->decoded, i->dpc);
+    return i->codeBase + (VMUVALUE)(i->pc - i->code);
 }
 
 static VMVALUE LoadValue(Interpreter *i, VMUVALUE addr)
 {
-    VMVALUE *p = (VMVALUE *)MapAddress(i, addr);
-    return *p;
+    MemoryWindow *window = &i->windows[addr >> WINDOW_SHIFT];
+    VMUVALUE offset = addr - window->base;
+    if (offset >= window->longSize)
+        return LoadRegister(i, addr);
+    return *(VMVALUE *)(window->data + offset);
+}
+
+/* LoadRegister - load a long from outside of the image (cog registers are only simulated by the cycle-cost model) */
+static VMVALUE LoadRegister(Interpreter *i, VMUVALUE addr)
+{
+    if (!i->cycles || addr < COG_BASE || addr >= RAM_BASE)
+        Abort(i, "address error");
+    return CycleRegister(i->cycles, addr);
 }
 
 static VMVALUE LoadByteValue(Interpreter *i, VMUVALUE addr)
@@ -292,8 +283,19 @@ static VMVALUE LoadByteValue(Interpreter *i, VMUVALUE addr)
 
 static void StoreValue(Interpreter *i, VMUVALUE addr, VMVALUE value)
 {
-    VMVALUE *p = (VMVALUE *)MapAddress(i, addr);
-    *p = value;
+    MemoryWindow *window = &i->windows[addr >> WINDOW_SHIFT];
+    VMUVALUE offset = addr - window->base;
+    if (offset >= window->longSize)
+        StoreRegister(i, addr, value);
+    else
+        *(VMVALUE *)(window->data + offset) = value;
+}
+
+/* StoreRegister - store a long outside of the image (stores to cog registers are ignored by the cycle-cost model) */
+static void StoreRegister(Interpreter *i, VMUVALUE addr, VMVALUE value)
+{
+    if (!i->cycles || addr < COG_BASE || addr >= RAM_BASE)
+        Abort(i, "address error");
 }
 
 static void StoreByteValue(Interpreter *i, VMUVALUE addr, VMVALUE value)
@@ -302,7 +304,7 @@ static void StoreByteValue(Interpreter *i, VMUVALUE addr, VMVALUE value)
     *p = value;
 }
 
-static void DoTrap(Interpreter *i, int op)
+void DoTrap(Interpreter *i, int op)
 {
     switch (op) {
     case TRAP_GETCHAR:
@@ -332,6 +334,7 @@ void ShowStack(Interpreter *i)
 {
     VMVALUE *p;
     if (i->sp < i->stackTop) {
+        xbInfo(i->sys, "%08x:", CodeAddress(i));
         xbInfo(i->sys, " %d", i->tos);
         for (p = i->sp; p < i->stackTop - 1; ++p) {
             if (p == i->fp)
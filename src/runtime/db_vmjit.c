@@ -0,0 +1,1118 @@
+/* db_vmjit.c - translate bytecode into x86-64 machine code
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ * Each function is translated the first time it is called.  A function
+ * is the code reachable from its entry point without following calls and
+ * ends at OP_RETURN, OP_RETURNZ, OP_POPJ or OP_HALT.  The generated code
+ * keeps the interpreter state in registers:
+ *
+ *  rbx     Interpreter structure
+ *  r12     sp
+ *  r13     fp
+ *  r14d    tos
+ *  r15     stack (the lowest stack address)
+ *
+ * Calls and returns go through a dispatch stub that maps an image address
+ * to the native code for it.  If there is no native code for the address
+ * the stub returns to ExecuteJit which compiles the function starting at
+ * that address and continues there.  OP_TRAP calls the interpreter's trap
+ * handler and OP_NATIVE is ignored just as it is by the interpreter.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "db_vm.h"
+
+#ifdef VM_JIT
+
+#include <sys/mman.h>
+
+/* JIT compiler instruction flags */
+#define DF_INSN     0x01    /* start of an instruction in the function being compiled */
+#define DF_TARGET   0x02    /* instruction that needs an entry in the native code map */
+
+/* native code space for each byte of bytecode */
+#define JIT_BYTES_PER_BYTE  64
+#define JIT_MIN_SPACE       (64 * 1024)
+
+/* maximum size of the native code for a single instruction */
+#define JIT_MAX_INSN        256
+
+/* offset used when an instruction doesn't continue with the next one */
+#define NO_NEXT     ((VMUVALUE)~0)
+
+/* registers */
+#define RAX         0
+#define RCX         1
+#define RDX         2
+#define RBX         3
+#define RSI         6
+#define RDI         7
+#define R12         12
+#define R13         13
+#define R14         14
+#define R15         15
+#define NOREG       -1
+
+/* registers holding the interpreter state */
+#define I_REG       RBX
+#define SP_REG      R12
+#define FP_REG      R13
+#define TOS_REG     R14
+#define STACK_REG   R15
+
+/* condition codes */
+#define CC_B        0x2
+#define CC_AE       0x3
+#define CC_E        0x4
+#define CC_NE       0x5
+#define CC_BE       0x6
+#define CC_L        0xc
+#define CC_GE       0xd
+#define CC_LE       0xe
+#define CC_G        0xf
+#define CC_ALWAYS   -1
+
+/* arithmetic opcode extensions */
+#define ALU_ADD     0
+#define ALU_OR      1
+#define ALU_AND     4
+#define ALU_SUB     5
+#define ALU_XOR     6
+#define ALU_CMP     7
+
+/* kinds of right operands of binary operators */
+#define OPND_STACK  0       /* the right operand is in tos and the left one on the stack */
+#define OPND_IMM    1       /* the right operand is a literal and the left one is in tos */
+#define OPND_LOCAL  2       /* the right operand is a local variable and the left one is in tos */
+
+/* word size */
+#define WORD        ((int)sizeof(VMVALUE))
+
+/* native code entry function */
+typedef intptr_t JitEntry(Interpreter *i, uint8_t *code);
+
+/* reference to a text offset that is resolved after a function is compiled */
+typedef struct {
+    uint8_t *patch;         /* 32 bit displacement to patch */
+    VMUVALUE target;        /* text offset of the target */
+} JitFixup;
+
+/* text section translated into native code */
+struct JitText {
+    VMUVALUE base;          /* image address of the text section */
+    VMUVALUE size;          /* size of the text section */
+    uint8_t *data;          /* original bytecode */
+    uint8_t **map;          /* maps text offsets to native code */
+    uint8_t *flags;         /* scratch instruction flags used while compiling */
+    VMUVALUE *work;         /* scratch work list used while compiling */
+    VMUVALUE *insns;        /* instructions in the function being compiled */
+    int insnCount;          /* number of instructions in the function being compiled */
+    JitFixup *fixups;       /* references to resolve in the function being compiled */
+    int fixupCount;         /* number of references to resolve */
+    uint8_t *code;          /* native code space */
+    uint8_t *free;          /* next free byte of native code space */
+    uint8_t *top;           /* end of native code space */
+    JitEntry *enter;        /* enter native code at the address passed to it */
+    uint8_t *leave;         /* return to ExecuteJit with the value in rax */
+    uint8_t *dispatch;      /* continue at the image address in eax */
+    uint8_t *halt;          /* halt the program */
+    uint8_t *overflow;      /* abort with a stack overflow */
+    uint8_t *addressError;  /* abort with an address error */
+    uint8_t *intOverflow;   /* abort with an integer overflow */
+};
+
+/* prototypes for local functions */
+static uint8_t *CompileFunction(Interpreter *i, JitText *jit, VMUVALUE offset);
+static void FindInstructions(JitText *jit, VMUVALUE offset);
+static int CompileInstruction(Interpreter *i, JitText *jit, int k, VMUVALUE *pNext);
+static int CompileOperand(Interpreter *i, JitText *jit, int k, VMUVALUE end, int kind, VMVALUE value, VMUVALUE *pNext);
+static int CompileBinaryOp(JitText *jit, int op, int kind, VMVALUE value);
+static int CompileCompare(JitText *jit, int op, int kind, VMVALUE value);
+static void CompileCompareBranch(JitText *jit, int cc, int op, VMUVALUE offset);
+static int CompileConstantAccess(Interpreter *i, JitText *jit, int op, VMUVALUE addr);
+static void CompileWindowAddress(JitText *jit, size_t limit);
+static void CompilePush(JitText *jit);
+static void CompilePop(JitText *jit);
+static void CompileSaveState(JitText *jit);
+static void CompileRestoreState(JitText *jit);
+static void CompileCall(JitText *jit, void *fcn);
+static void CompileBranch(JitText *jit, int cc, VMUVALUE target);
+static int IsFusable(JitText *jit, int k, VMUVALUE offset);
+static int IsLabel(JitText *jit, VMUVALUE offset);
+static int CompareFixups(const void *p1, const void *p2);
+static int CompareOffsets(const void *p1, const void *p2);
+static void EmitStubs(JitText *jit);
+static void Byte(JitText *jit, int value);
+static void Long(JitText *jit, uint32_t value);
+static void Quad(JitText *jit, uint64_t value);
+static void Rex(JitText *jit, int w, int reg, int index, int base);
+static void Opcode(JitText *jit, int op);
+static void RR(JitText *jit, int w, int op, int reg, int rm);
+static void Mem(JitText *jit, int w, int op, int reg, int base, int index, int scale, int32_t disp);
+static void AluRI(JitText *jit, int w, int alu, int reg, VMVALUE value);
+static void MovRI(JitText *jit, int reg, uint32_t value);
+static void MovRI64(JitText *jit, int reg, uint64_t value);
+static void Jcc(JitText *jit, int cc, uint8_t *target);
+static uint8_t *Jcc8(JitText *jit, int cc);
+static void Patch8(JitText *jit, uint8_t *patch);
+static void AddressError(Interpreter *i);
+static void IntegerOverflow(Interpreter *i);
+static void UndefinedOpcode(Interpreter *i, int op);
+
+/* JitImage - prepare the text section of an image for the JIT compiler */
+int JitImage(System *sys, ImageHdr *image)
+{
+    ImageSection *section = NULL;
+    JitText *jit;
+    size_t size;
+    void *code;
+    int j;
+
+    /* find the section containing the main code */
+    for (j = 0; j < image->sectionCount; ++j) {
+        ImageFileSection *fileSection = image->sections[j].fileSection;
+        if (image->mainCode >= fileSection->base
+        &&  image->mainCode < fileSection->base + fileSection->size) {
+            section = &image->sections[j];
+            break;
+        }
+    }
+    if (!section)
+        return FALSE;
+
+    /* allocate and initialize the JIT compiler state */
+    if (!(jit = (JitText *)xbGlobalAlloc(sys, sizeof(JitText))))
+        return FALSE;
+    jit->base = section->fileSection->base;
+    jit->size = section->fileSection->size;
+    jit->data = section->data;
+    if (!(jit->map = (uint8_t **)xbGlobalAlloc(sys, jit->size * sizeof(uint8_t *)))
+    ||  !(jit->flags = (uint8_t *)xbGlobalAlloc(sys, jit->size))
+    ||  !(jit->work = (VMUVALUE *)xbGlobalAlloc(sys, jit->size * sizeof(VMUVALUE)))
+    ||  !(jit->insns = (VMUVALUE *)xbGlobalAlloc(sys, jit->size * sizeof(VMUVALUE)))
+    ||  !(jit->fixups = (JitFixup *)xbGlobalAlloc(sys, 2 * jit->size * sizeof(JitFixup))))
+        return FALSE;
+    memset(jit->map, 0, jit->size * sizeof(uint8_t *));
+
+    /* allocate the native code space writable but not executable */
+    size = jit->size * JIT_BYTES_PER_BYTE + JIT_MIN_SPACE;
+    code = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED)
+        return FALSE;
+    jit->code = jit->free = (uint8_t *)code;
+    jit->top = jit->code + size;
+
+    /* generate the code shared by all functions and make it executable */
+    EmitStubs(jit);
+    if (mprotect(jit->code, size, PROT_READ | PROT_EXEC) != 0)
+        return FALSE;
+
+    /* use the JIT compiler */
+    image->jit = jit;
+    return TRUE;
+}
+
+/* ExecuteJit - execute native code starting at an image address */
+int ExecuteJit(Interpreter *i, VMUVALUE addr)
+{
+    JitText *jit = i->image->jit;
+    VMUVALUE offset;
+    intptr_t result;
+    uint8_t *code;
+
+    for (;;) {
+
+        /* find or compile the native code for the address */
+        offset = addr - jit->base;
+        if (offset >= jit->size)
+            Abort(i, "address error");
+        if (!(code = jit->map[offset]))
+            code = CompileFunction(i, jit, offset);
+
+        /* execute until the program halts or reaches code that hasn't been compiled */
+        if ((result = (*jit->enter)(i, code)) < 0)
+            return TRUE;
+        addr = (VMUVALUE)result;
+    }
+}
+
+/* CompileFunction - compile the function starting at a text offset */
+static uint8_t *CompileFunction(Interpreter *i, JitText *jit, VMUVALUE offset)
+{
+    VMUVALUE next;
+    JitFixup *fixup;
+    int k, j;
+
+    /* find the instructions in the function */
+    FindInstructions(jit, offset);
+
+    /* the native code space is only writable while compiling */
+    if (mprotect(jit->code, jit->top - jit->code, PROT_READ | PROT_WRITE) != 0)
+        Abort(i, "can't write native code space");
+
+    /* compile the instructions in address order */
+    jit->fixupCount = 0;
+    for (k = 0; k < jit->insnCount; ) {
+        if (jit->top - jit->free < JIT_MAX_INSN)
+            Abort(i, "insufficient native code space");
+        jit->map[jit->insns[k]] = jit->free;
+        k += CompileInstruction(i, jit, k, &next);
+
+        /* branch to the next instruction if it doesn't immediately follow this one */
+        if (next != NO_NEXT && (k >= jit->insnCount || jit->insns[k] != next))
+            CompileBranch(jit, CC_ALWAYS, next);
+    }
+
+    /* resolve references to the instructions in the function */
+    qsort(jit->fixups, jit->fixupCount, sizeof(JitFixup), CompareFixups);
+    for (j = 0, fixup = jit->fixups; j < jit->fixupCount; ++j, ++fixup) {
+        int32_t disp = (int32_t)(jit->map[fixup->target] - (fixup->patch + 4));
+        memcpy(fixup->patch, &disp, sizeof(disp));
+    }
+
+    /* make the new code executable */
+    if (mprotect(jit->code, jit->top - jit->code, PROT_READ | PROT_EXEC) != 0)
+        Abort(i, "can't execute native code space");
+
+    /* only keep map entries for instructions that can be reached from outside of straight-line code */
+    for (k = 0; k < jit->insnCount; ++k)
+        if (!(jit->flags[jit->insns[k]] & DF_TARGET))
+            jit->map[jit->insns[k]] = NULL;
+
+    return jit->map[offset];
+}
+
+/* FindInstructions - find the instructions in the function starting at a text offset */
+static void FindInstructions(JitText *jit, VMUVALUE offset)
+{
+    VMUVALUE target, end;
+    int op, size, cnt, k;
+
+    /* find all of the instructions reachable from the entry point without following calls */
+    memset(jit->flags, 0, jit->size);
+    jit->flags[offset] |= DF_TARGET;
+    jit->insnCount = 0;
+    jit->work[0] = offset;
+    cnt = 1;
+    while (cnt > 0) {
+        offset = jit->work[--cnt];
+        while (offset < jit->size && !(jit->flags[offset] & DF_INSN) && !jit->map[offset]) {
+            jit->flags[offset] |= DF_INSN;
+            jit->insns[jit->insnCount++] = offset;
+            op = VMCODEBYTE(jit->data + offset);
+            if ((size = OperandSize(op)) == UNDEFINED_OPERAND || offset + 1 + size > jit->size)
+                break;
+            end = offset + 1 + size;
+            if (IsBranch(op)) {
+                target = end + GetCodeWord(jit->data + offset + 1);
+                if (target < jit->size) {
+                    jit->flags[target] |= DF_TARGET;
+                    jit->work[cnt++] = target;
+                }
+            }
+            else if (op == OP_PUSHJ && end < jit->size)
+                jit->flags[end] |= DF_TARGET;
+            if (IsTerminal(op))
+                break;
+            offset = end;
+        }
+    }
+
+    /* sort the instructions into address order */
+    qsort(jit->insns, jit->insnCount, sizeof(VMUVALUE), CompareOffsets);
+
+    /* instructions that don't immediately follow the instruction before them need map entries */
+    for (k = 0; k < jit->insnCount; ++k) {
+        offset = jit->insns[k];
+        op = VMCODEBYTE(jit->data + offset);
+        if ((size = OperandSize(op)) != UNDEFINED_OPERAND && !IsTerminal(op)) {
+            end = offset + 1 + size;
+            if (end < jit->size && (k + 1 >= jit->insnCount || jit->insns[k + 1] != end))
+                jit->flags[end] |= DF_TARGET;
+        }
+    }
+}
+
+/* CompileInstruction - compile the instruction at insns[k] and any instructions combined with it */
+static int CompileInstruction(Interpreter *i, JitText *jit, int k, VMUVALUE *pNext)
+{
+    VMUVALUE offset = jit->insns[k], end;
+    uint8_t *operand, *patch;
+    int op, size, cnt, j;
+
+    /* undefined opcodes abort when they are executed */
+    op = VMCODEBYTE(jit->data + offset);
+    if ((size = OperandSize(op)) == UNDEFINED_OPERAND) {
+        CompileSaveState(jit);
+        RR(jit, 1, 0x89, I_REG, RDI);
+        MovRI(jit, RSI, op);
+        CompileCall(jit, UndefinedOpcode);
+        *pNext = NO_NEXT;
+        return 1;
+    }
+
+    /* so do instructions that run off the end of the text section */
+    if (offset + 1 + size > jit->size) {
+        Jcc(jit, CC_ALWAYS, jit->addressError);
+        *pNext = NO_NEXT;
+        return 1;
+    }
+
+    operand = jit->data + offset + 1;
+    end = offset + 1 + size;
+    *pNext = (IsTerminal(op) ? NO_NEXT : end);
+
+    switch (op) {
+    case OP_HALT:
+        Jcc(jit, CC_ALWAYS, jit->halt);
+        break;
+    case OP_BRT:
+    case OP_BRF:
+        RR(jit, 0, 0x85, TOS_REG, TOS_REG);
+        CompileCompareBranch(jit, CC_NE, op, end + GetCodeWord(operand));
+        break;
+    case OP_BRTSC:
+    case OP_BRFSC:
+        RR(jit, 0, 0x85, TOS_REG, TOS_REG);
+        CompileBranch(jit, op == OP_BRTSC ? CC_NE : CC_E, end + GetCodeWord(operand));
+        CompilePop(jit);
+        break;
+    case OP_BR:
+        CompileBranch(jit, CC_ALWAYS, end + GetCodeWord(operand));
+        break;
+    case OP_NOT:
+        RR(jit, 0, 0x85, TOS_REG, TOS_REG);
+        RR(jit, 0, 0x0f90 | CC_E, 0, RAX);
+        RR(jit, 0, 0x0fb6, TOS_REG, RAX);
+        break;
+    case OP_NEG:
+        RR(jit, 0, 0xf7, 3, TOS_REG);
+        break;
+    case OP_BNOT:
+        RR(jit, 0, 0xf7, 2, TOS_REG);
+        break;
+    case OP_LT:
+    case OP_LE:
+    case OP_EQ:
+    case OP_NE:
+    case OP_GE:
+    case OP_GT:
+        if (IsFusable(jit, k + 1, end)) {
+            int op2 = VMCODEBYTE(jit->data + end);
+            if ((op2 == OP_BRT || op2 == OP_BRF) && end + 1 + WORD <= jit->size) {
+                int cc = CompileCompare(jit, op, OPND_STACK, 0);
+                CompileCompareBranch(jit, cc, op2, end + 1 + WORD + GetCodeWord(jit->data + end + 1));
+                *pNext = end + 1 + WORD;
+                return 2;
+            }
+        }
+        CompileBinaryOp(jit, op, OPND_STACK, 0);
+        break;
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_REM:
+    case OP_BAND:
+    case OP_BOR:
+    case OP_BXOR:
+    case OP_SHL:
+    case OP_SHR:
+    case OP_INDEX:
+        CompileBinaryOp(jit, op, OPND_STACK, 0);
+        break;
+    case OP_LIT:
+        if ((cnt = CompileOperand(i, jit, k, end, OPND_IMM, (VMVALUE)GetCodeWord(operand), pNext)) > 0)
+            return cnt;
+        CompilePush(jit);
+        MovRI(jit, TOS_REG, GetCodeWord(operand));
+        break;
+    case OP_SLIT:
+        if ((cnt = CompileOperand(i, jit, k, end, OPND_IMM, (int8_t)VMCODEBYTE(operand), pNext)) > 0)
+            return cnt;
+        CompilePush(jit);
+        MovRI(jit, TOS_REG, (VMVALUE)(int8_t)VMCODEBYTE(operand));
+        break;
+    case OP_LREF:
+        if ((cnt = CompileOperand(i, jit, k, end, OPND_LOCAL, (int8_t)VMCODEBYTE(operand), pNext)) > 0)
+            return cnt;
+        CompilePush(jit);
+        Mem(jit, 0, 0x8b, TOS_REG, FP_REG, NOREG, 0, (int8_t)VMCODEBYTE(operand) * WORD);
+        break;
+    case OP_LSET:
+        Mem(jit, 0, 0x89, TOS_REG, FP_REG, NOREG, 0, (int8_t)VMCODEBYTE(operand) * WORD);
+        CompilePop(jit);
+        break;
+    case OP_LOAD:
+        CompileWindowAddress(jit, offsetof(MemoryWindow, longSize));
+        Mem(jit, 0, 0x8b, TOS_REG, RAX, NOREG, 0, 0);
+        break;
+    case OP_LOADB:
+        CompileWindowAddress(jit, offsetof(MemoryWindow, size));
+        Mem(jit, 0, 0x0fb6, TOS_REG, RAX, NOREG, 0, 0);
+        break;
+    case OP_STORE:
+    case OP_STOREB:
+        CompileWindowAddress(jit, op == OP_STORE ? offsetof(MemoryWindow, longSize) : offsetof(MemoryWindow, size));
+        Mem(jit, 0, 0x8b, RDX, SP_REG, NOREG, 0, 0);
+        Mem(jit, 0, op == OP_STORE ? 0x89 : 0x88, RDX, RAX, NOREG, 0, 0);
+        Mem(jit, 0, 0x8b, TOS_REG, SP_REG, NOREG, 0, WORD);
+        AluRI(jit, 1, ALU_ADD, SP_REG, 2 * WORD);
+        break;
+    case OP_PUSHJ:
+        RR(jit, 0, 0x89, TOS_REG, RAX);
+        MovRI(jit, TOS_REG, jit->base + end);
+        Jcc(jit, CC_ALWAYS, jit->dispatch);
+        *pNext = NO_NEXT;
+        break;
+    case OP_POPJ:
+        RR(jit, 0, 0x89, TOS_REG, RAX);
+        CompilePop(jit);
+        Jcc(jit, CC_ALWAYS, jit->dispatch);
+        break;
+    case OP_CLEAN:
+        AluRI(jit, 1, ALU_ADD, SP_REG, VMCODEBYTE(operand) * WORD);
+        break;
+    case OP_FRAME:
+        cnt = VMCODEBYTE(operand);
+
+        /* save the old frame pointer as an offset from the base of the stack */
+        RR(jit, 1, 0x89, FP_REG, RAX);
+        RR(jit, 1, 0x29, STACK_REG, RAX);
+        RR(jit, 1, 0xc1, 7, RAX);
+        Byte(jit, 2);
+        RR(jit, 1, 0x89, SP_REG, FP_REG);
+
+        /* reserve and clear space for the frame */
+        Mem(jit, 1, 0x8d, RCX, SP_REG, NOREG, 0, -cnt * WORD);
+        RR(jit, 1, 0x39, STACK_REG, RCX);
+        Jcc(jit, CC_B, jit->overflow);
+        if (cnt <= 8) {
+            for (j = 1; j <= cnt; ++j) {
+                Mem(jit, 0, 0xc7, 0, SP_REG, NOREG, 0, -j * WORD);
+                Long(jit, 0);
+            }
+            RR(jit, 1, 0x89, RCX, SP_REG);
+        }
+        else {
+            RR(jit, 0, 0x31, RDX, RDX);
+            patch = jit->free;
+            AluRI(jit, 1, ALU_SUB, SP_REG, WORD);
+            Mem(jit, 0, 0x89, RDX, SP_REG, NOREG, 0, 0);
+            RR(jit, 1, 0x39, RCX, SP_REG);
+            Byte(jit, 0x70 | CC_NE);
+            Byte(jit, (int)(patch - (jit->free + 1)));
+        }
+        Mem(jit, 0, 0x89, RAX, FP_REG, NOREG, 0, F_FP * WORD);
+        break;
+    case OP_RETURNZ:
+        CompilePush(jit);
+        RR(jit, 0, 0x31, TOS_REG, TOS_REG);
+        // fall through
+    case OP_RETURN:
+        Mem(jit, 0, 0x8b, RAX, SP_REG, NOREG, 0, 0);
+        RR(jit, 1, 0x89, FP_REG, SP_REG);
+        Mem(jit, 1, 0x63, RDX, FP_REG, NOREG, 0, F_FP * WORD);
+        Mem(jit, 1, 0x8d, FP_REG, STACK_REG, RDX, 2, 0);
+        Jcc(jit, CC_ALWAYS, jit->dispatch);
+        break;
+    case OP_DROP:
+        CompilePop(jit);
+        break;
+    case OP_DUP:
+        CompilePush(jit);
+        break;
+    case OP_NATIVE:
+        break;
+    case OP_TRAP:
+        CompileSaveState(jit);
+        RR(jit, 1, 0x89, I_REG, RDI);
+        MovRI(jit, RSI, VMCODEBYTE(operand));
+        CompileCall(jit, DoTrap);
+        CompileRestoreState(jit);
+        break;
+    }
+
+    return 1;
+}
+
+/* CompileOperand - combine a literal or local variable with the instructions that use it */
+static int CompileOperand(Interpreter *i, JitText *jit, int k, VMUVALUE end, int kind, VMVALUE value, VMUVALUE *pNext)
+{
+    int op, op2, cc;
+
+    /* make sure the next instruction can be combined with this one */
+    if (!IsFusable(jit, k + 1, end))
+        return 0;
+    op = VMCODEBYTE(jit->data + end);
+
+    switch (op) {
+    case OP_LT:
+    case OP_LE:
+    case OP_EQ:
+    case OP_NE:
+    case OP_GE:
+    case OP_GT:
+        if (IsFusable(jit, k + 2, end + 1) && end + 2 + WORD <= jit->size) {
+            op2 = VMCODEBYTE(jit->data + end + 1);
+            if (op2 == OP_BRT || op2 == OP_BRF) {
+                cc = CompileCompare(jit, op, kind, value);
+                CompileCompareBranch(jit, cc, op2, end + 2 + WORD + GetCodeWord(jit->data + end + 2));
+                *pNext = end + 2 + WORD;
+                return 3;
+            }
+        }
+        break;
+    case OP_LOAD:
+    case OP_LOADB:
+    case OP_STORE:
+    case OP_STOREB:
+    case OP_PUSHJ:
+        if (kind != OPND_IMM)
+            return 0;
+        if (op == OP_PUSHJ) {
+            VMUVALUE target = (VMUVALUE)value - jit->base;
+            CompilePush(jit);
+            MovRI(jit, TOS_REG, jit->base + end + 1);
+            if (IsLabel(jit, target))
+                CompileBranch(jit, CC_ALWAYS, target);
+            else {
+                MovRI(jit, RAX, value);
+                Jcc(jit, CC_ALWAYS, jit->dispatch);
+            }
+            *pNext = NO_NEXT;
+            return 2;
+        }
+        if (!CompileConstantAccess(i, jit, op, (VMUVALUE)value))
+            return 0;
+        *pNext = end + 1;
+        return 2;
+    }
+
+    if (!CompileBinaryOp(jit, op, kind, value))
+        return 0;
+    *pNext = end + 1;
+    return 2;
+}
+
+/* CompileBinaryOp - compile a binary operator */
+static int CompileBinaryOp(JitText *jit, int op, int kind, VMVALUE value)
+{
+    uint8_t *zero, *minusOne, *done;
+    int alu, cc;
+
+    switch (op) {
+    case OP_ADD:
+    case OP_BAND:
+    case OP_BOR:
+    case OP_BXOR:
+        alu = (op == OP_ADD ? ALU_ADD : op == OP_BAND ? ALU_AND : op == OP_BOR ? ALU_OR : ALU_XOR);
+        if (kind == OPND_IMM)
+            AluRI(jit, 0, alu, TOS_REG, value);
+        else if (kind == OPND_LOCAL)
+            Mem(jit, 0, alu * 8 + 3, TOS_REG, FP_REG, NOREG, 0, value * WORD);
+        else {
+            Mem(jit, 0, alu * 8 + 3, TOS_REG, SP_REG, NOREG, 0, 0);
+            AluRI(jit, 1, ALU_ADD, SP_REG, WORD);
+        }
+        break;
+    case OP_SUB:
+        if (kind == OPND_IMM)
+            AluRI(jit, 0, ALU_SUB, TOS_REG, value);
+        else if (kind == OPND_LOCAL)
+            Mem(jit, 0, 0x2b, TOS_REG, FP_REG, NOREG, 0, value * WORD);
+        else {
+            RR(jit, 0, 0xf7, 3, TOS_REG);
+            Mem(jit, 0, 0x03, TOS_REG, SP_REG, NOREG, 0, 0);
+            AluRI(jit, 1, ALU_ADD, SP_REG, WORD);
+        }
+        break;
+    case OP_MUL:
+        if (kind == OPND_IMM) {
+            RR(jit, 0, 0x69, TOS_REG, TOS_REG);
+            Long(jit, value);
+        }
+        else if (kind == OPND_LOCAL)
+            Mem(jit, 0, 0x0faf, TOS_REG, FP_REG, NOREG, 0, value * WORD);
+        else {
+            Mem(jit, 0, 0x0faf, TOS_REG, SP_REG, NOREG, 0, 0);
+            AluRI(jit, 1, ALU_ADD, SP_REG, WORD);
+        }
+        break;
+    case OP_DIV:
+    case OP_REM:
+        if (kind != OPND_STACK)
+            return FALSE;
+
+        /* division by zero gives zero and the most negative number divided by -1 aborts like the interpreter */
+        Mem(jit, 0, 0x8b, RAX, SP_REG, NOREG, 0, 0);
+        AluRI(jit, 1, ALU_ADD, SP_REG, WORD);
+        RR(jit, 0, 0x85, TOS_REG, TOS_REG);
+        zero = Jcc8(jit, CC_E);
+        AluRI(jit, 0, ALU_CMP, TOS_REG, -1);
+        minusOne = Jcc8(jit, CC_E);
+        Byte(jit, 0x99);
+        RR(jit, 0, 0xf7, 7, TOS_REG);
+        RR(jit, 0, 0x89, op == OP_DIV ? RAX : RDX, TOS_REG);
+        done = Jcc8(jit, CC_ALWAYS);
+        Patch8(jit, minusOne);
+        AluRI(jit, 0, ALU_CMP, RAX, VMVALUE_MIN);
+        Jcc(jit, CC_E, jit->intOverflow);
+        if (op == OP_DIV) {
+            RR(jit, 0, 0xf7, 3, RAX);
+            RR(jit, 0, 0x89, RAX, TOS_REG);
+        }
+        else
+            RR(jit, 0, 0x31, TOS_REG, TOS_REG);
+        Patch8(jit, zero);
+        Patch8(jit, done);
+        break;
+    case OP_SHL:
+    case OP_SHR:
+        if (kind == OPND_IMM) {
+            RR(jit, 0, 0xc1, op == OP_SHL ? 4 : 7, TOS_REG);
+            Byte(jit, value & 31);
+        }
+        else {
+            if (kind == OPND_LOCAL)
+                Mem(jit, 0, 0x8b, RCX, FP_REG, NOREG, 0, value * WORD);
+            else {
+                RR(jit, 0, 0x89, TOS_REG, RCX);
+                Mem(jit, 0, 0x8b, TOS_REG, SP_REG, NOREG, 0, 0);
+                AluRI(jit, 1, ALU_ADD, SP_REG, WORD);
+            }
+            RR(jit, 0, 0xd3, op == OP_SHL ? 4 : 7, TOS_REG);
+        }
+        break;
+    case OP_LT:
+    case OP_LE:
+    case OP_EQ:
+    case OP_NE:
+    case OP_GE:
+    case OP_GT:
+        cc = CompileCompare(jit, op, kind, value);
+        RR(jit, 0, 0x0f90 | cc, 0, RAX);
+        RR(jit, 0, 0x0fb6, TOS_REG, RAX);
+        break;
+    case OP_INDEX:
+        if (kind == OPND_IMM)
+            AluRI(jit, 0, ALU_ADD, TOS_REG, (VMVALUE)((VMUVALUE)value * WORD));
+        else if (kind == OPND_LOCAL) {
+            Mem(jit, 0, 0x8b, RAX, FP_REG, NOREG, 0, value * WORD);
+            RR(jit, 0, 0xc1, 4, RAX);
+            Byte(jit, 2);
+            RR(jit, 0, 0x01, RAX, TOS_REG);
+        }
+        else {
+            RR(jit, 0, 0xc1, 4, TOS_REG);
+            Byte(jit, 2);
+            Mem(jit, 0, 0x03, TOS_REG, SP_REG, NOREG, 0, 0);
+            AluRI(jit, 1, ALU_ADD, SP_REG, WORD);
+        }
+        break;
+    default:
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* CompileCompare - compare the operands of a comparison operator and return the condition code */
+static int CompileCompare(JitText *jit, int op, int kind, VMVALUE value)
+{
+    switch (kind) {
+    case OPND_IMM:
+        AluRI(jit, 0, ALU_CMP, TOS_REG, value);
+        break;
+    case OPND_LOCAL:
+        Mem(jit, 0, 0x3b, TOS_REG, FP_REG, NOREG, 0, value * WORD);
+        break;
+    default:
+        Mem(jit, 0, 0x8b, RAX, SP_REG, NOREG, 0, 0);
+        Mem(jit, 1, 0x8d, SP_REG, SP_REG, NOREG, 0, WORD);
+        RR(jit, 0, 0x39, TOS_REG, RAX);
+        break;
+    }
+    switch (op) {
+    case OP_LT:     return CC_L;
+    case OP_LE:     return CC_LE;
+    case OP_EQ:     return CC_E;
+    case OP_NE:     return CC_NE;
+    case OP_GE:     return CC_GE;
+    default:        return CC_G;
+    }
+}
+
+/* CompileCompareBranch - pop tos and branch if the condition code matches a OP_BRT or OP_BRF */
+static void CompileCompareBranch(JitText *jit, int cc, int op, VMUVALUE target)
+{
+    Mem(jit, 0, 0x8b, TOS_REG, SP_REG, NOREG, 0, 0);
+    Mem(jit, 1, 0x8d, SP_REG, SP_REG, NOREG, 0, WORD);
+    CompileBranch(jit, op == OP_BRT ? cc : cc ^ 1, target);
+}
+
+/* CompileConstantAccess - compile a load or store at a constant address */
+static int CompileConstantAccess(Interpreter *i, JitText *jit, int op, VMUVALUE addr)
+{
+    MemoryWindow *window = &i->windows[addr >> WINDOW_SHIFT];
+    VMUVALUE offset = addr - window->base;
+
+    /* addresses that aren't mapped use the general code that aborts when it is executed */
+    if (offset >= (op == OP_LOAD || op == OP_STORE ? window->longSize : window->size))
+        return FALSE;
+
+    MovRI64(jit, RAX, (uint64_t)(uintptr_t)(window->data + offset));
+    switch (op) {
+    case OP_LOAD:
+        CompilePush(jit);
+        Mem(jit, 0, 0x8b, TOS_REG, RAX, NOREG, 0, 0);
+        break;
+    case OP_LOADB:
+        CompilePush(jit);
+        Mem(jit, 0, 0x0fb6, TOS_REG, RAX, NOREG, 0, 0);
+        break;
+    case OP_STORE:
+    case OP_STOREB:
+        Mem(jit, 0, op == OP_STORE ? 0x89 : 0x88, TOS_REG, RAX, NOREG, 0, 0);
+        CompilePop(jit);
+        break;
+    }
+    return TRUE;
+}
+
+/* CompileWindowAddress - map the address in tos to a host address in rax checking it against a window limit */
+static void CompileWindowAddress(JitText *jit, size_t limit)
+{
+    int32_t windows = offsetof(Interpreter, windows);
+    RR(jit, 0, 0x89, TOS_REG, RAX);
+    RR(jit, 0, 0xc1, 5, RAX);
+    Byte(jit, WINDOW_SHIFT);
+    RR(jit, 0, 0x69, RAX, RAX);
+    Long(jit, sizeof(MemoryWindow));
+    RR(jit, 1, 0x01, I_REG, RAX);
+    RR(jit, 0, 0x89, TOS_REG, RCX);
+    Mem(jit, 0, 0x2b, RCX, RAX, NOREG, 0, windows + offsetof(MemoryWindow, base));
+    Mem(jit, 0, 0x3b, RCX, RAX, NOREG, 0, windows + limit);
+    Jcc(jit, CC_AE, jit->addressError);
+    Mem(jit, 1, 0x8b, RAX, RAX, NOREG, 0, windows + offsetof(MemoryWindow, data));
+    RR(jit, 1, 0x01, RCX, RAX);
+}
+
+/* CompilePush - push tos checking for stack overflow */
+static void CompilePush(JitText *jit)
+{
+    RR(jit, 1, 0x39, STACK_REG, SP_REG);
+    Jcc(jit, CC_BE, jit->overflow);
+    AluRI(jit, 1, ALU_SUB, SP_REG, WORD);
+    Mem(jit, 0, 0x89, TOS_REG, SP_REG, NOREG, 0, 0);
+}
+
+/* CompilePop - pop the top of the stack into tos */
+static void CompilePop(JitText *jit)
+{
+    Mem(jit, 0, 0x8b, TOS_REG, SP_REG, NOREG, 0, 0);
+    AluRI(jit, 1, ALU_ADD, SP_REG, WORD);
+}
+
+/* CompileSaveState - store the interpreter state in the Interpreter structure */
+static void CompileSaveState(JitText *jit)
+{
+    Mem(jit, 1, 0x89, SP_REG, I_REG, NOREG, 0, offsetof(Interpreter, sp));
+    Mem(jit, 1, 0x89, FP_REG, I_REG, NOREG, 0, offsetof(Interpreter, fp));
+    Mem(jit, 0, 0x89, TOS_REG, I_REG, NOREG, 0, offsetof(Interpreter, tos));
+}
+
+/* CompileRestoreState - load the interpreter state from the Interpreter structure */
+static void CompileRestoreState(JitText *jit)
+{
+    Mem(jit, 1, 0x8b, SP_REG, I_REG, NOREG, 0, offsetof(Interpreter, sp));
+    Mem(jit, 1, 0x8b, FP_REG, I_REG, NOREG, 0, offsetof(Interpreter, fp));
+    Mem(jit, 0, 0x8b, TOS_REG, I_REG, NOREG, 0, offsetof(Interpreter, tos));
+}
+
+/* CompileCall - call a C function */
+static void CompileCall(JitText *jit, void *fcn)
+{
+    MovRI64(jit, RAX, (uint64_t)(uintptr_t)fcn);
+    RR(jit, 0, 0xff, 2, RAX);
+}
+
+/* CompileBranch - branch to a text offset */
+static void CompileBranch(JitText *jit, int cc, VMUVALUE target)
+{
+    JitFixup *fixup;
+
+    /* branches outside of the text section abort when they are taken */
+    if (target >= jit->size) {
+        Jcc(jit, cc, jit->addressError);
+        return;
+    }
+
+    /* branch to code compiled for another function */
+    if (!(jit->flags[target] & DF_INSN) && jit->map[target]) {
+        Jcc(jit, cc, jit->map[target]);
+        return;
+    }
+
+    /* branch to an instruction in this function */
+    Jcc(jit, cc, jit->free);
+    fixup = &jit->fixups[jit->fixupCount++];
+    fixup->patch = jit->free - 4;
+    fixup->target = target;
+}
+
+/* IsFusable - check for an instruction at insns[k] that can be combined with the one before it */
+static int IsFusable(JitText *jit, int k, VMUVALUE offset)
+{
+    return k < jit->insnCount
+        && jit->insns[k] == offset
+        && !(jit->flags[offset] & DF_TARGET)
+        && OperandSize(VMCODEBYTE(jit->data + offset)) != UNDEFINED_OPERAND;
+}
+
+/* IsLabel - check for a text offset that will have native code when this function is compiled */
+static int IsLabel(JitText *jit, VMUVALUE offset)
+{
+    if (offset >= jit->size)
+        return FALSE;
+    if (jit->flags[offset] & DF_INSN)
+        return (jit->flags[offset] & DF_TARGET) != 0;
+    return jit->map[offset] != NULL;
+}
+
+/* CompareFixups - compare references by the address of their displacements */
+static int CompareFixups(const void *p1, const void *p2)
+{
+    const JitFixup *f1 = (const JitFixup *)p1;
+    const JitFixup *f2 = (const JitFixup *)p2;
+    return f1->patch < f2->patch ? -1 : f1->patch > f2->patch;
+}
+
+/* CompareOffsets - compare two text offsets */
+static int CompareOffsets(const void *p1, const void *p2)
+{
+    VMUVALUE o1 = *(const VMUVALUE *)p1;
+    VMUVALUE o2 = *(const VMUVALUE *)p2;
+    return o1 < o2 ? -1 : o1 > o2;
+}
+
+/* EmitStubs - generate the code shared by all functions */
+static void EmitStubs(JitText *jit)
+{
+    uint8_t *exit1, *exit2;
+
+    /* enter(i, code): save the callee saved registers, load the state and jump to the code */
+    jit->enter = (JitEntry *)jit->free;
+    Byte(jit, 0x53);
+    Byte(jit, 0x55);
+    Rex(jit, 0, 0, 0, R12); Byte(jit, 0x50 | (R12 & 7));
+    Rex(jit, 0, 0, 0, R13); Byte(jit, 0x50 | (R13 & 7));
+    Rex(jit, 0, 0, 0, R14); Byte(jit, 0x50 | (R14 & 7));
+    Rex(jit, 0, 0, 0, R15); Byte(jit, 0x50 | (R15 & 7));
+    AluRI(jit, 1, ALU_SUB, 4, 8);
+    RR(jit, 1, 0x89, RDI, I_REG);
+    CompileRestoreState(jit);
+    Mem(jit, 1, 0x8b, STACK_REG, I_REG, NOREG, 0, offsetof(Interpreter, stack));
+    RR(jit, 0, 0xff, 4, RSI);
+
+    /* leave: save the state and return the value in rax */
+    jit->leave = jit->free;
+    CompileSaveState(jit);
+    AluRI(jit, 1, ALU_ADD, 4, 8);
+    Rex(jit, 0, 0, 0, R15); Byte(jit, 0x58 | (R15 & 7));
+    Rex(jit, 0, 0, 0, R14); Byte(jit, 0x58 | (R14 & 7));
+    Rex(jit, 0, 0, 0, R13); Byte(jit, 0x58 | (R13 & 7));
+    Rex(jit, 0, 0, 0, R12); Byte(jit, 0x58 | (R12 & 7));
+    Byte(jit, 0x5d);
+    Byte(jit, 0x5b);
+    Byte(jit, 0xc3);
+
+    /* dispatch: jump to the native code for the image address in eax or return it to ExecuteJit */
+    jit->dispatch = jit->free;
+    RR(jit, 0, 0x89, RAX, RCX);
+    AluRI(jit, 0, ALU_SUB, RCX, jit->base);
+    AluRI(jit, 0, ALU_CMP, RCX, jit->size);
+    exit1 = Jcc8(jit, CC_AE);
+    MovRI64(jit, RDX, (uint64_t)(uintptr_t)jit->map);
+    Mem(jit, 1, 0x8b, RDX, RDX, RCX, 3, 0);
+    RR(jit, 1, 0x85, RDX, RDX);
+    exit2 = Jcc8(jit, CC_E);
+    RR(jit, 0, 0xff, 4, RDX);
+    Patch8(jit, exit1);
+    Patch8(jit, exit2);
+    Jcc(jit, CC_ALWAYS, jit->leave);
+
+    /* halt: return -1 to ExecuteJit */
+    jit->halt = jit->free;
+    RR(jit, 1, 0xc7, 0, RAX);
+    Long(jit, (uint32_t)-1);
+    Jcc(jit, CC_ALWAYS, jit->leave);
+
+    /* overflow: abort with a stack overflow */
+    jit->overflow = jit->free;
+    CompileSaveState(jit);
+    RR(jit, 1, 0x89, I_REG, RDI);
+    CompileCall(jit, StackOverflow);
+
+    /* addressError: abort with an address error */
+    jit->addressError = jit->free;
+    CompileSaveState(jit);
+    RR(jit, 1, 0x89, I_REG, RDI);
+    CompileCall(jit, AddressError);
+
+    /* intOverflow: abort with an integer overflow */
+    jit->intOverflow = jit->free;
+    CompileSaveState(jit);
+    RR(jit, 1, 0x89, I_REG, RDI);
+    CompileCall(jit, IntegerOverflow);
+}
+
+static void Byte(JitText *jit, int value)
+{
+    *jit->free++ = (uint8_t)value;
+}
+
+static void Long(JitText *jit, uint32_t value)
+{
+    memcpy(jit->free, &value, sizeof(value));
+    jit->free += sizeof(value);
+}
+
+static void Quad(JitText *jit, uint64_t value)
+{
+    memcpy(jit->free, &value, sizeof(value));
+    jit->free += sizeof(value);
+}
+
+/* Rex - emit a REX prefix if one is needed */
+static void Rex(JitText *jit, int w, int reg, int index, int base)
+{
+    int rex = 0x40 | (w ? 0x08 : 0) | ((reg & 8) >> 1) | ((index & 8) >> 2) | ((base & 8) >> 3);
+    if (rex != 0x40)
+        Byte(jit, rex);
+}
+
+/* Opcode - emit a one or two byte opcode */
+static void Opcode(JitText *jit, int op)
+{
+    if (op > 0xff)
+        Byte(jit, op >> 8);
+    Byte(jit, op & 0xff);
+}
+
+/* RR - emit an instruction with a register operand and a register or opcode extension */
+static void RR(JitText *jit, int w, int op, int reg, int rm)
+{
+    Rex(jit, w, reg, 0, rm);
+    Opcode(jit, op);
+    Byte(jit, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+/* Mem - emit an instruction with a [base + index * (1 << scale) + disp] memory operand */
+static void Mem(JitText *jit, int w, int op, int reg, int base, int index, int scale, int32_t disp)
+{
+    int mod = (disp == 0 && (base & 7) != 5 ? 0x00 : disp >= -128 && disp <= 127 ? 0x40 : 0x80);
+    Rex(jit, w, reg, index == NOREG ? 0 : index, base);
+    Opcode(jit, op);
+    if (index == NOREG && (base & 7) != 4)
+        Byte(jit, mod | ((reg & 7) << 3) | (base & 7));
+    else {
+        Byte(jit, mod | ((reg & 7) << 3) | 4);
+        Byte(jit, (scale << 6) | ((index == NOREG ? 4 : index) & 7) << 3 | (base & 7));
+    }
+    if (mod == 0x40)
+        Byte(jit, disp);
+    else if (mod == 0x80)
+        Long(jit, disp);
+}
+
+/* AluRI - emit an arithmetic instruction with a register and an immediate operand */
+static void AluRI(JitText *jit, int w, int alu, int reg, VMVALUE value)
+{
+    if (value >= -128 && value <= 127) {
+        RR(jit, w, 0x83, alu, reg);
+        Byte(jit, value);
+    }
+    else {
+        RR(jit, w, 0x81, alu, reg);
+        Long(jit, value);
+    }
+}
+
+/* MovRI - load a 32 bit register with an immediate value */
+static void MovRI(JitText *jit, int reg, uint32_t value)
+{
+    Rex(jit, 0, 0, 0, reg);
+    Byte(jit, 0xb8 | (reg & 7));
+    Long(jit, value);
+}
+
+/* MovRI64 - load a 64 bit register with an immediate value */
+static void MovRI64(JitText *jit, int reg, uint64_t value)
+{
+    Rex(jit, 1, 0, 0, reg);
+    Byte(jit, 0xb8 | (reg & 7));
+    Quad(jit, value);
+}
+
+/* Jcc - emit a conditional or unconditional jump with a 32 bit displacement */
+static void Jcc(JitText *jit, int cc, uint8_t *target)
+{
+    if (cc == CC_ALWAYS)
+        Byte(jit, 0xe9);
+    else {
+        Byte(jit, 0x0f);
+        Byte(jit, 0x80 | cc);
+    }
+    Long(jit, (uint32_t)(target - (jit->free + 4)));
+}
+
+/* Jcc8 - emit a forward jump with an 8 bit displacement to be patched later */
+static uint8_t *Jcc8(JitText *jit, int cc)
+{
+    Byte(jit, cc == CC_ALWAYS ? 0xeb : 0x70 | cc);
+    Byte(jit, 0);
+    return jit->free - 1;
+}
+
+/* Patch8 - point a forward jump at the next instruction */
+static void Patch8(JitText *jit, uint8_t *patch)
+{
+    *patch = (uint8_t)(jit->free - (patch + 1));
+}
+
+static void AddressError(Interpreter *i)
+{
+    Abort(i, "address error");
+}
+
+static void IntegerOverflow(Interpreter *i)
+{
+    Abort(i, "integer overflow");
+}
+
+static void UndefinedOpcode(Interpreter *i, int op)
+{
+    Abort(i, "undefined opcode 0x%02x", op);
+}
+
+#else
+
+/* JitImage - the JIT compiler isn't available on this platform */
+int JitImage(System *sys, ImageHdr *image)
+{
+    return FALSE;
+}
+
+/* ExecuteJit - the JIT compiler isn't available on this platform */
+int ExecuteJit(Interpreter *i, VMUVALUE addr)
+{
+    Abort(i, "JIT compiler not available");
+    return FALSE;
+}
+
+#endif
@@ -0,0 +1,470 @@
+/* db_vmloop.h - instruction loop for the bytecode interpreter
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ * This file is included by db_vmint.c once for each execution engine.  The
+ * including file defines EXECUTE, the name of the function to define, and
+ * DECODED when the engine executes pre-decoded code instead of bytecode.
+ * The macros below that access the code have defaults for each code format
+ * and an engine only defines the ones it changes:
+ *
+ *  CODE                type of a code element
+ *  PC_FIELD            Interpreter field holding the pc between calls
+ *  DISPATCH_SIZE       number of opcodes in the dispatch table
+ *  FetchOpcode()       get the next opcode
+ *  GetWordOperand(v)   get a word operand
+ *  GetByteOperand(v)   get an unsigned byte operand
+ *  GetSByteOperand(v)  get a signed byte operand
+ *  Branch()            take a branch
+ *  SkipBranch()        skip over the target of a branch not taken
+ *  PushJ()             call the function whose address is in tos
+ *  JumpTo(addr)        continue at an image address (a return)
+ *  UndefinedOpcode()   get the value of the last opcode fetched
+ *
+ * The default versions call these hooks, which do nothing unless the
+ * engine defines them:
+ *
+ *  BranchHook(taken)   a conditional branch is taken or not
+ *  CallHook(addr)      a function is called
+ *  ReturnHook()        a function returns
+ *  NativeInstruction(inst)  simulate the operand of OP_NATIVE
+ *
+ * Every one of these macros is undefined at the end of this file.
+ *
+ */
+
+/* hooks */
+#ifndef BranchHook
+#define BranchHook(taken)       ((void)0)
+#endif
+#ifndef CallHook
+#define CallHook(addr)          ((void)0)
+#endif
+#ifndef ReturnHook
+#define ReturnHook()            ((void)0)
+#endif
+
+#ifdef DECODED
+
+/* pre-decoded code */
+#ifndef CODE
+#define CODE                DecodedWord
+#endif
+#ifndef PC_FIELD
+#define PC_FIELD            dpc
+#endif
+#ifndef DISPATCH_SIZE
+#define DISPATCH_SIZE       (XOP_LAST + 1)
+#endif
+#ifndef FetchOpcode
+#define FetchOpcode()       ((pc++)->op)
+#endif
+#ifndef GetWordOperand
+#define GetWordOperand(v)   ((v) = (pc++)->value)
+#endif
+#ifndef GetByteOperand
+#define GetByteOperand(v)   ((v) = (pc++)->value)
+#endif
+#ifndef GetSByteOperand
+#define GetSByteOperand(v)  ((v) = (pc++)->value)
+#endif
+#ifndef Branch
+#define Branch()            (BranchHook(TRUE), pc = pc->target)
+#endif
+#ifndef SkipBranch
+#define SkipBranch()        (BranchHook(FALSE), ++pc)
+#endif
+#ifndef PushJ
+#define PushJ()             do {                                \
+                                GetWordOperand(tmp);            \
+                                SaveState();                    \
+                                pc = MapCode(i, tos);           \
+                                CallHook(tos);                  \
+                                tos = tmp;                      \
+                            } while (0)
+#endif
+#ifndef JumpTo
+#define JumpTo(addr)        do {                                \
+                                ReturnHook();                   \
+                                SaveState();                    \
+                                pc = MapCode(i, addr);          \
+                            } while (0)
+#endif
+#ifndef UndefinedOpcode
+#define UndefinedOpcode()   VMCODEBYTE(MapAddress(i, DecodedAddress(i->image->decoded, pc - 1)))
+#endif
+
+#else
+
+/* bytecode */
+#ifndef CODE
+#define CODE                uint8_t
+#endif
+#ifndef PC_FIELD
+#define PC_FIELD            pc
+#endif
+#ifndef DISPATCH_SIZE
+#define DISPATCH_SIZE       256
+#endif
+#ifndef FetchOpcode
+#define FetchOpcode()       VMCODEBYTE(pc++)
+#endif
+#ifndef GetWordOperand
+#define GetWordOperand(v)   do {                                \
+                                int _cnt;                       \
+                                for ((v) = 0, _cnt = sizeof(VMUVALUE); --_cnt >= 0; ) \
+                                    (v) = ((v) << 8) | VMCODEBYTE(pc++); \
+                            } while (0)
+#endif
+#ifndef GetByteOperand
+#define GetByteOperand(v)   ((v) = VMCODEBYTE(pc++))
+#endif
+#ifndef GetSByteOperand
+#define GetSByteOperand(v)  ((v) = (int8_t)VMCODEBYTE(pc++))
+#endif
+#ifndef Branch
+#define Branch()            do {                                \
+                                BranchHook(TRUE);               \
+                                GetWordOperand(tmp);            \
+                                pc += tmp;                      \
+                            } while (0)
+#endif
+#ifndef SkipBranch
+#define SkipBranch()        (BranchHook(FALSE), pc += sizeof(VMUVALUE))
+#endif
+#ifndef PushJ
+#define PushJ()             do {                                \
+                                tmp = i->codeBase + (VMUVALUE)(pc - i->code); \
+                                SaveState();                    \
+                                pc = MapAddress(i, tos);        \
+                                CallHook(tos);                  \
+                                tos = tmp;                      \
+                            } while (0)
+#endif
+#ifndef JumpTo
+#define JumpTo(addr)        (ReturnHook(), pc = i->code + ((VMUVALUE)(addr) - i->codeBase))
+#endif
+#ifndef UndefinedOpcode
+#define UndefinedOpcode()   VMCODEBYTE(pc - 1)
+#endif
+
+#endif
+
+/* EXECUTE - execute instructions starting at the saved pc */
+static int EXECUTE(Interpreter *i)
+{
+#ifdef VM_THREADED
+    static void *dispatch[DISPATCH_SIZE] = {
+        [0 ... DISPATCH_SIZE - 1] = &&L_undefined,
+        [OP_HALT]       = &&L_OP_HALT,
+        [OP_BRT]        = &&L_OP_BRT,
+        [OP_BRTSC]      = &&L_OP_BRTSC,
+        [OP_BRF]        = &&L_OP_BRF,
+        [OP_BRFSC]      = &&L_OP_BRFSC,
+        [OP_BR]         = &&L_OP_BR,
+        [OP_NOT]        = &&L_OP_NOT,
+        [OP_NEG]        = &&L_OP_NEG,
+        [OP_ADD]        = &&L_OP_ADD,
+        [OP_SUB]        = &&L_OP_SUB,
+        [OP_MUL]        = &&L_OP_MUL,
+        [OP_DIV]        = &&L_OP_DIV,
+        [OP_REM]        = &&L_OP_REM,
+        [OP_BNOT]       = &&L_OP_BNOT,
+        [OP_BAND]       = &&L_OP_BAND,
+        [OP_BOR]        = &&L_OP_BOR,
+        [OP_BXOR]       = &&L_OP_BXOR,
+        [OP_SHL]        = &&L_OP_SHL,
+        [OP_SHR]        = &&L_OP_SHR,
+        [OP_LT]         = &&L_OP_LT,
+        [OP_LE]         = &&L_OP_LE,
+        [OP_EQ]         = &&L_OP_EQ,
+        [OP_NE]         = &&L_OP_NE,
+        [OP_GE]         = &&L_OP_GE,
+        [OP_GT]         = &&L_OP_GT,
+        [OP_LIT]        = &&L_OP_LIT,
+        [OP_SLIT]       = &&L_OP_SLIT,
+        [OP_LOAD]       = &&L_OP_LOAD,
+        [OP_LOADB]      = &&L_OP_LOADB,
+        [OP_STORE]      = &&L_OP_STORE,
+        [OP_STOREB]     = &&L_OP_STOREB,
+        [OP_LREF]       = &&L_OP_LREF,
+        [OP_LSET]       = &&L_OP_LSET,
+        [OP_INDEX]      = &&L_OP_INDEX,
+        [OP_PUSHJ]      = &&L_OP_PUSHJ,
+        [OP_POPJ]       = &&L_OP_POPJ,
+        [OP_CLEAN]      = &&L_OP_CLEAN,
+        [OP_FRAME]      = &&L_OP_FRAME,
+        [OP_RETURN]     = &&L_OP_RETURN,
+        [OP_RETURNZ]    = &&L_OP_RETURNZ,
+        [OP_DROP]       = &&L_OP_DROP,
+        [OP_DUP]        = &&L_OP_DUP,
+        [OP_NATIVE]     = &&L_OP_NATIVE,
+        [OP_TRAP]       = &&L_OP_TRAP,
+#ifdef DECODED
+        [XOP_CALL]      = &&L_XOP_CALL,
+        [XOP_BADADDR]   = &&L_XOP_BADADDR,
+#endif
+    };
+#endif
+    register CODE *pc;
+    register VMVALUE *sp, *fp;
+    register VMVALUE tos;
+    VMVALUE *stack;
+    VMVALUE tmp;
+    int cnt;
+
+    /* load the interpreter state into locals */
+    RestoreState();
+    stack = i->stack;
+
+#ifdef VM_THREADED
+    NEXT;
+#else
+    for (;;) {
+#if 0
+        SaveState();
+        ShowStack(i);
+#endif
+        switch (FetchOpcode()) {
+#endif
+        OPCODE(OP_HALT)
+            SaveState();
+            return TRUE;
+        OPCODE(OP_BRT)
+            if (tos)
+                Branch();
+            else
+                SkipBranch();
+            tos = LPop();
+            NEXT;
+        OPCODE(OP_BRTSC)
+            if (tos)
+                Branch();
+            else {
+                SkipBranch();
+                tos = LPop();
+            }
+            NEXT;
+        OPCODE(OP_BRF)
+            if (!tos)
+                Branch();
+            else
+                SkipBranch();
+            tos = LPop();
+            NEXT;
+        OPCODE(OP_BRFSC)
+            if (!tos)
+                Branch();
+            else {
+                SkipBranch();
+                tos = LPop();
+            }
+            NEXT;
+        OPCODE(OP_BR)
+            Branch();
+            NEXT;
+        OPCODE(OP_NOT)
+            tos = (tos ? FALSE : TRUE);
+            NEXT;
+        OPCODE(OP_NEG)
+            tos = -tos;
+            NEXT;
+        OPCODE(OP_ADD)
+            tmp = LPop();
+            tos = tmp + tos;
+            NEXT;
+        OPCODE(OP_SUB)
+            tmp = LPop();
+            tos = tmp - tos;
+            NEXT;
+        OPCODE(OP_MUL)
+            tmp = LPop();
+            tos = tmp * tos;
+            NEXT;
+        OPCODE(OP_DIV)
+            tmp = LPop();
+            if (tos == -1 && tmp == VMVALUE_MIN)
+                Abort(i, "integer overflow");
+            tos = (tos == 0 ? 0 : tmp / tos);
+            NEXT;
+        OPCODE(OP_REM)
+            tmp = LPop();
+            if (tos == -1 && tmp == VMVALUE_MIN)
+                Abort(i, "integer overflow");
+            tos = (tos == 0 ? 0 : tmp % tos);
+            NEXT;
+        OPCODE(OP_BNOT)
+            tos = ~tos;
+            NEXT;
+        OPCODE(OP_BAND)
+            tmp = LPop();
+            tos = tmp & tos;
+            NEXT;
+        OPCODE(OP_BOR)
+            tmp = LPop();
+            tos = tmp | tos;
+            NEXT;
+        OPCODE(OP_BXOR)
+            tmp = LPop();
+            tos = tmp ^ tos;
+            NEXT;
+        OPCODE(OP_SHL)
+            tmp = LPop();
+            tos = tmp << tos;
+            NEXT;
+        OPCODE(OP_SHR)
+            tmp = LPop();
+            tos = tmp >> tos;
+            NEXT;
+        OPCODE(OP_LT)
+            tmp = LPop();
+            tos = (tmp < tos ? TRUE : FALSE);
+            NEXT;
+        OPCODE(OP_LE)
+            tmp = LPop();
+            tos = (tmp <= tos ? TRUE : FALSE);
+            NEXT;
+        OPCODE(OP_EQ)
+            tmp = LPop();
+            tos = (tmp == tos ? TRUE : FALSE);
+            NEXT;
+        OPCODE(OP_NE)
+            tmp = LPop();
+            tos = (tmp != tos ? TRUE : FALSE);
+            NEXT;
+        OPCODE(OP_GE)
+            tmp = LPop();
+            tos = (tmp >= tos ? TRUE : FALSE);
+            NEXT;
+        OPCODE(OP_GT)
+            tmp = LPop();
+            tos = (tmp > tos ? TRUE : FALSE);
+            NEXT;
+        OPCODE(OP_LIT)
+            GetWordOperand(tmp);
+            LCPush(tos);
+            tos = tmp;
+            NEXT;
+        OPCODE(OP_SLIT)
+            GetSByteOperand(tmp);
+            LCPush(tos);
+            tos = tmp;
+            NEXT;
+        OPCODE(OP_LOAD)
+            SaveState();
+            tos = LoadValue(i, (VMUVALUE)tos);
+            NEXT;
+        OPCODE(OP_LOADB)
+            SaveState();
+            tos = LoadByteValue(i, (VMUVALUE)tos);
+            NEXT;
+        OPCODE(OP_STORE)
+            tmp = LPop();
+            SaveState();
+            StoreValue(i, (VMUVALUE)tos, tmp);
+            tos = LPop();
+            NEXT;
+        OPCODE(OP_STOREB)
+            tmp = LPop();
+            SaveState();
+            StoreByteValue(i, (VMUVALUE)tos, tmp);
+            tos = LPop();
+            NEXT;
+        OPCODE(OP_LREF)
+            GetSByteOperand(tmp);
+            LCPush(tos);
+            tos = fp[(int)tmp];
+            NEXT;
+        OPCODE(OP_LSET)
+            GetSByteOperand(tmp);
+            fp[(int)tmp] = tos;
+            tos = LPop();
+            NEXT;
+        OPCODE(OP_INDEX)
+            tmp = LPop();
+            tos = tmp + tos * sizeof (VMVALUE);
+            NEXT;
+        OPCODE(OP_PUSHJ)
+            PushJ();
+            NEXT;
+        OPCODE(OP_POPJ)
+            JumpTo(tos);
+            tos = LPop();
+            NEXT;
+        OPCODE(OP_CLEAN)
+            GetByteOperand(cnt);
+            LDrop(cnt);
+            NEXT;
+        OPCODE(OP_FRAME)
+            GetByteOperand(cnt);
+            tmp = (VMVALUE)(fp - stack);
+            fp = sp;
+            LReserve(cnt);
+            fp[F_FP] = tmp;
+            NEXT;
+        OPCODE(OP_RETURNZ)
+            LCPush(tos);
+            tos = 0;
+            // fall through
+        OPCODE(OP_RETURN)
+            JumpTo(LTop());
+            sp = fp;
+            fp = (VMVALUE *)(stack + fp[F_FP]);
+            NEXT;
+        OPCODE(OP_DROP)
+            tos = LPop();
+            NEXT;
+        OPCODE(OP_DUP)
+            LCPush(tos);
+            NEXT;
+        OPCODE(OP_NATIVE)
+            GetWordOperand(tmp);
+#ifdef NativeInstruction
+            NativeInstruction(tmp);
+#endif
+            NEXT;
+        OPCODE(OP_TRAP)
+            GetByteOperand(cnt);
+            SaveState();
+            DoTrap(i, cnt);
+            RestoreState();
+            NEXT;
+#ifdef DECODED
+        OPCODE(XOP_CALL)
+            LCPush(tos);
+            tos = pc[1].value;
+            pc = pc[0].target;
+            NEXT;
+        OPCODE(XOP_BADADDR)
+            SaveState();
+            Abort(i, "address error");
+            NEXT;
+#endif
+        UNDEFINED
+            SaveState();
+            Abort(i, "undefined opcode 0x%02x", UndefinedOpcode());
+            NEXT;
+#ifndef VM_THREADED
+        }
+    }
+#endif
+}
+
+#undef EXECUTE
+#undef DECODED
+#undef CODE
+#undef PC_FIELD
+#undef DISPATCH_SIZE
+#undef FetchOpcode
+#undef GetWordOperand
+#undef GetByteOperand
+#undef GetSByteOperand
+#undef Branch
+#undef SkipBranch
+#undef PushJ
+#undef JumpTo
+#undef UndefinedOpcode
+#undef BranchHook
+#undef CallHook
+#undef ReturnHook
+#undef NativeInstruction
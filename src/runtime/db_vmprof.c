@@ -0,0 +1,366 @@
+/* db_vmprof.c - instruction-level profiler
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ * The profiled interpreter counts every instruction it executes by text
+ * offset and by call stack.  Calls and returns move through a call tree
+ * with one node for each distinct call stack so that the report can show
+ * inclusive and exclusive counts for each function and the folded stacks
+ * can be written without keeping a trace.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "db_vmprof.h"
+
+/* line hotspot */
+typedef struct {
+    VMUVALUE file;
+    VMUVALUE line;
+    uint64_t count;
+} LineCount;
+
+/* prototypes for local functions */
+static ProfileFunction *GetFunction(Profile *p, VMUVALUE addr);
+static ProfileFunction *NewFunction(Profile *p, VMUVALUE addr);
+static void FinishProfile(Profile *p);
+static void SumExclusive(ProfileNode *node);
+static void WriteFoldedNode(FILE *fp, ProfileNode *node, ProfileNode **path, int depth);
+static int FindLine(ImageDebug *debug, VMUVALUE addr);
+static double Percent(uint64_t count, uint64_t total);
+static int CompareInclusive(const void *p1, const void *p2);
+static int CompareLines(const void *p1, const void *p2);
+static int CompareCounts(const void *p1, const void *p2);
+
+/* InitProfile - initialize the profiler for an image */
+Profile *InitProfile(System *sys, ImageHdr *image)
+{
+    ImageFileSection *section = NULL;
+    Profile *p;
+    int j;
+
+    /* find the section containing the main code */
+    for (j = 0; j < image->sectionCount; ++j) {
+        ImageFileSection *fileSection = image->sections[j].fileSection;
+        if (image->mainCode >= fileSection->base && image->mainCode < fileSection->base + fileSection->size) {
+            section = fileSection;
+            break;
+        }
+    }
+    if (!section)
+        return NULL;
+
+    /* allocate the profiler state */
+    if (!(p = (Profile *)xbGlobalAlloc(sys, sizeof(Profile))))
+        return NULL;
+    memset(p, 0, sizeof(Profile));
+    p->sys = sys;
+    p->image = image;
+    p->base = section->base;
+    p->size = section->size;
+    if (!(p->counts = (uint64_t *)xbGlobalAlloc(sys, (p->size + 1) * sizeof(uint64_t)))
+    ||  !(p->map = (ProfileFunction **)xbGlobalAlloc(sys, p->size * sizeof(ProfileFunction *))))
+        return NULL;
+    memset(p->counts, 0, (p->size + 1) * sizeof(uint64_t));
+    memset(p->map, 0, p->size * sizeof(ProfileFunction *));
+
+    /* the main code is the root of the call tree */
+    p->root.function = GetFunction(p, image->mainCode);
+    p->root.function->calls = 1;
+    p->root.function->active = 1;
+    p->node = &p->root;
+
+    /* return the profiler state */
+    return p;
+}
+
+/* ProfileCall - enter a function */
+void ProfileCall(Profile *p, VMUVALUE addr)
+{
+    ProfileFunction *function = GetFunction(p, addr);
+    ProfileNode *node;
+
+    /* find the node for the new call stack */
+    for (node = p->node->children; node != NULL; node = node->sibling)
+        if (node->function == function)
+            break;
+
+    /* add a node if this is the first call with this call stack */
+    if (!node) {
+        if (!(node = (ProfileNode *)xbGlobalAlloc(p->sys, sizeof(ProfileNode))))
+            Fatal(p->sys, "insufficient memory for the profiler");
+        memset(node, 0, sizeof(ProfileNode));
+        node->parent = p->node;
+        node->function = function;
+        node->sibling = p->node->children;
+        p->node->children = node;
+    }
+
+    /* only the outermost active call of a recursive function counts toward its inclusive count */
+    ++function->calls;
+    if (function->active++ == 0)
+        function->entry = p->total;
+
+    /* enter the function */
+    p->node = node;
+    if (++p->depth > p->maxDepth)
+        p->maxDepth = p->depth;
+}
+
+/* ProfileReturn - return from a function */
+void ProfileReturn(Profile *p)
+{
+    ProfileFunction *function;
+
+    /* returns from the main code don't match a call */
+    if (p->node == &p->root)
+        return;
+
+    /* leave the function */
+    function = p->node->function;
+    if (--function->active == 0)
+        function->inclusive += p->total - function->entry;
+    p->node = p->node->parent;
+    --p->depth;
+}
+
+/* WriteProfileReport - write the function and line report */
+void WriteProfileReport(Profile *p, FILE *fp)
+{
+    ImageDebug *debug = p->image->debug;
+    ProfileFunction **functions;
+    LineCount *lines;
+    VMUVALUE offset;
+    int count, j;
+
+    FinishProfile(p);
+
+    fprintf(fp, "%llu instructions executed\n\n", (unsigned long long)p->total);
+
+    /* write the functions in order of decreasing inclusive count */
+    if (!(functions = (ProfileFunction **)xbGlobalAlloc(p->sys, (p->functionCount + 1) * sizeof(ProfileFunction *))))
+        Fatal(p->sys, "insufficient memory for the profiler");
+    memcpy(functions, p->functions, p->functionCount * sizeof(ProfileFunction *));
+    qsort(functions, p->functionCount, sizeof(ProfileFunction *), CompareInclusive);
+    fprintf(fp, "%-24s %12s %16s %7s %16s %7s\n", "function", "calls", "inclusive", "%", "exclusive", "%");
+    for (j = 0; j < p->functionCount; ++j) {
+        ProfileFunction *function = functions[j];
+        fprintf(fp, "%-24s %12llu %16llu %7.2f %16llu %7.2f\n",
+                function->name,
+                (unsigned long long)function->calls,
+                (unsigned long long)function->inclusive,
+                Percent(function->inclusive, p->total),
+                (unsigned long long)function->exclusive,
+                Percent(function->exclusive, p->total));
+    }
+
+    /* line hotspots need the line table */
+    if (!debug || debug->lineCount == 0) {
+        fprintf(fp, "\nno line table (compile with xbcom -g)\n");
+        return;
+    }
+
+    /* add up the counts for each line table entry */
+    if (!(lines = (LineCount *)xbGlobalAlloc(p->sys, debug->lineCount * sizeof(LineCount))))
+        Fatal(p->sys, "insufficient memory for the profiler");
+    for (j = 0; j < debug->lineCount; ++j) {
+        lines[j].file = debug->lines[j].file;
+        lines[j].line = debug->lines[j].line;
+        lines[j].count = 0;
+    }
+    for (offset = 0; offset < p->size; ++offset)
+        if (p->counts[offset] && (j = FindLine(debug, p->base + offset)) >= 0)
+            lines[j].count += p->counts[offset];
+
+    /* combine the entries for each source line */
+    qsort(lines, debug->lineCount, sizeof(LineCount), CompareLines);
+    for (j = 0, count = 0; j < debug->lineCount; ++j) {
+        if (count > 0 && lines[count - 1].file == lines[j].file && lines[count - 1].line == lines[j].line)
+            lines[count - 1].count += lines[j].count;
+        else
+            lines[count++] = lines[j];
+    }
+
+    /* write the lines in order of decreasing count */
+    qsort(lines, count, sizeof(LineCount), CompareCounts);
+    fprintf(fp, "\n%-40s %16s %7s\n", "line", "count", "%");
+    for (j = 0; j < count && lines[j].count > 0; ++j) {
+        char buf[PATH_MAX];
+        snprintf(buf, sizeof(buf), "%s:%u",
+                 lines[j].file < debug->fileCount ? debug->files[lines[j].file] : "?",
+                 lines[j].line);
+        fprintf(fp, "%-40s %16llu %7.2f\n",
+                buf,
+                (unsigned long long)lines[j].count,
+                Percent(lines[j].count, p->total));
+    }
+}
+
+/* WriteFoldedStacks - write the call stacks in the folded format used by flame graph tools */
+void WriteFoldedStacks(Profile *p, FILE *fp)
+{
+    ProfileNode **path;
+    FinishProfile(p);
+    if (!(path = (ProfileNode **)xbGlobalAlloc(p->sys, (p->maxDepth + 1) * sizeof(ProfileNode *))))
+        Fatal(p->sys, "insufficient memory for the profiler");
+    WriteFoldedNode(fp, &p->root, path, 0);
+}
+
+/* GetFunction - get the function with an entry address */
+static ProfileFunction *GetFunction(Profile *p, VMUVALUE addr)
+{
+    VMUVALUE offset = addr - p->base;
+    if (offset >= p->size) {
+        if (!p->other)
+            p->other = NewFunction(p, addr);
+        return p->other;
+    }
+    if (!p->map[offset])
+        p->map[offset] = NewFunction(p, addr);
+    return p->map[offset];
+}
+
+/* NewFunction - add a function */
+static ProfileFunction *NewFunction(Profile *p, VMUVALUE addr)
+{
+    ImageDebug *debug = p->image->debug;
+    ProfileFunction *function;
+    char buf[64], *name = NULL;
+    int j;
+
+    /* get the function name from the debug section */
+    if (debug) {
+        for (j = 0; j < debug->functionCount; ++j)
+            if (debug->functions[j].base == addr) {
+                name = debug->functionNames[j];
+                break;
+            }
+    }
+
+    /* otherwise, make a name from the address */
+    if (!name) {
+        if (addr == p->image->mainCode)
+            strcpy(buf, "[main]");
+        else if (addr - p->base >= p->size)
+            strcpy(buf, "[other]");
+        else
+            sprintf(buf, "fn_%08x", addr);
+        if (!(name = (char *)xbGlobalAlloc(p->sys, strlen(buf) + 1)))
+            Fatal(p->sys, "insufficient memory for the profiler");
+        strcpy(name, buf);
+    }
+
+    /* grow the function table if necessary */
+    if (p->functionCount >= p->maxFunctions) {
+        ProfileFunction **functions;
+        int maxFunctions = p->maxFunctions ? p->maxFunctions * 2 : 64;
+        if (!(functions = (ProfileFunction **)xbGlobalAlloc(p->sys, maxFunctions * sizeof(ProfileFunction *))))
+            Fatal(p->sys, "insufficient memory for the profiler");
+        if (p->functionCount > 0)
+            memcpy(functions, p->functions, p->functionCount * sizeof(ProfileFunction *));
+        p->functions = functions;
+        p->maxFunctions = maxFunctions;
+    }
+
+    /* add the function */
+    if (!(function = (ProfileFunction *)xbGlobalAlloc(p->sys, sizeof(ProfileFunction))))
+        Fatal(p->sys, "insufficient memory for the profiler");
+    memset(function, 0, sizeof(ProfileFunction));
+    function->addr = addr;
+    function->name = name;
+    p->functions[p->functionCount++] = function;
+
+    /* return the new function */
+    return function;
+}
+
+/* FinishProfile - close the calls that were active when the program stopped */
+static void FinishProfile(Profile *p)
+{
+    ProfileNode *node;
+    if (!p->finished) {
+        for (node = p->node; node != NULL; node = node->parent)
+            if (--node->function->active == 0)
+                node->function->inclusive += p->total - node->function->entry;
+        SumExclusive(&p->root);
+        p->finished = TRUE;
+    }
+}
+
+/* SumExclusive - add the counts in a call tree to the exclusive counts of its functions */
+static void SumExclusive(ProfileNode *node)
+{
+    ProfileNode *child;
+    node->function->exclusive += node->count;
+    for (child = node->children; child != NULL; child = child->sibling)
+        SumExclusive(child);
+}
+
+/* WriteFoldedNode - write the folded stacks for a call tree */
+static void WriteFoldedNode(FILE *fp, ProfileNode *node, ProfileNode **path, int depth)
+{
+    ProfileNode *child;
+    int j;
+    path[depth] = node;
+    if (node->count > 0) {
+        for (j = 0; j <= depth; ++j)
+            fprintf(fp, "%s%s", j > 0 ? ";" : "", path[j]->function->name);
+        fprintf(fp, " %llu\n", (unsigned long long)node->count);
+    }
+    for (child = node->children; child != NULL; child = child->sibling)
+        WriteFoldedNode(fp, child, path, depth + 1);
+}
+
+/* FindLine - find the line table entry for an address */
+static int FindLine(ImageDebug *debug, VMUVALUE addr)
+{
+    int lo = 0, hi = debug->lineCount - 1, found = -1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (debug->lines[mid].addr <= addr) {
+            found = mid;
+            lo = mid + 1;
+        }
+        else
+            hi = mid - 1;
+    }
+    return found;
+}
+
+/* Percent - compute a percentage of the total */
+static double Percent(uint64_t count, uint64_t total)
+{
+    return total ? count * 100.0 / total : 0.0;
+}
+
+/* CompareInclusive - compare functions by decreasing inclusive count */
+static int CompareInclusive(const void *p1, const void *p2)
+{
+    const ProfileFunction *f1 = *(const ProfileFunction **)p1;
+    const ProfileFunction *f2 = *(const ProfileFunction **)p2;
+    if (f1->inclusive != f2->inclusive)
+        return f1->inclusive < f2->inclusive ? 1 : -1;
+    return f1->addr < f2->addr ? -1 : f1->addr > f2->addr;
+}
+
+/* CompareLines - compare line counts by file and line number */
+static int CompareLines(const void *p1, const void *p2)
+{
+    const LineCount *l1 = (const LineCount *)p1;
+    const LineCount *l2 = (const LineCount *)p2;
+    if (l1->file != l2->file)
+        return l1->file < l2->file ? -1 : 1;
+    return l1->line < l2->line ? -1 : l1->line > l2->line;
+}
+
+/* CompareCounts - compare line counts by decreasing count */
+static int CompareCounts(const void *p1, const void *p2)
+{
+    const LineCount *l1 = (const LineCount *)p1;
+    const LineCount *l2 = (const LineCount *)p2;
+    if (l1->count != l2->count)
+        return l1->count < l2->count ? 1 : -1;
+    return CompareLines(p1, p2);
+}
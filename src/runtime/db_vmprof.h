@@ -0,0 +1,67 @@
+/* db_vmprof.h - definitions for the instruction-level profiler
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#ifndef __DB_VMPROF_H__
+#define __DB_VMPROF_H__
+
+#include <stdio.h>
+#include "db_vm.h"
+
+/* profiled function */
+typedef struct {
+    VMUVALUE addr;          /* entry address */
+    char *name;             /* function name */
+    uint64_t calls;         /* number of calls */
+    uint64_t inclusive;     /* instructions executed by the function and the functions it calls */
+    uint64_t exclusive;     /* instructions executed by the function itself */
+    uint64_t entry;         /* instruction count when the outermost active call started */
+    int active;             /* number of active calls */
+} ProfileFunction;
+
+/* call tree node (one for each distinct call stack) */
+typedef struct ProfileNode ProfileNode;
+struct ProfileNode {
+    ProfileNode *parent;        /* caller */
+    ProfileNode *children;      /* first callee */
+    ProfileNode *sibling;       /* next callee of the caller */
+    ProfileFunction *function;  /* function called */
+    uint64_t count;             /* instructions executed with this call stack */
+};
+
+/* profiler state */
+struct Profile {
+    System *sys;                /* system interface */
+    ImageHdr *image;            /* image being profiled */
+    VMUVALUE base;              /* address of the text section */
+    VMUVALUE size;              /* size of the text section */
+    uint64_t *counts;           /* instructions executed at each text offset (plus one for other addresses) */
+    uint64_t total;             /* total instructions executed */
+    ProfileFunction **map;      /* functions by entry offset */
+    ProfileFunction *other;     /* calls to addresses outside of the text section */
+    ProfileFunction **functions;/* functions in the order they were first called */
+    int functionCount;          /* number of functions */
+    int maxFunctions;           /* size of the functions array */
+    ProfileNode root;           /* call tree root (the main code) */
+    ProfileNode *node;          /* node for the current call stack */
+    int depth;                  /* current call depth */
+    int maxDepth;               /* maximum call depth */
+    int finished;               /* active calls have been closed */
+};
+
+/* count an instruction at a text offset (evaluates offset twice) */
+#define ProfileInstruction(p, offset)                                           \
+                        (++(p)->counts[(VMUVALUE)(offset) < (p)->size ? (VMUVALUE)(offset) : (p)->size], \
+                         ++(p)->node->count,                                    \
+                         ++(p)->total)
+
+/* prototypes from db_vmprof.c */
+Profile *InitProfile(System *sys, ImageHdr *image);
+void ProfileCall(Profile *p, VMUVALUE addr);
+void ProfileReturn(Profile *p);
+void WriteProfileReport(Profile *p, FILE *fp);
+void WriteFoldedStacks(Profile *p, FILE *fp);
+
+#endif
@@ -0,0 +1,167 @@
+/* db_vmstats.c - opcode statistics
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ * Counts the opcodes executed by the bytecode interpreter along with
+ * every adjacent pair and triple of opcodes and the outcome of each
+ * conditional branch.  The results are written as JSON so they can be
+ * used to choose superinstructions and to check the branch layout
+ * chosen by the code generator.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "db_vmstats.h"
+#include "db_vmdebug.h"
+
+#ifdef VM_STATS
+
+/* opcode sequence */
+typedef struct {
+    uint64_t count;
+    uint8_t ops[3];
+} Sequence;
+
+/* prototypes for local functions */
+static void GetOpcodeNames(const char **names);
+static void WriteSequences(FILE *fp, const char **names, Sequence *sequences, int count, int length);
+static int CompareSequences(const void *p1, const void *p2);
+
+/* InitStats - initialize the opcode statistics */
+Stats *InitStats(System *sys)
+{
+    Stats *s;
+    if (!(s = (Stats *)xbGlobalAlloc(sys, sizeof(Stats))))
+        return NULL;
+    memset(s, 0, sizeof(Stats));
+    s->sys = sys;
+    s->prev = s->prev2 = STATS_NONE;
+    return s;
+}
+
+/* StatsOpcode - count an opcode and the sequences that end with it */
+int StatsOpcode(Stats *s, int op)
+{
+    int slot = (op < STATS_NONE ? op : STATS_NONE);
+    ++s->counts[slot];
+    ++s->pairs[s->prev][slot];
+    ++s->triples[s->prev2][s->prev][slot];
+    ++s->total;
+    s->prev2 = s->prev;
+    s->prev = slot;
+    return op;
+}
+
+/* StatsBranch - count the outcome of the current branch instruction */
+void StatsBranch(Stats *s, int taken)
+{
+    if (taken)
+        ++s->taken[s->prev];
+    else
+        ++s->notTaken[s->prev];
+}
+
+/* WriteStats - write the opcode statistics as JSON */
+void WriteStats(Stats *s, FILE *fp)
+{
+    static int branches[] = { OP_BRT, OP_BRTSC, OP_BRF, OP_BRFSC, -1 };
+    const char *names[STATS_OPCODES];
+    Sequence *sequences;
+    int count, maxCount, j, k, l;
+
+    GetOpcodeNames(names);
+
+    /* write the opcode counts */
+    fprintf(fp, "{\n  \"instructions\": %llu,\n  \"opcodes\": {", (unsigned long long)s->total);
+    for (j = 0, count = 0; j < STATS_NONE; ++j)
+        if (s->counts[j] > 0)
+            fprintf(fp, "%s\n    \"%s\": %llu", count++ ? "," : "", names[j], (unsigned long long)s->counts[j]);
+    fprintf(fp, "\n  },\n");
+
+    /* write the branch outcomes */
+    fprintf(fp, "  \"branches\": {");
+    for (j = 0; branches[j] >= 0; ++j) {
+        int op = branches[j];
+        fprintf(fp, "%s\n    \"%s\": { \"taken\": %llu, \"not_taken\": %llu }",
+                j > 0 ? "," : "", names[op],
+                (unsigned long long)s->taken[op],
+                (unsigned long long)s->notTaken[op]);
+    }
+    fprintf(fp, "\n  },\n");
+
+    /* collect the sequences (there can't be more of them than instructions executed) */
+    maxCount = STATS_NONE * STATS_NONE * STATS_NONE;
+    if (s->total < maxCount)
+        maxCount = (int)s->total;
+    if (!(sequences = (Sequence *)malloc((maxCount + 1) * sizeof(Sequence))))
+        Fatal(s->sys, "insufficient memory");
+
+    /* write the opcode pairs */
+    for (j = 0, count = 0; j < STATS_NONE; ++j)
+        for (k = 0; k < STATS_NONE; ++k)
+            if (s->pairs[j][k] > 0) {
+                sequences[count].count = s->pairs[j][k];
+                sequences[count].ops[0] = j;
+                sequences[count].ops[1] = k;
+                sequences[count].ops[2] = 0;
+                ++count;
+            }
+    fprintf(fp, "  \"pairs\": [");
+    WriteSequences(fp, names, sequences, count, 2);
+    fprintf(fp, "\n  ],\n");
+
+    /* write the opcode triples */
+    for (j = 0, count = 0; j < STATS_NONE; ++j)
+        for (k = 0; k < STATS_NONE; ++k)
+            for (l = 0; l < STATS_NONE; ++l)
+                if (s->triples[j][k][l] > 0) {
+                    sequences[count].count = s->triples[j][k][l];
+                    sequences[count].ops[0] = j;
+                    sequences[count].ops[1] = k;
+                    sequences[count].ops[2] = l;
+                    ++count;
+                }
+    fprintf(fp, "  \"triples\": [");
+    WriteSequences(fp, names, sequences, count, 3);
+    fprintf(fp, "\n  ]\n}\n");
+
+    free(sequences);
+}
+
+/* GetOpcodeNames - get the name of each opcode from the disassembler table */
+static void GetOpcodeNames(const char **names)
+{
+    FLASH_SPACE OTDEF *op;
+    int j;
+    for (j = 0; j < STATS_OPCODES; ++j)
+        names[j] = "UNDEFINED";
+    for (op = OpcodeTable; op->name; ++op)
+        if (op->code < STATS_NONE && strcmp(names[op->code], "UNDEFINED") == 0)
+            names[op->code] = op->name;
+}
+
+/* WriteSequences - write opcode sequences in order of decreasing count */
+static void WriteSequences(FILE *fp, const char **names, Sequence *sequences, int count, int length)
+{
+    int j, k;
+    qsort(sequences, count, sizeof(Sequence), CompareSequences);
+    for (j = 0; j < count; ++j) {
+        fprintf(fp, "%s\n    { \"ops\": [", j > 0 ? "," : "");
+        for (k = 0; k < length; ++k)
+            fprintf(fp, "%s\"%s\"", k > 0 ? ", " : "", names[sequences[j].ops[k]]);
+        fprintf(fp, "], \"count\": %llu }", (unsigned long long)sequences[j].count);
+    }
+}
+
+/* CompareSequences - compare sequences for qsort (most frequent first) */
+static int CompareSequences(const void *p1, const void *p2)
+{
+    const Sequence *s1 = (const Sequence *)p1;
+    const Sequence *s2 = (const Sequence *)p2;
+    if (s1->count != s2->count)
+        return s1->count < s2->count ? 1 : -1;
+    return memcmp(s1->ops, s2->ops, sizeof(s1->ops));
+}
+
+#endif
@@ -0,0 +1,40 @@
+/* db_vmstats.h - definitions for opcode statistics
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#ifndef __DB_VMSTATS_H__
+#define __DB_VMSTATS_H__
+
+#include <stdio.h>
+#include "db_vm.h"
+
+#ifdef VM_STATS
+
+/* number of opcode slots (the last one collects undefined opcodes and the start of execution) */
+#define STATS_OPCODES   64
+#define STATS_NONE      (STATS_OPCODES - 1)
+
+/* opcode statistics */
+struct Stats {
+    System *sys;                /* system interface */
+    uint64_t total;             /* total instructions executed */
+    uint64_t counts[STATS_OPCODES];                                 /* executions of each opcode */
+    uint64_t pairs[STATS_OPCODES][STATS_OPCODES];                   /* executions of each opcode pair */
+    uint64_t triples[STATS_OPCODES][STATS_OPCODES][STATS_OPCODES];  /* executions of each opcode triple */
+    uint64_t taken[STATS_OPCODES];      /* branches taken by each opcode */
+    uint64_t notTaken[STATS_OPCODES];   /* branches not taken by each opcode */
+    int prev;                   /* opcode of the current instruction */
+    int prev2;                  /* opcode of the instruction before that */
+};
+
+/* prototypes from db_vmstats.c */
+Stats *InitStats(System *sys);
+int StatsOpcode(Stats *s, int op);
+void StatsBranch(Stats *s, int taken);
+void WriteStats(Stats *s, FILE *fp);
+
+#endif
+
+#endif
@@ -4,7 +4,16 @@
 #include "db_system.h"
 #include "mem_malloc.h"
 #include "db_vm.h"
+#include "db_vmprof.h"
+#include "db_vmstats.h"
+#include "db_vmcycles.h"
+#include "db_vmcache.h"
 
+/* defaults */
+#define DEF_BOARD   "hub"
+
+static void Usage(void);
+static void WriteProfile(Profile *profile, char *name, void (*write)(Profile *p, FILE *fp));
 static void MyInfo(System *sys, const char *fmt, va_list ap);
 static void MyError(System *sys, const char *fmt, va_list ap);
 static SystemOps myOps = {
@@ -14,29 +23,228 @@ static SystemOps myOps = {
 
 int main(int argc, char *argv[])
 {
+    char *infile = NULL, *reportFile = NULL, *foldedFile = NULL, *statsFile = NULL, *cacheFile = NULL;
+    int simulateCycles = FALSE;
+    BoardConfig *config;
+    char *board;
     ImageHdr *image;
     Interpreter *i;
-    char *infile;
+    int flags = 0, status = 0;
     System *sys;
+    int j;
     
-    if (argc != 2) {
-        fprintf(stderr, "usage: xbint <file>\n");
-        return 1;
+    /* get the environment settings */
+    if (!(board = getenv("BOARD")))
+        board = DEF_BOARD;
+
+    /* get the arguments */
+    for (j = 1; j < argc; ++j) {
+        if (argv[j][0] == '-') {
+            switch (argv[j][1]) {
+            case 'b':
+                if (argv[j][2])
+                    board = &argv[j][2];
+                else if (++j < argc)
+                    board = argv[j];
+                else
+                    Usage();
+                break;
+            case 'c':
+                simulateCycles = TRUE;
+                break;
+            case 'M':
+                if (argv[j][2])
+                    cacheFile = &argv[j][2];
+                else if (++j < argc)
+                    cacheFile = argv[j];
+                else
+                    Usage();
+                break;
+            case 'j':
+                flags |= IMAGE_JIT;
+                break;
+            case 'p':
+                flags |= IMAGE_PREDECODE;
+                break;
+            case 'P':
+                if (argv[j][2])
+                    reportFile = &argv[j][2];
+                else if (++j < argc)
+                    reportFile = argv[j];
+                else
+                    Usage();
+                break;
+            case 'F':
+                if (argv[j][2])
+                    foldedFile = &argv[j][2];
+                else if (++j < argc)
+                    foldedFile = argv[j];
+                else
+                    Usage();
+                break;
+#ifdef VM_STATS
+            case 'S':
+                if (argv[j][2])
+                    statsFile = &argv[j][2];
+                else if (++j < argc)
+                    statsFile = argv[j];
+                else
+                    Usage();
+                break;
+#endif
+            default:
+                Usage();
+                break;
+            }
+        }
+        else {
+            if (infile)
+                Usage();
+            infile = argv[j];
+        }
     }
-    infile = argv[1];
     
+    /* make sure there was an input file */
+    if (!infile)
+        Usage();
+    
+    /* the profiler uses the bytecode interpreter */
+    if (reportFile || foldedFile) {
+        if (flags & (IMAGE_JIT | IMAGE_PREDECODE)) {
+            fprintf(stderr, "error: profiling can't be combined with -j or -p\n");
+            return 1;
+        }
+        flags |= IMAGE_DEBUG;
+    }
+
+    /* opcode statistics also use the bytecode interpreter */
+    if (statsFile && (reportFile || foldedFile || (flags & (IMAGE_JIT | IMAGE_PREDECODE)))) {
+        fprintf(stderr, "error: opcode statistics can't be combined with -j, -p, -P or -F\n");
+        return 1;
+    }
+
+    /* the cycle-cost model also uses the bytecode interpreter */
+    if (simulateCycles && (reportFile || foldedFile || statsFile || (flags & (IMAGE_JIT | IMAGE_PREDECODE)))) {
+        fprintf(stderr, "error: cycle simulation can't be combined with -j, -p, -P, -F or -S\n");
+        return 1;
+    }
+
+    /* so does the cache simulator which also uses function names from the debug section */
+    if (cacheFile) {
+        if (reportFile || foldedFile || statsFile || (flags & (IMAGE_JIT | IMAGE_PREDECODE))) {
+            fprintf(stderr, "error: cache simulation can't be combined with -j, -p, -P, -F or -S\n");
+            return 1;
+        }
+        flags |= IMAGE_DEBUG;
+    }
+
     sys = MemInit();
     sys->ops = &myOps;
 
-    if (!(image = LoadImage(sys, infile)))
+    if (!(image = LoadImage(sys, infile, flags)))
         Fatal(sys, "can't load image '%s'", infile);
 
     if (!(i = (Interpreter *)InitInterpreter(sys, image)))
         Fatal(sys, "insufficient memory");
         
-    Execute(i, image);
+    if ((reportFile || foldedFile) && !(i->profile = InitProfile(sys, image)))
+        Fatal(sys, "can't initialize the profiler");
+
+    /* get the simulated board from the board configuration file */
+    if (simulateCycles || cacheFile) {
+        xbAddEnvironmentPath(sys);
+        if (!(config = GetBoardConfig(ParseConfigurationFile(sys, "xbasic.cfg"), board)))
+            Fatal(sys, "no board type: %s", board);
+        if (!(i->cycles = InitCycleModel(sys, config->clkfreq)))
+            Fatal(sys, "insufficient memory");
+        if (cacheFile) {
+            if (!config->cacheDriver)
+                Fatal(sys, "board type %s has no cache driver", board);
+            if (!(i->cache = InitCacheModel(sys, image, config, i->cycles)))
+                Fatal(sys, "can't initialize the cache simulator");
+        }
+    }
+
+#ifdef VM_STATS
+    if (statsFile && !(i->stats = InitStats(sys)))
+        Fatal(sys, "insufficient memory");
+#endif
+
+    /* the opcode statistics are only written if the program reaches its halt instruction */
+    if (!Execute(i, image)) {
+        statsFile = NULL;
+        status = 1;
+    }
     
-    return 0;
+    /* show the simulated run time */
+    if (i->cycles)
+        fprintf(stderr, "%llu instructions, %llu cycles (%.3f ms at %u Hz)\n",
+                (unsigned long long)i->cycles->instructions,
+                (unsigned long long)i->cycles->count,
+                i->cycles->count * 1000.0 / i->cycles->clkfreq,
+                (unsigned)i->cycles->clkfreq);
+
+    /* write the cache simulator report */
+    if (cacheFile) {
+        FILE *fp;
+        if (!(fp = fopen(cacheFile, "w")))
+            Fatal(sys, "can't create '%s'", cacheFile);
+        WriteCacheReport(i->cache, fp);
+        fclose(fp);
+    }
+
+    /* write the profiler output */
+    if (reportFile)
+        WriteProfile(i->profile, reportFile, WriteProfileReport);
+    if (foldedFile)
+        WriteProfile(i->profile, foldedFile, WriteFoldedStacks);
+
+#ifdef VM_STATS
+    /* write the opcode statistics */
+    if (statsFile) {
+        FILE *fp;
+        if (!(fp = fopen(statsFile, "w")))
+            Fatal(sys, "can't create '%s'", statsFile);
+        WriteStats(i->stats, fp);
+        fclose(fp);
+    }
+#endif
+
+    /* exit with a status of 1 if the program aborted */
+    return status;
+}
+
+static void Usage(void)
+{
+    fprintf(stderr, "\
+usage: xbint\n\
+         [ -b <type> ]   select the board for -c and -M (c3 | ssf | hub | hub96) (default is hub)\n\
+         [ -c ]          simulate CNT with the cycle costs of the VM cog on a HUB-mode board\n\
+         [ -j ]          translate functions into native code on their first call\n\
+         [ -p ]          pre-decode the bytecode before executing it\n\
+         [ -M <file> ]   also simulate the board's flash cache and write a report with a geometry sweep\n\
+         [ -P <file> ]   profile the program and write a function and line report\n\
+         [ -F <file> ]   profile the program and write folded call stacks for flame graphs\n\
+"
+#ifdef VM_STATS
+"\
+         [ -S <file> ]   count opcodes, opcode pairs and triples and branch outcomes as JSON\n\
+"
+#endif
+"\
+         <name>          image file to run\n\
+");
+    exit(1);
+}
+
+/* WriteProfile - write profiler output to a file */
+static void WriteProfile(Profile *profile, char *name, void (*write)(Profile *p, FILE *fp))
+{
+    FILE *fp;
+    if (!(fp = fopen(name, "w")))
+        Fatal(profile->sys, "can't create '%s'", name);
+    (*write)(profile, fp);
+    fclose(fp);
 }
 
 static void MyInfo(System *sys, const char *fmt, va_list ap)
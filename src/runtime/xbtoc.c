@@ -0,0 +1,904 @@
+/* xbtoc.c - translate a compiled image into a C program
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ * Each function in the image becomes a C function that operates on a
+ * simulated stack and a copy of the image sections.  Calls to functions
+ * whose addresses are known become direct C calls.  The generated program
+ * uses the VM_getchar and VM_putchar functions from db_platform.c:
+ *
+ *  xbtoc prog.bai
+ *  gcc -Wall -O2 prog.c src/common/db_platform.c -o prog
+ *
+ * The support functions are static inline so the ones a program doesn't
+ * use are left out without a warning.  A program that aborts exits with
+ * a status of 1 just as xbint does.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "db_system.h"
+#include "mem_malloc.h"
+#include "db_vm.h"
+
+/* translator instruction flags */
+#define DF_INSN     0x01    /* start of an instruction in the function being translated */
+#define DF_TARGET   0x02    /* instruction that needs a label */
+#define DF_FUNCTION 0x04    /* entry point of a function */
+
+/* kinds of right operands of binary operators */
+#define OPND_STACK  0       /* the right operand is in tos and the left one on the stack */
+#define OPND_IMM    1       /* the right operand is a literal and the left one is in tos */
+#define OPND_LOCAL  2       /* the right operand is a local variable and the left one is in tos */
+
+/* translator state */
+typedef struct {
+    ImageHdr *image;        /* image being translated */
+    FILE *fp;               /* output file */
+    VMUVALUE base;          /* image address of the text section */
+    VMUVALUE size;          /* size of the text section */
+    uint8_t *data;          /* text section data */
+    uint8_t *flags;         /* instruction flags */
+    VMUVALUE *work;         /* scratch work list */
+    VMUVALUE *insns;        /* instructions in the function being translated */
+    int insnCount;          /* number of instructions in the function being translated */
+    VMUVALUE *functions;    /* function entry points */
+    int functionCount;      /* number of functions */
+} Translator;
+
+/* runtime support code at the start of every translated program */
+static char *prelude[] = {
+"#include <stdio.h>",
+"#include <stdlib.h>",
+"#include <stdarg.h>",
+"#include <stdint.h>",
+"#include <string.h>",
+"",
+"typedef int32_t VMVALUE;",
+"typedef uint32_t VMUVALUE;",
+"",
+"/* memory window */",
+"typedef struct {",
+"    VMUVALUE base;",
+"    VMUVALUE size;",
+"    VMUVALUE longSize;",
+"    uint8_t *data;",
+"} MemoryWindow;",
+"",
+"/* platform functions from db_platform.c */",
+"int VM_getchar(void);",
+"void VM_putchar(int ch);",
+"",
+"/* arithmetic wraps around just as it does in the interpreter */",
+"#define ADD(a, b)       ((VMVALUE)((VMUVALUE)(a) + (VMUVALUE)(b)))",
+"#define SUB(a, b)       ((VMVALUE)((VMUVALUE)(a) - (VMUVALUE)(b)))",
+"#define MUL(a, b)       ((VMVALUE)((VMUVALUE)(a) * (VMUVALUE)(b)))",
+"#define NEG(a)          ((VMVALUE)-(VMUVALUE)(a))",
+"#define DIV(a, b)       ((b) == 0 ? 0 : (b) == -1 ? DivideByMinusOne(a) : (a) / (b))",
+"#define REM(a, b)       ((b) == 0 ? 0 : (b) == -1 ? (DivideByMinusOne(a), 0) : (a) % (b))",
+"#define SHL(a, b)       ((VMVALUE)((VMUVALUE)(a) << ((b) & 31)))",
+"#define SHR(a, b)       ((a) >> ((b) & 31))",
+"#define INDEX(a, b)     ADD(a, MUL(b, sizeof(VMVALUE)))",
+"",
+"/* the interpreter state is kept in locals in each function */",
+"#define SaveState()     (vmSp = sp, vmFp = fp, vmTos = tos)",
+"#define RestoreState()  (sp = vmSp, fp = vmFp, tos = vmTos)",
+"#define Push(v)         do {                                    \\",
+"                            if (sp - 1 < stack)                 \\",
+"                                StackOverflow();                \\",
+"                            *--sp = (v);                        \\",
+"                        } while (0)",
+"#define Pop()           (*sp++)",
+"#define Reserve(n)      do {                                    \\",
+"                            if (sp - (n) < stack)               \\",
+"                                StackOverflow();                \\",
+"                            sp -= (n);                          \\",
+"                            memset(sp, 0, (n) * sizeof(VMVALUE)); \\",
+"                        } while (0)",
+"#define Call(f, ret)    do {                                    \\",
+"                            SaveState();                        \\",
+"                            if (f() != (ret))                   \\",
+"                                BadReturn();                    \\",
+"                            RestoreState();                     \\",
+"                        } while (0)",
+"#define CallAddress(addr, ret) do {                             \\",
+"                            SaveState();                        \\",
+"                            if (CallFunction(addr) != (ret))    \\",
+"                                BadReturn();                    \\",
+"                            RestoreState();                     \\",
+"                        } while (0)",
+"",
+"#ifdef __GNUC__",
+"#define NORETURN        __attribute__((noreturn))",
+"#else",
+"#define NORETURN",
+"#endif",
+"",
+"static inline VMUVALUE CallFunction(VMUVALUE addr);",
+"",
+NULL
+};
+
+/* runtime support functions */
+static char *runtime[] = {
+"static VMVALUE stack[STACK_SIZE];",
+"static VMVALUE *vmSp, *vmFp, vmTos;",
+"",
+"static inline NORETURN void Abort(const char *fmt, ...)",
+"{",
+"    va_list ap;",
+"    va_start(ap, fmt);",
+"    fprintf(stderr, \"abort: \");",
+"    vfprintf(stderr, fmt, ap);",
+"    fprintf(stderr, \"\\n\");",
+"    va_end(ap);",
+"    exit(1);",
+"}",
+"",
+"static inline NORETURN void StackOverflow(void)",
+"{",
+"    Abort(\"stack overflow\");",
+"}",
+"",
+"static inline NORETURN void AddressError(void)",
+"{",
+"    Abort(\"address error\");",
+"}",
+"",
+"static inline NORETURN void BadReturn(void)",
+"{",
+"    Abort(\"unsupported return address\");",
+"}",
+"",
+"static inline NORETURN void UndefinedOpcode(int op)",
+"{",
+"    Abort(\"undefined opcode 0x%02x\", op);",
+"}",
+"",
+"static inline NORETURN void Halt(void)",
+"{",
+"    exit(0);",
+"}",
+"",
+"static inline VMVALUE DivideByMinusOne(VMVALUE value)",
+"{",
+"    if (value == INT32_MIN)",
+"        Abort(\"integer overflow\");",
+"    return NEG(value);",
+"}",
+"",
+"static inline uint8_t *MapAddress(VMUVALUE addr)",
+"{",
+"    MemoryWindow *window = &windows[addr >> WINDOW_SHIFT];",
+"    VMUVALUE offset = addr - window->base;",
+"    if (offset >= window->size)",
+"        AddressError();",
+"    return window->data + offset;",
+"}",
+"",
+"static inline uint8_t *MapLongAddress(VMUVALUE addr)",
+"{",
+"    MemoryWindow *window = &windows[addr >> WINDOW_SHIFT];",
+"    VMUVALUE offset = addr - window->base;",
+"    if (offset >= window->longSize)",
+"        AddressError();",
+"    return window->data + offset;",
+"}",
+"",
+"static inline VMVALUE GetLong(const uint8_t *p)",
+"{",
+"    VMVALUE value;",
+"    memcpy(&value, p, sizeof(value));",
+"    return value;",
+"}",
+"",
+"static inline void PutLong(uint8_t *p, VMVALUE value)",
+"{",
+"    memcpy(p, &value, sizeof(value));",
+"}",
+"",
+"#define LoadValue(addr)             GetLong(MapLongAddress(addr))",
+"#define LoadByteValue(addr)         (*MapAddress(addr))",
+"#define StoreValue(addr, value)     PutLong(MapLongAddress(addr), value)",
+"#define StoreByteValue(addr, value) (*MapAddress(addr) = (uint8_t)(value))",
+"",
+NULL
+};
+
+/* prototypes for local functions */
+static void Usage(void);
+static char *ConstructOutputName(const char *infile, char *outfile, char *ext);
+static void FindFunctions(Translator *t);
+static void FindInstructions(Translator *t, VMUVALUE offset);
+static void AddFunction(Translator *t, VMUVALUE offset);
+static void WriteSections(Translator *t);
+static void WriteFunction(Translator *t, VMUVALUE offset);
+static int WriteInstruction(Translator *t, int k, VMUVALUE *pNext);
+static int WriteOperand(Translator *t, int k, VMUVALUE end, int kind, VMVALUE value, VMUVALUE *pNext);
+static void WriteBinaryOp(Translator *t, int op, const char *left, const char *right);
+static int WriteConstantAccess(Translator *t, int op, VMUVALUE addr);
+static void WriteBranch(Translator *t, VMUVALUE target);
+static void WriteReturn(Translator *t, const char *addr);
+static char *Literal(char *buf, VMVALUE value);
+static int IsFusable(Translator *t, int k, VMUVALUE offset);
+static int CompareOffsets(const void *p1, const void *p2);
+static void MyInfo(System *sys, const char *fmt, va_list ap);
+static void MyError(System *sys, const char *fmt, va_list ap);
+static SystemOps myOps = {
+    MyInfo,
+    MyError
+};
+
+int main(int argc, char *argv[])
+{
+    char *infile = NULL, *outfile = NULL, outbuf[PATH_MAX];
+    ImageSection *section = NULL;
+    Translator t;
+    System *sys;
+    char **p;
+    int j;
+
+    /* get the arguments */
+    for (j = 1; j < argc; ++j) {
+        if (argv[j][0] == '-') {
+            switch (argv[j][1]) {
+            case 'o':
+                if (argv[j][2])
+                    outfile = &argv[j][2];
+                else if (++j < argc)
+                    outfile = argv[j];
+                else
+                    Usage();
+                break;
+            default:
+                Usage();
+                break;
+            }
+        }
+        else {
+            if (infile)
+                Usage();
+            infile = argv[j];
+        }
+    }
+
+    /* make sure there was an input file */
+    if (!infile)
+        Usage();
+
+    /* create the output file name */
+    if (!outfile)
+        outfile = ConstructOutputName(infile, outbuf, ".c");
+
+    sys = MemInit();
+    sys->ops = &myOps;
+
+    /* load the image */
+    memset(&t, 0, sizeof(t));
+    if (!(t.image = LoadImage(sys, infile, 0)))
+        Fatal(sys, "can't load image '%s'", infile);
+
+    /* find the section containing the main code */
+    for (j = 0; j < t.image->sectionCount; ++j) {
+        ImageFileSection *fileSection = t.image->sections[j].fileSection;
+        if (t.image->mainCode >= fileSection->base
+        &&  t.image->mainCode < fileSection->base + fileSection->size) {
+            section = &t.image->sections[j];
+            break;
+        }
+    }
+    if (!section)
+        Fatal(sys, "no code at the main entry point");
+    t.base = section->fileSection->base;
+    t.size = section->fileSection->size;
+    t.data = section->data;
+
+    /* allocate the translator tables */
+    if (!(t.flags = (uint8_t *)xbGlobalAlloc(sys, t.size))
+    ||  !(t.work = (VMUVALUE *)xbGlobalAlloc(sys, t.size * sizeof(VMUVALUE)))
+    ||  !(t.insns = (VMUVALUE *)xbGlobalAlloc(sys, t.size * sizeof(VMUVALUE)))
+    ||  !(t.functions = (VMUVALUE *)xbGlobalAlloc(sys, t.size * sizeof(VMUVALUE))))
+        Fatal(sys, "insufficient memory");
+    memset(t.flags, 0, t.size);
+
+    /* find the functions reachable from the main entry point */
+    FindFunctions(&t);
+
+    if (!(t.fp = fopen(outfile, "w")))
+        Fatal(sys, "can't create '%s'", outfile);
+
+    /* write the runtime support code and the image sections */
+    fprintf(t.fp, "/* %s - translated from %s by xbtoc */\n\n", outfile, infile);
+    for (p = prelude; *p; ++p)
+        fprintf(t.fp, "%s\n", *p);
+    WriteSections(&t);
+    for (p = runtime; *p; ++p)
+        fprintf(t.fp, "%s\n", *p);
+
+    /* the trap handler */
+    fprintf(t.fp, "static inline void DoTrap(int op)\n");
+    fprintf(t.fp, "{\n");
+    fprintf(t.fp, "    switch (op) {\n");
+    fprintf(t.fp, "    case %d:\n", TRAP_GETCHAR);
+    fprintf(t.fp, "        *--vmSp = vmTos;\n");
+    fprintf(t.fp, "        vmTos = VM_getchar();\n");
+    fprintf(t.fp, "        break;\n");
+    fprintf(t.fp, "    case %d:\n", TRAP_PUTCHAR);
+    fprintf(t.fp, "        VM_putchar(vmTos);\n");
+    fprintf(t.fp, "        vmTos = *vmSp++;\n");
+    fprintf(t.fp, "        break;\n");
+    fprintf(t.fp, "    default:\n");
+    fprintf(t.fp, "        Abort(\"undefined print opcode 0x%%02x\", op);\n");
+    fprintf(t.fp, "        break;\n");
+    fprintf(t.fp, "    }\n");
+    fprintf(t.fp, "}\n\n");
+
+    /* the function prototypes */
+    for (j = 0; j < t.functionCount; ++j)
+        fprintf(t.fp, "static VMUVALUE F_%08x(void);\n", t.base + t.functions[j]);
+    fprintf(t.fp, "\n");
+
+    /* the functions */
+    for (j = 0; j < t.functionCount; ++j)
+        WriteFunction(&t, t.functions[j]);
+
+    /* calls to addresses that aren't known until run time */
+    fprintf(t.fp, "static inline VMUVALUE CallFunction(VMUVALUE addr)\n");
+    fprintf(t.fp, "{\n");
+    fprintf(t.fp, "    switch (addr) {\n");
+    for (j = 0; j < t.functionCount; ++j) {
+        fprintf(t.fp, "    case 0x%08x:\n", t.base + t.functions[j]);
+        fprintf(t.fp, "        return F_%08x();\n", t.base + t.functions[j]);
+    }
+    fprintf(t.fp, "    }\n");
+    fprintf(t.fp, "    AddressError();\n");
+    fprintf(t.fp, "}\n\n");
+
+    /* the main program */
+    fprintf(t.fp, "int main(void)\n");
+    fprintf(t.fp, "{\n");
+    fprintf(t.fp, "    vmSp = vmFp = stack + STACK_SIZE;\n");
+    fprintf(t.fp, "    vmTos = 0;\n");
+    fprintf(t.fp, "    F_%08x();\n", t.image->mainCode);
+    fprintf(t.fp, "    AddressError();\n");
+    fprintf(t.fp, "}\n");
+
+    fclose(t.fp);
+
+    return 0;
+}
+
+static void Usage(void)
+{
+    fprintf(stderr, "\
+usage: xbtoc\n\
+         [ -o <file> ]   output file (default is the image name with a .c extension)\n\
+         <name>          image file to translate\n\
+");
+    exit(1);
+}
+
+/* ConstructOutputName - construct an output filename from an input filename */
+static char *ConstructOutputName(const char *infile, char *outfile, char *ext)
+{
+    char *end = strrchr(infile, '.');
+    if (end && !strchr(end, '/') && !strchr(end, '\\')) {
+        strncpy(outfile, infile, end - infile);
+        outfile[end - infile] = '\0';
+    }
+    else
+        strcpy(outfile, infile);
+    strcat(outfile, ext);
+    return outfile;
+}
+
+/* FindFunctions - find the functions reachable from the main entry point */
+static void FindFunctions(Translator *t)
+{
+    VMUVALUE offset, target;
+    int j, k;
+
+    AddFunction(t, t->image->mainCode - t->base);
+    for (j = 0; j < t->functionCount; ++j) {
+        FindInstructions(t, t->functions[j]);
+
+        /* function addresses are literals that point to a frame instruction or are called */
+        for (k = 0; k < t->insnCount; ++k) {
+            offset = t->insns[k];
+            if (VMCODEBYTE(t->data + offset) == OP_LIT && offset + 1 + sizeof(VMVALUE) <= t->size) {
+                target = GetCodeWord(t->data + offset + 1) - t->base;
+                if (target < t->size
+                &&  (VMCODEBYTE(t->data + target) == OP_FRAME
+                ||   (IsFusable(t, k + 1, offset + 1 + sizeof(VMVALUE))
+                &&    VMCODEBYTE(t->data + offset + 1 + sizeof(VMVALUE)) == OP_PUSHJ)))
+                    AddFunction(t, target);
+            }
+        }
+    }
+
+    /* write the functions in address order */
+    qsort(t->functions, t->functionCount, sizeof(VMUVALUE), CompareOffsets);
+}
+
+/* AddFunction - add a function entry point */
+static void AddFunction(Translator *t, VMUVALUE offset)
+{
+    if (!(t->flags[offset] & DF_FUNCTION)) {
+        t->flags[offset] |= DF_FUNCTION;
+        t->functions[t->functionCount++] = offset;
+    }
+}
+
+/* FindInstructions - find the instructions in the function starting at a text offset */
+static void FindInstructions(Translator *t, VMUVALUE offset)
+{
+    VMUVALUE target, end;
+    int op, size, cnt, k;
+
+    /* clear the flags left from the last function */
+    for (k = 0; k < t->size; ++k)
+        t->flags[k] &= DF_FUNCTION;
+
+    /* find all of the instructions reachable from the entry point without following calls */
+    t->insnCount = 0;
+    t->work[0] = offset;
+    cnt = 1;
+    while (cnt > 0) {
+        offset = t->work[--cnt];
+        while (offset < t->size && !(t->flags[offset] & DF_INSN)) {
+            t->flags[offset] |= DF_INSN;
+            t->insns[t->insnCount++] = offset;
+            op = VMCODEBYTE(t->data + offset);
+            if ((size = OperandSize(op)) == UNDEFINED_OPERAND || offset + 1 + size > t->size)
+                break;
+            end = offset + 1 + size;
+            if (IsBranch(op)) {
+                target = end + GetCodeWord(t->data + offset + 1);
+                if (target < t->size) {
+                    t->flags[target] |= DF_TARGET;
+                    t->work[cnt++] = target;
+                }
+            }
+            if (IsTerminal(op))
+                break;
+            offset = end;
+        }
+    }
+
+    /* sort the instructions into address order */
+    qsort(t->insns, t->insnCount, sizeof(VMUVALUE), CompareOffsets);
+
+    /* instructions that don't immediately follow the instruction before them need labels */
+    for (k = 0; k < t->insnCount; ++k) {
+        offset = t->insns[k];
+        op = VMCODEBYTE(t->data + offset);
+        if ((size = OperandSize(op)) != UNDEFINED_OPERAND && !IsTerminal(op)) {
+            end = offset + 1 + size;
+            if (end < t->size && (k + 1 >= t->insnCount || t->insns[k + 1] != end))
+                t->flags[end] |= DF_TARGET;
+        }
+    }
+}
+
+/* WriteSections - write the image sections and the memory window table */
+static void WriteSections(Translator *t)
+{
+    ImageHdr *image = t->image;
+    int j, k;
+
+    fprintf(t->fp, "#define STACK_SIZE      %u\n", image->stackSize);
+    fprintf(t->fp, "#define WINDOW_SHIFT    %d\n", WINDOW_SHIFT);
+    fprintf(t->fp, "#define WINDOW_COUNT    %d\n\n", WINDOW_COUNT);
+
+    for (j = 0; j < image->sectionCount; ++j) {
+        ImageSection *section = &image->sections[j];
+        VMUVALUE size = section->fileSection->size;
+        fprintf(t->fp, "/* section at 0x%08x */\n", section->fileSection->base);
+
+        /* the C compiler clears the zero-filled data after the contents */
+        fprintf(t->fp, "static uint8_t section_%d[%u] = {", j, section->size > 0 ? section->size : 1);
+        for (k = 0; k < size; ++k)
+            fprintf(t->fp, "%s0x%02x,", k % 16 == 0 ? "\n    " : " ", section->data[k]);
+        fprintf(t->fp, "\n};\n\n");
+    }
+
+    fprintf(t->fp, "static MemoryWindow windows[WINDOW_COUNT] = {\n");
+    for (j = 0; j < image->sectionCount; ++j) {
+        ImageFileSection *fileSection = image->sections[j].fileSection;
+        VMUVALUE size = image->sections[j].size;
+        fprintf(t->fp, "    [0x%x] = { 0x%08x, %u, %u, section_%d },\n",
+                fileSection->base >> WINDOW_SHIFT,
+                fileSection->base,
+                size,
+                size >= sizeof(VMVALUE) ? size - (VMUVALUE)sizeof(VMVALUE) + 1 : 0,
+                j);
+    }
+    fprintf(t->fp, "};\n\n");
+}
+
+/* WriteFunction - write the C function for the function starting at a text offset */
+static void WriteFunction(Translator *t, VMUVALUE offset)
+{
+    VMUVALUE next;
+    int k;
+
+    FindInstructions(t, offset);
+
+    fprintf(t->fp, "static VMUVALUE F_%08x(void)\n", t->base + offset);
+    fprintf(t->fp, "{\n");
+    fprintf(t->fp, "    VMVALUE *sp = vmSp, *fp = vmFp, tos = vmTos, tmp;\n");
+    fprintf(t->fp, "    (void)tmp;\n");
+
+    for (k = 0; k < t->insnCount; ) {
+        if (t->flags[t->insns[k]] & DF_TARGET)
+            fprintf(t->fp, "L_%08x:\n", t->base + t->insns[k]);
+        k += WriteInstruction(t, k, &next);
+
+        /* branch to the next instruction if it doesn't immediately follow this one */
+        if (next != (VMUVALUE)~0 && (k >= t->insnCount || t->insns[k] != next))
+            WriteBranch(t, next);
+    }
+
+    fprintf(t->fp, "}\n\n");
+}
+
+/* WriteInstruction - write the instruction at insns[k] and any instructions combined with it */
+static int WriteInstruction(Translator *t, int k, VMUVALUE *pNext)
+{
+    VMUVALUE offset = t->insns[k], end;
+    uint8_t *operand;
+    char buf[32];
+    int op, size, cnt;
+
+    *pNext = (VMUVALUE)~0;
+
+    /* undefined opcodes abort when they are executed */
+    op = VMCODEBYTE(t->data + offset);
+    if ((size = OperandSize(op)) == UNDEFINED_OPERAND) {
+        fprintf(t->fp, "    UndefinedOpcode(0x%02x);\n", op);
+        return 1;
+    }
+
+    /* so do instructions that run off the end of the text section */
+    if (offset + 1 + size > t->size) {
+        fprintf(t->fp, "    AddressError();\n");
+        return 1;
+    }
+
+    operand = t->data + offset + 1;
+    end = offset + 1 + size;
+    if (!IsTerminal(op))
+        *pNext = end;
+
+    switch (op) {
+    case OP_HALT:
+        fprintf(t->fp, "    SaveState();\n");
+        fprintf(t->fp, "    Halt();\n");
+        break;
+    case OP_BRT:
+    case OP_BRF:
+        fprintf(t->fp, "    tmp = tos;\n");
+        fprintf(t->fp, "    tos = Pop();\n");
+        fprintf(t->fp, "    if (%stmp)\n    ", op == OP_BRT ? "" : "!");
+        WriteBranch(t, end + GetCodeWord(operand));
+        break;
+    case OP_BRTSC:
+    case OP_BRFSC:
+        fprintf(t->fp, "    if (%stos)\n    ", op == OP_BRTSC ? "" : "!");
+        WriteBranch(t, end + GetCodeWord(operand));
+        fprintf(t->fp, "    tos = Pop();\n");
+        break;
+    case OP_BR:
+        WriteBranch(t, end + GetCodeWord(operand));
+        break;
+    case OP_NOT:
+        fprintf(t->fp, "    tos = !tos;\n");
+        break;
+    case OP_NEG:
+        fprintf(t->fp, "    tos = NEG(tos);\n");
+        break;
+    case OP_BNOT:
+        fprintf(t->fp, "    tos = ~tos;\n");
+        break;
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_REM:
+    case OP_BAND:
+    case OP_BOR:
+    case OP_BXOR:
+    case OP_SHL:
+    case OP_SHR:
+    case OP_LT:
+    case OP_LE:
+    case OP_EQ:
+    case OP_NE:
+    case OP_GE:
+    case OP_GT:
+    case OP_INDEX:
+        fprintf(t->fp, "    tmp = Pop();\n");
+        WriteBinaryOp(t, op, "tmp", "tos");
+        break;
+    case OP_LIT:
+        if ((cnt = WriteOperand(t, k, end, OPND_IMM, (VMVALUE)GetCodeWord(operand), pNext)) > 0)
+            return cnt;
+        fprintf(t->fp, "    Push(tos);\n");
+        fprintf(t->fp, "    tos = %s;\n", Literal(buf, (VMVALUE)GetCodeWord(operand)));
+        break;
+    case OP_SLIT:
+        if ((cnt = WriteOperand(t, k, end, OPND_IMM, (int8_t)VMCODEBYTE(operand), pNext)) > 0)
+            return cnt;
+        fprintf(t->fp, "    Push(tos);\n");
+        fprintf(t->fp, "    tos = %d;\n", (int8_t)VMCODEBYTE(operand));
+        break;
+    case OP_LREF:
+        if ((cnt = WriteOperand(t, k, end, OPND_LOCAL, (int8_t)VMCODEBYTE(operand), pNext)) > 0)
+            return cnt;
+        fprintf(t->fp, "    Push(tos);\n");
+        fprintf(t->fp, "    tos = fp[%d];\n", (int8_t)VMCODEBYTE(operand));
+        break;
+    case OP_LSET:
+        fprintf(t->fp, "    fp[%d] = tos;\n", (int8_t)VMCODEBYTE(operand));
+        fprintf(t->fp, "    tos = Pop();\n");
+        break;
+    case OP_LOAD:
+        fprintf(t->fp, "    tos = LoadValue((VMUVALUE)tos);\n");
+        break;
+    case OP_LOADB:
+        fprintf(t->fp, "    tos = LoadByteValue((VMUVALUE)tos);\n");
+        break;
+    case OP_STORE:
+        fprintf(t->fp, "    tmp = Pop();\n");
+        fprintf(t->fp, "    StoreValue((VMUVALUE)tos, tmp);\n");
+        fprintf(t->fp, "    tos = Pop();\n");
+        break;
+    case OP_STOREB:
+        fprintf(t->fp, "    tmp = Pop();\n");
+        fprintf(t->fp, "    StoreByteValue((VMUVALUE)tos, tmp);\n");
+        fprintf(t->fp, "    tos = Pop();\n");
+        break;
+    case OP_PUSHJ:
+        fprintf(t->fp, "    tmp = tos;\n");
+        fprintf(t->fp, "    tos = 0x%08x;\n", t->base + end);
+        fprintf(t->fp, "    CallAddress((VMUVALUE)tmp, 0x%08x);\n", t->base + end);
+        break;
+    case OP_POPJ:
+        fprintf(t->fp, "    tmp = tos;\n");
+        fprintf(t->fp, "    tos = Pop();\n");
+        WriteReturn(t, "tmp");
+        break;
+    case OP_CLEAN:
+        fprintf(t->fp, "    sp += %d;\n", VMCODEBYTE(operand));
+        break;
+    case OP_FRAME:
+        fprintf(t->fp, "    tmp = (VMVALUE)(fp - stack);\n");
+        fprintf(t->fp, "    fp = sp;\n");
+        fprintf(t->fp, "    Reserve(%d);\n", VMCODEBYTE(operand));
+        fprintf(t->fp, "    fp[%d] = tmp;\n", F_FP);
+        break;
+    case OP_RETURNZ:
+        fprintf(t->fp, "    Push(tos);\n");
+        fprintf(t->fp, "    tos = 0;\n");
+        // fall through
+    case OP_RETURN:
+        fprintf(t->fp, "    tmp = *sp;\n");
+        fprintf(t->fp, "    sp = fp;\n");
+        fprintf(t->fp, "    fp = stack + fp[%d];\n", F_FP);
+        WriteReturn(t, "tmp");
+        break;
+    case OP_DROP:
+        fprintf(t->fp, "    tos = Pop();\n");
+        break;
+    case OP_DUP:
+        fprintf(t->fp, "    Push(tos);\n");
+        break;
+    case OP_NATIVE:
+        fprintf(t->fp, "    /* native instruction 0x%08x ignored */\n", GetCodeWord(operand));
+        break;
+    case OP_TRAP:
+        fprintf(t->fp, "    SaveState();\n");
+        fprintf(t->fp, "    DoTrap(%d);\n", VMCODEBYTE(operand));
+        fprintf(t->fp, "    RestoreState();\n");
+        break;
+    }
+
+    return 1;
+}
+
+/* WriteOperand - combine a literal or local variable with the instruction that uses it */
+static int WriteOperand(Translator *t, int k, VMUVALUE end, int kind, VMVALUE value, VMUVALUE *pNext)
+{
+    char buf[32];
+    int op;
+
+    /* make sure the next instruction can be combined with this one */
+    if (!IsFusable(t, k + 1, end))
+        return 0;
+    op = VMCODEBYTE(t->data + end);
+
+    switch (op) {
+    case OP_LOAD:
+    case OP_LOADB:
+    case OP_STORE:
+    case OP_STOREB:
+        if (kind != OPND_IMM || !WriteConstantAccess(t, op, (VMUVALUE)value))
+            return 0;
+        break;
+    case OP_PUSHJ:
+        if (kind != OPND_IMM || (VMUVALUE)value - t->base >= t->size
+        ||  !(t->flags[(VMUVALUE)value - t->base] & DF_FUNCTION))
+            return 0;
+        fprintf(t->fp, "    Push(tos);\n");
+        fprintf(t->fp, "    tos = 0x%08x;\n", t->base + end + 1);
+        fprintf(t->fp, "    Call(F_%08x, 0x%08x);\n", (VMUVALUE)value, t->base + end + 1);
+        break;
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_REM:
+    case OP_BAND:
+    case OP_BOR:
+    case OP_BXOR:
+    case OP_SHL:
+    case OP_SHR:
+    case OP_LT:
+    case OP_LE:
+    case OP_EQ:
+    case OP_NE:
+    case OP_GE:
+    case OP_GT:
+    case OP_INDEX:
+        if (kind == OPND_IMM)
+            WriteBinaryOp(t, op, "tos", Literal(buf, value));
+        else {
+            sprintf(buf, "fp[%d]", value);
+            WriteBinaryOp(t, op, "tos", buf);
+        }
+        break;
+    default:
+        return 0;
+    }
+
+    *pNext = end + 1;
+    return 2;
+}
+
+/* WriteBinaryOp - write a binary operator */
+static void WriteBinaryOp(Translator *t, int op, const char *left, const char *right)
+{
+    char *fmt;
+    switch (op) {
+    case OP_ADD:    fmt = "ADD(%s, %s)";    break;
+    case OP_SUB:    fmt = "SUB(%s, %s)";    break;
+    case OP_MUL:    fmt = "MUL(%s, %s)";    break;
+    case OP_DIV:    fmt = "DIV(%s, %s)";    break;
+    case OP_REM:    fmt = "REM(%s, %s)";    break;
+    case OP_BAND:   fmt = "%s & %s";        break;
+    case OP_BOR:    fmt = "%s | %s";        break;
+    case OP_BXOR:   fmt = "%s ^ %s";        break;
+    case OP_SHL:    fmt = "SHL(%s, %s)";    break;
+    case OP_SHR:    fmt = "SHR(%s, %s)";    break;
+    case OP_LT:     fmt = "%s < %s";        break;
+    case OP_LE:     fmt = "%s <= %s";       break;
+    case OP_EQ:     fmt = "%s == %s";       break;
+    case OP_NE:     fmt = "%s != %s";       break;
+    case OP_GE:     fmt = "%s >= %s";       break;
+    case OP_GT:     fmt = "%s > %s";        break;
+    default:        fmt = "INDEX(%s, %s)";  break;
+    }
+    fprintf(t->fp, "    tos = ");
+    fprintf(t->fp, fmt, left, right);
+    fprintf(t->fp, ";\n");
+}
+
+/* WriteConstantAccess - write a load or store at a constant address */
+static int WriteConstantAccess(Translator *t, int op, VMUVALUE addr)
+{
+    ImageHdr *image = t->image;
+    VMUVALUE offset = 0, limit;
+    int j;
+
+    /* find the section containing the address */
+    for (j = 0; j < image->sectionCount; ++j) {
+        ImageFileSection *fileSection = image->sections[j].fileSection;
+        offset = addr - fileSection->base;
+        limit = image->sections[j].size;
+        if (op == OP_LOAD || op == OP_STORE)
+            limit = (limit >= sizeof(VMVALUE) ? limit - (VMUVALUE)sizeof(VMVALUE) + 1 : 0);
+        if (offset < limit)
+            break;
+    }
+
+    /* addresses that aren't mapped use the general code that aborts when it is executed */
+    if (j >= image->sectionCount)
+        return FALSE;
+
+    switch (op) {
+    case OP_LOAD:
+        fprintf(t->fp, "    Push(tos);\n");
+        fprintf(t->fp, "    tos = GetLong(section_%d + 0x%x);\n", j, offset);
+        break;
+    case OP_LOADB:
+        fprintf(t->fp, "    Push(tos);\n");
+        fprintf(t->fp, "    tos = section_%d[0x%x];\n", j, offset);
+        break;
+    case OP_STORE:
+        fprintf(t->fp, "    PutLong(section_%d + 0x%x, tos);\n", j, offset);
+        fprintf(t->fp, "    tos = Pop();\n");
+        break;
+    case OP_STOREB:
+        fprintf(t->fp, "    section_%d[0x%x] = (uint8_t)tos;\n", j, offset);
+        fprintf(t->fp, "    tos = Pop();\n");
+        break;
+    }
+    return TRUE;
+}
+
+/* WriteBranch - write a branch to a text offset */
+static void WriteBranch(Translator *t, VMUVALUE target)
+{
+    if (target >= t->size)
+        fprintf(t->fp, "    AddressError();\n");
+    else
+        fprintf(t->fp, "    goto L_%08x;\n", t->base + target);
+}
+
+/* WriteReturn - write a return to the address in a variable */
+static void WriteReturn(Translator *t, const char *addr)
+{
+    fprintf(t->fp, "    SaveState();\n");
+    fprintf(t->fp, "    return (VMUVALUE)%s;\n", addr);
+}
+
+/* Literal - format a literal value */
+static char *Literal(char *buf, VMVALUE value)
+{
+    if (value >= -32768 && value <= 32767)
+        sprintf(buf, "%d", value);
+    else
+        sprintf(buf, "(VMVALUE)0x%08x", (VMUVALUE)value);
+    return buf;
+}
+
+/* IsFusable - check for an instruction at insns[k] that can be combined with the one before it */
+static int IsFusable(Translator *t, int k, VMUVALUE offset)
+{
+    return k < t->insnCount
+        && t->insns[k] == offset
+        && !(t->flags[offset] & DF_TARGET)
+        && OperandSize(VMCODEBYTE(t->data + offset)) != UNDEFINED_OPERAND;
+}
+
+/* CompareOffsets - compare two text offsets */
+static int CompareOffsets(const void *p1, const void *p2)
+{
+    VMUVALUE o1 = *(const VMUVALUE *)p1;
+    VMUVALUE o2 = *(const VMUVALUE *)p2;
+    return o1 < o2 ? -1 : o1 > o2;
+}
+
+static void MyInfo(System *sys, const char *fmt, va_list ap)
+{
+    vfprintf(stdout, fmt, ap);
+}
+
+static void MyError(System *sys, const char *fmt, va_list ap)
+{
+    vfprintf(stderr, fmt, ap);
+}
+
+void Fatal(System *sys, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    xbError(sys, "error: ");
+    xbErrorV(sys, fmt, ap);
+    xbError(sys, "\n");
+    va_end(ap);
+    exit(1);
+}
@@ -0,0 +1,220 @@
+/* kwhash.c - generate the keyword hash table used by the token scanner
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ * usage: kwhash <db_scan.c> <db_compiler.h> <db_keywords.h>
+ *
+ * Reads the keyword table (ktab) from db_scan.c, checks that it is in the
+ * same order as the keyword tokens in the token enum in db_compiler.h and
+ * then looks for the smallest hash table and the hash parameters that put
+ * every keyword into its own slot.  The hash macros and the slot table are
+ * written to db_keywords.h.  The makefile reruns this whenever db_scan.c or
+ * db_compiler.h changes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAXKEYWORDS     255     /* the slots hold a ktab index plus one in a byte */
+#define MAXNAME         32
+#define MAXLINE         256
+
+/* hash parameters to try (smallest table first) */
+#define MINSLOTS        32
+#define MAXSLOTS        256
+#define MAXMULTIPLIER   31
+#define MAXSHIFT        8
+
+static char keywords[MAXKEYWORDS][MAXNAME];
+static char tokens[MAXKEYWORDS][MAXNAME];
+static int keywordCount;
+
+static void ReadKeywords(const char *path);
+static void CheckTokenOrder(const char *path);
+static int FindParameters(int *pSlots, int *pMultiplier, int *pShift, unsigned char *slots);
+static unsigned int Hash(const char *keyword, int multiplier);
+static void WriteTable(const char *path, int nslots, int multiplier, int shift, unsigned char *slots);
+static FILE *OpenFile(const char *path, const char *mode);
+
+int main(int argc, char *argv[])
+{
+    unsigned char slots[MAXSLOTS];
+    int nslots, multiplier, shift;
+
+    if (argc != 4) {
+        fprintf(stderr, "usage: kwhash <db_scan.c> <db_compiler.h> <db_keywords.h>\n");
+        exit(1);
+    }
+
+    ReadKeywords(argv[1]);
+    CheckTokenOrder(argv[2]);
+
+    if (!FindParameters(&nslots, &multiplier, &shift, slots)) {
+        fprintf(stderr, "error: no hash parameters put every keyword in its own slot\n");
+        exit(1);
+    }
+
+    WriteTable(argv[3], nslots, multiplier, shift, slots);
+
+    return 0;
+}
+
+/* ReadKeywords - read the entries of ktab in db_scan.c */
+static void ReadKeywords(const char *path)
+{
+    char line[MAXLINE], keyword[MAXNAME], token[MAXNAME];
+    int inTable = 0;
+    FILE *fp;
+
+    fp = OpenFile(path, "r");
+    while (fgets(line, sizeof(line), fp)) {
+        if (!inTable) {
+            if (strstr(line, "ktab[] = {"))
+                inTable = 1;
+        }
+        else if (sscanf(line, " { \"%31[^\"]\" , %31[A-Z_] }", keyword, token) == 2) {
+            if (keywordCount >= MAXKEYWORDS) {
+                fprintf(stderr, "error: too many keywords in %s\n", path);
+                exit(1);
+            }
+            strcpy(keywords[keywordCount], keyword);
+            strcpy(tokens[keywordCount], token);
+            ++keywordCount;
+        }
+        else if (strstr(line, "NULL"))
+            break;
+    }
+    fclose(fp);
+
+    if (keywordCount == 0) {
+        fprintf(stderr, "error: no keyword table in %s\n", path);
+        exit(1);
+    }
+}
+
+/* CheckTokenOrder - make sure ktab is in the same order as the token enum */
+static void CheckTokenOrder(const char *path)
+{
+    char line[MAXLINE], token[MAXNAME];
+    int i = -1;
+    FILE *fp;
+
+    fp = OpenFile(path, "r");
+    while (i < keywordCount && fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, " %31[A-Z_]", token) != 1 || strncmp(token, "T_", 2) != 0)
+            continue;
+        if (i < 0) {
+            if (strcmp(token, tokens[0]) != 0)
+                continue;
+            i = 0;
+        }
+        if (strcmp(token, tokens[i]) != 0) {
+            fprintf(stderr, "error: ktab entry %d is %s but the token enum has %s\n", i, tokens[i], token);
+            exit(1);
+        }
+        ++i;
+    }
+    fclose(fp);
+
+    if (i < keywordCount) {
+        fprintf(stderr, "error: the keyword tokens in %s don't match ktab\n", path);
+        exit(1);
+    }
+}
+
+/* FindParameters - find the smallest table with a hash that doesn't collide */
+static int FindParameters(int *pSlots, int *pMultiplier, int *pShift, unsigned char *slots)
+{
+    int nslots, multiplier, shift, i;
+    unsigned int slot;
+
+    for (nslots = MINSLOTS; nslots <= MAXSLOTS; nslots <<= 1) {
+        if (nslots < keywordCount)
+            continue;
+        for (multiplier = 2; multiplier <= MAXMULTIPLIER; ++multiplier) {
+            for (shift = 0; shift <= MAXSHIFT; ++shift) {
+                memset(slots, 0, nslots);
+                for (i = 0; i < keywordCount; ++i) {
+                    slot = (Hash(keywords[i], multiplier) >> shift) & (nslots - 1);
+                    if (slots[slot] != 0)
+                        break;
+                    slots[slot] = i + 1;
+                }
+                if (i >= keywordCount) {
+                    *pSlots = nslots;
+                    *pMultiplier = multiplier;
+                    *pShift = shift;
+                    return 1;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Hash - hash a keyword the way KeywordHash in db_keywords.h does */
+static unsigned int Hash(const char *keyword, int multiplier)
+{
+    unsigned int hash = 0;
+    while (*keyword)
+        hash = hash * multiplier + (*keyword++ | 0x20);
+    return hash;
+}
+
+/* WriteTable - write the hash macros and the slot table */
+static void WriteTable(const char *path, int nslots, int multiplier, int shift, unsigned char *slots)
+{
+    FILE *fp;
+    int i;
+
+    fp = OpenFile(path, "w");
+
+    fprintf(fp, "/* db_keywords.h - keyword hash table for db_scan.c\n");
+    fprintf(fp, " *\n");
+    fprintf(fp, " * Generated by kwhash from the keyword table in db_scan.c.  Don't edit it,\n");
+    fprintf(fp, " * it is rebuilt by the makefile whenever the keywords change.\n");
+    fprintf(fp, " *\n");
+    fprintf(fp, " */\n");
+    fprintf(fp, "\n");
+    fprintf(fp, "#ifndef __DB_KEYWORDS_H__\n");
+    fprintf(fp, "#define __DB_KEYWORDS_H__\n");
+    fprintf(fp, "\n");
+    fprintf(fp, "/* keyword hash table size (a power of two) */\n");
+    fprintf(fp, "#define KEYWORD_SLOTS   %d\n", nslots);
+    fprintf(fp, "\n");
+    fprintf(fp, "/* KeywordHash - add a character to a keyword hash (case insensitive for letters) */\n");
+    fprintf(fp, "#define KeywordHash(hash, ch)   ((hash) * %d + ((ch) | 0x20))\n", multiplier);
+    fprintf(fp, "\n");
+    fprintf(fp, "/* KeywordSlot - map a keyword hash onto a slot in keywordSlots */\n");
+    fprintf(fp, "#define KeywordSlot(hash)       (((hash) >> %d) & (KEYWORD_SLOTS - 1))\n", shift);
+    fprintf(fp, "\n");
+    fprintf(fp, "/* ktab index plus one of the keyword in each slot (zero for an empty slot) */\n");
+    fprintf(fp, "static const uint8_t keywordSlots[KEYWORD_SLOTS] = {\n");
+    for (i = 0; i < nslots; ++i) {
+        if (i % 16 == 0)
+            fprintf(fp, "    ");
+        fprintf(fp, "%2d", slots[i]);
+        if (i == nslots - 1)
+            fprintf(fp, "\n");
+        else
+            fprintf(fp, i % 16 == 15 ? ",\n" : ", ");
+    }
+    fprintf(fp, "};\n");
+    fprintf(fp, "\n");
+    fprintf(fp, "#endif\n");
+
+    fclose(fp);
+}
+
+/* OpenFile - open a file or exit with an error */
+static FILE *OpenFile(const char *path, const char *mode)
+{
+    FILE *fp;
+    if (!(fp = fopen(path, mode))) {
+        fprintf(stderr, "error: can't open: %s\n", path);
+        exit(1);
+    }
+    return fp;
+}
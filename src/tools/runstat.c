@@ -0,0 +1,69 @@
+/* runstat.c - run a command and report its wall time and peak memory
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ * Used by the benchmark suite (make bench).  The command's own output is
+ * left alone and the measurements are written to a separate file as
+ * "<wall time in ms> <peak resident memory in KB>".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+int main(int argc, char *argv[])
+{
+    struct timeval start, end;
+    struct rusage usage;
+    double ms;
+    long kb;
+    FILE *fp;
+    pid_t pid;
+    int status;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: runstat <outfile> <command> [ <arg>... ]\n");
+        exit(1);
+    }
+
+    gettimeofday(&start, NULL);
+
+    /* run the command */
+    if ((pid = fork()) < 0) {
+        fprintf(stderr, "error: can't fork\n");
+        exit(1);
+    }
+    else if (pid == 0) {
+        execvp(argv[2], &argv[2]);
+        fprintf(stderr, "error: can't run: %s\n", argv[2]);
+        _exit(127);
+    }
+
+    /* wait for it to finish */
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        fprintf(stderr, "error: wait failed\n");
+        exit(1);
+    }
+
+    gettimeofday(&end, NULL);
+    ms = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_usec - start.tv_usec) / 1000.0;
+
+    /* ru_maxrss is in bytes on Mac OS X and in kilobytes elsewhere */
+    kb = usage.ru_maxrss;
+#ifdef MACOSX
+    kb /= 1024;
+#endif
+
+    if (!(fp = fopen(argv[1], "w"))) {
+        fprintf(stderr, "error: can't create: %s\n", argv[1]);
+        exit(1);
+    }
+    fprintf(fp, "%.3f %ld\n", ms, kb);
+    fclose(fp);
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
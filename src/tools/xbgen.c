@@ -0,0 +1,257 @@
+/* xbgen.c - generate large xbasic programs for testing how the compiler scales
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ * The generated program is valid and runs but it is meant to be compiled,
+ * not run.  Each function has a SELECT statement, a nest of IF statements
+ * and a few string literals and uses one of the globals.  The functions form
+ * call chains of CHAIN_LENGTH functions (each one calls the one before it)
+ * and main calls the last function of each chain, so every function is
+ * reachable but the main code stays small.  The functions are spread evenly
+ * over the main file and the include files.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* number of string literals in each function */
+#define STRINGS_PER_FUNCTION    2
+
+/* number of functions in each call chain */
+#define CHAIN_LENGTH            8
+
+/* generator options */
+typedef struct {
+    int functions;      /* number of functions */
+    int globals;        /* number of global variables */
+    int strings;        /* number of distinct string literals */
+    int includes;       /* number of include files */
+    int arms;           /* number of arms in each SELECT statement */
+    int depth;          /* nesting depth of the IF statements */
+} Options;
+
+static void Usage(void);
+static int GetNumber(int argc, char *argv[], int *pi);
+static int FunctionLines(Options *opts);
+static FILE *CreateFile(const char *name);
+static void WriteFunction(FILE *fp, Options *opts, int i);
+static void Indent(FILE *fp, int level);
+
+int main(int argc, char *argv[])
+{
+    Options opts = { 0, 100, 100, 0, 8, 3 };
+    char base[FILENAME_MAX], name[FILENAME_MAX + 16], *outfile = NULL, *p;
+    int lines = 1000, first, last, i, j;
+    FILE *fp;
+
+    /* get the arguments */
+    for (i = 1; i < argc; ++i) {
+
+        /* handle switches */
+        if (argv[i][0] == '-') {
+            switch (argv[i][1]) {
+            case 'l':
+                lines = GetNumber(argc, argv, &i);
+                break;
+            case 'f':
+                opts.functions = GetNumber(argc, argv, &i);
+                break;
+            case 'g':
+                opts.globals = GetNumber(argc, argv, &i);
+                break;
+            case 's':
+                opts.strings = GetNumber(argc, argv, &i);
+                break;
+            case 'i':
+                opts.includes = GetNumber(argc, argv, &i);
+                break;
+            case 'c':
+                opts.arms = GetNumber(argc, argv, &i);
+                break;
+            case 'n':
+                opts.depth = GetNumber(argc, argv, &i);
+                break;
+            default:
+                Usage();
+                break;
+            }
+        }
+
+        /* handle the output filename */
+        else {
+            if (outfile)
+                Usage();
+            outfile = argv[i];
+        }
+    }
+
+    /* make sure an output file was specified */
+    if (!outfile)
+        Usage();
+
+    /* there must be at least one global for the functions to use */
+    if (opts.globals < 1)
+        opts.globals = 1;
+
+    /* pick the number of functions to make roughly the requested number of lines */
+    if (opts.functions == 0) {
+        int fixed = opts.globals + opts.includes + 5;
+        int perChain = FunctionLines(&opts) * CHAIN_LENGTH + 1;
+        opts.functions = lines > fixed ? (lines - fixed + perChain - 1) / perChain * CHAIN_LENGTH : 1;
+    }
+
+    /* include files are named after the main file */
+    strcpy(base, outfile);
+    if ((p = strrchr(base, '.')) != NULL && !strchr(p, '/') && !strchr(p, '\\'))
+        *p = '\0';
+
+    /* write the globals and the include statements */
+    fp = CreateFile(outfile);
+    fprintf(fp, "rem generated by xbgen\n\n");
+    fprintf(fp, "include \"print.bas\"\n\n");
+    for (i = 0; i < opts.globals; ++i)
+        fprintf(fp, "dim g%d = %d\n", i, i);
+    fprintf(fp, "\n");
+    for (j = 0; j < opts.includes; ++j) {
+        if ((p = strrchr(base, '/')) == NULL && (p = strrchr(base, '\\')) == NULL)
+            p = base;
+        else
+            ++p;
+        fprintf(fp, "include \"%s_%d.bas\"\n", p, j);
+    }
+
+    /* write the functions (each file gets a contiguous range so calls are always backward) */
+    for (j = 0; j <= opts.includes; ++j) {
+        FILE *ofp = fp;
+        first = (int)((long)opts.functions * j / (opts.includes + 1));
+        last = (int)((long)opts.functions * (j + 1) / (opts.includes + 1));
+        if (j < opts.includes) {
+            sprintf(name, "%s_%d.bas", base, j);
+            ofp = CreateFile(name);
+        }
+        for (i = first; i < last; ++i)
+            WriteFunction(ofp, &opts, i);
+        if (ofp != fp)
+            fclose(ofp);
+    }
+
+    /* write the main code (it calls the last function in each chain) */
+    for (i = CHAIN_LENGTH - 1; i < opts.functions + CHAIN_LENGTH - 1; i += CHAIN_LENGTH) {
+        int n = i < opts.functions ? i : opts.functions - 1;
+        fprintf(fp, "print fn%d(%d, 2)\n", n, n);
+    }
+    fclose(fp);
+
+    return 0;
+}
+
+/* Usage - display a usage message and exit */
+static void Usage(void)
+{
+    fprintf(stderr, "\
+usage: xbgen\n\
+         [ -l <lines> ]  approximate number of lines (default is 1000)\n\
+         [ -f <count> ]  number of functions (overrides -l)\n\
+         [ -g <count> ]  number of global variables (default is 100)\n\
+         [ -s <count> ]  number of distinct string literals (default is 100)\n\
+         [ -i <count> ]  number of include files (default is 0)\n\
+         [ -c <count> ]  number of arms in each SELECT statement (default is 8)\n\
+         [ -n <depth> ]  nesting depth of the IF statements (default is 3)\n\
+         <name>          main file to write (include files are <name>_<n>.bas)\n\
+");
+    exit(1);
+}
+
+/* GetNumber - get the numeric argument of an option */
+static int GetNumber(int argc, char *argv[], int *pi)
+{
+    char *p;
+    int n;
+    if (argv[*pi][2])
+        p = &argv[*pi][2];
+    else if (++(*pi) < argc)
+        p = argv[*pi];
+    else
+        Usage();
+    if ((n = atoi(p)) < 0)
+        Usage();
+    return n;
+}
+
+/* FunctionLines - get the number of lines in each function (including the blank line) */
+static int FunctionLines(Options *opts)
+{
+    return 6                        /* def, dim, assignment, call, return, end def */
+         + 3 + opts->arms * 2       /* select, case else, end select and the arms */
+         + opts->depth * 4          /* if, else, assignment and end if at each level */
+         + (opts->strings > 0 ? 2 + STRINGS_PER_FUNCTION : 0) /* if, end if and the prints */
+         + 1;                       /* blank line */
+}
+
+/* CreateFile - create an output file */
+static FILE *CreateFile(const char *name)
+{
+    FILE *fp;
+    if (!(fp = fopen(name, "w"))) {
+        fprintf(stderr, "error: can't create: %s\n", name);
+        exit(1);
+    }
+    return fp;
+}
+
+/* WriteFunction - write a function */
+static void WriteFunction(FILE *fp, Options *opts, int i)
+{
+    int level, j;
+
+    fprintf(fp, "def fn%d(a, b)\n", i);
+    fprintf(fp, "    dim t\n");
+    fprintf(fp, "    t = a * 3 + b + g%d\n", i % opts->globals);
+
+    /* a SELECT statement */
+    fprintf(fp, "    select a & %d\n", opts->arms * 2 - 1);
+    for (j = 0; j < opts->arms; ++j) {
+        fprintf(fp, "        case %d\n", j);
+        fprintf(fp, "            t = t + %d\n", j + i);
+    }
+    fprintf(fp, "        case else\n");
+    fprintf(fp, "    end select\n");
+
+    /* nested IF statements */
+    for (level = 0; level < opts->depth; ++level) {
+        Indent(fp, level + 1);
+        fprintf(fp, "if t > %d then\n", level * 100);
+    }
+    for (level = opts->depth; --level >= 0; ) {
+        Indent(fp, level + 2);
+        fprintf(fp, "t = t - %d\n", level + 1);
+        Indent(fp, level + 1);
+        fprintf(fp, "else\n");
+        Indent(fp, level + 1);
+        fprintf(fp, "end if\n");
+    }
+
+    /* string literals (never printed when the program runs) */
+    if (opts->strings > 0) {
+        fprintf(fp, "    if t = -1 then\n");
+        for (j = 0; j < STRINGS_PER_FUNCTION; ++j)
+            fprintf(fp, "        print \"string %d\"\n", (i * STRINGS_PER_FUNCTION + j) % opts->strings);
+        fprintf(fp, "    end if\n");
+    }
+
+    /* call the previous function */
+    if (i % CHAIN_LENGTH != 0)
+        fprintf(fp, "    t = t + fn%d(a, 1) & 255\n", i - 1);
+    else
+        fprintf(fp, "    t = t & 255\n");
+    fprintf(fp, "    return t\n");
+    fprintf(fp, "end def\n\n");
+}
+
+/* Indent - indent a line to a nesting level */
+static void Indent(FILE *fp, int level)
+{
+    while (--level >= 0)
+        fprintf(fp, "    ");
+}
@@ -34,6 +34,8 @@ SOURCES += \
     ../src/compiler/db_generate.c \
     ../src/compiler/db_expr.c \
     ../src/compiler/db_compiler.c \
+    ../src/compiler/db_debug.c \
+    ../src/compiler/db_module.c \
     ../src/loader/PLoadLib.c \
     ../src/loader/db_packet.c \
     ../src/loader/db_loader.c \
@@ -53,6 +55,7 @@ HEADERS += \
     ../src/common/db_image.h \
     ../src/common/db_config.h \
     ../src/compiler/db_compiler.h \
+    ../src/compiler/db_keywords.h \
     ../src/loader/PLoadLib.h \
     ../src/loader/db_packet.h \
     ../src/loader/db_loader.h \